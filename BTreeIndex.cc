@@ -9,16 +9,93 @@
  
 #include "BTreeIndex.h"
 #include "BTreeNode.h"
+#include <cstring>
+#include <algorithm>
 
 using namespace std;
 
+// index option flags saved in the third word of page 0
+static const int INDEX_COMPRESSED_LEAVES = 0x1;
+static const int INDEX_COUNTED           = 0x2;
+static const int INDEX_CLUSTERED         = 0x4;
+
+// page 0 holds [rootPid, treeHeight, flags, free list head]
+
+/*
+ * Add delta to the row count of the child pid of a counted node.
+ * @return false if pid is not a child of the node
+ */
+template <class KeyType>
+static bool addChildRows(BTNonLeafNodeT<KeyType>& node, PageId pid, int delta)
+{
+	int i = node.getChildIndex(pid);
+	int count;
+	if (i < 0 || node.readChildCount(i, count) < 0)
+		return false;
+
+	node.setChildCount(i, count + delta);
+	return true;
+}
+
+/*
+ * Order tuples on their keys alone, so that a stable sort keeps the
+ * tuples of a key in load order.
+ */
+template <class KeyType>
+static bool tupleKeyLess(const pair<KeyType, string>& a, const pair<KeyType, string>& b)
+{
+	return a.first < b.first;
+}
+
+template <class KeyType>
+map<string, typename BTreeIndexT<KeyType>::PinnedIndex> BTreeIndexT<KeyType>::pinnedIndexes;
+
+template <class KeyType>
+int BTreeIndexT<KeyType>::pinBudget = 64;
+
+template <class KeyType>
+pthread_rwlock_t BTreeIndexT<KeyType>::pinLatch = PTHREAD_RWLOCK_INITIALIZER;
+
 /*
  * BTreeIndex constructor
  */
-BTreeIndex::BTreeIndex()
+template <class KeyType>
+BTreeIndexT<KeyType>::BTreeIndexT()
 {
     rootPid = -1;
     treeHeight = 0;
+    writable = false;
+    compressedLeaves = false;
+    counted = false;
+    clustered = false;
+    pins = NULL;
+    freePid = 0;
+    freeHead = -1;
+    pthread_rwlock_init(&rootLatch, NULL);
+    pthread_mutex_init(&allocLatch, NULL);
+    pthread_mutex_init(&latchTable, NULL);
+    pthread_mutex_init(&countLatch, NULL);
+    pthread_mutex_init(&bufferLatch, NULL);
+    bufferedCount = 0;
+}
+
+/*
+ * BTreeIndex destructor
+ */
+template <class KeyType>
+BTreeIndexT<KeyType>::~BTreeIndexT()
+{
+	for (size_t i = 0; i < latches.size(); i++) {
+		if (latches[i] != NULL) {
+			pthread_mutex_destroy(latches[i]);
+			delete latches[i];
+		}
+	}
+	pthread_mutex_destroy(&bufferLatch);
+	pthread_mutex_destroy(&countLatch);
+	pthread_mutex_destroy(&latchTable);
+	pthread_mutex_destroy(&allocLatch);
+	pthread_rwlock_destroy(&rootLatch);
 }
 
 /*
@@ -28,32 +105,79 @@ BTreeIndex::BTreeIndex()
  * @param mode[IN] 'r' for read, 'w' for write
  * @return error code. 0 if no error
  */
-RC BTreeIndex::open(const string& indexname, char mode)
+template <class KeyType>
+RC BTreeIndexT<KeyType>::open(const string& indexname, char mode)
 {
 	RC rc;
-	pf = PageFile(indexname, mode);
 	rc = pf.open(indexname, mode);
 	if (rc < 0) {
 		return rc;
 	}
+	writable = (mode == 'w' || mode == 'W');
 
 	char buf[PageFile::PAGE_SIZE];
+	memset(buf, 0, PageFile::PAGE_SIZE);
+
+	// the pinned pages of the file are only good if nobody else wrote it,
+	// and only for a snapshot that sees the latest pages
+	pthread_rwlock_wrlock(&pinLatch);
+	pins = &pinnedIndexes[indexname];
+	bool current = pf.isCurrent();
 
 	if (pf.endPid() == 0) {
  		rootPid = -1;
  		treeHeight = 0;
+ 		compressedLeaves = false;
+		counted = false;
+		clustered = false;
+		freeHead = -1;
 	 	int* bufPtr = (int*) buf;
 		bufPtr[0] = rootPid;
 		bufPtr[1] = treeHeight;
+		bufPtr[2] = 0;
+		bufPtr[3] = freeHead;
 		pf.write(0, buf);
+		pins->nodes.clear();
+	}
+	else if (current && pins->endPid == pf.endPid()) {
+		rootPid = pins->rootPid;
+		treeHeight = pins->treeHeight;
+		compressedLeaves = (pins->flags & INDEX_COMPRESSED_LEAVES) != 0;
+		counted = (pins->flags & INDEX_COUNTED) != 0;
+		clustered = (pins->flags & INDEX_CLUSTERED) != 0;
+		freeHead = pins->freeHead;
+		freePid = pf.endPid();
+		pthread_rwlock_unlock(&pinLatch);
+		return 0;
 	}
 	else {
 	 	pf.read(0, buf);
 	 	int* bufPtr = (int*) buf;
 	 	rootPid = bufPtr[0];
 	 	treeHeight = bufPtr[1];
+	 	compressedLeaves = (bufPtr[2] & INDEX_COMPRESSED_LEAVES) != 0;
+	 	counted = (bufPtr[2] & INDEX_COUNTED) != 0;
+	 	clustered = (bufPtr[2] & INDEX_CLUSTERED) != 0;
+		// files written before the free list have 0 here
+		freeHead = (bufPtr[3] > 0) ? bufPtr[3] : -1;
+		if (!current) {
+			pthread_rwlock_unlock(&pinLatch);
+			freePid = pf.endPid();
+			return 0;
+		}
+		pins->nodes.clear();
 	}
 
+	pins->endPid = pf.endPid();
+	pins->rootPid = rootPid;
+	pins->treeHeight = treeHeight;
+	pins->flags = (compressedLeaves ? INDEX_COMPRESSED_LEAVES : 0) | (counted ? INDEX_COUNTED : 0)
+		| (clustered ? INDEX_CLUSTERED : 0);
+	pins->freeHead = freeHead;
+	pthread_rwlock_unlock(&pinLatch);
+
+	freePid = pf.endPid();
+
     return 0;
 }
 
@@ -61,9 +185,45 @@ RC BTreeIndex::open(const string& indexname, char mode)
  * Close the index file.
  * @return error code. 0 if no error
  */
-RC BTreeIndex::close()
+template <class KeyType>
+RC BTreeIndexT<KeyType>::close()
 {
 	RC rc;
+
+	// the buffered inserts go into the leaves before the tree is saved
+	if ((rc = flushBuffers()) < 0) {
+		pf.close();
+		return rc;
+	}
+
+	// save rootPid and treeHeight so that the tree can be reopened later
+	if (writable) {
+		char buf[PageFile::PAGE_SIZE];
+		memset(buf, 0, PageFile::PAGE_SIZE);
+		int* bufPtr = (int*) buf;
+		bufPtr[0] = rootPid;
+		bufPtr[1] = treeHeight;
+		bufPtr[2] = (compressedLeaves ? INDEX_COMPRESSED_LEAVES : 0) | (counted ? INDEX_COUNTED : 0)
+			| (clustered ? INDEX_CLUSTERED : 0);
+		bufPtr[3] = freeHead;
+		rc = pf.write(0, buf);
+
+		pthread_rwlock_wrlock(&pinLatch);
+		if (rc < 0) {
+			pins->endPid = -1;
+			pthread_rwlock_unlock(&pinLatch);
+			pf.close();
+			return rc;
+		}
+
+		pins->endPid = pf.endPid();
+		pins->rootPid = rootPid;
+		pins->treeHeight = treeHeight;
+		pins->flags = bufPtr[2];
+		pins->freeHead = freeHead;
+		pthread_rwlock_unlock(&pinLatch);
+	}
+
 	rc = pf.close();
 	if (rc < 0) {
     	return rc;
@@ -72,252 +232,3227 @@ RC BTreeIndex::close()
     return 0;
 }
 
-RC BTreeIndex::insertHelper(const RecordId& rid, int key, PageId pid, int &new_key, PageId &new_pid, int curr_height)
+/*
+ * Descend from the root to the node on the given level that covers key.
+ * A node that split after the descent read its parent passed the keys
+ * behind its last separator to its right siblings. Such a node is left
+ * through its right link when key is past its last separator and at
+ * least the first separator of the right sibling; any key between the
+ * two is found by moving right on a lower level.
+ * @param key[IN] the key to find
+ * @param level[IN] the level to stop at (0 for the leaf)
+ * @param path[OUT] the node visited on every level from the root down
+ * @param height[OUT] the height of the tree the descent started from
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::descend(const KeyType& key, int level, PageId* path, int& height)
 {
 	RC rc;
+	PageId pid;
+
+	pthread_rwlock_rdlock(&rootLatch);
+	pid = rootPid;
+	height = treeHeight;
+	pthread_rwlock_unlock(&rootLatch);
+
+	if (level >= height || height > MAX_HEIGHT)
+		return RC_INVALID_FILE_FORMAT;
 
-	if (curr_height < treeHeight)
-	{
-		BTNonLeafNode *nln = new BTNonLeafNode;
-		rc = nln->read(pid, pf);
+	BTNonLeafNodeT<KeyType> node;
+	BTNonLeafNodeT<KeyType> next;
+	for (int l = height - 1; l > level; l--) {
+		rc = readNonLeaf(pid, node);
 		if (rc < 0)
 			return rc;
 
-		PageId next_pid;
-		rc = nln->locateChildPtr(key, next_pid);
+		for (;;) {
+			KeyType last, first;
+			PageId nextPid = node.getNextNodePtr();
+			if (nextPid < 0 || node.readNLEntry(node.getKeyCount() - 1, last) < 0 || key < last)
+				break;
+			if ((rc = readNonLeaf(nextPid, next)) < 0)
+				return rc;
+			if (next.readNLEntry(0, first) < 0 || key < first)
+				break;
+			pid = nextPid;
+			node = next;
+		}
+
+		path[l] = pid;
+		rc = node.locateChildPtr(key, pid);
 		if (rc < 0)
 			return rc;
+	}
 
-		int new_key;
-		PageId new_pid;
-		rc = insertHelper(rid, key, next_pid, new_key, new_pid, curr_height+1);
-		if (rc == RC_NODE_FULL) {
-			rc = nln->insert(new_key, new_pid);
+	path[level] = pid;
+	return 0;
+}
+
+/*
+ * Insert the new sibling (key, sibPid) of the latched node child on
+ * level into its parent, splitting upwards as far as needed.
+ * The parent is latched before child is unlatched, so a thread that
+ * moved right onto the sibling finds it in the parent once it gets
+ * there itself.
+ * @param level[IN] the level of child
+ * @param path[IN] the descent path of the insert (see descend())
+ * @param height[IN] the height of the tree when path was taken
+ * @param child[IN] the node that was split
+ * @param key[IN] the first key of the sibling
+ * @param sibPid[IN] the PageId of the sibling
+ * @param childRows[IN] the rows left under child (counted index only;
+ *                      only needed if child is the root)
+ * @param sibRows[IN] the rows under the sibling (counted index only)
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::insertParent(int level, PageId* path, int height, PageId child, KeyType key, PageId sibPid, int childRows, int sibRows)
+{
+	RC rc;
 
+	for (;;) {
+		// a split root gets a new root above it
+		pthread_rwlock_wrlock(&rootLatch);
+		if (rootPid == child) {
+			BTNonLeafNodeT<KeyType> root;
+			root.setLevel(level + 1);
+			root.setCounted(counted);
+			rc = root.initializeRoot(child, key, sibPid);
+			if (rc == 0 && counted) {
+				root.setChildCount(0, childRows);
+				root.setChildCount(1, sibRows);
+			}
 			if (rc == 0) {
-				rc = nln->write(pid, pf);
-				return rc;
+				PageId pid = allocatePages(1);
+				rc = writeNonLeaf(pid, root);
+				if (rc == 0) {
+					rootPid = pid;
+					treeHeight = level + 2;
+				}
 			}
-			else if (rc == RC_NODE_FULL) {
-				int midKey;
-				BTNonLeafNode *sib = new BTNonLeafNode;
-
-				rc = nln->insertAndSplit(new_key, new_pid, *sib, midKey);
-				if (rc < 0)
-					return rc;
-				new_pid = pf.endPid();
+			pthread_rwlock_unlock(&rootLatch);
+			unlatch(child);
+			return rc;
+		}
+		pthread_rwlock_unlock(&rootLatch);
 
-				rc = sib->write(new_pid, pf);
-				rc = nln->write(pid, pf);
-				if (rc < 0)
-					return rc;
+		// the parent level is on the path unless the tree grew since
+		if (level + 1 >= height && (rc = descend(key, level + 1, path, height)) < 0) {
+			unlatch(child);
+			return rc;
+		}
 
-				new_key = midKey;
+		// A non-leaf node that is changed is read from the page file,
+		// since a pinned copy may lag behind while other inserts run.
+		// If the parent on the path was split, child moved to one of
+		// its right siblings.
+		PageId parent = path[level + 1];
+		BTNonLeafNodeT<KeyType> node;
+		latch(parent);
+		rc = node.read(parent, pf);
+		while (rc == 0 && !node.hasChildPtr(child)) {
+			PageId next = node.getNextNodePtr();
+			if (next < 0) {
+				rc = RC_INVALID_FILE_FORMAT;
+				break;
 			}
-			else return rc;
+			latch(next);
+			unlatch(parent);
+			parent = next;
+			rc = node.read(parent, pf);
+		}
+		unlatch(child);
+		if (rc < 0) {
+			unlatch(parent);
+			return rc;
+		}
 
+		rc = node.insert(key, sibPid, child);
+		if (rc != RC_NODE_FULL) {
+			if (rc == 0 && counted) {
+				addChildRows(node, child, -sibRows);
+				addChildRows(node, sibPid, sibRows);
+			}
+			if (rc == 0)
+				rc = writeNonLeaf(parent, node);
+			unlatch(parent);
+			return rc;
 		}
-		else return rc;
-	}
-	else if (curr_height == treeHeight) // leaf node
-	{
-		BTLeafNode *ln = new BTLeafNode;
-		ln->read(pid, pf);
 
-		rc = ln->insert(key, rid);
+		// split the parent; the new sibling goes on disk before the
+		// parent points to it
+		BTNonLeafNodeT<KeyType> sib;
+		KeyType midKey;
+		rc = node.insertAndSplit(key, sibPid, child, sib, midKey);
+		if (rc == 0 && counted) {
+			if (!addChildRows(node, child, -sibRows))
+				addChildRows(sib, child, -sibRows);
+			if (!addChildRows(node, sibPid, sibRows))
+				addChildRows(sib, sibPid, sibRows);
+			childRows = node.getTotalCount();
+			sibRows = sib.getTotalCount();
+		}
 		if (rc == 0) {
-			ln->write(pid, pf);
-			return 0;
+			sibPid = allocatePages(1);
+			rc = writeNonLeaf(sibPid, sib);
 		}
-
-		BTLeafNode *sib = new BTLeafNode;
-		int sib_key;
-		rc = ln->insertAndSplit(key, rid, *sib, sib_key);
-		if (rc < 0)
+		if (rc == 0) {
+			node.setNextNodePtr(sibPid);
+			rc = writeNonLeaf(parent, node);
+		}
+		if (rc < 0) {
+			unlatch(parent);
 			return rc;
+		}
 
-		PageId sib_pid = pf.endPid();
-		rc = sib->write(sib_pid, pf);
-		if (rc < 0)
-			return rc;
+		child = parent;
+		key = midKey;
+		level++;
+	}
+}
 
-		ln->setNextNodePtr(sib_pid);
-		rc = ln->write(pid, pf);
-		if (rc < 0)
-			return rc;
+/*
+ * Reserve n consecutive pages. A single page is taken from the free
+ * list if it has one, more pages come from the end of the index file.
+ * @param n[IN] the number of pages
+ * @return the PageId of the first page
+ */
+template <class KeyType>
+PageId BTreeIndexT<KeyType>::allocatePages(int n)
+{
+	PageId pid = -1;
 
-		return 0;
+	pthread_mutex_lock(&allocLatch);
+	if (n == 1 && freeHead >= 0) {
+		char buf[PageFile::PAGE_SIZE];
+		nodeHeader* h = (nodeHeader*) buf;
 
+		// a free page that cannot be read ends the list
+		pid = freeHead;
+		if (pf.read(pid, buf) == 0 && (h->flags & NODE_FREE))
+			freeHead = h->nextPid;
+		else
+			pid = freeHead = -1;
 	}
+	if (pid < 0) {
+		pid = freePid;
+		freePid += n;
+	}
+	pthread_mutex_unlock(&allocLatch);
 
-	return 0;
-
-	//rc = insert(key, cursor.pid); //nonleafnode
-	//if (rc < 0)
-	//	return rc;
-	//insertAndSplit;
-	//locate;
+	return pid;
 }
 
 /*
- * Insert (key, RecordId) pair to the index.
- * @param key[IN] the key for the value inserted into the index
- * @param rid[IN] the RecordId for the record being inserted into the index
+ * Put the page pid on the free list.
+ * @param pid[IN] the PageId of the page nothing points to any more
  * @return error code. 0 if no error
  */
-RC BTreeIndex::insert(int key, const RecordId& rid)
+template <class KeyType>
+RC BTreeIndexT<KeyType>::freePage(PageId pid)
 {
 	RC rc;
-	// If there are no nodes in the tree
-	if (treeHeight == 0) {
-		BTLeafNode *ln = new BTLeafNode;
-		rc = ln->insert(key, rid);
-		if (rc < 0)
-			return rc;
-	
-		rootPid = 1;
-		rc = ln->write(rootPid, pf);
-		if (rc < 0)
-			return rc;
+	char buf[PageFile::PAGE_SIZE];
+	nodeHeader* h = (nodeHeader*) buf;
 
-		treeHeight = 1;
-	}
-	else {
-		int new_key;
-		PageId new_pid;
-		rc = insertHelper(rid, key, rootPid, new_key, new_pid, 1);
-
-		// If the node had to be split then should initialize a new root
-		if (rc == RC_NODE_FULL)
-		{
-			BTNonLeafNode *new_root = new BTNonLeafNode;
-			rc = new_root->initializeRoot(rootPid, new_key, new_pid);
-			if (rc < 0)
-				return rc;
+	memset(buf, 0, PageFile::PAGE_SIZE);
+	h->flags = NODE_FREE;
+	h->prevPid = -1;
 
-			rootPid = pf.endPid();
-			rc = new_root->write(rootPid, pf);
-			if (rc < 0)
-				return rc;
+	// the list is kept in the free pages themselves
+	pthread_mutex_lock(&allocLatch);
+	h->nextPid = freeHead;
+	rc = pf.write(pid, buf);
+	if (rc == 0)
+		freeHead = pid;
+	pthread_mutex_unlock(&allocLatch);
 
-			treeHeight++;
+	pthread_rwlock_wrlock(&pinLatch);
+	pins->writes++;
+	pins->nodes.erase(pid);
+	pthread_rwlock_unlock(&pinLatch);
 
-			return 0;
-		}
+	return rc;
+}
 
-		
+/*
+ * Lock the insert latch of the node at pid.
+ * @param pid[IN] the PageId of the node
+ */
+template <class KeyType>
+void BTreeIndexT<KeyType>::latch(PageId pid)
+{
+	pthread_mutex_lock(&latchTable);
+	if ((size_t) pid >= latches.size())
+		latches.resize(pid + 1, NULL);
+	if (latches[pid] == NULL) {
+		latches[pid] = new pthread_mutex_t;
+		pthread_mutex_init(latches[pid], NULL);
 	}
+	pthread_mutex_t* m = latches[pid];
+	pthread_mutex_unlock(&latchTable);
+
+	pthread_mutex_lock(m);
+}
+
+/*
+ * Unlock the insert latch of the node at pid.
+ * @param pid[IN] the PageId of the node
+ */
+template <class KeyType>
+void BTreeIndexT<KeyType>::unlatch(PageId pid)
+{
+	pthread_mutex_lock(&latchTable);
+	pthread_mutex_t* m = latches[pid];
+	pthread_mutex_unlock(&latchTable);
+
+	pthread_mutex_unlock(m);
+}
 
-	/*
-	IndexCursor cursor;
+/*
+ * Write rids into a new posting list.
+ * @param rids[IN] the RecordIds of the list
+ * @param n[IN] the number of RecordIds (at least 1)
+ * @param headPid[IN] the first of the (n - 1) / MAX_RIDS + 1 pages
+ *                    reserved for the list
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::createPosting(const RecordId* rids, int n, PageId headPid)
+{
 	RC rc;
-	rc = locate(key, cursor);
-	if (rc < 0)
-		return rc;
 
-	insertHelper(key, rid, cursor.pid, int &new_key, PageId &new_pid, int curr_height)
+	// the pages of a new list are allocated back to back
+	PageId lastPid = headPid + (n - 1) / BTPostingNode::MAX_RIDS;
 
+	int i = 0;
+	for (PageId pid = headPid; pid <= lastPid; pid++) {
+		BTPostingNode pn;
+		while (i < n && pn.append(rids[i]) == 0)
+			i++;
 
-	BTLeafNode ln;
-	//rc = *(cursor.pid)->insert(key, rid); //leafnode
-	if (rc == 0)
-		return 0;
-	int sib_key;
-	BTLeafNode sib_ln;
-	ln.insertAndSplit(key, rid, sib_ln, sib_key);
-	//get midkey
+		pn.setNextNodePtr(pid < lastPid ? pid + 1 : -1);
+		if (pid == headPid)
+			pn.setLastNodePtr(lastPid);
+		if (pid == headPid && counted)
+			pn.setTotalCount(n);
 
-	int counter = 1;
-	locateHelper(key, cursor, 0, treeHeight-counter);
-	while (rc != 0 && counter <= treeHeight) {
-		insert(key, cursor.pid); //nonleafnode
-		//insertsplit;
-		//locate;
+		rc = pn.write(pid, pf);
+		if (rc < 0)
+			return rc;
 	}
-	*/
 
-    return 0;
+	return 0;
 }
 
-RC BTreeIndex::locateHelper(int searchKey, IndexCursor& cursor, int counter, int treeHeight) {
+/*
+ * Append rid to the end of the posting list starting at headPid.
+ * @param headPid[IN] the first page of the list
+ * @param rid[IN] the RecordId to append
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::appendPosting(PageId headPid, const RecordId& rid)
+{
 	RC rc;
-	if (counter == treeHeight) { // leaf node
-		BTLeafNode *ln = new BTLeafNode();
-		rc = ln->locate(searchKey, cursor.eid);
+	BTPostingNode head;
+	BTPostingNode last;
+
+	rc = head.read(headPid, pf);
+	if (rc < 0)
+		return rc;
+
+	PageId lastPid = head.getLastNodePtr();
+	BTPostingNode* tail = &head;
+	if (lastPid != headPid) {
+		rc = last.read(lastPid, pf);
 		if (rc < 0)
 			return rc;
+		tail = &last;
 	}
-	else { // nonleaf node
-		BTNonLeafNode *n = new BTNonLeafNode();
-		rc = n->locateChildPtr(searchKey,cursor.pid);
+
+	// a counted index keeps the length of the list in its first page
+	if (counted)
+		head.setTotalCount(head.getTotalCount() + 1);
+
+	if (tail->append(rid) == 0) {
+		if ((rc = tail->write(lastPid, pf)) < 0)
+			return rc;
+		return (counted && tail != &head) ? head.write(headPid, pf) : 0;
+	}
+
+	// the last page is full: chain a new page behind it
+	BTPostingNode page;
+	PageId newPid = allocatePages(1);
+	page.append(rid);
+	rc = page.write(newPid, pf);
+	if (rc < 0)
+		return rc;
+
+	tail->setNextNodePtr(newPid);
+	head.setLastNodePtr(newPid);
+	if (tail != &head) {
+		rc = tail->write(lastPid, pf);
 		if (rc < 0)
 			return rc;
-		return locateHelper(searchKey, cursor, counter+1, treeHeight);
 	}
-	return 0;
+	return head.write(headPid, pf);
 }
 
-/**
- * Run the standard B+Tree key search algorithm and identify the
- * leaf node where searchKey may exist. If an index entry with
- * searchKey exists in the leaf node, set IndexCursor to its location
- * (i.e., IndexCursor.pid = PageId of the leaf node, and
- * IndexCursor.eid = the searchKey index entry number.) and return 0.
- * If not, set IndexCursor.pid = PageId of the leaf node and
- * IndexCursor.eid = the index entry immediately after the largest
- * index key that is smaller than searchKey, and return the error
- * code RC_NO_SUCH_RECORD.
- * Using the returned "IndexCursor", you will have to call readForward()
- * to retrieve the actual (key, rid) pair from the index.
- * @param key[IN] the key to find
- * @param cursor[OUT] the cursor pointing to the index entry with
- *                    searchKey or immediately behind the largest key
- *                    smaller than searchKey.
- * @return 0 if searchKey is found. Othewise an error code
+/*
+ * Insert (key, RecordId) pair to the index.
+ * @param key[IN] the key for the value inserted into the index
+ * @param rid[IN] the RecordId for the record being inserted into the index
+ * @return error code. 0 if no error
  */
-RC BTreeIndex::locate(int searchKey, IndexCursor& cursor)
+template <class KeyType>
+RC BTreeIndexT<KeyType>::insert(const KeyType& key, const RecordId& rid)
 {
-	/*if(cursor.pid < 0 || cursor.pid >= pf.endPid())
-    	return RC_INVALID_CURSOR;*/
+	RC rc;
+	PageId path[MAX_HEIGHT];
+	int height = 0;
 
+	if (clustered)
+		return RC_INVALID_ATTRIBUTE;
+	if (!counted)
+		return insertEntry(key, rid);
+
+	// A counted index raises the row counts on the path of key first.
+	// A split then moves the rows of the new sibling out of the raised
+	// count of the split node, so both end up with their exact counts.
+	pthread_mutex_lock(&countLatch);
+	if (treeHeight > 1) {
+		rc = descend(key, 0, path, height);
+		if (rc == 0)
+			rc = addRows(path, height, 1);
+		if (rc < 0) {
+			pthread_mutex_unlock(&countLatch);
+			return rc;
+		}
+	}
+
+	rc = insertEntry(key, rid);
+	if (rc < 0 && height > 1)
+		addRows(path, height, -1);
+	pthread_mutex_unlock(&countLatch);
+
+	return rc;
+}
+
+/*
+ * insert() without the row counts of a counted index.
+ * @param key[IN] the key for the value inserted into the index
+ * @param rid[IN] the RecordId for the record being inserted into the index
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::insertEntry(const KeyType& key, const RecordId& rid)
+{
 	RC rc;
-	rc = locateHelper(searchKey, cursor, 0, treeHeight); // puts the cursor at the leaf node
+	PageId path[MAX_HEIGHT];
+	int height;
+
+	// If there are no nodes in the tree, the first leaf becomes the root
+	pthread_rwlock_rdlock(&rootLatch);
+	height = treeHeight;
+	pthread_rwlock_unlock(&rootLatch);
+	if (height == 0) {
+		pthread_rwlock_wrlock(&rootLatch);
+		if (treeHeight == 0) {
+			BTLeafNodeT<KeyType> ln;
+			ln.setCompressed(compressedLeaves);
+			rc = ln.insert(key, rid);
+			if (rc == 0) {
+				PageId pid = allocatePages(1);
+				rc = ln.write(pid, pf);
+				if (rc == 0) {
+					rootPid = pid;
+					treeHeight = 1;
+				}
+			}
+			pthread_rwlock_unlock(&rootLatch);
+			return rc;
+		}
+		pthread_rwlock_unlock(&rootLatch);
+	}
+
+	rc = descend(key, 0, path, height);
 	if (rc < 0)
 		return rc;
 
-    return 0;
+	PageId pid = path[0];
+	BTLeafNodeT<KeyType> ln;
+	latch(pid);
+	rc = ln.read(pid, pf);
+
+	// a leaf that split since the descent passed the larger keys on
+	// to its right siblings
+	while (rc == 0) {
+		KeyType k;
+		RecordId r;
+		PageId next = ln.getNextNodePtr();
+		if (next < 0 || (ln.readLEntry(ln.getKeyCount() - 1, k, r) == 0 && !(k < key)))
+			break;
+
+		BTLeafNodeT<KeyType> nl;
+		latch(next);
+		if ((rc = nl.read(next, pf)) < 0) {
+			unlatch(next);
+			break;
+		}
+		if (nl.readLEntry(0, k, r) == 0 && key < k) {
+			unlatch(next);
+			break;
+		}
+		unlatch(pid);
+		pid = next;
+		ln = nl;
+	}
+	if (rc < 0) {
+		unlatch(pid);
+		return rc;
+	}
+
+	// a duplicated key only grows its posting list, and a key with
+	// POSTING_THRESHOLD entries in the leaf moves them to a new list
+	int eid;
+	if (ln.locate(key, eid) == 0) {
+		KeyType k;
+		RecordId r;
+		RecordId run[BTLeafNodeT<KeyType>::MAX_COMPRESSED_KEYS + 1];
+		int n = 0;
+
+		ln.readLEntry(eid, k, r);
+		if (isPostingRid(r)) {
+			rc = appendPosting(r.pid, rid);
+			unlatch(pid);
+			return rc;
+		}
+
+		while (ln.readLEntry(eid + n, k, r) == 0 && k == key)
+			run[n++] = r;
+
+		if (n >= POSTING_THRESHOLD) {
+			// the pages of the list are reserved first, since the leaf
+			// entry points to them; they are freed again if the run
+			// cannot be collapsed
+			RecordId head;
+			head.pid = allocatePages(n / BTPostingNode::MAX_RIDS + 1);
+			head.sid = POSTING_SID;
+			if (ln.collapseRun(eid, n, head) == 0) {
+				run[n++] = rid;
+				rc = createPosting(run, n, head.pid);
+				if (rc == 0)
+					rc = ln.write(pid, pf);
+				unlatch(pid);
+				return rc;
+			}
+			for (int i = 0; i < n / BTPostingNode::MAX_RIDS + 1; i++)
+				if ((rc = freePage(head.pid + i)) < 0) {
+					unlatch(pid);
+					return rc;
+				}
+		}
+	}
+
+	rc = ln.insert(key, rid);
+	if (rc != RC_NODE_FULL) {
+		if (rc == 0)
+			rc = ln.write(pid, pf);
+		unlatch(pid);
+		return rc;
+	}
+
+	// split the leaf; the sibling goes on disk before the leaf points to
+	// it, and the leaf behind the sibling is pointed back at it last
+	BTLeafNodeT<KeyType> sib;
+	KeyType sibKey;
+	PageId sibPid = -1;
+	int lnRows = 0, sibRows = 0;
+	rc = ln.insertAndSplit(key, rid, sib, sibKey);
+	if (rc == 0 && counted) {
+		rc = leafRows(sib, 0, sib.getKeyCount(), sibRows);
+		if (rc == 0 && height == 1)
+			rc = leafRows(ln, 0, ln.getKeyCount(), lnRows);
+	}
+	if (rc == 0) {
+		sibPid = allocatePages(1);
+		sib.setPrevNodePtr(pid);
+		rc = sib.write(sibPid, pf);
+	}
+	if (rc == 0) {
+		ln.setNextNodePtr(sibPid);
+		rc = ln.write(pid, pf);
+	}
+	if (rc == 0 && sib.getNextNodePtr() >= 0) {
+		PageId next = sib.getNextNodePtr();
+		latch(next);
+		rc = setPrevLeaf(next, sibPid);
+		unlatch(next);
+	}
+	if (rc < 0) {
+		unlatch(pid);
+		return rc;
+	}
+
+	return insertParent(0, path, height, pid, sibKey, sibPid, lnRows, sibRows);
 }
 
 /*
- * Read the (key, rid) pair at the location specified by the index cursor,
- * and move foward the cursor to the next entry.
- * @param cursor[IN/OUT] the cursor pointing to an leaf-node index entry in the b+tree
- * @param key[OUT] the key stored at the index cursor location.
- * @param rid[OUT] the RecordId stored at the index cursor location.
+ * Insert a (key, RecordId) pair through the insert buffers.
+ * @param key[IN] the key for the value inserted into the index
+ * @param rid[IN] the RecordId for the record being inserted into the index
  * @return error code. 0 if no error
  */
-RC BTreeIndex::readForward(IndexCursor& cursor, int& key, RecordId& rid)
+template <class KeyType>
+RC BTreeIndexT<KeyType>::insertBuffered(const KeyType& key, const RecordId& rid)
 {
-    if (cursor.pid < 0 || cursor.pid >= pf.endPid())
-    	return RC_INVALID_CURSOR;
+	RC rc;
+	PageId path[MAX_HEIGHT];
+	int height;
 
-    //create a new BTLeafNode
-    BTLeafNode * ln = new BTLeafNode();
-    RC rc;
+	if (clustered)
+		return RC_INVALID_ATTRIBUTE;
 
-    if((rc = ln->read(cursor.pid, pf)) != 0)
-    	return rc;
-    if((rc = ln->readLEntry(cursor.eid, key, rid)) != 0)
-    	return rc;
+	// a tree without a parent of leaves has no buffers
+	pthread_rwlock_rdlock(&rootLatch);
+	height = treeHeight;
+	pthread_rwlock_unlock(&rootLatch);
+	if (height < 2)
+		return insert(key, rid);
 
-    if(cursor.eid == ln->getKeyCount()-1)
-    {
-    	cursor.pid = ln->getNextNodePtr();
-    	cursor.eid = 0;
-    }
-    else
-    	cursor.eid++;
+	// the descent stops above the leaves, so it reads pinned pages only
+	if ((rc = descend(key, 1, path, height)) < 0)
+		return rc;
 
-    return 0;
+	pthread_mutex_lock(&bufferLatch);
+	vector<pair<KeyType, RecordId> >& buffer = buffers[path[1]];
+	buffer.push_back(make_pair(key, rid));
+	bufferedKeys.insert(make_pair(key, path[1]));
+	__atomic_fetch_add(&bufferedCount, 1, __ATOMIC_RELEASE);
+
+	// a full buffer is flushed, and so is the fullest one once all of them
+	// together hold too many pairs
+	rc = 0;
+	if (buffer.size() >= (size_t) NODE_BUFFER_ENTRIES)
+		rc = flushBuffer(path[1]);
+	else if (bufferedCount >= MAX_BUFFERED_ENTRIES) {
+		typename map<PageId, vector<pair<KeyType, RecordId> > >::iterator it, fullest;
+		for (it = fullest = buffers.begin(); it != buffers.end(); ++it)
+			if (it->second.size() > fullest->second.size())
+				fullest = it;
+		rc = flushBuffer(fullest->first);
+	}
+	pthread_mutex_unlock(&bufferLatch);
 
+	return rc;
 }
+
+/*
+ * Move every buffered pair into the leaves.
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::flushBuffers()
+{
+	RC rc;
+	vector<pair<KeyType, RecordId> > batch;
+
+	pthread_mutex_lock(&bufferLatch);
+	if (bufferedCount == 0) {
+		pthread_mutex_unlock(&bufferLatch);
+		return 0;
+	}
+
+	// all buffers go down in a single pass over the leaves
+	batch.reserve(bufferedCount);
+	typename map<PageId, vector<pair<KeyType, RecordId> > >::iterator it;
+	for (it = buffers.begin(); it != buffers.end(); ++it)
+		batch.insert(batch.end(), it->second.begin(), it->second.end());
+	buffers.clear();
+	bufferedKeys.clear();
+
+	// the lookups that skip the buffers see the count drop only once the
+	// pairs are in the leaves
+	sort(batch.begin(), batch.end());
+	rc = insertSorted(batch);
+	__atomic_store_n(&bufferedCount, 0, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&bufferLatch);
+
+	return rc;
+}
+
+/*
+ * Move the pairs buffered at the parent of leaves node into the leaves.
+ * The caller holds bufferLatch.
+ * @param node[IN] the PageId of the node
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::flushBuffer(PageId node)
+{
+	RC rc;
+	vector<pair<KeyType, RecordId> > batch;
+
+	typename map<PageId, vector<pair<KeyType, RecordId> > >::iterator it = buffers.find(node);
+	if (it == buffers.end())
+		return 0;
+	batch.swap(it->second);
+	buffers.erase(it);
+	for (size_t i = 0; i < batch.size(); i++)
+		bufferedKeys.erase(bufferedKeys.find(make_pair(batch[i].first, node)));
+
+	// as in flushBuffers(), the count drops once the pairs are in the leaves
+	sort(batch.begin(), batch.end());
+	rc = insertSorted(batch);
+	__atomic_fetch_sub(&bufferedCount, (int) batch.size(), __ATOMIC_RELEASE);
+	return rc;
+}
+
+/*
+ * Move the buffered pairs with lo <= key <= hi into the leaves, a whole
+ * buffer at a time.
+ * @param lo[IN] the smallest key (NULL for no bound)
+ * @param hi[IN] the largest key (NULL for no bound)
+ * @param flushed[OUT] true if any pair was moved
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::flushRange(const KeyType* lo, const KeyType* hi, bool& flushed)
+{
+	RC rc = 0;
+
+	// without buffered pairs a lookup takes no latch; a pair buffered
+	// meanwhile is like an insert that runs concurrently with it
+	flushed = false;
+	if (__atomic_load_n(&bufferedCount, __ATOMIC_ACQUIRE) == 0)
+		return 0;
+
+	pthread_mutex_lock(&bufferLatch);
+	for (;;) {
+		typename multiset<pair<KeyType, PageId> >::iterator it = bufferedKeys.begin();
+		if (lo != NULL)
+			it = bufferedKeys.lower_bound(make_pair(*lo, (PageId) -1));
+		if (it == bufferedKeys.end() || (hi != NULL && *hi < it->first))
+			break;
+		if ((rc = flushBuffer(it->second)) < 0)
+			break;
+		flushed = true;
+	}
+	pthread_mutex_unlock(&bufferLatch);
+
+	return rc;
+}
+
+/*
+ * Move into the leaves the buffered pairs from searchKey up to the entry
+ * cursor points to (the first key of the next leaf if it points past the
+ * last entry of its leaf).
+ * @param searchKey[IN] the key of the lookup
+ * @param cursor[IN] the cursor locate() set for it
+ * @param flushed[OUT] true if any pair was moved
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::flushLocated(const KeyType& searchKey, const IndexCursor& cursor, bool& flushed)
+{
+	RC rc;
+	BTLeafNodeT<KeyType> ln;
+	KeyType key;
+	RecordId rid;
+	PageId next;
+
+	flushed = false;
+	if (__atomic_load_n(&bufferedCount, __ATOMIC_ACQUIRE) == 0 || cursor.pid < 0)
+		return 0;
+
+	if ((rc = ln.read(cursor.pid, pf)) < 0)
+		return rc;
+	if (cursor.eid < ln.getKeyCount()) {
+		if ((rc = ln.readLEntry(cursor.eid, key, rid)) < 0)
+			return rc;
+		return flushRange(&searchKey, &key, flushed);
+	}
+
+	// the last leaf takes every larger key
+	if ((next = ln.getNextNodePtr()) < 0)
+		return flushRange(&searchKey, NULL, flushed);
+	if ((rc = ln.read(next, pf)) < 0)
+		return rc;
+	if ((rc = ln.readLEntry(0, key, rid)) < 0)
+		return rc;
+	return flushRange(&searchKey, &key, flushed);
+}
+
+/*
+ * Set the cursor to return the entry eid of the leaf ln next.
+ * @param cursor[IN/OUT] the cursor
+ * @param ln[IN] the leaf
+ * @param eid[IN] the entry
+ */
+template <class KeyType>
+void BTreeIndexT<KeyType>::setUnread(IndexCursor& cursor, BTLeafNodeT<KeyType>& ln, int eid)
+{
+	KeyType key;
+	RecordId rid;
+
+	if (ln.readLEntry(eid, key, rid) != 0)
+		return;
+	cursor.last = rid;
+	cursor.lastNext = ln.getNextNodePtr();
+	cursor.unread = true;
+}
+
+/*
+ * Insert sorted (key, RecordId) pairs, one leaf at a time.
+ * @param entries[IN] the pairs in key order
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::insertSorted(const vector<pair<KeyType, RecordId> >& entries)
+{
+	RC rc;
+	PageId path[MAX_HEIGHT];
+	int height;
+
+	for (size_t i = 0, j; i < entries.size(); i = j) {
+		pthread_rwlock_rdlock(&rootLatch);
+		height = treeHeight;
+		pthread_rwlock_unlock(&rootLatch);
+
+		// the row counts of a counted index change with the leaf
+		if (height > 0 && counted)
+			pthread_mutex_lock(&countLatch);
+		rc = (height > 0) ? descend(entries[i].first, 0, path, height) : 0;
+
+		// the leaf of the first pair takes the pairs behind it up to its
+		// last key (all of them if it is the last leaf) while they fit
+		// and are new keys in the leaf. A leaf that split since the
+		// descent still holds every key up to its last one
+		j = i;
+		if (rc == 0 && height > 0) {
+			PageId pid = path[0];
+			BTLeafNodeT<KeyType> ln;
+			KeyType last;
+			RecordId r;
+			int eid;
+
+			latch(pid);
+			rc = ln.read(pid, pf);
+			bool lastLeaf = (ln.getNextNodePtr() < 0);
+			if (rc == 0 && ln.readLEntry(ln.getKeyCount() - 1, last, r) == 0) {
+				for (; j < entries.size(); j++) {
+					if (!lastLeaf && last < entries[j].first)
+						break;
+					if (ln.locate(entries[j].first, eid) == 0)
+						break;
+					if (ln.insert(entries[j].first, entries[j].second) != 0)
+						break;
+				}
+			}
+			if (rc == 0 && j > i)
+				rc = ln.write(pid, pf);
+			if (rc == 0 && j > i && counted && height > 1)
+				rc = addRows(path, height, (int) (j - i));
+			unlatch(pid);
+		}
+		if (height > 0 && counted)
+			pthread_mutex_unlock(&countLatch);
+		if (rc < 0)
+			return rc;
+
+		// a pair the leaf cannot take as it is (a split, a duplicate key,
+		// a key past the leaf) goes through insert()
+		if (j == i) {
+			if ((rc = insert(entries[i].first, entries[i].second)) < 0)
+				return rc;
+			j = i + 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Insert a (key, value) tuple into a clustered index.
+ * @param key[IN] the key of the tuple
+ * @param value[IN] the value of the tuple
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::insertTuple(const KeyType& key, const string& value)
+{
+	RC rc;
+	PageId path[MAX_HEIGHT];
+	int height;
+
+	if (!clustered)
+		return RC_INVALID_ATTRIBUTE;
+
+	// If there are no nodes in the tree, the first leaf becomes the root
+	pthread_rwlock_rdlock(&rootLatch);
+	height = treeHeight;
+	pthread_rwlock_unlock(&rootLatch);
+	if (height == 0) {
+		pthread_rwlock_wrlock(&rootLatch);
+		if (treeHeight == 0) {
+			BTTupleNodeT<KeyType> ln;
+			rc = ln.insert(key, value);
+			if (rc == 0) {
+				PageId pid = allocatePages(1);
+				rc = ln.write(pid, pf);
+				if (rc == 0) {
+					rootPid = pid;
+					treeHeight = 1;
+				}
+			}
+			pthread_rwlock_unlock(&rootLatch);
+			return rc;
+		}
+		pthread_rwlock_unlock(&rootLatch);
+	}
+
+	rc = descend(key, 0, path, height);
+	if (rc < 0)
+		return rc;
+
+	PageId pid = path[0];
+	BTTupleNodeT<KeyType> ln;
+	latch(pid);
+	rc = ln.read(pid, pf);
+
+	// the tuple goes behind its equal keys, which a split since the
+	// descent may have passed on to the right siblings
+	while (rc == 0) {
+		KeyType k;
+		PageId next = ln.getNextNodePtr();
+		if (next < 0 || (ln.readKey(ln.getKeyCount() - 1, k) == 0 && key < k))
+			break;
+
+		BTTupleNodeT<KeyType> nl;
+		latch(next);
+		if ((rc = nl.read(next, pf)) < 0) {
+			unlatch(next);
+			break;
+		}
+		if (nl.readKey(0, k) == 0 && key < k) {
+			unlatch(next);
+			break;
+		}
+		unlatch(pid);
+		pid = next;
+		ln = nl;
+	}
+	if (rc < 0) {
+		unlatch(pid);
+		return rc;
+	}
+
+	rc = ln.insert(key, value);
+	if (rc != RC_NODE_FULL) {
+		if (rc == 0)
+			rc = ln.write(pid, pf);
+		unlatch(pid);
+		return rc;
+	}
+
+	// split the leaf like insertEntry() does
+	BTTupleNodeT<KeyType> sib;
+	KeyType sibKey;
+	PageId sibPid = -1;
+	rc = ln.insertAndSplit(key, value, sib, sibKey);
+	if (rc == 0) {
+		sibPid = allocatePages(1);
+		sib.setPrevNodePtr(pid);
+		rc = sib.write(sibPid, pf);
+	}
+	if (rc == 0) {
+		ln.setNextNodePtr(sibPid);
+		rc = ln.write(pid, pf);
+	}
+	if (rc == 0 && sib.getNextNodePtr() >= 0) {
+		PageId next = sib.getNextNodePtr();
+		latch(next);
+		rc = setPrevLeaf(next, sibPid);
+		unlatch(next);
+	}
+	if (rc < 0) {
+		unlatch(pid);
+		return rc;
+	}
+
+	return insertParent(0, path, height, pid, sibKey, sibPid, 0, 0);
+}
+
+/*
+ * Point the leaf at pid back at its new left sibling.
+ * @param pid[IN] the PageId of the leaf
+ * @param prevPid[IN] the PageId of its left sibling
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::setPrevLeaf(PageId pid, PageId prevPid)
+{
+	RC rc;
+
+	if (clustered) {
+		BTTupleNodeT<KeyType> tn;
+		if ((rc = tn.read(pid, pf)) < 0)
+			return rc;
+		tn.setPrevNodePtr(prevPid);
+		return tn.write(pid, pf);
+	}
+
+	BTLeafNodeT<KeyType> ln;
+	if ((rc = ln.read(pid, pf)) < 0)
+		return rc;
+	ln.setPrevNodePtr(prevPid);
+	return ln.write(pid, pf);
+}
+
+/*
+ * Add delta to the row count of every node on the path in its parent.
+ * @param path[IN] the descent path (see descend())
+ * @param height[IN] the height of the tree
+ * @param delta[IN] the number of rows added (or removed if negative)
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::addRows(PageId* path, int height, int delta)
+{
+	RC rc;
+	BTNonLeafNodeT<KeyType> node;
+
+	for (int l = 1; l < height; l++) {
+		if ((rc = readNonLeaf(path[l], node)) < 0)
+			return rc;
+		if (!addChildRows(node, path[l - 1], delta))
+			return RC_INVALID_FILE_FORMAT;
+		if ((rc = writeNonLeaf(path[l], node)) < 0)
+			return rc;
+	}
+
+	return 0;
+}
+
+/*
+ * Count the rows in the entries from to to - 1 of a leaf in a counted
+ * index.
+ * @param leaf[IN] the leaf
+ * @param from[IN] the first entry
+ * @param to[IN] the entry behind the last one
+ * @param rows[OUT] the number of rows
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::leafRows(BTLeafNodeT<KeyType>& leaf, int from, int to, int& rows)
+{
+	RC rc;
+	const KeyType* k;
+	const RecordId* r;
+
+	int n = leaf.readLEntries(from, k, r);
+	if (to - from < n)
+		n = to - from;
+
+	rows = 0;
+	for (int i = 0; i < n; i++) {
+		if (!isPostingRid(r[i])) {
+			rows++;
+			continue;
+		}
+
+		BTPostingNode head;
+		if ((rc = head.read(r[i].pid, pf)) < 0)
+			return rc;
+		rows += head.getTotalCount();
+	}
+
+	return 0;
+}
+
+/*
+ * Remove the (key, RecordId) pair from the index.
+ * @param key[IN] the key of the pair
+ * @param rid[IN] the RecordId of the pair
+ * @return error code. 0 if no error, RC_NO_SUCH_RECORD if the pair
+ *         is not in the index
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::remove(const KeyType& key, const RecordId& rid)
+{
+	RC rc;
+	PageId path[MAX_HEIGHT];
+	int height;
+
+	if (clustered)
+		return RC_INVALID_ATTRIBUTE;
+	if ((rc = flushBuffers()) < 0)
+		return rc;
+	if (treeHeight == 0)
+		return RC_NO_SUCH_RECORD;
+	if ((rc = descend(key, 0, path, height)) < 0)
+		return rc;
+
+	PageId pid = path[0];
+	BTLeafNodeT<KeyType> ln;
+	if ((rc = ln.read(pid, pf)) < 0)
+		return rc;
+
+	// find rid among the entries of key, or the posting list of key
+	int eid;
+	KeyType k;
+	RecordId r;
+	if (ln.locate(key, eid) != 0)
+		return RC_NO_SUCH_RECORD;
+	for (;; eid++) {
+		if (ln.readLEntry(eid, k, r) < 0 || !(k == key))
+			return RC_NO_SUCH_RECORD;
+		if (isPostingRid(r) || (r.pid == rid.pid && r.sid == rid.sid))
+			break;
+	}
+
+	if (isPostingRid(r)) {
+		int left;
+		RecordId single;
+		if ((rc = removePosting(r.pid, rid, left, single)) < 0)
+			return rc;
+		if (counted && (rc = addRows(path, height, -1)) < 0)
+			return rc;
+		if (left > 1)
+			return 0;
+
+		// a list down to one RecordId goes back into the leaf (unless
+		// a compressed leaf cannot pack it)
+		if (left == 1) {
+			if (ln.collapseRun(eid, 1, single) < 0)
+				return 0;
+			if ((rc = ln.write(pid, pf)) < 0)
+				return rc;
+			return freePage(r.pid);
+		}
+	}
+	else if (counted && (rc = addRows(path, height, -1)) < 0)
+		return rc;
+
+	if ((rc = ln.remove(eid)) < 0)
+		return rc;
+
+	// the root leaf only goes away with its last entry
+	if (height == 1) {
+		if (ln.getKeyCount() > 0)
+			return ln.write(pid, pf);
+
+		pthread_rwlock_wrlock(&rootLatch);
+		rootPid = -1;
+		treeHeight = 0;
+		pthread_rwlock_unlock(&rootLatch);
+		return freePage(pid);
+	}
+
+	if (ln.isUnderfull())
+		return rebalanceLeaf(path, height, pid, ln);
+
+	if ((rc = ln.write(pid, pf)) < 0)
+		return rc;
+	return (eid == 0) ? fixSeparator(path, height, pid, ln) : 0;
+}
+
+/*
+ * Remove rid from the posting list starting at headPid.
+ * @param headPid[IN] the first page of the list
+ * @param rid[IN] the RecordId to remove
+ * @param left[OUT] 0 if the list is now empty and freed, 1 if it holds
+ *                  a single RecordId, 2 if it holds more
+ * @param single[OUT] the remaining RecordId if left is 1
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::removePosting(PageId headPid, const RecordId& rid, int& left, RecordId& single)
+{
+	RC rc;
+	BTPostingNode head;
+	BTPostingNode prev;
+	BTPostingNode page;
+	BTPostingNode next;
+
+	if ((rc = head.read(headPid, pf)) < 0)
+		return rc;
+
+	// find the page holding rid
+	PageId prevPid = -1;
+	PageId pid = headPid;
+	BTPostingNode* cur = &head;
+	int i;
+	for (;;) {
+		RecordId r;
+		for (i = 0; cur->readEntry(i, r) == 0; i++)
+			if (r.pid == rid.pid && r.sid == rid.sid)
+				break;
+		if (i < cur->getRidCount())
+			break;
+
+		PageId nextPid = cur->getNextNodePtr();
+		if (nextPid < 0)
+			return RC_NO_SUCH_RECORD;
+		if (cur == &page)
+			prev = page;
+		prevPid = pid;
+		pid = nextPid;
+		if ((rc = page.read(pid, pf)) < 0)
+			return rc;
+		cur = &page;
+	}
+	cur->remove(i);
+	if (counted)
+		head.setTotalCount(head.getTotalCount() - 1);
+
+	// Two neighbouring pages that fit on one page are merged, so the
+	// list shrinks along with its RecordIds. The first page is never
+	// merged away, since the leaf entry points to it.
+	BTPostingNode* from = NULL;
+	BTPostingNode* to = NULL;
+	PageId fromPid = -1, toPid = -1;
+	BTPostingNode* p = (prevPid == headPid) ? &head : &prev;
+	if (prevPid >= 0 && p->getRidCount() + cur->getRidCount() <= BTPostingNode::MAX_RIDS) {
+		from = cur;
+		fromPid = pid;
+		to = p;
+		toPid = prevPid;
+	}
+	else if (cur->getNextNodePtr() >= 0) {
+		PageId nextPid = cur->getNextNodePtr();
+		if ((rc = next.read(nextPid, pf)) < 0)
+			return rc;
+		if (cur->getRidCount() + next.getRidCount() <= BTPostingNode::MAX_RIDS) {
+			from = &next;
+			fromPid = nextPid;
+			to = cur;
+			toPid = pid;
+		}
+	}
+
+	if (from != NULL) {
+		const RecordId* rids;
+		int n = from->readEntries(rids);
+		for (int k = 0; k < n; k++)
+			to->append(rids[k]);
+		to->setNextNodePtr(from->getNextNodePtr());
+		if (head.getLastNodePtr() == fromPid)
+			head.setLastNodePtr(toPid);
+		if (to != &head && (rc = to->write(toPid, pf)) < 0)
+			return rc;
+		if ((rc = head.write(headPid, pf)) < 0)
+			return rc;
+		if ((rc = freePage(fromPid)) < 0)
+			return rc;
+	}
+	else if (head.getRidCount() == 0) {
+		// the last RecordId of the list is gone
+		left = 0;
+		return freePage(headPid);
+	}
+	else {
+		if ((rc = cur->write(pid, pf)) < 0)
+			return rc;
+		if (counted && cur != &head && (rc = head.write(headPid, pf)) < 0)
+			return rc;
+	}
+
+	// only the first page can be left with a single RecordId
+	left = (head.getRidCount() > 1 || head.getNextNodePtr() >= 0) ? 2 : 1;
+	if (left == 1)
+		head.readEntry(0, single);
+	return 0;
+}
+
+/*
+ * Set the separator in front of the leaf at pid to the first key of
+ * the leaf.
+ * @param path[IN] the descent path to the leaf (see descend())
+ * @param height[IN] the height of the tree
+ * @param pid[IN] the PageId of the leaf
+ * @param leaf[IN] the leaf
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::fixSeparator(PageId* path, int height, PageId pid, BTLeafNodeT<KeyType>& leaf)
+{
+	RC rc;
+	KeyType first;
+	RecordId r;
+
+	if (leaf.readLEntry(0, first, r) < 0)
+		return 0;
+
+	BTNonLeafNodeT<KeyType> node;
+	for (int l = 1; l < height; l++) {
+		if ((rc = readNonLeaf(path[l], node)) < 0)
+			return rc;
+
+		int i = node.getChildIndex(pid);
+		if (i < 0)
+			return RC_INVALID_FILE_FORMAT;
+		if (i > 0) {
+			KeyType sep;
+			node.readNLEntry(i - 1, sep);
+			if (sep == first)
+				return 0;
+			node.setKey(i - 1, first);
+			return writeNonLeaf(path[l], node);
+		}
+		pid = path[l];
+	}
+
+	// the leftmost leaf has no separator
+	return 0;
+}
+
+/*
+ * Write the underfull leaf at pid after refilling it from or merging
+ * it with a sibling under the same parent.
+ * @param path[IN] the descent path to the leaf (see descend())
+ * @param height[IN] the height of the tree
+ * @param pid[IN] the PageId of the leaf
+ * @param leaf[IN] the leaf
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::rebalanceLeaf(PageId* path, int height, PageId pid, BTLeafNodeT<KeyType>& leaf)
+{
+	RC rc;
+	BTNonLeafNodeT<KeyType> parent;
+
+	if ((rc = readNonLeaf(path[1], parent)) < 0)
+		return rc;
+	int i = parent.getChildIndex(pid);
+	if (i < 0)
+		return RC_INVALID_FILE_FORMAT;
+
+	// pair the leaf with its right sibling, or with its left sibling
+	// if it is the last child; sep is the key between the two
+	int sep = (i < parent.getKeyCount()) ? i : i - 1;
+	PageId lpid, rpid;
+	BTLeafNodeT<KeyType> left, right;
+	parent.readChildPtr(sep, lpid);
+	parent.readChildPtr(sep + 1, rpid);
+	if (lpid == pid) {
+		left = leaf;
+		rc = right.read(rpid, pf);
+	}
+	else {
+		right = leaf;
+		rc = left.read(lpid, pf);
+	}
+	if (rc < 0)
+		return rc;
+
+	// the two leaves hold the rows of both counts in the parent
+	int lrows = 0, rrows = 0;
+	if (counted) {
+		parent.readChildCount(sep, lrows);
+		parent.readChildCount(sep + 1, rrows);
+	}
+
+	if (left.merge(right) == 0) {
+		if ((rc = left.write(lpid, pf)) < 0)
+			return rc;
+		if (left.getNextNodePtr() >= 0 && (rc = setPrevLeaf(left.getNextNodePtr(), lpid)) < 0)
+			return rc;
+		if (counted)
+			parent.setChildCount(sep, lrows + rrows);
+		parent.remove(sep);
+		if ((rc = writeNonLeaf(path[1], parent)) < 0)
+			return rc;
+		if ((rc = freePage(rpid)) < 0)
+			return rc;
+		if ((rc = fixSeparator(path, height, lpid, left)) < 0)
+			return rc;
+		return rebalance(path, height, 1);
+	}
+
+	KeyType rightKey;
+	if (left.redistribute(right, rightKey) == 0) {
+		if ((rc = left.write(lpid, pf)) < 0)
+			return rc;
+		if ((rc = right.write(rpid, pf)) < 0)
+			return rc;
+		if (counted) {
+			int rows;
+			if ((rc = leafRows(left, 0, left.getKeyCount(), rows)) < 0)
+				return rc;
+			parent.setChildCount(sep, rows);
+			parent.setChildCount(sep + 1, lrows + rrows - rows);
+		}
+		parent.setKey(sep, rightKey);
+		if ((rc = writeNonLeaf(path[1], parent)) < 0)
+			return rc;
+		return fixSeparator(path, height, lpid, left);
+	}
+
+	// neither fits (runs of equal keys in compressed leaves); the leaf
+	// stays underfull
+	if ((rc = leaf.write(pid, pf)) < 0)
+		return rc;
+	return fixSeparator(path, height, pid, leaf);
+}
+
+/*
+ * Rebalance the non-leaf node on the path at level after it lost a
+ * child, and the levels above it as far as needed.
+ * @param path[IN] the descent path (see descend())
+ * @param height[IN] the height of the tree
+ * @param level[IN] the level of the node that lost a child
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::rebalance(PageId* path, int height, int level)
+{
+	RC rc;
+	BTNonLeafNodeT<KeyType> node, parent, left, right;
+
+	for (; level < height; level++) {
+		PageId pid = path[level];
+		if ((rc = readNonLeaf(pid, node)) < 0)
+			return rc;
+
+		// a root with a single child hands the root over to the child
+		if (level == height - 1) {
+			if (node.getKeyCount() > 0)
+				return 0;
+
+			PageId child;
+			node.readChildPtr(0, child);
+			pthread_rwlock_wrlock(&rootLatch);
+			rootPid = child;
+			treeHeight = level;
+			pthread_rwlock_unlock(&rootLatch);
+			return freePage(pid);
+		}
+
+		if (!node.isUnderfull())
+			return 0;
+
+		PageId ppid = path[level + 1];
+		if ((rc = readNonLeaf(ppid, parent)) < 0)
+			return rc;
+		int i = parent.getChildIndex(pid);
+		if (i < 0)
+			return RC_INVALID_FILE_FORMAT;
+
+		int sep = (i < parent.getKeyCount()) ? i : i - 1;
+		PageId lpid, rpid;
+		KeyType midKey;
+		parent.readChildPtr(sep, lpid);
+		parent.readChildPtr(sep + 1, rpid);
+		parent.readNLEntry(sep, midKey);
+		if (lpid == pid) {
+			left = node;
+			rc = readNonLeaf(rpid, right);
+		}
+		else {
+			right = node;
+			rc = readNonLeaf(lpid, left);
+		}
+		if (rc < 0)
+			return rc;
+
+		// a merge takes a child away from the parent, so go on upwards
+		if (left.merge(midKey, right) == 0) {
+			if ((rc = writeNonLeaf(lpid, left)) < 0)
+				return rc;
+			if (counted)
+				parent.setChildCount(sep, left.getTotalCount());
+			parent.remove(sep);
+			if ((rc = writeNonLeaf(ppid, parent)) < 0)
+				return rc;
+			if ((rc = freePage(rpid)) < 0)
+				return rc;
+			continue;
+		}
+
+		KeyType newMidKey;
+		if ((rc = left.redistribute(midKey, right, newMidKey)) < 0)
+			return rc;
+		if ((rc = writeNonLeaf(lpid, left)) < 0)
+			return rc;
+		if ((rc = writeNonLeaf(rpid, right)) < 0)
+			return rc;
+		if (counted) {
+			parent.setChildCount(sep, left.getTotalCount());
+			parent.setChildCount(sep + 1, right.getTotalCount());
+		}
+		parent.setKey(sep, newMidKey);
+		return writeNonLeaf(ppid, parent);
+	}
+
+	return 0;
+}
+
+/**
+ * Run the standard B+Tree key search algorithm and identify the
+ * leaf node where searchKey may exist. If an index entry with
+ * searchKey exists in the leaf node, set IndexCursor to its location
+ * (i.e., IndexCursor.pid = PageId of the leaf node, and
+ * IndexCursor.eid = the searchKey index entry number.) and return 0.
+ * If not, set IndexCursor.pid = PageId of the leaf node and
+ * IndexCursor.eid = the index entry immediately after the largest
+ * index key that is smaller than searchKey, and return the error
+ * code RC_NO_SUCH_RECORD.
+ * Using the returned "IndexCursor", you will have to call readForward()
+ * to retrieve the actual (key, rid) pair from the index.
+ * @param key[IN] the key to find
+ * @param cursor[OUT] the cursor pointing to the index entry with
+ *                    searchKey or immediately behind the largest key
+ *                    smaller than searchKey.
+ * @return 0 if searchKey is found. Othewise an error code
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::locate(const KeyType& searchKey, IndexCursor& cursor)
+{
+	RC rc, frc;
+	PageId parentPid;
+	bool flushed;
+
+	// the buffered pairs the cursor would have passed go into the leaves,
+	// and the lookup runs again
+	do {
+		rc = locate(searchKey, cursor, parentPid);
+		if (rc < 0 && rc != RC_NO_SUCH_RECORD)
+			return rc;
+		if ((frc = flushLocated(searchKey, cursor, flushed)) < 0)
+			return frc;
+	} while (flushed);
+
+	return rc;
+}
+
+/*
+ * locate() that also returns the parent of the leaf on the descent path.
+ * @param searchKey[IN] the key to find
+ * @param cursor[OUT] the cursor (see locate())
+ * @param parentPid[OUT] the parent of the leaf (-1 if the leaf is the root)
+ * @return 0 if searchKey is found. Othewise an error code
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::locate(const KeyType& searchKey, IndexCursor& cursor, PageId& parentPid)
+{
+	RC rc;
+	PageId path[MAX_HEIGHT];
+	int height;
+
+	cursor.pid = -1;
+	cursor.eid = 0;
+	cursor.ppid = -1;
+	cursor.peid = 0;
+	cursor.last.pid = -1;
+	cursor.last.sid = 0;
+	cursor.unread = false;
+	parentPid = -1;
+
+	// an empty tree has no leaf to point to
+	pthread_rwlock_rdlock(&rootLatch);
+	height = treeHeight;
+	pthread_rwlock_unlock(&rootLatch);
+	if (height == 0)
+		return RC_NO_SUCH_RECORD;
+
+	rc = descend(searchKey, 0, path, height);
+	if (rc < 0)
+		return rc;
+
+	if (height > 1)
+		parentPid = path[1];
+
+	BTLeafNodeT<KeyType> ln;
+	cursor.pid = path[0];
+	rc = ln.read(cursor.pid, pf);
+	if (rc < 0)
+		return rc;
+	rc = ln.locate(searchKey, cursor.eid);
+
+	// searchKey may have moved on to a right sibling in a split since
+	// the descent
+	while (rc != 0 && cursor.eid == ln.getKeyCount()) {
+		KeyType k;
+		RecordId r;
+		BTLeafNodeT<KeyType> nl;
+		PageId next = ln.getNextNodePtr();
+		if (next < 0)
+			break;
+		if ((rc = nl.read(next, pf)) < 0)
+			return rc;
+		if (nl.readLEntry(0, k, r) == 0 && searchKey < k) {
+			rc = RC_NO_SUCH_RECORD;
+			setUnread(cursor, nl, 0);
+			break;
+		}
+		cursor.pid = next;
+		ln = nl;
+		rc = ln.locate(searchKey, cursor.eid);
+	}
+
+	setUnread(cursor, ln, cursor.eid);
+	return rc;
+}
+
+/*
+ * locate() on a clustered index, at the first tuple of searchKey.
+ * @param searchKey[IN] the key to find
+ * @param cursor[OUT] the cursor (see locate())
+ * @param parentPid[OUT] the parent of the leaf (-1 if not known)
+ * @return 0 if searchKey is found. Othewise an error code
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::locateTuple(const KeyType& searchKey, IndexCursor& cursor, PageId& parentPid)
+{
+	RC rc;
+	PageId path[MAX_HEIGHT];
+	int height;
+
+	cursor.pid = -1;
+	cursor.eid = 0;
+	cursor.ppid = -1;
+	cursor.peid = 0;
+	cursor.last.pid = -1;
+	cursor.last.sid = 0;
+	cursor.unread = false;
+	parentPid = -1;
+
+	pthread_rwlock_rdlock(&rootLatch);
+	height = treeHeight;
+	pthread_rwlock_unlock(&rootLatch);
+	if (height == 0)
+		return RC_NO_SUCH_RECORD;
+
+	rc = descend(searchKey, 0, path, height);
+	if (rc < 0)
+		return rc;
+
+	if (height > 1)
+		parentPid = path[1];
+
+	BTTupleNodeT<KeyType> ln;
+	cursor.pid = path[0];
+	rc = ln.read(cursor.pid, pf);
+	if (rc < 0)
+		return rc;
+	rc = ln.locate(searchKey, cursor.eid);
+
+	// searchKey may have moved on to a right sibling in a split since
+	// the descent
+	while (rc != 0 && cursor.eid == ln.getKeyCount()) {
+		KeyType k;
+		BTTupleNodeT<KeyType> nl;
+		PageId next = ln.getNextNodePtr();
+		if (next < 0)
+			break;
+		if ((rc = nl.read(next, pf)) < 0)
+			return rc;
+		if (nl.readKey(0, k) == 0 && searchKey < k) {
+			rc = RC_NO_SUCH_RECORD;
+			break;
+		}
+		cursor.pid = next;
+		ln = nl;
+		rc = ln.locate(searchKey, cursor.eid);
+	}
+
+	// the descent reaches the last leaf a run of searchKey is in, so go
+	// back while the leaf in front ends with searchKey
+	while (rc == 0 && cursor.eid == 0) {
+		KeyType k;
+		PageId pid = cursor.pid;
+		BTTupleNodeT<KeyType> pl = ln;
+		RC prc = readPrevLeaf(pid, pl);
+		if (prc < 0)
+			return prc;
+		if (pid < 0 || pl.readKey(pl.getKeyCount() - 1, k) < 0 || !(k == searchKey))
+			break;
+
+		cursor.pid = pid;
+		ln = pl;
+		ln.locate(searchKey, cursor.eid);
+		parentPid = -1;
+	}
+
+	return rc;
+}
+
+/*
+ * Locate many keys at once, and again whenever the buffered pairs one
+ * of the cursors would have passed had to go into the leaves.
+ * @param keys[IN] the keys to find
+ * @param cursors[OUT] the cursor of every key (see locate())
+ * @param rcs[OUT] what locate() returns for every key
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::locateMany(const std::vector<KeyType>& keys, std::vector<IndexCursor>& cursors, std::vector<RC>& rcs)
+{
+	RC rc;
+	bool flushed;
+
+	do {
+		if ((rc = locateBatch(keys, cursors, rcs)) < 0)
+			return rc;
+		flushed = false;
+		for (size_t i = 0; i < keys.size() && !flushed; i++)
+			if ((rc = flushLocated(keys[i], cursors[i], flushed)) < 0)
+				return rc;
+	} while (flushed);
+
+	return 0;
+}
+
+/*
+ * Locate many keys at once, continuing every lookup from the lowest node
+ * read so far that covers its key.
+ * @param keys[IN] the keys to find
+ * @param cursors[OUT] the cursor of every key (see locate())
+ * @param rcs[OUT] what locate() returns for every key
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::locateBatch(const std::vector<KeyType>& keys, std::vector<IndexCursor>& cursors, std::vector<RC>& rcs)
+{
+	RC rc;
+	PageId root;
+	int height;
+
+	cursors.resize(keys.size());
+	rcs.assign(keys.size(), RC_NO_SUCH_RECORD);
+	for (size_t i = 0; i < keys.size(); i++) {
+		cursors[i].pid = -1;
+		cursors[i].eid = 0;
+		cursors[i].ppid = -1;
+		cursors[i].peid = 0;
+		cursors[i].last.pid = -1;
+		cursors[i].last.sid = 0;
+		cursors[i].unread = false;
+	}
+
+	pthread_rwlock_rdlock(&rootLatch);
+	root = rootPid;
+	height = treeHeight;
+	pthread_rwlock_unlock(&rootLatch);
+	if (height == 0)
+		return 0;
+	if (height > MAX_HEIGHT)
+		return RC_INVALID_FILE_FORMAT;
+
+	// the node last read on every level, which covers the keys with
+	// lo <= key < hi (a missing bound is open)
+	std::vector<BTNonLeafNodeT<KeyType> > nodes(height);
+	BTLeafNodeT<KeyType> ln;
+	PageId pids[MAX_HEIGHT];
+	KeyType lo[MAX_HEIGHT], hi[MAX_HEIGHT];
+	bool hasLo[MAX_HEIGHT], hasHi[MAX_HEIGHT], valid[MAX_HEIGHT];
+	PageId prefetched = -1;   // the parent whose leaves were read ahead
+	for (int l = 0; l < height; l++)
+		valid[l] = false;
+
+	for (size_t i = 0; i < keys.size(); i++) {
+		const KeyType& key = keys[i];
+
+		int l = 0;
+		while (l < height && !(valid[l] && (!hasLo[l] || !(key < lo[l])) && (!hasHi[l] || key < hi[l])))
+			l++;
+
+		// the root covers every key
+		if (l == height) {
+			l = height - 1;
+			pids[l] = root;
+			hasLo[l] = hasHi[l] = false;
+			rc = (l > 0) ? readNonLeaf(root, nodes[l]) : ln.read(root, pf);
+			if (rc < 0)
+				return rc;
+			valid[l] = true;
+		}
+
+		for (; l > 0; l--) {
+			BTNonLeafNodeT<KeyType>& node = nodes[l];
+			PageId child;
+			node.locateChildPtr(key, child);
+			int c = node.getChildIndex(child);
+
+			pids[l - 1] = child;
+			hasLo[l - 1] = (c > 0) || hasLo[l];
+			if (c > 0)
+				node.readNLEntry(c - 1, lo[l - 1]);
+			else if (hasLo[l])
+				lo[l - 1] = lo[l];
+			hasHi[l - 1] = (c < node.getKeyCount()) || hasHi[l];
+			if (c < node.getKeyCount())
+				node.readNLEntry(c, hi[l - 1]);
+			else if (hasHi[l])
+				hi[l - 1] = hi[l];
+
+			if (l == 1) {
+				if (pids[1] != prefetched) {
+					prefetchLeaves(node, keys, i, hasHi[1] ? &hi[1] : NULL);
+					prefetched = pids[1];
+				}
+				rc = ln.read(child, pf);
+			}
+			else
+				rc = readNonLeaf(child, nodes[l - 1]);
+			if (rc < 0)
+				return rc;
+			valid[l - 1] = true;
+		}
+
+		// key may have moved on to a right sibling in a split since the
+		// leaf was reached; the leaf read then no longer has known bounds
+		IndexCursor& cursor = cursors[i];
+		cursor.pid = pids[0];
+		rc = ln.locate(key, cursor.eid);
+		while (rc != 0 && cursor.eid == ln.getKeyCount()) {
+			KeyType k;
+			RecordId r;
+			BTLeafNodeT<KeyType> nl;
+			PageId next = ln.getNextNodePtr();
+			if (next < 0)
+				break;
+			if ((rc = nl.read(next, pf)) < 0)
+				return rc;
+			if (nl.readLEntry(0, k, r) == 0 && key < k) {
+				rc = RC_NO_SUCH_RECORD;
+				setUnread(cursor, nl, 0);
+				break;
+			}
+			cursor.pid = pids[0] = next;
+			ln = nl;
+			valid[0] = false;
+			rc = ln.locate(key, cursor.eid);
+		}
+		setUnread(cursor, ln, cursor.eid);
+		rcs[i] = rc;
+	}
+
+	return 0;
+}
+
+/*
+ * Read ahead the leaves under node that the keys from keys[from] on
+ * land in, up to the first key >= hi or out of order. Runs of
+ * consecutive PageIds are requested at once, and a single leaf is left
+ * to the read that follows.
+ * @param node[IN] the parent of the leaves
+ * @param keys[IN] the keys of locateMany()
+ * @param from[IN] the first key under node
+ * @param hi[IN] the first key behind node (NULL for none)
+ */
+template <class KeyType>
+void BTreeIndexT<KeyType>::prefetchLeaves(BTNonLeafNodeT<KeyType>& node, const std::vector<KeyType>& keys, size_t from, const KeyType* hi)
+{
+	PageId first = -1;
+	PageId last = -1;
+	PageId pid;
+	int leaves = 0;
+
+	for (size_t i = from; i < keys.size() && (hi == NULL || keys[i] < *hi); i++) {
+		if (i > from && keys[i] < keys[i - 1])
+			break;
+		node.locateChildPtr(keys[i], pid);
+		if (pid == last)
+			continue;
+		leaves++;
+		if (first >= 0 && pid != last + 1) {
+			pf.prefetch(first, last - first + 1);
+			first = pid;
+		}
+		else if (first < 0)
+			first = pid;
+		last = pid;
+	}
+
+	if (leaves > 1)
+		pf.prefetch(first, last - first + 1);
+}
+
+/*
+ * Read the (key, rid) pair at the location specified by the index cursor,
+ * and move foward the cursor to the next entry.
+ * @param cursor[IN/OUT] the cursor pointing to an leaf-node index entry in the b+tree
+ * @param key[OUT] the key stored at the index cursor location.
+ * @param rid[OUT] the RecordId stored at the index cursor location.
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::readForward(IndexCursor& cursor, KeyType& key, RecordId& rid)
+{
+    if (cursor.pid < 0)
+    	return RC_END_OF_TREE;
+    if (cursor.pid >= pf.endPid())
+    	return RC_INVALID_CURSOR;
+
+    BTLeafNodeT<KeyType> ln;
+    IndexCursor start = cursor;
+    RC rc;
+
+    if((rc = ln.read(cursor.pid, pf)) != 0)
+    	return rc;
+
+    // Inserts since the last call may have shifted the entry read last
+    // to the right, or a split moved it to a right sibling. It is found
+    // again by its RecordId, so that no entry is returned twice. So is
+    // the entry a lookup found, so that no smaller key is returned first.
+    if(cursor.last.pid >= 0)
+    {
+    	PageId pid = cursor.pid;
+    	int at = (cursor.ppid >= 0 || cursor.unread) ? 0 : 1;
+    	int eid = cursor.eid - at;
+    	rc = seekEntry(pid, ln, eid, cursor.last, cursor.lastNext);
+    	if(rc == RC_INVALID_CURSOR && cursor.ppid < 0)
+    	{
+    		// an insert moved its run of equal keys into a posting list;
+    		// the rest of the list follows the entry
+    		pid = cursor.pid;
+    		if((rc = ln.read(pid, pf)) != 0)
+    			return rc;
+    		if((rc = seekPosting(pid, ln, eid, cursor.last, cursor.lastNext, cursor.ppid, cursor.peid)) < 0)
+    			return rc;
+    		KeyType k;
+    		if((rc = ln.readLEntry(eid, k, cursor.last)) != 0)
+    			return rc;
+    		cursor.lastNext = ln.getNextNodePtr();
+
+    		// an entry not read yet is read from its place in the list
+    		BTPostingNode pn;
+    		if((rc = pn.read(cursor.ppid, pf)) != 0)
+    			return rc;
+    		if(!cursor.unread && ++cursor.peid == pn.getRidCount())
+    		{
+    			cursor.ppid = pn.getNextNodePtr();
+    			cursor.peid = 0;
+    		}
+    		at = (cursor.ppid >= 0) ? 0 : 1;
+    	}
+    	else if(rc < 0)
+    		return rc;
+    	cursor.pid = pid;
+    	cursor.eid = eid + at;
+    }
+
+    // the buffered pairs between the entry read last and the next one
+    // go into the leaves before the next one is read
+    KeyType lo;
+    RecordId r;
+    bool check = (cursor.last.pid >= 0 && !cursor.unread && cursor.ppid < 0 &&
+                  __atomic_load_n(&bufferedCount, __ATOMIC_ACQUIRE) > 0 &&
+                  ln.readLEntry(cursor.eid - 1, lo, r) == 0);
+
+    // locate() may leave the cursor just past the last entry of a leaf,
+    // and so does every read of the last entry of a leaf
+    while(cursor.eid >= ln.getKeyCount())
+    {
+    	cursor.pid = ln.getNextNodePtr();
+    	cursor.eid = 0;
+    	if (cursor.pid < 0)
+    		return RC_END_OF_TREE;
+    	if((rc = ln.read(cursor.pid, pf)) != 0)
+    		return rc;
+    }
+
+    if((rc = ln.readLEntry(cursor.eid, key, rid)) != 0)
+    	return rc;
+    if(check)
+    {
+    	bool flushed;
+    	if((rc = flushRange(&lo, &key, flushed)) < 0)
+    		return rc;
+    	if(flushed)
+    	{
+    		cursor = start;
+    		return readForward(cursor, key, rid);
+    	}
+    }
+    cursor.last = rid;
+    cursor.lastNext = ln.getNextNodePtr();
+    cursor.unread = false;
+
+    // a posting list is read to its end before the cursor leaves the entry
+    if(isPostingRid(rid))
+    {
+    	if(cursor.ppid < 0)
+    	{
+    		cursor.ppid = rid.pid;
+    		cursor.peid = 0;
+    	}
+
+    	BTPostingNode pn;
+    	if((rc = pn.read(cursor.ppid, pf)) != 0)
+    		return rc;
+    	if((rc = pn.readEntry(cursor.peid, rid)) != 0)
+    		return rc;
+
+    	if(++cursor.peid < pn.getRidCount())
+    		return 0;
+    	cursor.ppid = pn.getNextNodePtr();
+    	cursor.peid = 0;
+    	if(cursor.ppid >= 0)
+    		return 0;
+    }
+
+    // the cursor stays in the leaf, so that the next call can find the
+    // entry again if the leaf splits meanwhile
+    cursor.eid++;
+
+    return 0;
+
+}
+
+/*
+ * Set the cursor to the last entry with a key <= searchKey.
+ * @param searchKey[IN] the largest key to return
+ * @param cursor[OUT] the cursor pointing to the entry
+ * @return 0 if searchKey is found. RC_NO_SUCH_RECORD if the cursor
+ *         points to a smaller key (or to nothing). Otherwise an error code
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::locateBackward(const KeyType& searchKey, IndexCursor& cursor)
+{
+	RC rc = locate(searchKey, cursor);
+	if (rc < 0 && rc != RC_NO_SUCH_RECORD)
+		return rc;
+	if (cursor.pid < 0)
+		return RC_NO_SUCH_RECORD;
+
+	BTLeafNodeT<KeyType> ln;
+	KeyType k;
+	RecordId r;
+	bool found = (rc == 0);
+	bool buffered = (__atomic_load_n(&bufferedCount, __ATOMIC_ACQUIRE) > 0);
+	if ((found || buffered) && (rc = ln.read(cursor.pid, pf)) < 0)
+		return rc;
+
+	// the entry before the first larger key; an eid of -1 leaves it to
+	// readBackward() to move to the previous leaf. Otherwise a run of
+	// equal keys never spans two leaves
+	if (!found)
+		cursor.eid--;
+	else
+		while (ln.readLEntry(cursor.eid + 1, k, r) == 0 && k == searchKey)
+			cursor.eid++;
+	cursor.last.pid = -1;
+	cursor.unread = false;
+	if (found || cursor.eid >= 0) {
+		if (!found && !buffered && (rc = ln.read(cursor.pid, pf)) < 0)
+			return rc;
+		setUnread(cursor, ln, cursor.eid);
+	}
+
+	// the buffered pairs between the entry and searchKey come behind it
+	bool flushed;
+	if (buffered) {
+		PageId pid = cursor.pid;
+		if (cursor.eid >= 0)
+			rc = ln.readLEntry(cursor.eid, k, r);
+		else if ((rc = readPrevLeaf(pid, ln)) == 0 && pid >= 0)
+			rc = ln.readLEntry(ln.getKeyCount() - 1, k, r);
+		if (rc < 0)
+			return rc;
+		if ((rc = flushRange((pid >= 0) ? &k : NULL, &searchKey, flushed)) < 0)
+			return rc;
+		if (flushed)
+			return locateBackward(searchKey, cursor);
+	}
+
+	return found ? 0 : RC_NO_SUCH_RECORD;
+}
+
+/*
+ * Set the cursor to the last entry of the index.
+ * @param cursor[OUT] the cursor pointing to the entry
+ * @return error code. 0 if no error, RC_NO_SUCH_RECORD if the index is
+ *         empty
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::locateLast(IndexCursor& cursor)
+{
+	RC rc;
+	PageId pid;
+	int height;
+	bool flushed;
+
+	cursor.pid = -1;
+	cursor.eid = 0;
+	cursor.ppid = -1;
+	cursor.peid = 0;
+	cursor.last.pid = -1;
+	cursor.last.sid = 0;
+	cursor.unread = false;
+
+	pthread_rwlock_rdlock(&rootLatch);
+	pid = rootPid;
+	height = treeHeight;
+	pthread_rwlock_unlock(&rootLatch);
+	if (height == 0)
+		return RC_NO_SUCH_RECORD;
+
+	// take the last child on every level, after moving right past the
+	// nodes that split during the descent
+	BTNonLeafNodeT<KeyType> node;
+	for (int l = height - 1; l > 0; l--) {
+		if ((rc = readNonLeaf(pid, node)) < 0)
+			return rc;
+		while (node.getNextNodePtr() >= 0) {
+			pid = node.getNextNodePtr();
+			if ((rc = readNonLeaf(pid, node)) < 0)
+				return rc;
+		}
+		if ((rc = node.readChildPtr(node.getKeyCount(), pid)) < 0)
+			return rc;
+	}
+
+	BTLeafNodeT<KeyType> ln;
+	if ((rc = ln.read(pid, pf)) < 0)
+		return rc;
+	while (ln.getNextNodePtr() >= 0) {
+		pid = ln.getNextNodePtr();
+		if ((rc = ln.read(pid, pf)) < 0)
+			return rc;
+	}
+
+	cursor.pid = pid;
+	cursor.eid = ln.getKeyCount() - 1;
+
+	// the buffered pairs from the last key on come behind it
+	KeyType k;
+	RecordId r;
+	if (ln.readLEntry(cursor.eid, k, r) == 0)
+		rc = flushRange(&k, NULL, flushed);
+	else
+		rc = flushRange(NULL, NULL, flushed);
+	if (rc < 0)
+		return rc;
+	if (flushed)
+		return locateLast(cursor);
+	return 0;
+}
+
+/*
+ * Read the (key, rid) pair at the location specified by the index cursor,
+ * and move the cursor back to the previous entry.
+ * @param cursor[IN/OUT] the cursor pointing to an leaf-node index entry in the b+tree
+ * @param key[OUT] the key stored at the index cursor location
+ * @param rid[OUT] the RecordId stored at the index cursor location
+ * @return error code. 0 if no error, RC_END_OF_TREE before the first entry
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::readBackward(IndexCursor& cursor, KeyType& key, RecordId& rid)
+{
+	RC rc;
+	BTLeafNodeT<KeyType> ln;
+	IndexCursor start = cursor;
+
+	if (cursor.pid < 0)
+		return RC_END_OF_TREE;
+	if (cursor.pid >= pf.endPid())
+		return RC_INVALID_CURSOR;
+	if ((rc = ln.read(cursor.pid, pf)) < 0)
+		return rc;
+
+	// Inserts since the last call may have shifted the entry read last
+	// to the right, or a split moved it to a right sibling. It is found
+	// again by its RecordId, so that no entry in front of it is skipped.
+	if (cursor.last.pid >= 0) {
+		PageId pid = cursor.pid;
+		int at = (cursor.ppid >= 0 || cursor.unread) ? 0 : 1;
+		int eid = cursor.eid + at;
+		rc = seekEntry(pid, ln, eid, cursor.last, cursor.lastNext);
+		if (rc == 0) {
+			cursor.pid = pid;
+			cursor.eid = eid - at;
+		}
+		else if (rc != RC_INVALID_CURSOR || !cursor.unread)
+			return rc;
+		else {
+			// the entry the lookup found went into a posting list; the
+			// cursor reads from where the lookup left it
+			cursor.last.pid = -1;
+			cursor.unread = false;
+			if ((rc = ln.read(cursor.pid, pf)) < 0)
+				return rc;
+		}
+	}
+
+	// the buffered pairs between the next entry and the entry read last
+	// go into the leaves before the next one is read
+	KeyType hi;
+	RecordId r;
+	bool check = (cursor.last.pid >= 0 && !cursor.unread && cursor.ppid < 0 &&
+	              __atomic_load_n(&bufferedCount, __ATOMIC_ACQUIRE) > 0 &&
+	              ln.readLEntry(cursor.eid + 1, hi, r) == 0);
+
+	// a cursor in front of the first entry of its leaf moves to the last
+	// entry of the previous leaf
+	while (cursor.eid < 0) {
+		if ((rc = readPrevLeaf(cursor.pid, ln)) < 0)
+			return rc;
+		if (cursor.pid < 0)
+			return RC_END_OF_TREE;
+		cursor.eid = ln.getKeyCount() - 1;
+	}
+
+	if ((rc = ln.readLEntry(cursor.eid, key, rid)) < 0)
+		return rc;
+	if (check) {
+		bool flushed;
+		if ((rc = flushRange(&key, &hi, flushed)) < 0)
+			return rc;
+		if (flushed) {
+			cursor = start;
+			return readBackward(cursor, key, rid);
+		}
+	}
+	cursor.last = rid;
+	cursor.lastNext = ln.getNextNodePtr();
+	cursor.unread = false;
+
+	// a posting list is read to its end (in list order) before the
+	// cursor leaves the entry
+	if (isPostingRid(rid)) {
+		if (cursor.ppid < 0) {
+			cursor.ppid = rid.pid;
+			cursor.peid = 0;
+		}
+
+		BTPostingNode pn;
+		if ((rc = pn.read(cursor.ppid, pf)) < 0)
+			return rc;
+		if ((rc = pn.readEntry(cursor.peid, rid)) < 0)
+			return rc;
+
+		if (++cursor.peid < pn.getRidCount())
+			return 0;
+		cursor.ppid = pn.getNextNodePtr();
+		cursor.peid = 0;
+		if (cursor.ppid >= 0)
+			return 0;
+	}
+
+	cursor.eid--;
+	return 0;
+}
+
+/*
+ * Find the leaf entry with the RecordId rid, last seen at entry eid of
+ * the leaf ln at pid, in that leaf or the right siblings split off it.
+ * @param pid[IN/OUT] the PageId of the leaf holding the entry
+ * @param ln[IN/OUT] the leaf holding the entry
+ * @param eid[IN/OUT] the entry number of the entry
+ * @param rid[IN] the RecordId of the entry
+ * @param end[IN] the leaf the entry cannot be in (-1 for none)
+ * @return error code. 0 if no error, RC_INVALID_CURSOR if there is no
+ *         such entry
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::seekEntry(PageId& pid, BTLeafNodeT<KeyType>& ln, int& eid, const RecordId& rid, PageId end)
+{
+	RC rc;
+	KeyType k;
+	RecordId r;
+
+	// the entry is usually still at eid; inserts shift it to the right,
+	// and a run of equal keys in front of it that becomes a posting list
+	// shifts it to the left
+	if (ln.readLEntry(eid, k, r) == 0 && r.pid == rid.pid && r.sid == rid.sid)
+		return 0;
+
+	for (;;) {
+		for (eid = 0; ln.readLEntry(eid, k, r) == 0; eid++)
+			if (r.pid == rid.pid && r.sid == rid.sid)
+				return 0;
+
+		pid = ln.getNextNodePtr();
+		if (pid < 0 || pid == end)
+			return RC_INVALID_CURSOR;
+		if ((rc = ln.read(pid, pf)) < 0)
+			return rc;
+	}
+}
+
+/*
+ * Find the posting list that holds the RecordId rid in the leaf ln at
+ * pid or in its right siblings up to end.
+ * @param pid[IN/OUT] the PageId of the leaf holding the list
+ * @param ln[IN/OUT] the leaf holding the list
+ * @param eid[OUT] the entry number of the list
+ * @param rid[IN] the RecordId to find
+ * @param end[IN] the leaf the list cannot be in (-1 for none)
+ * @param ppid[OUT] the posting page holding rid
+ * @param peid[OUT] the entry number of rid in the posting page
+ * @return error code. 0 if no error, RC_INVALID_CURSOR if there is no
+ *         such list
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::seekPosting(PageId& pid, BTLeafNodeT<KeyType>& ln, int& eid, const RecordId& rid, PageId end, PageId& ppid, int& peid)
+{
+	RC rc;
+	KeyType k;
+	RecordId r;
+	BTPostingNode pn;
+	const RecordId* rids;
+
+	for (;;) {
+		for (eid = 0; ln.readLEntry(eid, k, r) == 0; eid++) {
+			if (!isPostingRid(r))
+				continue;
+			for (ppid = r.pid; ppid >= 0; ppid = pn.getNextNodePtr()) {
+				if ((rc = pn.read(ppid, pf)) < 0)
+					return rc;
+				int n = pn.readEntries(rids);
+				for (peid = 0; peid < n; peid++)
+					if (rids[peid].pid == rid.pid && rids[peid].sid == rid.sid)
+						return 0;
+			}
+		}
+
+		pid = ln.getNextNodePtr();
+		if (pid < 0 || pid == end)
+			return RC_INVALID_CURSOR;
+		if ((rc = ln.read(pid, pf)) < 0)
+			return rc;
+	}
+}
+
+/*
+ * Move from the leaf ln at pid to its left sibling. A left link that
+ * was read before a split finished points in front of the new sibling,
+ * so the right links are followed from there until they lead back to pid.
+ * @param pid[IN/OUT] the PageId of the leaf; -1 if it was the first leaf
+ * @param ln[IN/OUT] the leaf
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+template <class LeafNode>
+RC BTreeIndexT<KeyType>::readPrevLeaf(PageId& pid, LeafNode& ln)
+{
+	RC rc;
+	PageId cur = pid;
+
+	pid = ln.getPrevNodePtr();
+	if (pid < 0)
+		return 0;
+	if ((rc = ln.read(pid, pf)) < 0)
+		return rc;
+	while (ln.getNextNodePtr() != cur) {
+		pid = ln.getNextNodePtr();
+		if (pid < 0)
+			return RC_INVALID_FILE_FORMAT;
+		if ((rc = ln.read(pid, pf)) < 0)
+			return rc;
+	}
+
+	return 0;
+}
+
+/*
+ * Set up a batched cursor at the first entry with a key >= searchKey.
+ * @param searchKey[IN] the key to start from
+ * @param cursor[OUT] the cursor
+ * @return 0 if searchKey is found. RC_NO_SUCH_RECORD if the cursor
+ *         starts at a larger key. Otherwise an error code
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::openCursor(const KeyType& searchKey, BTreeCursorT<KeyType>& cursor)
+{
+	RC rc;
+	bool flushed;
+
+	cursor.index = this;
+	cursor.pf = &pf;
+	cursor.leafPid = -1;
+	cursor.ahead.clear();
+	cursor.aheadPos = 0;
+	cursor.prefetched = 0;
+	if (clustered)
+		return locateTuple(searchKey, cursor.pos, cursor.nextParent);
+	// the scan may read every key from searchKey on
+	if ((rc = flushRange(&searchKey, NULL, flushed)) < 0)
+		return rc;
+	return locate(searchKey, cursor.pos, cursor.nextParent);
+}
+
+template <class KeyType>
+BTreeCursorT<KeyType>::BTreeCursorT()
+{
+	index = NULL;
+	pf = NULL;
+	pos.pid = -1;
+	pos.eid = 0;
+	pos.ppid = -1;
+	pos.peid = 0;
+	pos.last.pid = -1;
+	pos.last.sid = 0;
+	pos.unread = false;
+	leafPid = -1;
+	prefetchLeaves = 0;
+	prefetchRf = NULL;
+	aheadPos = 0;
+	prefetched = 0;
+	nextParent = -1;
+}
+
+/*
+ * Read ahead the next leaves and the record pages of every new leaf.
+ * @param leaves[IN] how many leaves to read ahead (0 to turn it off)
+ * @param rf[IN] the RecordFile the RecordIds point into (NULL for none)
+ */
+template <class KeyType>
+void BTreeCursorT<KeyType>::setPrefetch(int leaves, const RecordFile* rf)
+{
+	prefetchLeaves = (leaves > 0) ? leaves : 0;
+	prefetchRf = rf;
+}
+
+/*
+ * Read ahead after the cursor moved to the leaf leafPid.
+ * The leaves behind it are queued in ahead from the children of its
+ * parent and of the parent's right siblings. When the leaf is not the
+ * next one in the queue (a split since the queue was filled), the queue
+ * falls back to the leaf chain and holds only the next leaf.
+ */
+template <class KeyType>
+void BTreeCursorT<KeyType>::prefetch()
+{
+	const KeyType* k;
+	const RecordId* r;
+
+	if (prefetchLeaves > 0) {
+		size_t i = aheadPos;
+		while (i < ahead.size() && ahead[i] != leafPid)
+			i++;
+
+		if (i < ahead.size())
+			aheadPos = i + 1;
+		else if (!ahead.empty() || nextParent < 0) {
+			ahead.clear();
+			aheadPos = prefetched = 0;
+			nextParent = -1;
+			PageId next = index->clustered ? tuples.getNextNodePtr() : leaf.getNextNodePtr();
+			if (next >= 0)
+				ahead.push_back(next);
+		}
+
+		// take more leaves from the next parent when the queue runs short;
+		// the first parent only contributes the leaves after leafPid
+		BTNonLeafNodeT<KeyType> node;
+		while (ahead.size() - aheadPos < (size_t) prefetchLeaves && nextParent >= 0) {
+			if (index->readNonLeaf(nextParent, node) < 0) {
+				nextParent = -1;
+				break;
+			}
+			ahead.erase(ahead.begin(), ahead.begin() + aheadPos);
+			prefetched -= (prefetched < aheadPos) ? prefetched : aheadPos;
+			aheadPos = 0;
+
+			int c = node.getChildIndex(leafPid) + 1;
+			PageId child;
+			while (node.readChildPtr(c++, child) == 0)
+				ahead.push_back(child);
+			nextParent = node.getNextNodePtr();
+		}
+
+		if (prefetched < aheadPos)
+			prefetched = aheadPos;
+		for (; prefetched < ahead.size() && prefetched < aheadPos + prefetchLeaves; prefetched++)
+			pf->prefetch(ahead[prefetched]);
+	}
+
+	// the tuples of a clustered index are in the leaf itself
+	if (index->clustered)
+		return;
+
+	// the posting lists of the leaf are read ahead with its records
+	int count = leaf.readLEntries(pos.eid, k, r);
+	for (int i = 0; i < count; i++)
+		if (isPostingRid(r[i]))
+			pf->prefetch(r[i].pid);
+	prefetchRecords(r, count);
+}
+
+/*
+ * Read ahead the record pages of rids (and nothing for posting list
+ * entries). Consecutive RecordIds on the same page are requested once.
+ * @param rids[IN] the RecordIds
+ * @param n[IN] the number of RecordIds
+ */
+template <class KeyType>
+void BTreeCursorT<KeyType>::prefetchRecords(const RecordId* rids, int n)
+{
+	if (prefetchRf == NULL)
+		return;
+
+	PageId last = -1;
+	for (int i = 0; i < n; i++) {
+		if (isPostingRid(rids[i]) || rids[i].pid == last)
+			continue;
+		last = rids[i].pid;
+		prefetchRf->prefetch(rids[i]);
+	}
+}
+
+/*
+ * Return the next batch of (key, rid) pairs in key order.
+ * @param keys[OUT] the keys of the batch
+ * @param rids[OUT] the RecordIds of the batch
+ * @param n[OUT] the number of pairs in the batch
+ * @return error code. 0 if no error, RC_END_OF_TREE after the last entry
+ */
+template <class KeyType>
+RC BTreeCursorT<KeyType>::next(const KeyType*& keys, const RecordId*& rids, int& n)
+{
+	RC rc;
+	const KeyType* k;
+	const RecordId* r;
+
+	for (;;) {
+		if (pos.pid < 0)
+			return RC_END_OF_TREE;
+
+		// the page file is only touched when the scan reaches a new leaf
+		if (leafPid != pos.pid) {
+			if ((rc = leaf.read(pos.pid, *pf)) < 0)
+				return rc;
+			leafPid = pos.pid;
+			if (prefetchLeaves > 0 || prefetchRf != NULL)
+				prefetch();
+		}
+
+		int count = leaf.readLEntries(pos.eid, k, r);
+		if (count == 0) {
+			pos.pid = leaf.getNextNodePtr();
+			pos.eid = 0;
+			continue;
+		}
+
+		// a posting list is returned a page at a time
+		if (isPostingRid(r[0])) {
+			if (pos.ppid < 0)
+				pos.ppid = r[0].pid;
+			if ((rc = posting.read(pos.ppid, *pf)) < 0)
+				return rc;
+
+			n = posting.readEntries(rids);
+			for (int i = 0; i < n; i++)
+				postingKeys[i] = k[0];
+			keys = postingKeys;
+
+			pos.ppid = posting.getNextNodePtr();
+			if (prefetchRf != NULL) {
+				pf->prefetch(pos.ppid);
+				prefetchRecords(rids, n);
+			}
+			if (pos.ppid < 0)
+				pos.eid++;
+			return 0;
+		}
+
+		// otherwise every entry up to the next posting list
+		n = 1;
+		while (n < count && !isPostingRid(r[n]))
+			n++;
+		keys = k;
+		rids = r;
+		pos.eid += n;
+		return 0;
+	}
+}
+
+/*
+ * Return the next tuple of a clustered index in key order.
+ * @param key[OUT] the key of the tuple
+ * @param value[OUT] the value of the tuple
+ * @return error code. 0 if no error, RC_END_OF_TREE after the last tuple
+ */
+template <class KeyType>
+RC BTreeCursorT<KeyType>::nextTuple(KeyType& key, string& value)
+{
+	RC rc;
+
+	for (;;) {
+		if (pos.pid < 0)
+			return RC_END_OF_TREE;
+
+		if (leafPid != pos.pid) {
+			if ((rc = tuples.read(pos.pid, *pf)) < 0)
+				return rc;
+			leafPid = pos.pid;
+			if (prefetchLeaves > 0)
+				prefetch();
+		}
+
+		if (tuples.readTuple(pos.eid, key, value) == 0) {
+			pos.eid++;
+			return 0;
+		}
+		pos.pid = tuples.getNextNodePtr();
+		pos.eid = 0;
+	}
+}
+
+/*
+ * Store the leaf nodes of the index in the compressed format.
+ * @param compressed[IN] true to compress the leaf nodes
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::setCompressedLeaves(bool compressed)
+{
+	if (treeHeight != 0 && compressed != compressedLeaves)
+		return RC_INVALID_ATTRIBUTE;
+	if (compressed && (clustered || !KeyTraits<KeyType>::packable))
+		return RC_INVALID_ATTRIBUTE;
+
+	compressedLeaves = compressed;
+	return 0;
+}
+
+/*
+ * Keep the number of rows under every child in the non-leaf nodes.
+ * @param counted[IN] true to count the rows under every child
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::setCountedNodes(bool counted)
+{
+	if (treeHeight != 0 && counted != this->counted)
+		return RC_INVALID_ATTRIBUTE;
+	if (counted && clustered)
+		return RC_INVALID_ATTRIBUTE;
+
+	this->counted = counted;
+	return 0;
+}
+
+/*
+ * Store whole (key, value) tuples in the leaves of the index.
+ * @param clustered[IN] true to store the tuples in the leaves
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::setClustered(bool clustered)
+{
+	if (treeHeight != 0 && clustered != this->clustered)
+		return RC_INVALID_ATTRIBUTE;
+	if (clustered && (compressedLeaves || counted))
+		return RC_INVALID_ATTRIBUTE;
+
+	this->clustered = clustered;
+	return 0;
+}
+
+/*
+ * Return true if the leaves of the index hold the tuples.
+ */
+template <class KeyType>
+bool BTreeIndexT<KeyType>::isClustered()
+{
+	return clustered;
+}
+
+/*
+ * Count the entries with a key smaller than key (or equal to it).
+ * Every child left of the descent adds its count from the parent; in
+ * the leaf the rows are counted on the side of key with fewer posting
+ * lists, since the first page of each has to be read.
+ * @param key[IN] the key
+ * @param inclusive[IN] true to count the entries equal to key as well
+ * @param count[OUT] the number of entries
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::countLess(const KeyType& key, bool inclusive, int& count)
+{
+	RC rc;
+	BTNonLeafNodeT<KeyType> node;
+	PageId pid = rootPid;
+	int below = -1;   // the rows under pid (-1 if not known)
+	int c;
+
+	count = 0;
+	if (treeHeight == 0)
+		return 0;
+
+	for (int l = treeHeight - 1; l > 0; l--) {
+		if ((rc = readNonLeaf(pid, node)) < 0)
+			return rc;
+		node.locateChildPtr(key, pid);
+		int i = node.getChildIndex(pid);
+		for (int j = 0; j < i; j++) {
+			if ((rc = node.readChildCount(j, c)) < 0)
+				return rc;
+			count += c;
+		}
+		node.readChildCount(i, below);
+	}
+
+	BTLeafNodeT<KeyType> ln;
+	if ((rc = ln.read(pid, pf)) < 0)
+		return rc;
+
+	int eid;
+	KeyType k;
+	RecordId r;
+	ln.locate(key, eid);
+	while (inclusive && ln.readLEntry(eid, k, r) == 0 && k == key)
+		eid++;
+
+	int n = ln.getKeyCount();
+	int before = 0, after = 0;
+	for (int i = 0; i < n; i++) {
+		ln.readLEntry(i, k, r);
+		if (!isPostingRid(r))
+			continue;
+		if (i < eid)
+			before++;
+		else
+			after++;
+	}
+
+	if (below >= 0 && after < before) {
+		if ((rc = leafRows(ln, eid, n, c)) < 0)
+			return rc;
+		count += below - c;
+	}
+	else {
+		if ((rc = leafRows(ln, 0, eid, c)) < 0)
+			return rc;
+		count += c;
+	}
+
+	return 0;
+}
+
+/*
+ * Count the entries with lo <= key <= hi in a counted index.
+ * @param lo[IN] the smallest key to count
+ * @param hi[IN] the largest key to count
+ * @param count[OUT] the number of entries
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::countRange(const KeyType& lo, const KeyType& hi, int& count)
+{
+	RC rc;
+	int below;
+	bool flushed;
+
+	count = 0;
+	if (!counted)
+		return RC_INVALID_ATTRIBUTE;
+	if (hi < lo)
+		return 0;
+	if ((rc = flushRange(&lo, &hi, flushed)) < 0)
+		return rc;
+
+	pthread_mutex_lock(&countLatch);
+	rc = countLess(hi, true, count);
+	if (rc == 0)
+		rc = countLess(lo, false, below);
+	pthread_mutex_unlock(&countLatch);
+
+	if (rc < 0)
+		return rc;
+	count -= below;
+	return 0;
+}
+
+/*
+ * Return the number of entries with a key smaller than key.
+ * @param key[IN] the key
+ * @param rank[OUT] the number of smaller entries
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::rank(const KeyType& key, int& rank)
+{
+	RC rc;
+	bool flushed;
+
+	rank = 0;
+	if (!counted)
+		return RC_INVALID_ATTRIBUTE;
+	if ((rc = flushRange(NULL, &key, flushed)) < 0)
+		return rc;
+
+	pthread_mutex_lock(&countLatch);
+	rc = countLess(key, false, rank);
+	pthread_mutex_unlock(&countLatch);
+
+	return rc;
+}
+
+/*
+ * Set the cursor to the n-th entry (from 0) in key order in a counted
+ * index. The descent skips the children whose counts add up to less
+ * than n, and a position inside a posting list skips its full pages.
+ * @param n[IN] the position of the entry
+ * @param cursor[OUT] the cursor pointing to the entry
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::locateNth(int n, IndexCursor& cursor)
+{
+	RC rc = RC_NO_SUCH_RECORD;
+	BTNonLeafNodeT<KeyType> node;
+	BTLeafNodeT<KeyType> ln;
+	BTPostingNode page;
+	int nth = n;
+	bool flushed;
+
+	cursor.pid = -1;
+	cursor.eid = 0;
+	cursor.ppid = -1;
+	cursor.peid = 0;
+	cursor.last.pid = -1;
+	cursor.last.sid = 0;
+	cursor.unread = false;
+	if (!counted)
+		return RC_INVALID_ATTRIBUTE;
+	if (n < 0)
+		return RC_NO_SUCH_RECORD;
+	rc = RC_NO_SUCH_RECORD;
+
+	pthread_mutex_lock(&countLatch);
+	PageId pid = rootPid;
+	int l = treeHeight - 1;
+	for (; l > 0; l--) {
+		if ((rc = readNonLeaf(pid, node)) < 0)
+			break;
+
+		int i, c;
+		for (i = 0; node.readChildCount(i, c) == 0 && n >= c; i++)
+			n -= c;
+		if (node.readChildPtr(i, pid) < 0) {
+			rc = RC_NO_SUCH_RECORD;
+			break;
+		}
+	}
+
+	if (l == 0 && (rc = ln.read(pid, pf)) == 0) {
+		KeyType k;
+		RecordId r;
+		rc = RC_NO_SUCH_RECORD;
+		for (int eid = 0; ln.readLEntry(eid, k, r) == 0; eid++) {
+			int rows = 1;
+			if (isPostingRid(r)) {
+				if ((rc = page.read(r.pid, pf)) < 0)
+					break;
+				rows = page.getTotalCount();
+				rc = RC_NO_SUCH_RECORD;
+			}
+			if (n >= rows) {
+				n -= rows;
+				continue;
+			}
+
+			cursor.pid = pid;
+			cursor.eid = eid;
+			rc = 0;
+			if (!isPostingRid(r))
+				break;
+
+			// page holds the first page of the list
+			cursor.ppid = r.pid;
+			while (n >= page.getRidCount()) {
+				n -= page.getRidCount();
+				cursor.ppid = page.getNextNodePtr();
+				if ((rc = page.read(cursor.ppid, pf)) < 0)
+					break;
+			}
+			cursor.peid = n;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&countLatch);
+	if (rc < 0 && rc != RC_NO_SUCH_RECORD)
+		return rc;
+
+	// the buffered pairs up to the entry found count for n; past the last
+	// entry, all of them do
+	RC found = rc;
+	KeyType k;
+	RecordId r;
+	if (found == 0 && ln.readLEntry(cursor.eid, k, r) == 0)
+		rc = flushRange(NULL, &k, flushed);
+	else
+		rc = flushRange(NULL, NULL, flushed);
+	if (rc < 0)
+		return rc;
+	if (flushed)
+		return locateNth(nth, cursor);
+	return found;
+}
+
+/*
+ * Decide how many of the sorted entries from start go into the next
+ * leaf of a bulk load.
+ * @param entries[IN] the sorted leaf entries
+ * @param start[IN] the first entry of the leaf
+ * @param fillFactor[IN] how full to pack the leaf, in percent
+ * @return the number of entries for the leaf
+ */
+template <class KeyType>
+int BTreeIndexT<KeyType>::bulkLeafSize(const vector<pair<KeyType, RecordId> >& entries, size_t start, int fillFactor)
+{
+	size_t left = entries.size() - start;
+
+	// find out how many entries a full page takes (a compressed leaf
+	// takes more or fewer depending on how well the entries pack)
+	BTLeafNodeT<KeyType> ln;
+	ln.setCompressed(compressedLeaves);
+	size_t fit = 0;
+	while (fit < left && ln.insert(entries[start + fit].first, entries[start + fit].second) == 0)
+		fit++;
+
+	// the last leaf takes whatever is left if it fits on the page
+	size_t n = fit;
+	if (fit < left)
+		n = max((size_t) 1, fit * fillFactor / 100);
+
+	// a key must not span two leaves (see BTLeafNodeT::insertAndSplit)
+	size_t m = n;
+	while (m > 0 && m < left && entries[start + m - 1].first == entries[start + m].first)
+		m--;
+	if (m == 0) {
+		m = n;
+		while (m < fit && entries[start + m - 1].first == entries[start + m].first)
+			m++;
+	}
+
+	return (int) m;
+}
+
+/*
+ * Add many (key, RecordId) pairs at once, building an empty index
+ * bottom-up.
+ * @param entries[IN/OUT] the pairs to add (sorted on return)
+ * @param fillFactor[IN] how full to pack each node, in percent (1-100)
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::bulkLoad(vector<pair<KeyType, RecordId> >& entries, int fillFactor)
+{
+	RC rc;
+
+	if (clustered || fillFactor < 1 || fillFactor > 100)
+		return RC_INVALID_ATTRIBUTE;
+
+	// sorting on (key, rid) keeps the duplicates of a key in load order
+	sort(entries.begin(), entries.end());
+
+	if (treeHeight != 0)
+		return insertSorted(entries);
+	if (entries.empty())
+		return 0;
+
+	// Write the posting lists first. A key with more than POSTING_THRESHOLD
+	// entries gets a list and a single leaf entry, like insert() would do.
+	vector<pair<KeyType, RecordId> > leafEntries;
+	vector<int> entryRows;   // the rows of every leaf entry (counted index)
+	vector<RecordId> run;
+	for (size_t i = 0, j; i < entries.size(); i = j) {
+		for (j = i; j < entries.size() && entries[j].first == entries[i].first; j++)
+			;
+
+		if (j - i <= (size_t) POSTING_THRESHOLD) {
+			leafEntries.insert(leafEntries.end(), entries.begin() + i, entries.begin() + j);
+			if (counted)
+				entryRows.insert(entryRows.end(), j - i, 1);
+			continue;
+		}
+
+		run.clear();
+		for (size_t k = i; k < j; k++)
+			run.push_back(entries[k].second);
+
+		RecordId head;
+		head.pid = allocatePages((int) (run.size() - 1) / BTPostingNode::MAX_RIDS + 1);
+		head.sid = POSTING_SID;
+		rc = createPosting(&run[0], (int) run.size(), head.pid);
+		if (rc < 0)
+			return rc;
+		leafEntries.push_back(make_pair(entries[i].first, head));
+		if (counted)
+			entryRows.push_back((int) run.size());
+	}
+
+	// Pack the leaves left to right, on consecutive pages once the free
+	// list is used up, and keep the first key and PageId of every node
+	// for the level above.
+	vector<pair<KeyType, PageId> > level;
+	vector<int> levelRows;   // the rows under every node of level
+	PageId pid = allocatePages(1);
+	for (size_t i = 0; i < leafEntries.size(); ) {
+		int n = bulkLeafSize(leafEntries, i, fillFactor);
+
+		BTLeafNodeT<KeyType> ln;
+		ln.setCompressed(compressedLeaves);
+		for (int k = 0; k < n; k++)
+			if ((rc = ln.insert(leafEntries[i + k].first, leafEntries[i + k].second)) < 0)
+				return rc;
+
+		PageId next = (i + n < leafEntries.size()) ? allocatePages(1) : -1;
+		ln.setNextNodePtr(next);
+		ln.setPrevNodePtr(level.empty() ? -1 : level.back().second);
+		rc = ln.write(pid, pf);
+		if (rc < 0)
+			return rc;
+
+		level.push_back(make_pair(leafEntries[i].first, pid));
+		if (counted) {
+			int rows = 0;
+			for (int k = 0; k < n; k++)
+				rows += entryRows[i + k];
+			levelRows.push_back(rows);
+		}
+		pid = next;
+		i += n;
+	}
+
+	return buildLevels(level, levelRows, fillFactor);
+}
+
+/*
+ * Build the non-leaf levels of a bulk load on top of level.
+ * @param level[IN/OUT] the first key and PageId of every node of the
+ *                      lowest level
+ * @param levelRows[IN/OUT] the rows under every node (counted index)
+ * @param fillFactor[IN] how full to pack each node, in percent
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::buildLevels(vector<pair<KeyType, PageId> >& level, vector<int>& levelRows, int fillFactor)
+{
+	RC rc;
+	PageId pid;
+
+	// Build the non-leaf levels until a single root is left.
+	// A node holds fillFactor percent of the children it can take,
+	// but at least three so that every node has two children.
+	int height = 1;
+	int maxKeys = counted ? BTNonLeafNodeT<KeyType>::MAX_COUNTED_KEYS : BTNonLeafNodeT<KeyType>::MAX_KEYS;
+	int fanout = max(3, (maxKeys + 1) * fillFactor / 100);
+	while (level.size() > 1) {
+		vector<pair<KeyType, PageId> > parents;
+		vector<int> parentRows;
+
+		pid = allocatePages(1);
+		for (size_t i = 0; i < level.size(); ) {
+			size_t n = min((size_t) fanout, level.size() - i);
+			// do not leave a single child for the last node
+			if (level.size() - i - n == 1)
+				n--;
+
+			BTNonLeafNodeT<KeyType> nln;
+			nln.setLevel(height);
+			nln.setCounted(counted);
+			nln.initializeRoot(level[i].second, level[i + 1].first, level[i + 1].second);
+			for (size_t k = 2; k < n; k++)
+				nln.insert(level[i + k].first, level[i + k].second, level[i + k - 1].second);
+			if (counted) {
+				for (size_t k = 0; k < n; k++)
+					nln.setChildCount((int) k, levelRows[i + k]);
+				parentRows.push_back(nln.getTotalCount());
+			}
+
+			PageId next = (i + n < level.size()) ? allocatePages(1) : -1;
+			nln.setNextNodePtr(next);
+			rc = writeNonLeaf(pid, nln);
+			if (rc < 0)
+				return rc;
+
+			parents.push_back(make_pair(level[i].first, pid));
+			pid = next;
+			i += n;
+		}
+
+		level.swap(parents);
+		levelRows.swap(parentRows);
+		height++;
+	}
+
+	rootPid = level[0].second;
+	treeHeight = height;
+
+	return 0;
+}
+
+/*
+ * Add many (key, value) tuples to a clustered index at once.
+ * @param tuples[IN/OUT] the tuples to add (sorted on return)
+ * @param fillFactor[IN] how full to pack each node, in percent (1-100)
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::bulkLoadTuples(vector<pair<KeyType, string> >& tuples, int fillFactor)
+{
+	RC rc;
+
+	if (!clustered || fillFactor < 1 || fillFactor > 100)
+		return RC_INVALID_ATTRIBUTE;
+
+	stable_sort(tuples.begin(), tuples.end(), tupleKeyLess<KeyType>);
+
+	if (treeHeight != 0) {
+		for (size_t i = 0; i < tuples.size(); i++)
+			if ((rc = insertTuple(tuples[i].first, tuples[i].second)) < 0)
+				return rc;
+		return 0;
+	}
+	if (tuples.empty())
+		return 0;
+
+	// Pack the leaves left to right with fillFactor percent of the bytes
+	// of a page (but at least one tuple each), and keep the first key
+	// and PageId of every leaf for the level above.
+	vector<pair<KeyType, PageId> > level;
+	vector<int> levelRows;
+	int budget = BTTupleNodeT<KeyType>::CAPACITY * fillFactor / 100;
+	PageId pid = allocatePages(1);
+	for (size_t i = 0; i < tuples.size(); ) {
+		BTTupleNodeT<KeyType> ln;
+		size_t n = 0;
+		int used = 0;
+		while (i + n < tuples.size()) {
+			int size = BTTupleNodeT<KeyType>::tupleSize(tuples[i + n].second);
+			if (n > 0 && used + size > budget)
+				break;
+			if ((rc = ln.insert(tuples[i + n].first, tuples[i + n].second)) < 0)
+				return rc;
+			used += size;
+			n++;
+		}
+
+		PageId next = (i + n < tuples.size()) ? allocatePages(1) : -1;
+		ln.setNextNodePtr(next);
+		ln.setPrevNodePtr(level.empty() ? -1 : level.back().second);
+		rc = ln.write(pid, pf);
+		if (rc < 0)
+			return rc;
+
+		level.push_back(make_pair(tuples[i].first, pid));
+		pid = next;
+		i += n;
+	}
+
+	return buildLevels(level, levelRows, fillFactor);
+}
+
+/*
+ * Set how many non-leaf pages of each index file stay pinned in memory.
+ * @param pages[IN] the number of pages to pin per index file
+ */
+template <class KeyType>
+void BTreeIndexT<KeyType>::setPinBudget(int pages)
+{
+	pthread_rwlock_wrlock(&pinLatch);
+	pinBudget = (pages > 0) ? pages : 0;
+
+	typename map<string, PinnedIndex>::iterator it;
+	for (it = pinnedIndexes.begin(); it != pinnedIndexes.end(); it++)
+		it->second.nodes.clear();
+	pthread_rwlock_unlock(&pinLatch);
+}
+
+/*
+ * Read the non-leaf node at pid, from its pinned copy if there is one.
+ * @param pid[IN] the PageId to read
+ * @param node[OUT] the node
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::readNonLeaf(PageId pid, BTNonLeafNodeT<KeyType>& node)
+{
+	// a snapshot that misses a later write of the file reads its own
+	// pages; a write pins its node only after the file saw the write
+	pthread_rwlock_rdlock(&pinLatch);
+	bool current = pf.isCurrent();
+	typename map<PageId, BTNonLeafNodeT<KeyType> >::iterator it = pins->nodes.find(pid);
+	if (current && it != pins->nodes.end()) {
+		node = it->second;
+		pthread_rwlock_unlock(&pinLatch);
+		return 0;
+	}
+	unsigned writes = pins->writes;
+	pthread_rwlock_unlock(&pinLatch);
+
+	RC rc = node.read(pid, pf);
+	if (rc < 0)
+		return rc;
+
+	// a node written meanwhile may be newer than the copy just read
+	pthread_rwlock_wrlock(&pinLatch);
+	if (current && pins->writes == writes)
+		pin(pid, node);
+	pthread_rwlock_unlock(&pinLatch);
+	return 0;
+}
+
+/*
+ * Write the non-leaf node at pid and keep its pinned copy current.
+ * @param pid[IN] the PageId to write to
+ * @param node[IN] the node
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::writeNonLeaf(PageId pid, BTNonLeafNodeT<KeyType>& node)
+{
+	RC rc = node.write(pid, pf);
+	if (rc < 0)
+		return rc;
+
+	pthread_rwlock_wrlock(&pinLatch);
+	pins->writes++;
+	typename map<PageId, BTNonLeafNodeT<KeyType> >::iterator it = pins->nodes.find(pid);
+	if (it != pins->nodes.end())
+		it->second = node;
+	else
+		pin(pid, node);
+	pthread_rwlock_unlock(&pinLatch);
+
+	return 0;
+}
+
+/*
+ * Pin a copy of the non-leaf node at pid if the budget allows.
+ * @param pid[IN] the PageId of the node
+ * @param node[IN] the node
+ */
+template <class KeyType>
+void BTreeIndexT<KeyType>::pin(PageId pid, BTNonLeafNodeT<KeyType>& node)
+{
+	if (pinBudget == 0)
+		return;
+
+	// with the budget used up, give the place of a node on the lowest
+	// pinned level to a node on a higher level
+	if ((int) pins->nodes.size() >= pinBudget) {
+		typename map<PageId, BTNonLeafNodeT<KeyType> >::iterator it, victim;
+		victim = pins->nodes.begin();
+		for (it = pins->nodes.begin(); it != pins->nodes.end(); it++)
+			if (it->second.getLevel() < victim->second.getLevel())
+				victim = it;
+
+		if (victim->second.getLevel() >= node.getLevel())
+			return;
+		pins->nodes.erase(victim);
+	}
+
+	pins->nodes[pid] = node;
+}
+
+// the key types the index is compiled for (see BTreeKey.h)
+template class BTreeIndexT<int>;
+template class BTreeIndexT<long long>;
+template class BTreeIndexT<FixedString<16> >;
+template class BTreeIndexT<FixedString<32> >;
+template class BTreeCursorT<int>;
+template class BTreeCursorT<long long>;
+template class BTreeCursorT<FixedString<16> >;
+template class BTreeCursorT<FixedString<32> >;
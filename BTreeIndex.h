@@ -13,6 +13,13 @@
 #include "Bruinbase.h"
 #include "PageFile.h"
 #include "RecordFile.h"
+#include "BTreeKey.h"
+#include "BTreeNode.h"
+#include <map>
+#include <set>
+#include <vector>
+#include <utility>
+#include <pthread.h>
              
 /**
  * The data structure to point to a particular entry at a b+tree leaf node.
@@ -25,15 +32,120 @@ typedef struct {
   PageId  pid;  
   // The entry number inside the node
   int     eid;  
+  // the page of the posting list being read at entry eid (-1 if none)
+  PageId  ppid;
+  // the entry number inside the posting page
+  int     peid;
+  // the RecordId of the leaf entry readForward() or readBackward() read
+  // last (pid -1 if none)
+  RecordId last;
+  // the right sibling of the leaf of that entry when it was read; splits
+  // since then cannot have moved the entry past it
+  PageId  lastNext;
+  // true if last is the entry the lookup found, not read yet: the next
+  // read returns it instead of the entry behind it
+  bool    unread;
 } IndexCursor;
 
+template <class KeyType> class BTreeIndexT;
+
+/**
+ * A cursor for range scans that keeps the current leaf in memory and
+ * returns its entries in batches. The page file is only read when the
+ * scan moves on to the next leaf or posting page, so a range scan reads
+ * every leaf once instead of once per entry as readForward() does.
+ * A cursor is set up by BTreeIndexT::openCursor() and must not be used
+ * after the index is closed.
+ */
+template <class KeyType>
+class BTreeCursorT {
+ public:
+  BTreeCursorT();
+
+  /**
+   * Return the next batch of (key, rid) pairs in key order.
+   * A batch is either a run of leaf entries or one page of a posting
+   * list (where every key is the key of the list).
+   * The arrays stay valid until the next call.
+   * @param keys[OUT] the keys of the batch
+   * @param rids[OUT] the RecordIds of the batch
+   * @param n[OUT] the number of pairs in the batch
+   * @return error code. 0 if no error, RC_END_OF_TREE after the last entry
+   */
+  RC next(const KeyType*& keys, const RecordId*& rids, int& n);
+
+  /**
+   * Return the next tuple of a clustered index in key order (see
+   * BTreeIndexT::setClustered()).
+   * @param key[OUT] the key of the tuple
+   * @param value[OUT] the value of the tuple
+   * @return error code. 0 if no error, RC_END_OF_TREE after the last tuple
+   */
+  RC nextTuple(KeyType& key, std::string& value);
+
+  /**
+   * Read ahead while the scan goes on: whenever the cursor moves to a
+   * new leaf, the next leaves are requested from the operating system
+   * in the background, and so are the record pages the RecordIds of
+   * the new leaf (or posting page) point to.
+   * The upcoming leaves are taken from the parent nodes, so the reads
+   * do not wait for one another as they would along the leaf chain.
+   * @param leaves[IN] how many leaves to read ahead (0 to turn it off)
+   * @param rf[IN] the RecordFile the RecordIds point into (NULL for none)
+   */
+  void setPrefetch(int leaves, const RecordFile* rf);
+
+ private:
+  friend class BTreeIndexT<KeyType>;
+
+  void prefetch();
+  void prefetchRecords(const RecordId* rids, int n);
+
+  BTreeIndexT<KeyType>* index;   // the index the cursor scans
+  const PageFile*      pf;       // the page file of the index
+  IndexCursor          pos;      // the next entry to return
+  PageId               leafPid;  // the leaf held in leaf (-1 if none)
+  BTLeafNodeT<KeyType> leaf;     // the current leaf
+  BTPostingNode        posting;  // the current posting page
+  BTTupleNodeT<KeyType> tuples;  // the current leaf of a clustered index
+  KeyType              postingKeys[BTPostingNode::MAX_RIDS]; // its keys
+
+  int                  prefetchLeaves; // the leaves to read ahead
+  const RecordFile*    prefetchRf;     // the RecordFile to read ahead in
+  std::vector<PageId>  ahead;          // the leaves behind the current one
+  size_t               aheadPos;       // the first of them not yet reached
+  size_t               prefetched;     // the first of them not yet prefetched
+  PageId               nextParent;     // the parent to take more leaves from
+};
+
 /**
  * Implements a B-Tree index for bruinbase.
- * 
+ * The index is a template on the key type (int, long long or a
+ * FixedString, see BTreeKey.h); every instantiation gets its own
+ * compiled node search with no run-time dispatch on the key type.
+ *
+ * Several threads may call insert(), insertBuffered(), the locate*()
+ * calls, readForward(), readBackward() and openCursor() on the same open
+ * index. The tree follows the B-link design: every node points to its
+ * right sibling, and a split writes the new sibling before the node that
+ * points to it, so a descent that raced with a split finds the moved keys
+ * by following right links. Leaves also point to their left sibling for backward
+ * scans; a split points the leaf behind the new sibling back at it last,
+ * and readBackward() follows right links from a stale left link.
+ * Lookups therefore take no node latches at all. An insert latches only
+ * the leaf it changes and, when that leaf splits, one node per level
+ * on the way up; so does insertTuple(). The inserts into a counted index
+ * (see setCountedNodes()) run one at a time, since each of them changes
+ * every node on its path, and the buffered inserts take turns on the
+ * insert buffers. open(), close(), remove(), the bulk loads and
+ * the set*() calls must not run concurrently with other calls on the
+ * index.
  */
-class BTreeIndex {
+template <class KeyType>
+class BTreeIndexT {
  public:
-  BTreeIndex();
+  BTreeIndexT();
+  ~BTreeIndexT();
 
   /**
    * Open the index file in read or write mode.
@@ -56,9 +168,56 @@ class BTreeIndex {
    * @param rid[IN] the RecordId for the record being inserted into the index
    * @return error code. 0 if no error
    */
-  RC insert(int key, const RecordId& rid);
+  RC insert(const KeyType& key, const RecordId& rid);
+
+  /**
+   * Insert (key, RecordId) pair to the index through the insert buffer of
+   * the parent of the leaf the key goes to, like the message buffers of a
+   * B-epsilon tree. A parent's buffer is flushed once it holds
+   * NODE_BUFFER_ENTRIES pairs (and the fullest one once all buffers
+   * together hold MAX_BUFFERED_ENTRIES): its pairs are sorted and every
+   * leaf under it is read and written once for all of its pairs, instead
+   * of once per pair as with insert(). Unsorted keys then cost about one
+   * leaf write per batch of pairs that share a leaf.
+   *
+   * The buffers are kept in memory by this BTreeIndexT. A lookup only
+   * moves into the leaves the buffered pairs in the key range it reads,
+   * as a query of a B-epsilon tree merges the buffers on its path:
+   * locate() those from searchKey up to the entry it finds, readForward()
+   * and readBackward() those between the entry read last and the next
+   * one, openCursor() those from searchKey on, the count calls those they
+   * count. Every other pair stays buffered until its buffer fills up, or
+   * until remove(), flushBuffers() or close(), so the file holds them
+   * once it is closed. An index opened elsewhere sees them only after
+   * that. SqlEngine does not use this call: a LOAD sorts all of its pairs
+   * and adds them through bulkLoad().
+   * @param key[IN] the key for the value inserted into the index
+   * @param rid[IN] the RecordId for the record being inserted into the index
+   * @return error code. 0 if no error
+   */
+  RC insertBuffered(const KeyType& key, const RecordId& rid);
+
+  /**
+   * Move all pairs of the insert buffers (see insertBuffered()) into the
+   * leaves, in a single pass in key order.
+   * @return error code. 0 if no error
+   */
+  RC flushBuffers();
 
-  RC insertHelper(const RecordId& rid, int key, PageId pid, int &new_key, PageId &new_pid, int curr_height);
+  /**
+   * Remove the (key, RecordId) pair from the index.
+   * A leaf or non-leaf node that falls below half full borrows entries
+   * from a sibling or is merged into it, a root with a single child is
+   * replaced by that child, and the freed pages go on a free list that
+   * new nodes are taken from. The separator in front of every leaf stays
+   * equal to the first key of the leaf, which keeps the right links
+   * usable for concurrent inserts and lookups afterwards.
+   * @param key[IN] the key of the pair
+   * @param rid[IN] the RecordId of the pair
+   * @return error code. 0 if no error, RC_NO_SUCH_RECORD if the pair
+   *         is not in the index
+   */
+  RC remove(const KeyType& key, const RecordId& rid);
 
   /**
    * Run the standard B+Tree key search algorithm and identify the
@@ -78,21 +237,578 @@ class BTreeIndex {
    *                    smaller than searchKey.
    * @return 0 if searchKey is found. Othewise, an error code
    */
-  RC locate(int searchKey, IndexCursor& cursor);
+  RC locate(const KeyType& searchKey, IndexCursor& cursor);
 
-  RC locateHelper(int searchKey, IndexCursor& cursor, int counter, int treeHeight);
+  /**
+   * Locate many keys at once. The keys are looked up one after the other,
+   * but a key that falls under a node read for an earlier key continues
+   * from that node instead of from the root, so sorted keys share the
+   * reads of the non-leaf nodes and of the leaves they have in common.
+   * When the lookups move to a new parent of leaves, the leaves it holds
+   * for the next keys are requested from the operating system at once,
+   * so their reads overlap instead of waiting for one another.
+   * Any key order works, but ascending keys share the most.
+   * @param keys[IN] the keys to find
+   * @param cursors[OUT] the cursor of every key (see locate())
+   * @param rcs[OUT] what locate() returns for every key: 0 if the key is
+   *                 found, RC_NO_SUCH_RECORD if not
+   * @return error code. 0 if no error
+   */
+  RC locateMany(const std::vector<KeyType>& keys, std::vector<IndexCursor>& cursors, std::vector<RC>& rcs);
 
   /**
    * Read the (key, rid) pair at the location specified by the index cursor,
-   * and move foward the cursor to the next entry.
+   * and move foward the cursor to the next entry. The cursor finds the
+   * entry it read last again if inserts in other threads shifted it,
+   * split its leaf or moved it into a new posting list meanwhile, so no
+   * entry is returned twice; before the first read, it finds the entry
+   * the lookup found the same way, so no smaller key is returned.
    * @param cursor[IN/OUT] the cursor pointing to an leaf-node index entry in the b+tree
    * @param key[OUT] the key stored at the index cursor location
    * @param rid[OUT] the RecordId stored at the index cursor location
    * @return error code. 0 if no error
    */
-  RC readForward(IndexCursor& cursor, int& key, RecordId& rid);
+  RC readForward(IndexCursor& cursor, KeyType& key, RecordId& rid);
+
+  /**
+   * Set the cursor to the last entry with a key <= searchKey, so that
+   * readBackward() returns the entries from there on in descending key
+   * order.
+   * @param searchKey[IN] the largest key to return
+   * @param cursor[OUT] the cursor pointing to the entry
+   * @return 0 if searchKey is found. RC_NO_SUCH_RECORD if the cursor
+   *         points to a smaller key (or to nothing). Otherwise an error code
+   */
+  RC locateBackward(const KeyType& searchKey, IndexCursor& cursor);
+
+  /**
+   * Set the cursor to the last entry of the index, the one with the
+   * largest key.
+   * @param cursor[OUT] the cursor pointing to the entry
+   * @return error code. 0 if no error, RC_NO_SUCH_RECORD if the index is
+   *         empty
+   */
+  RC locateLast(IndexCursor& cursor);
+
+  /**
+   * Read the (key, rid) pair at the location specified by the index cursor,
+   * and move the cursor back to the previous entry. The RecordIds of a
+   * posting list are all returned before the cursor leaves its entry.
+   * Like readForward(), the cursor survives inserts in other threads,
+   * except for one that moves the entry it read last into a new posting
+   * list; the cursor then becomes invalid.
+   * @param cursor[IN/OUT] the cursor pointing to an leaf-node index entry in the b+tree
+   * @param key[OUT] the key stored at the index cursor location
+   * @param rid[OUT] the RecordId stored at the index cursor location
+   * @return error code. 0 if no error, RC_END_OF_TREE before the first entry
+   */
+  RC readBackward(IndexCursor& cursor, KeyType& key, RecordId& rid);
+
+  /**
+   * Set up a batched cursor at the first entry with a key >= searchKey.
+   * @param searchKey[IN] the key to start from
+   * @param cursor[OUT] the cursor
+   * @return 0 if searchKey is found. RC_NO_SUCH_RECORD if the cursor
+   *         starts at a larger key. Otherwise an error code
+   */
+  RC openCursor(const KeyType& searchKey, BTreeCursorT<KeyType>& cursor);
+
+  /**
+   * Store the leaf nodes of the index in the compressed format
+   * (keys and RecordIds bit-packed against per-node bases). This gives
+   * dense keys a much higher leaf fanout, so lookups and range scans
+   * read fewer pages. The choice is saved with the index and can only
+   * be changed while the index is empty. Only int keys can be compressed.
+   * @param compressed[IN] true to compress the leaf nodes
+   * @return error code. 0 if no error
+   */
+  RC setCompressedLeaves(bool compressed);
+
+  /**
+   * Keep the number of rows under every child in the non-leaf nodes (and
+   * the length of every posting list in its first page), so that
+   * countRange(), rank() and locateNth() take a single root-to-leaf
+   * descent instead of a scan of the leaves. Every insert and remove
+   * then also rewrites the non-leaf nodes on its path, and a non-leaf
+   * node holds fewer keys. The choice is saved with the index and can
+   * only be changed while the index is empty.
+   * @param counted[IN] true to count the rows under every child
+   * @return error code. 0 if no error
+   */
+  RC setCountedNodes(bool counted);
+
+  /**
+   * Make the index clustered: its leaves hold whole (key, value) tuples
+   * instead of (key, RecordId) pairs, so the index is the table. A range
+   * scan then returns the tuples from consecutive leaf entries and reads
+   * no record pages at all. The tuples are added with insertTuple() or
+   * bulkLoadTuples() and read with a cursor (see BTreeCursorT::nextTuple());
+   * the calls that take or return RecordIds fail on a clustered index.
+   * The choice is saved with the index and can only be changed while the
+   * index is empty. A clustered index is neither compressed nor counted.
+   * @param clustered[IN] true to store the tuples in the leaves
+   * @return error code. 0 if no error
+   */
+  RC setClustered(bool clustered);
+
+  /**
+   * Return true if the leaves of the index hold the tuples.
+   */
+  bool isClustered();
+
+  /**
+   * Insert a (key, value) tuple into a clustered index, behind the
+   * tuples with the same key.
+   * @param key[IN] the key of the tuple
+   * @param value[IN] the value of the tuple (cut off like in a RecordFile)
+   * @return error code. 0 if no error, RC_INVALID_ATTRIBUTE if the index
+   *         is not clustered
+   */
+  RC insertTuple(const KeyType& key, const std::string& value);
+
+  /**
+   * Add many (key, value) tuples to a clustered index at once.
+   * The tuples are sorted on their keys, keeping the order of equal
+   * keys, and an empty index is built bottom-up like in bulkLoad(); a
+   * leaf is filled by bytes, and a run of equal keys goes on in the next
+   * leaf where it does not fit. An index that already has tuples gets
+   * them through insertTuple().
+   * @param tuples[IN/OUT] the tuples to add (sorted on return)
+   * @param fillFactor[IN] how full to pack each node, in percent (1-100)
+   * @return error code. 0 if no error, RC_INVALID_ATTRIBUTE if the index
+   *         is not clustered
+   */
+  RC bulkLoadTuples(std::vector<std::pair<KeyType, std::string> >& tuples, int fillFactor);
+
+  /**
+   * Count the entries with lo <= key <= hi in a counted index.
+   * @param lo[IN] the smallest key to count
+   * @param hi[IN] the largest key to count
+   * @param count[OUT] the number of entries
+   * @return error code. 0 if no error, RC_INVALID_ATTRIBUTE if the
+   *         index is not counted
+   */
+  RC countRange(const KeyType& lo, const KeyType& hi, int& count);
+
+  /**
+   * Return the number of entries with a key smaller than key, which is
+   * the position of the first entry with key in a counted index.
+   * @param key[IN] the key
+   * @param rank[OUT] the number of smaller entries
+   * @return error code. 0 if no error, RC_INVALID_ATTRIBUTE if the
+   *         index is not counted
+   */
+  RC rank(const KeyType& key, int& rank);
+
+  /**
+   * Set the cursor to the n-th entry (from 0) in key order in a counted
+   * index, so that readForward() returns it next.
+   * @param n[IN] the position of the entry
+   * @param cursor[OUT] the cursor pointing to the entry
+   * @return error code. 0 if no error, RC_NO_SUCH_RECORD if the index
+   *         has n entries or less, RC_INVALID_ATTRIBUTE if the index is
+   *         not counted
+   */
+  RC locateNth(int n, IndexCursor& cursor);
+
+  /**
+   * Add many (key, RecordId) pairs at once.
+   * The pairs are sorted, and an empty index is then built bottom-up:
+   * leaves are packed left to right on consecutive pages and every upper
+   * level is built from the first keys of the level below. This avoids a
+   * root-to-leaf descent and the splits of insert() for every pair.
+   * An index that already has entries gets the sorted pairs leaf by leaf,
+   * like a flush of the insert buffers (see insertBuffered()).
+   * @param entries[IN/OUT] the pairs to add (sorted on return)
+   * @param fillFactor[IN] how full to pack each node, in percent (1-100)
+   * @return error code. 0 if no error
+   */
+  RC bulkLoad(std::vector<std::pair<KeyType, RecordId> >& entries, int fillFactor);
+
+  /**
+   * Set how many non-leaf pages of each index file stay pinned in memory.
+   * The pinned pages survive close(), so the root and the upper levels
+   * are read from disk once and a point lookup only reads its leaf.
+   * When the budget is used up, a page of a higher level replaces a
+   * pinned page of a lower level. Changing the budget drops all pinned
+   * pages. The default is 64 pages; 0 turns pinning off.
+   * @param pages[IN] the number of pages to pin per index file
+   */
+  static void setPinBudget(int pages);
   
  private:
+  friend class BTreeCursorT<KeyType>;
+
+  // the deepest tree insert() and locate() can descend
+  static const int MAX_HEIGHT = 32;
+
+  // the pairs an insert buffer holds before it is flushed
+  static const int NODE_BUFFER_ENTRIES = 1024;
+
+  // the pairs all insert buffers together hold at most
+  static const int MAX_BUFFERED_ENTRIES = 65536;
+
+  /**
+   * Move the pairs buffered for the non-leaf node into the leaves.
+   * The caller holds bufferLatch.
+   * @param node[IN] the parent of leaves the pairs were buffered at
+   * @return error code. 0 if no error
+   */
+  RC flushBuffer(PageId node);
+
+  /**
+   * Move the buffered pairs with lo <= key <= hi into the leaves.
+   * @param lo[IN] the smallest key (NULL for no bound)
+   * @param hi[IN] the largest key (NULL for no bound)
+   * @param flushed[OUT] true if any pair was moved
+   * @return error code. 0 if no error
+   */
+  RC flushRange(const KeyType* lo, const KeyType* hi, bool& flushed);
+
+  /**
+   * Move into the leaves the buffered pairs that a lookup of searchKey
+   * would have found at or before the entry cursor points to.
+   * @param searchKey[IN] the key of the lookup
+   * @param cursor[IN] the cursor locate() set for it
+   * @param flushed[OUT] true if any pair was moved, so that the cursor
+   *                     has to be set again
+   * @return error code. 0 if no error
+   */
+  RC flushLocated(const KeyType& searchKey, const IndexCursor& cursor, bool& flushed);
+
+  /**
+   * Set the cursor to return the entry eid of the leaf ln next, and keep
+   * its RecordId so that readForward() finds it again if inserts shift
+   * it meanwhile (see IndexCursor::unread). Nothing if there is no such
+   * entry.
+   * @param cursor[IN/OUT] the cursor
+   * @param ln[IN] the leaf
+   * @param eid[IN] the entry
+   */
+  void setUnread(IndexCursor& cursor, BTLeafNodeT<KeyType>& ln, int eid);
+
+  /**
+   * locateMany() without a look at the insert buffers.
+   * @param keys[IN] the keys to find
+   * @param cursors[OUT] the cursor of every key (see locate())
+   * @param rcs[OUT] what locate() returns for every key
+   * @return error code. 0 if no error
+   */
+  RC locateBatch(const std::vector<KeyType>& keys, std::vector<IndexCursor>& cursors, std::vector<RC>& rcs);
+
+  /**
+   * Insert sorted (key, RecordId) pairs. The pairs that fall into the
+   * same leaf are added to it with one read and one write of the leaf as
+   * long as they fit; the others (a split, a duplicated key) go through
+   * insert().
+   * @param entries[IN] the pairs in key order
+   * @return error code. 0 if no error
+   */
+  RC insertSorted(const std::vector<std::pair<KeyType, RecordId> >& entries);
+
+  /**
+   * locate() that also returns the parent of the leaf the cursor points to.
+   * @param searchKey[IN] the key to find
+   * @param cursor[OUT] the cursor (see locate())
+   * @param parentPid[OUT] the parent of the leaf on the descent path
+   *                       (-1 if the leaf is the root)
+   * @return 0 if searchKey is found. Othewise an error code
+   */
+  RC locate(const KeyType& searchKey, IndexCursor& cursor, PageId& parentPid);
+
+  /**
+   * locate() on a clustered index. The tuples of searchKey may begin in
+   * the leaves in front of the one the descent reaches, since a run of
+   * equal keys goes on across leaves; the cursor points to the first one.
+   * @param searchKey[IN] the key to find
+   * @param cursor[OUT] the cursor (see locate())
+   * @param parentPid[OUT] the parent of the leaf (-1 if not known)
+   * @return 0 if searchKey is found. Othewise an error code
+   */
+  RC locateTuple(const KeyType& searchKey, IndexCursor& cursor, PageId& parentPid);
+
+  /**
+   * Descend from the root to the node on the given level that covers
+   * key, moving right past nodes that were split during the descent.
+   * @param key[IN] the key to find
+   * @param level[IN] the level to stop at (0 for the leaf)
+   * @param path[OUT] the node visited on every level from the root down
+   * @param height[OUT] the height of the tree the descent started from
+   * @return error code. 0 if no error
+   */
+  RC descend(const KeyType& key, int level, PageId* path, int& height);
+
+  /**
+   * Insert the new sibling (key, sibPid) of the latched node child on
+   * level into its parent, splitting upwards as far as needed.
+   * Unlatches child.
+   * In a counted index the rows moved to the sibling are moved from the
+   * count of child to the count of the sibling in the parent.
+   * @param level[IN] the level of child
+   * @param path[IN] the descent path of the insert (see descend())
+   * @param height[IN] the height of the tree when path was taken
+   * @param child[IN] the node that was split
+   * @param key[IN] the first key of the sibling
+   * @param sibPid[IN] the PageId of the sibling
+   * @param childRows[IN] the rows left under child (counted index only;
+   *                      only needed if child is the root)
+   * @param sibRows[IN] the rows under the sibling (counted index only)
+   * @return error code. 0 if no error
+   */
+  RC insertParent(int level, PageId* path, int height, PageId child, KeyType key, PageId sibPid, int childRows, int sibRows);
+
+  /**
+   * insert() without the row counts of a counted index.
+   * @param key[IN] the key for the value inserted into the index
+   * @param rid[IN] the RecordId for the record being inserted into the index
+   * @return error code. 0 if no error
+   */
+  RC insertEntry(const KeyType& key, const RecordId& rid);
+
+  /**
+   * Read ahead the leaves under node that the keys from keys[from] on
+   * land in, up to the first key >= hi or out of order.
+   * @param node[IN] the parent of the leaves
+   * @param keys[IN] the keys of locateMany()
+   * @param from[IN] the first key under node
+   * @param hi[IN] the first key behind node (NULL for none)
+   */
+  void prefetchLeaves(BTNonLeafNodeT<KeyType>& node, const std::vector<KeyType>& keys, size_t from, const KeyType* hi);
+
+  /**
+   * Point the leaf at pid back at its new left sibling.
+   * @param pid[IN] the PageId of the leaf
+   * @param prevPid[IN] the PageId of its left sibling
+   * @return error code. 0 if no error
+   */
+  RC setPrevLeaf(PageId pid, PageId prevPid);
+
+  /**
+   * Move from the leaf ln at pid to its left sibling.
+   * @param pid[IN/OUT] the PageId of the leaf; -1 if it was the first leaf
+   * @param ln[IN/OUT] the leaf (a BTLeafNodeT, or a BTTupleNodeT in a
+   *                   clustered index)
+   * @return error code. 0 if no error
+   */
+  template <class LeafNode>
+  RC readPrevLeaf(PageId& pid, LeafNode& ln);
+
+  /**
+   * Find the leaf entry with the RecordId rid, last seen at entry eid of
+   * the leaf ln at pid, in that leaf or the right siblings split off it.
+   * @param pid[IN/OUT] the PageId of the leaf holding the entry
+   * @param ln[IN/OUT] the leaf holding the entry
+   * @param eid[IN/OUT] the entry number of the entry
+   * @param rid[IN] the RecordId of the entry
+   * @param end[IN] the leaf the entry cannot be in (-1 for none)
+   * @return error code. 0 if no error, RC_INVALID_CURSOR if there is no
+   *         such entry
+   */
+  RC seekEntry(PageId& pid, BTLeafNodeT<KeyType>& ln, int& eid, const RecordId& rid, PageId end);
+
+  /**
+   * Find the posting list that holds the RecordId rid among the entries
+   * of the leaf ln at pid and of its right siblings up to end. An insert
+   * moves a run of equal keys into a new posting list this way.
+   * @param pid[IN/OUT] the PageId of the leaf holding the list
+   * @param ln[IN/OUT] the leaf holding the list
+   * @param eid[OUT] the entry number of the list
+   * @param rid[IN] the RecordId to find
+   * @param end[IN] the leaf the list cannot be in (-1 for none)
+   * @param ppid[OUT] the posting page holding rid
+   * @param peid[OUT] the entry number of rid in the posting page
+   * @return error code. 0 if no error, RC_INVALID_CURSOR if there is no
+   *         such list
+   */
+  RC seekPosting(PageId& pid, BTLeafNodeT<KeyType>& ln, int& eid, const RecordId& rid, PageId end, PageId& ppid, int& peid);
+
+  /**
+   * Add delta to the row count of every node on the path in its parent.
+   * @param path[IN] the descent path (see descend())
+   * @param height[IN] the height of the tree
+   * @param delta[IN] the number of rows added (or removed if negative)
+   * @return error code. 0 if no error
+   */
+  RC addRows(PageId* path, int height, int delta);
+
+  /**
+   * Count the rows in the entries from to to - 1 of a leaf in a counted
+   * index. A posting list entry counts all its RecordIds, so its first
+   * page is read.
+   * @param leaf[IN] the leaf
+   * @param from[IN] the first entry
+   * @param to[IN] the entry behind the last one
+   * @param rows[OUT] the number of rows
+   * @return error code. 0 if no error
+   */
+  RC leafRows(BTLeafNodeT<KeyType>& leaf, int from, int to, int& rows);
+
+  /**
+   * Count the entries with a key smaller than key (or equal to it).
+   * @param key[IN] the key
+   * @param inclusive[IN] true to count the entries equal to key as well
+   * @param count[OUT] the number of entries
+   * @return error code. 0 if no error
+   */
+  RC countLess(const KeyType& key, bool inclusive, int& count);
+
+  /**
+   * Reserve n consecutive pages. A single page is taken from the free
+   * list if it has one, more pages come from the end of the index file.
+   * @param n[IN] the number of pages
+   * @return the PageId of the first page
+   */
+  PageId allocatePages(int n);
+
+  /**
+   * Put the page pid on the free list.
+   * @param pid[IN] the PageId of the page nothing points to any more
+   * @return error code. 0 if no error
+   */
+  RC freePage(PageId pid);
+
+  /**
+   * Remove rid from the posting list starting at headPid. An emptied
+   * page is unlinked and freed; the first page stays where it is, so
+   * the leaf entry keeps pointing to the list.
+   * @param headPid[IN] the first page of the list
+   * @param rid[IN] the RecordId to remove
+   * @param left[OUT] 0 if the list is now empty and freed, 1 if it holds
+   *                  a single RecordId, 2 if it holds more
+   * @param single[OUT] the remaining RecordId if left is 1
+   * @return error code. 0 if no error
+   */
+  RC removePosting(PageId headPid, const RecordId& rid, int& left, RecordId& single);
+
+  /**
+   * Set the separator in front of the leaf at pid to the first key of
+   * the leaf. The separator is in the lowest node on the path where
+   * the leaf is not under the leftmost child.
+   * @param path[IN] the descent path to the leaf (see descend())
+   * @param height[IN] the height of the tree
+   * @param pid[IN] the PageId of the leaf
+   * @param leaf[IN] the leaf
+   * @return error code. 0 if no error
+   */
+  RC fixSeparator(PageId* path, int height, PageId pid, BTLeafNodeT<KeyType>& leaf);
+
+  /**
+   * Write the underfull leaf at pid after refilling it from or merging
+   * it with a sibling under the same parent.
+   * @param path[IN] the descent path to the leaf (see descend())
+   * @param height[IN] the height of the tree
+   * @param pid[IN] the PageId of the leaf
+   * @param leaf[IN] the leaf
+   * @return error code. 0 if no error
+   */
+  RC rebalanceLeaf(PageId* path, int height, PageId pid, BTLeafNodeT<KeyType>& leaf);
+
+  /**
+   * Rebalance the non-leaf node on the path at level after it lost a
+   * child, and the levels above it as far as needed. A root left with
+   * a single child is replaced by the child.
+   * @param path[IN] the descent path (see descend())
+   * @param height[IN] the height of the tree
+   * @param level[IN] the level of the node that lost a child
+   * @return error code. 0 if no error
+   */
+  RC rebalance(PageId* path, int height, int level);
+
+  /**
+   * Lock and unlock the insert latch of the node at pid.
+   * Only inserts take node latches; a thread holding latches takes new
+   * ones left to right on a level and bottom up, so they never deadlock.
+   * @param pid[IN] the PageId of the node
+   */
+  void latch(PageId pid);
+  void unlatch(PageId pid);
+
+  /**
+   * Write rids into a new posting list.
+   * @param rids[IN] the RecordIds of the list
+   * @param n[IN] the number of RecordIds
+   * @param headPid[IN] the first of the (n - 1) / MAX_RIDS + 1 pages
+   *                    reserved for the list
+   * @return error code. 0 if no error
+   */
+  RC createPosting(const RecordId* rids, int n, PageId headPid);
+
+  /**
+   * Append rid to the end of the posting list starting at headPid.
+   * @param headPid[IN] the first page of the list
+   * @param rid[IN] the RecordId to append
+   * @return error code. 0 if no error
+   */
+  RC appendPosting(PageId headPid, const RecordId& rid);
+
+  /**
+   * Decide how many of the sorted entries from start go into the next
+   * leaf of a bulk load: fillFactor percent of what fits on a page,
+   * moved to the nearest boundary between two keys.
+   * @param entries[IN] the sorted leaf entries
+   * @param start[IN] the first entry of the leaf
+   * @param fillFactor[IN] how full to pack the leaf, in percent
+   * @return the number of entries for the leaf
+   */
+  int bulkLeafSize(const std::vector<std::pair<KeyType, RecordId> >& entries, size_t start, int fillFactor);
+
+  /**
+   * Build the non-leaf levels of a bulk load on top of the nodes of a
+   * level until a single root is left, and make it the root.
+   * @param level[IN/OUT] the first key and PageId of every node of the
+   *                      lowest level, left to right
+   * @param levelRows[IN/OUT] the rows under every node (counted index)
+   * @param fillFactor[IN] how full to pack each node, in percent
+   * @return error code. 0 if no error
+   */
+  RC buildLevels(std::vector<std::pair<KeyType, PageId> >& level, std::vector<int>& levelRows, int fillFactor);
+
+  /**
+   * Read the non-leaf node at pid, from its pinned copy if there is one.
+   * A node read from disk is pinned if the budget allows.
+   * @param pid[IN] the PageId to read
+   * @param node[OUT] the node
+   * @return error code. 0 if no error
+   */
+  RC readNonLeaf(PageId pid, BTNonLeafNodeT<KeyType>& node);
+
+  /**
+   * Write the non-leaf node at pid and keep its pinned copy current.
+   * @param pid[IN] the PageId to write to
+   * @param node[IN] the node
+   * @return error code. 0 if no error
+   */
+  RC writeNonLeaf(PageId pid, BTNonLeafNodeT<KeyType>& node);
+
+  /**
+   * Pin a copy of the non-leaf node at pid if the budget allows.
+   * The caller holds pinLatch for writing.
+   * @param pid[IN] the PageId of the node
+   * @param node[IN] the node
+   */
+  void pin(PageId pid, BTNonLeafNodeT<KeyType>& node);
+
+  /**
+   * The pinned pages of one index file. They are only valid while the
+   * file has endPid pages: a file that was changed through another
+   * PageFile has grown, since every split adds a page. (A split that
+   * reuses a freed page does not, but the index that freed the page
+   * dropped its pinned copy.)
+   */
+  struct PinnedIndex {
+    PinnedIndex() : endPid(-1), rootPid(-1), treeHeight(0), flags(0), freeHead(-1), writes(0) {}
+
+    PageId endPid;      // the size of the file the pages are valid for
+    PageId rootPid;     // the contents of page 0
+    int    treeHeight;
+    int    flags;
+    PageId freeHead;
+    unsigned writes;    // non-leaf writes so far; a node read from disk
+                        // is only pinned if no write happened meanwhile
+    std::map<PageId, BTNonLeafNodeT<KeyType> > nodes;  // the pinned nodes
+  };
+
+
   PageFile pf;         /// the PageFile used to store the actual b+tree in disk
 
   PageId   rootPid;    /// the PageId of the root node
@@ -101,6 +817,42 @@ class BTreeIndex {
   /// this class is destructed. Make sure to store the values of the two 
   /// variables in disk, so that they can be reconstructed when the index
   /// is opened again later.
+
+  bool     writable;   /// true if the index was opened in 'w' mode
+  bool     compressedLeaves; /// true if new leaf nodes are compressed
+  bool     counted;    /// true if the non-leaf nodes count their rows
+  bool     clustered;  /// true if the leaves hold whole tuples
+
+  PinnedIndex* pins;   /// the pinned pages of this index file
+
+  pthread_rwlock_t rootLatch;  /// guards rootPid and treeHeight
+  pthread_mutex_t  allocLatch; /// guards freePid and freeHead
+  PageId           freePid;    /// the first page not handed out yet
+  PageId           freeHead;   /// the first page of the free list (-1 if none)
+  pthread_mutex_t  latchTable; /// guards latches
+  pthread_mutex_t  countLatch; /// one insert at a time in a counted index
+  pthread_mutex_t  bufferLatch; /// guards buffers, bufferedKeys and bufferedCount
+  std::map<PageId, std::vector<std::pair<KeyType, RecordId> > > buffers; /// the insert buffers by parent of leaves
+  std::multiset<std::pair<KeyType, PageId> > bufferedKeys; /// the key of every buffered pair, with its buffer
+  int              bufferedCount; /// the pairs in all insert buffers; changed
+                                  /// atomically under bufferLatch, read
+                                  /// without it to skip the buffers
+  std::vector<pthread_mutex_t*> latches; /// the node latches by PageId
+
+  static std::map<std::string, PinnedIndex> pinnedIndexes; /// by file name
+  static int pinBudget; /// pages to pin per index file
+  static pthread_rwlock_t pinLatch; /// guards pinnedIndexes
 };
 
+// the B+tree index on the int key column
+typedef BTreeIndexT<int> BTreeIndex;
+typedef BTreeCursorT<int> BTreeCursor;
+
+// the secondary B+tree index on the value column. A value is indexed by
+// its first 16 bytes, so the index returns candidates whose value has to
+// be checked against the record.
+typedef FixedString<16> ValueKey;
+typedef BTreeIndexT<ValueKey> ValueIndex;
+typedef BTreeCursorT<ValueKey> ValueCursor;
+
 #endif /* BTREEINDEX_H */
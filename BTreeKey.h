@@ -0,0 +1,87 @@
+#ifndef BTREEKEY_H
+#define BTREEKEY_H
+
+#include <cstring>
+#include <string>
+
+/**
+ * A fixed-width byte string key for the B+tree.
+ * Shorter strings are padded with NUL bytes, longer strings are cut off
+ * after N bytes, so two keys compare like strcmp() on their first N bytes.
+ * Because of the cut-off an index on FixedString keys can only narrow down
+ * the candidates; the caller has to check the full value in the record.
+ */
+template <int N>
+struct FixedString {
+  char bytes[N];  // the key bytes, NUL padded (not NUL terminated when full)
+
+  /**
+   * make a key from the first N bytes of a string.
+   * @param s[IN] the string
+   * @return the key
+   */
+  static FixedString fromString(const std::string& s)
+  {
+    FixedString k;
+    size_t len = (s.size() < (size_t) N) ? s.size() : (size_t) N;
+    memset(k.bytes, 0, N);
+    memcpy(k.bytes, s.data(), len);
+    return k;
+  }
+
+  /**
+   * @return the key as a string (without the NUL padding)
+   */
+  std::string str() const
+  {
+    size_t len = 0;
+    while (len < (size_t) N && bytes[len] != 0) len++;
+    return std::string(bytes, len);
+  }
+};
+
+// FixedString comparators (bytes compare as unsigned char, like strcmp)
+template <int N>
+inline bool operator< (const FixedString<N>& k1, const FixedString<N>& k2)
+{ return memcmp(k1.bytes, k2.bytes, N) < 0; }
+template <int N>
+inline bool operator> (const FixedString<N>& k1, const FixedString<N>& k2)
+{ return memcmp(k1.bytes, k2.bytes, N) > 0; }
+template <int N>
+inline bool operator<= (const FixedString<N>& k1, const FixedString<N>& k2)
+{ return memcmp(k1.bytes, k2.bytes, N) <= 0; }
+template <int N>
+inline bool operator>= (const FixedString<N>& k1, const FixedString<N>& k2)
+{ return memcmp(k1.bytes, k2.bytes, N) >= 0; }
+template <int N>
+inline bool operator== (const FixedString<N>& k1, const FixedString<N>& k2)
+{ return memcmp(k1.bytes, k2.bytes, N) == 0; }
+template <int N>
+inline bool operator!= (const FixedString<N>& k1, const FixedString<N>& k2)
+{ return memcmp(k1.bytes, k2.bytes, N) != 0; }
+
+/**
+ * Compile-time properties of a B+tree key type.
+ * packable: keys can be stored as bit-packed offsets in compressed leaves
+ */
+template <class KeyType>
+struct KeyTraits {
+  static const bool packable = false;
+};
+
+template <>
+struct KeyTraits<int> {
+  static const bool packable = true;
+};
+
+//
+// The key types the B+tree is compiled for. Using another key type needs
+// an explicit instantiation at the end of BTreeNode.cc and BTreeIndex.cc.
+//
+//   int             - 32-bit keys (the key column)
+//   long long       - 64-bit keys
+//   FixedString<16> - short byte strings
+//   FixedString<32> - byte strings
+//
+
+#endif /* BTREEKEY_H */
@@ -1,454 +1,2033 @@
 #include "BTreeNode.h"
+#include <climits>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 using namespace std;
 
-BTLeafNode::BTLeafNode() {
+/*
+ * Branch-free upper bound over a sorted key array.
+ * The loop always runs ceil(log2(n)) times and the comparison result
+ * is folded into the pointer arithmetic, so for scalar keys the compiler
+ * emits a conditional move instead of an unpredictable branch.
+ * @param keys[IN] the sorted key array
+ * @param n[IN] the number of keys
+ * @param searchKey[IN] the key to search for
+ * @return the index of the first key that is > searchKey (n if none)
+ */
+template <class KeyType>
+static int upperBound(const KeyType* keys, int n, const KeyType& searchKey)
+{
+	if (n <= 0)
+		return 0;
+
+	const KeyType* base = keys;
+	while (n > 1) {
+		int half = n / 2;
+		base = (base[half] <= searchKey) ? base + half : base;
+		n -= half;
+	}
+	return (int) (base - keys) + (*base <= searchKey);
+}
+
+/*
+ * Branch-free lower bound over a sorted key array.
+ * @param keys[IN] the sorted key array
+ * @param n[IN] the number of keys
+ * @param searchKey[IN] the key to search for
+ * @return the index of the first key that is >= searchKey (n if none)
+ */
+template <class KeyType>
+static int lowerBound(const KeyType* keys, int n, const KeyType& searchKey)
+{
+	if (n <= 0)
+		return 0;
+
+	const KeyType* base = keys;
+	while (n > 1) {
+		int half = n / 2;
+		base = (base[half] < searchKey) ? base + half : base;
+		n -= half;
+	}
+	return (int) (base - keys) + (*base < searchKey);
+}
+
+/*
+ * Count the keys that are <= searchKey in a sorted key array.
+ * This generic version is a plain binary search; int keys have a
+ * vectorized overload below.
+ */
+template <class KeyType>
+static int countLessEqual(const KeyType* keys, int n, const KeyType& searchKey)
+{
+	return upperBound(keys, n, searchKey);
+}
+
+/*
+ * Count the keys that are < searchKey in a sorted key array.
+ */
+template <class KeyType>
+static int countLess(const KeyType* keys, int n, const KeyType& searchKey)
+{
+	return lowerBound(keys, n, searchKey);
+}
+
+// number of keys the vector compare in countLessEqual() finishes with
+static const int SIMD_WINDOW = 16;
+
+/*
+ * Count the int keys that are <= searchKey in a sorted key array.
+ * Since the keys are sorted this is the same as upperBound(). The range is
+ * first halved branch-free until at most SIMD_WINDOW keys are left, and the
+ * window is then finished by comparing a whole vector of keys at once and
+ * summing the comparison masks lane by lane (each "greater" lane is -1).
+ * AVX2 compares 8 keys per step, SSE2 (always present on x86-64) 4 keys;
+ * other targets finish with the scalar upperBound().
+ * @param keys[IN] the sorted key array
+ * @param n[IN] the number of keys
+ * @param searchKey[IN] the key to search for
+ * @return the number of keys <= searchKey
+ */
+static int countLessEqual(const int* keys, int n, int searchKey)
+{
+	// every key in front of base is <= searchKey and every key
+	// from base + n on is > searchKey
+	const int* base = keys;
+	while (n > SIMD_WINDOW) {
+		int half = n / 2;
+		base = (base[half] <= searchKey) ? base + half : base;
+		n -= half;
+	}
+	int count = (int) (base - keys);
+
+#if defined(__AVX2__)
+	int i = 0;
+	__m256i k = _mm256_set1_epi32(searchKey);
+	__m256i gt = _mm256_setzero_si256();
+	for (; i + 8 <= n; i += 8) {
+		__m256i v = _mm256_loadu_si256((const __m256i*) (base + i));
+		gt = _mm256_sub_epi32(gt, _mm256_cmpgt_epi32(v, k));
+	}
+	__m128i sum = _mm_add_epi32(_mm256_castsi256_si128(gt), _mm256_extracti128_si256(gt, 1));
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4e));
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xb1));
+	return count + i - _mm_cvtsi128_si32(sum) + upperBound(base + i, n - i, searchKey);
+#elif defined(__SSE2__)
+	int i = 0;
+	__m128i k = _mm_set1_epi32(searchKey);
+	__m128i gt = _mm_setzero_si128();
+	for (; i + 4 <= n; i += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i*) (base + i));
+		gt = _mm_sub_epi32(gt, _mm_cmpgt_epi32(v, k));
+	}
+	gt = _mm_add_epi32(gt, _mm_shuffle_epi32(gt, 0x4e));
+	gt = _mm_add_epi32(gt, _mm_shuffle_epi32(gt, 0xb1));
+	return count + i - _mm_cvtsi128_si32(gt) + upperBound(base + i, n - i, searchKey);
+#else
+	return count + upperBound(base, n, searchKey);
+#endif
+}
+
+/*
+ * Count the int keys that are < searchKey: the number of keys < k
+ * is the number of keys <= k - 1, so the vectorized search is reused.
+ */
+static int countLess(const int* keys, int n, int searchKey)
+{
+	return (searchKey == INT_MIN) ? 0 : countLessEqual(keys, n, searchKey - 1);
+}
+
+//
+// helper functions for the compressed leaf format
+//
+
+// bytes of slack kept after the packed arrays so that unpackBits() can
+// always load a whole 64-bit word
+static const int PACK_SLACK = sizeof(unsigned long long);
+
+// number of bits needed to store v
+static int bitsFor(unsigned int v)
+{
+	return v ? 32 - __builtin_clz(v) : 0;
+}
+
+// number of bytes needed for n packed values of the given width
+static int packedBytes(int n, int bits)
+{
+	return (n * bits + 7) / 8;
+}
+
+/*
+ * Compute the packing parameters and the page size needed to store
+ * n (key, rid) entries in the compressed leaf format.
+ * @param keys[IN] the sorted keys
+ * @param rids[IN] the RecordIds
+ * @param n[IN] the number of entries
+ * @param ch[OUT] the packing parameters
+ * @return the number of bytes the compressed page needs
+ */
+static int compressedSize(const int* keys, const RecordId* rids, int n, compressedLeafHeader& ch)
+{
+	PageId minPid = 0, maxPid = 0;
+	int maxSid = 0;
+
+	if (n > 0) {
+		minPid = maxPid = rids[0].pid;
+		for (int i = 1; i < n; i++) {
+			if (rids[i].pid < minPid) minPid = rids[i].pid;
+			if (rids[i].pid > maxPid) maxPid = rids[i].pid;
+		}
+		for (int i = 0; i < n; i++)
+			if (rids[i].sid > maxSid) maxSid = rids[i].sid;
+	}
+
+	// the keys are sorted, so the first and last key give the range
+	ch.keyBase = (n > 0) ? keys[0] : 0;
+	ch.pidBase = minPid;
+	ch.keyBits = bitsFor((n > 0) ? (unsigned int) keys[n - 1] - (unsigned int) keys[0] : 0);
+	ch.pidBits = bitsFor((unsigned int) maxPid - (unsigned int) minPid);
+	ch.sidBits = bitsFor((unsigned int) maxSid);
+	ch.unused = 0;
+
+	return sizeof(nodeHeader) + sizeof(compressedLeafHeader)
+	     + packedBytes(n, ch.keyBits) + packedBytes(n, ch.pidBits)
+	     + packedBytes(n, ch.sidBits) + PACK_SLACK;
+}
+
+/*
+ * Only int keys can be packed (KeyTraits<KeyType>::packable). The generic
+ * version is never called since setCompressed() refuses other key types.
+ */
+template <class KeyType>
+static int compressedSize(const KeyType*, const RecordId*, int, compressedLeafHeader&)
+{
+	return INT_MAX;
+}
+
+/*
+ * Bit-pack (values[i] - base) for n values of the given width into dst.
+ * @return the number of bytes written
+ */
+static int packBits(char* dst, const int* values, int stride, int n, int bits, unsigned int base)
+{
+	int bytes = packedBytes(n, bits);
+	memset(dst, 0, bytes);
+	for (int i = 0; i < n; i++) {
+		unsigned long long v = (unsigned int) values[i * stride] - base;
+		long long pos = (long long) i * bits;
+		for (int b = 0; b < bits; b += 8, pos += 8) {
+			// write up to 8 bits per step, they may straddle two bytes
+			int take = (bits - b < 8) ? bits - b : 8;
+			unsigned int chunk = (unsigned int) ((v >> b) & ((1u << take) - 1)) << (pos & 7);
+			dst[pos >> 3] |= (char) (chunk & 0xff);
+			if ((pos & 7) + take > 8)
+				dst[(pos >> 3) + 1] |= (char) (chunk >> 8);
+		}
+	}
+	return bytes;
+}
+
+/*
+ * Unpack n values of the given width from src and add base.
+ * Every iteration is an independent, branch-free 64-bit load, shift and
+ * mask, so the compiler can vectorize the loop (with gathers under AVX2).
+ * @return the number of bytes read
+ */
+static int unpackBits(const char* src, int* values, int stride, int n, int bits, unsigned int base)
+{
+	unsigned long long mask = (bits == 0) ? 0 : ((1ULL << bits) - 1);
+	for (int i = 0; i < n; i++) {
+		long long pos = (long long) i * bits;
+		unsigned long long w;
+		memcpy(&w, src + (pos >> 3), sizeof(w));
+		values[i * stride] = (int) (base + (unsigned int) ((w >> (pos & 7)) & mask));
+	}
+	return packedBytes(n, bits);
+}
+
+// pack / unpack the keys of a compressed leaf (int keys only)
+static int packKeys(char* dst, const int* keys, int n, const compressedLeafHeader& ch)
+{
+	return packBits(dst, keys, 1, n, ch.keyBits, ch.keyBase);
+}
+
+static int unpackKeys(const char* src, int* keys, int n, const compressedLeafHeader& ch)
+{
+	return unpackBits(src, keys, 1, n, ch.keyBits, ch.keyBase);
+}
+
+template <class KeyType>
+static int packKeys(char*, const KeyType*, int, const compressedLeafHeader&)
+{
+	return 0;
+}
+
+template <class KeyType>
+static int unpackKeys(const char*, KeyType*, int, const compressedLeafHeader&)
+{
+	return 0;
+}
+
+/*
+ * Check whether a leaf split before entry mid keeps every key in one node
+ * and leaves both halves within a page.
+ * @param keys[IN] all keys of the node being split, sorted
+ * @param rids[IN] all RecordIds of the node being split
+ * @param total[IN] the number of entries
+ * @param mid[IN] the first entry of the sibling
+ * @param compressed[IN] true if the halves use the compressed format
+ * @param maxKeys[IN] the most entries a node can take
+ * @return true if the node can be split before mid
+ */
+template <class KeyType>
+static bool splitFits(const KeyType* keys, const RecordId* rids, int total, int mid, bool compressed, int maxKeys)
+{
+	if (mid < 1 || mid >= total || keys[mid - 1] == keys[mid])
+		return false;
+	if (mid > maxKeys || total - mid > maxKeys)
+		return false;
+
+	if (!compressed)
+		return true;
+
+	compressedLeafHeader ch;
+	return compressedSize(keys, rids, mid, ch) <= PageFile::PAGE_SIZE &&
+	       compressedSize(keys + mid, rids + mid, total - mid, ch) <= PageFile::PAGE_SIZE;
+}
+
+template <class KeyType>
+BTLeafNodeT<KeyType>::BTLeafNodeT() {
+	memset(buffer, 0, PageFile::PAGE_SIZE);
+	header()->flags = NODE_LEAF;
+	header()->nextPid = -1;
+	header()->prevPid = -1;
+	compressed = false;
+}
+
+template <class KeyType>
+BTLeafNodeT<KeyType>::~BTLeafNodeT() {
+}
+
+/*
+ * Read the content of the node from the page pid in the PageFile pf.
+ * @param pid[IN] the PageId to read
+ * @param pf[IN] PageFile to read from
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+template <class KeyType>
+RC BTLeafNodeT<KeyType>::read(PageId pid, const PageFile& pf)
+{
+	RC rc = pf.read(pid, buffer);
+	if (rc < 0)
+		return rc;
+
+	// the leaves of a clustered index hold tuples (see BTTupleNodeT)
+	if (header()->flags & NODE_TUPLES)
+		return RC_INVALID_FILE_FORMAT;
+
+	compressed = (header()->flags & NODE_COMPRESSED) != 0;
+	if (compressed)
+		decode();
+
+	return 0;
+}
+
+/*
+ * Write the content of the node to the page pid in the PageFile pf.
+ * @param pid[IN] the PageId to write to
+ * @param pf[IN] PageFile to write to
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+template <class KeyType>
+RC BTLeafNodeT<KeyType>::write(PageId pid, PageFile& pf)
+{
+	if (compressed)
+		encode();
+
+	RC rc = pf.write(pid, buffer);
+	return rc;
+}
+
+/*
+ * Switch an empty node between the plain and the compressed page format.
+ * @param compressed[IN] true for the compressed format
+ * @return 0 if successful. Return an error code if the node is not empty.
+ */
+template <class KeyType>
+RC BTLeafNodeT<KeyType>::setCompressed(bool compressed)
+{
+	if (getKeyCount() != 0)
+		return RC_INVALID_ATTRIBUTE;
+	if (compressed && !KeyTraits<KeyType>::packable)
+		return RC_INVALID_ATTRIBUTE;
+
+	this->compressed = compressed;
+	if (compressed)
+		header()->flags |= NODE_COMPRESSED;
+	else
+		header()->flags &= ~NODE_COMPRESSED;
+
+	return 0;
+}
+
+/*
+ * Return whether the node uses the compressed page format.
+ * @return true if the node is compressed
+ */
+template <class KeyType>
+bool BTLeafNodeT<KeyType>::isCompressed()
+{
+	return compressed;
+}
+
+/*
+ * Pack the decoded entries of a compressed node into the buffer.
+ */
+template <class KeyType>
+void BTLeafNodeT<KeyType>::encode()
+{
+	int n = getKeyCount();
+	compressedLeafHeader ch;
+	compressedSize(ckeys, crids, n, ch);
+
+	char* p = buffer + sizeof(nodeHeader);
+	memcpy(p, &ch, sizeof(ch));
+	p += sizeof(ch);
+
+	p += packKeys(p, ckeys, n, ch);
+	p += packBits(p, &crids[0].pid, 2, n, ch.pidBits, ch.pidBase);
+	p += packBits(p, &crids[0].sid, 2, n, ch.sidBits, 0);
+
+	// clear the rest of the page so that stale bytes are not written out
+	memset(p, 0, buffer + PageFile::PAGE_SIZE - p);
+}
+
+/*
+ * Unpack the entries of a compressed node from the buffer.
+ */
+template <class KeyType>
+void BTLeafNodeT<KeyType>::decode()
+{
+	int n = getKeyCount();
+	compressedLeafHeader ch;
+
+	const char* p = buffer + sizeof(nodeHeader);
+	memcpy(&ch, p, sizeof(ch));
+	p += sizeof(ch);
+
+	p += unpackKeys(p, ckeys, n, ch);
+	p += unpackBits(p, &crids[0].pid, 2, n, ch.pidBits, ch.pidBase);
+	p += unpackBits(p, &crids[0].sid, 2, n, ch.sidBits, 0);
+}
+
+/*
+ * Return the node header stored at the beginning of the buffer.
+ */
+template <class KeyType>
+nodeHeader* BTLeafNodeT<KeyType>::header()
+{
+	return (nodeHeader*) buffer;
+}
+
+/*
+ * Return a pointer to the key array.
+ */
+template <class KeyType>
+KeyType* BTLeafNodeT<KeyType>::keys()
+{
+	if (compressed)
+		return ckeys;
+	return (KeyType*) (buffer + sizeof(nodeHeader));
+}
+
+/*
+ * Return a pointer to the RecordId array.
+ */
+template <class KeyType>
+RecordId* BTLeafNodeT<KeyType>::rids()
+{
+	if (compressed)
+		return crids;
+	return (RecordId*) (buffer + sizeof(nodeHeader) + MAX_KEYS * sizeof(KeyType));
+}
+
+/*
+ * Return the number of keys stored in the node.
+ * @return the number of keys in the node
+ */
+template <class KeyType>
+int BTLeafNodeT<KeyType>::getKeyCount()
+{
+	return header()->keyCount;
+}
+
+/*
+ * Set the number of keys stored in the node.
+ * @param count[IN] the new key count
+ */
+template <class KeyType>
+void BTLeafNodeT<KeyType>::setKeyCount(int count)
+{
+	header()->keyCount = count;
+}
+
+/*
+ * Insert a (key, rid) pair to the node.
+ * @param key[IN] the key to insert
+ * @param rid[IN] the RecordId to insert
+ * @return 0 if successful. Return an error code if the node is full.
+ */
+template <class KeyType>
+RC BTLeafNodeT<KeyType>::insert(const KeyType& key, const RecordId& rid)
+{
+	int count = getKeyCount();
+	if (count >= (compressed ? MAX_COMPRESSED_KEYS : MAX_KEYS))
+		return RC_NODE_FULL;
+
+	// insert after any entries with an equal key so duplicates keep load order
+	KeyType* k = keys();
+	RecordId* r = rids();
+	int eid = upperBound(k, count, key);
+
+	// shift the larger entries over by one and drop the new entry in place
+	memmove(k + eid + 1, k + eid, (count - eid) * sizeof(KeyType));
+	memmove(r + eid + 1, r + eid, (count - eid) * sizeof(RecordId));
+	k[eid] = key;
+	r[eid] = rid;
+
+	// a compressed node is full once the packed entries outgrow the page
+	compressedLeafHeader ch;
+	if (compressed && compressedSize(k, r, count + 1, ch) > PageFile::PAGE_SIZE) {
+		memmove(k + eid, k + eid + 1, (count - eid) * sizeof(KeyType));
+		memmove(r + eid, r + eid + 1, (count - eid) * sizeof(RecordId));
+		return RC_NODE_FULL;
+	}
+
+	setKeyCount(count + 1);
+
+	return 0;
+}
+
+/*
+ * Insert the (key, rid) pair to the node
+ * and split the node half and half with sibling.
+ * The first key of the sibling node is returned in siblingKey.
+ * @param key[IN] the key to insert.
+ * @param rid[IN] the RecordId to insert.
+ * @param sibling[IN] the sibling node to split with. This node MUST be EMPTY when this function is called.
+ * @param siblingKey[OUT] the first key in the sibling node after split.
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+template <class KeyType>
+RC BTLeafNodeT<KeyType>::insertAndSplit(const KeyType& key, const RecordId& rid,
+                                       BTLeafNodeT& sibling, KeyType& siblingKey)
+{
+	int numKeys = getKeyCount();
+
+	// Only a full node is split, and only into an empty sibling.
+	// (A compressed node can be full with fewer than MAX_KEYS entries.)
+	if (!compressed && numKeys < MAX_KEYS)
+		return RC_INVALID_FILE_FORMAT;
+	else if (sibling.getKeyCount() != 0)
+		return RC_INVALID_ATTRIBUTE;
+
+	// the sibling uses the same page format as this node
+	sibling.setCompressed(compressed);
+
+	// Lay out all entries plus the new one in order, then hand the upper
+	// half to the sibling.
+	KeyType allKeys[MAX_COMPRESSED_KEYS + 1];
+	RecordId allRids[MAX_COMPRESSED_KEYS + 1];
+	KeyType* k = keys();
+	RecordId* r = rids();
+	int eid = upperBound(k, numKeys, key);
+
+	memcpy(allKeys, k, eid * sizeof(KeyType));
+	allKeys[eid] = key;
+	memcpy(allKeys + eid + 1, k + eid, (numKeys - eid) * sizeof(KeyType));
+
+	memcpy(allRids, r, eid * sizeof(RecordId));
+	allRids[eid] = rid;
+	memcpy(allRids + eid + 1, r + eid, (numKeys - eid) * sizeof(RecordId));
+
+	int total = numKeys + 1;
+	int mid = (total + 1) / 2;
+
+	// A compressed half can still overflow when the new entry widens the
+	// packed key or pid range; move the split point away from that half.
+	if (compressed) {
+		compressedLeafHeader ch;
+		while (mid > 1 && compressedSize(allKeys, allRids, mid, ch) > PageFile::PAGE_SIZE)
+			mid--;
+		while (mid < total - 1 &&
+		       compressedSize(allKeys + mid, allRids + mid, total - mid, ch) > PageFile::PAGE_SIZE)
+			mid++;
+	}
+
+	// Do not split a run of equal keys: the descent follows an equal
+	// separator to the right, so every entry of a key has to be in one
+	// leaf. Take the nearest run boundary where both halves still fit.
+	// Runs are short (see POSTING_THRESHOLD), so one is always close by.
+	if (allKeys[mid - 1] == allKeys[mid]) {
+		int maxKeys = compressed ? MAX_COMPRESSED_KEYS : MAX_KEYS;
+		for (int d = 1; d < total; d++) {
+			if (splitFits(allKeys, allRids, total, mid - d, compressed, maxKeys)) {
+				mid -= d;
+				break;
+			}
+			if (splitFits(allKeys, allRids, total, mid + d, compressed, maxKeys)) {
+				mid += d;
+				break;
+			}
+		}
+	}
+
+	memcpy(k, allKeys, mid * sizeof(KeyType));
+	memcpy(r, allRids, mid * sizeof(RecordId));
+	setKeyCount(mid);
+
+	memcpy(sibling.keys(), allKeys + mid, (total - mid) * sizeof(KeyType));
+	memcpy(sibling.rids(), allRids + mid, (total - mid) * sizeof(RecordId));
+	sibling.setKeyCount(total - mid);
+
+	// The sibling takes over our old next pointer. The caller is responsible
+	// for linking this node and the sibling (and the leaf after it) to each
+	// other once the sibling has a PageId.
+	sibling.setNextNodePtr(getNextNodePtr());
+
+	siblingKey = allKeys[mid];
+	return 0;
+}
+
+/*
+ * Replace the n entries starting at eid, which all hold the same key,
+ * by a single entry with the same key and the given RecordId.
+ * @param eid[IN] the first entry of the run
+ * @param n[IN] the number of entries in the run
+ * @param rid[IN] the RecordId of the remaining entry
+ * @return 0 if successful. RC_NODE_FULL if a compressed node cannot
+ *         pack the new RecordId; the node is then left unchanged.
+ */
+template <class KeyType>
+RC BTLeafNodeT<KeyType>::collapseRun(int eid, int n, const RecordId& rid)
+{
+	int count = getKeyCount();
+	if (eid < 0 || n < 1 || eid + n > count)
+		return RC_INVALID_CURSOR;
+
+	KeyType* k = keys();
+	RecordId* r = rids();
+
+	// the new RecordId may widen the packed pid range of a compressed node
+	if (compressed) {
+		KeyType newKeys[MAX_COMPRESSED_KEYS];
+		RecordId newRids[MAX_COMPRESSED_KEYS];
+		compressedLeafHeader ch;
+
+		memcpy(newKeys, k, (eid + 1) * sizeof(KeyType));
+		memcpy(newKeys + eid + 1, k + eid + n, (count - eid - n) * sizeof(KeyType));
+		memcpy(newRids, r, eid * sizeof(RecordId));
+		newRids[eid] = rid;
+		memcpy(newRids + eid + 1, r + eid + n, (count - eid - n) * sizeof(RecordId));
+		if (compressedSize(newKeys, newRids, count - n + 1, ch) > PageFile::PAGE_SIZE)
+			return RC_NODE_FULL;
+	}
+
+	r[eid] = rid;
+	memmove(k + eid + 1, k + eid + n, (count - eid - n) * sizeof(KeyType));
+	memmove(r + eid + 1, r + eid + n, (count - eid - n) * sizeof(RecordId));
+	setKeyCount(count - n + 1);
+
+	return 0;
+}
+
+/*
+ * Remove the eid entry from the node.
+ * Fewer entries never need more bits, so a compressed node always fits.
+ * @param eid[IN] the entry number to remove
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+template <class KeyType>
+RC BTLeafNodeT<KeyType>::remove(int eid)
+{
+	int count = getKeyCount();
+	if (eid < 0 || eid >= count)
+		return RC_INVALID_CURSOR;
+
+	KeyType* k = keys();
+	RecordId* r = rids();
+	memmove(k + eid, k + eid + 1, (count - eid - 1) * sizeof(KeyType));
+	memmove(r + eid, r + eid + 1, (count - eid - 1) * sizeof(RecordId));
+	setKeyCount(count - 1);
+
+	return 0;
+}
+
+/*
+ * Move all entries of the right sibling to the end of this node.
+ * @param right[IN] the right sibling, with keys not smaller than ours
+ * @return 0 if successful. RC_NODE_FULL if the entries do not fit;
+ *         the node is then left unchanged.
+ */
+template <class KeyType>
+RC BTLeafNodeT<KeyType>::merge(BTLeafNodeT& right)
+{
+	int count = getKeyCount();
+	int rcount = right.getKeyCount();
+
+	if (compressed != right.compressed)
+		return RC_INVALID_ATTRIBUTE;
+	if (count + rcount > (compressed ? MAX_COMPRESSED_KEYS : MAX_KEYS))
+		return RC_NODE_FULL;
+
+	// the entries behind count are unused, so a failed merge changes nothing
+	KeyType* k = keys();
+	RecordId* r = rids();
+	memcpy(k + count, right.keys(), rcount * sizeof(KeyType));
+	memcpy(r + count, right.rids(), rcount * sizeof(RecordId));
+
+	compressedLeafHeader ch;
+	if (compressed && compressedSize(k, r, count + rcount, ch) > PageFile::PAGE_SIZE)
+		return RC_NODE_FULL;
+
+	setKeyCount(count + rcount);
+	setNextNodePtr(right.getNextNodePtr());
+
+	return 0;
+}
+
+/*
+ * Even out the entries of this node and its right sibling.
+ * @param right[IN] the right sibling, with keys not smaller than ours
+ * @param rightKey[OUT] the first key of the sibling afterwards
+ * @return 0 if successful. RC_NODE_FULL if no split point fits;
+ *         both nodes are then left unchanged.
+ */
+template <class KeyType>
+RC BTLeafNodeT<KeyType>::redistribute(BTLeafNodeT& right, KeyType& rightKey)
+{
+	int count = getKeyCount();
+	int rcount = right.getKeyCount();
+	int total = count + rcount;
+
+	if (compressed != right.compressed)
+		return RC_INVALID_ATTRIBUTE;
+
+	KeyType allKeys[2 * MAX_COMPRESSED_KEYS];
+	RecordId allRids[2 * MAX_COMPRESSED_KEYS];
+	memcpy(allKeys, keys(), count * sizeof(KeyType));
+	memcpy(allKeys + count, right.keys(), rcount * sizeof(KeyType));
+	memcpy(allRids, rids(), count * sizeof(RecordId));
+	memcpy(allRids + count, right.rids(), rcount * sizeof(RecordId));
+
+	// take the run boundary closest to the middle where both halves fit
+	int maxKeys = compressed ? MAX_COMPRESSED_KEYS : MAX_KEYS;
+	int mid = total / 2;
+	int d;
+	for (d = 0; d < total; d++) {
+		if (splitFits(allKeys, allRids, total, mid - d, compressed, maxKeys)) {
+			mid -= d;
+			break;
+		}
+		if (splitFits(allKeys, allRids, total, mid + d, compressed, maxKeys)) {
+			mid += d;
+			break;
+		}
+	}
+	if (d == total)
+		return RC_NODE_FULL;
+
+	memcpy(keys(), allKeys, mid * sizeof(KeyType));
+	memcpy(rids(), allRids, mid * sizeof(RecordId));
+	setKeyCount(mid);
+
+	memcpy(right.keys(), allKeys + mid, (total - mid) * sizeof(KeyType));
+	memcpy(right.rids(), allRids + mid, (total - mid) * sizeof(RecordId));
+	right.setKeyCount(total - mid);
+
+	rightKey = allKeys[mid];
+	return 0;
+}
+
+/*
+ * Return whether the node is less than half full.
+ * A compressed node is measured by the bytes its entries pack into.
+ * @return true if the node is underfull
+ */
+template <class KeyType>
+bool BTLeafNodeT<KeyType>::isUnderfull()
+{
+	if (!compressed)
+		return getKeyCount() < MAX_KEYS / 2;
+
+	compressedLeafHeader ch;
+	return compressedSize(ckeys, crids, getKeyCount(), ch) < PageFile::PAGE_SIZE / 2;
+}
+
+/**
+ * If searchKey exists in the node, set eid to the index entry
+ * with searchKey and return 0. If not, set eid to the index entry
+ * immediately after the largest index key that is smaller than searchKey,
+ * and return the error code RC_NO_SUCH_RECORD.
+ * Remember that keys inside a B+tree node are always kept sorted.
+ * @param searchKey[IN] the key to search for.
+ * @param eid[OUT] the index entry number with searchKey or immediately
+                   behind the largest key smaller than searchKey.
+ * @return 0 if searchKey is found. Otherwise return an error code.
+ */
+template <class KeyType>
+RC BTLeafNodeT<KeyType>::locate(const KeyType& searchKey, int& eid)
+{
+	int count = getKeyCount();
+	KeyType* k = keys();
+
+	// only the key array is touched
+	eid = countLess(k, count, searchKey);
+	if (eid < count && k[eid] == searchKey)
+		return 0;
+
+	return RC_NO_SUCH_RECORD;
+}
+
+/*
+ * Read the (key, rid) pair from the eid entry.
+ * @param eid[IN] the entry number to read the (key, rid) pair from
+ * @param key[OUT] the key from the entry
+ * @param rid[OUT] the RecordId from the entry
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+template <class KeyType>
+RC BTLeafNodeT<KeyType>::readLEntry(int eid, KeyType& key, RecordId& rid)
+{
+	if (eid < 0 || eid >= getKeyCount())
+		return RC_INVALID_CURSOR;
+
+	key = keys()[eid];
+	rid = rids()[eid];
+
+	return 0;
+}
+
+/*
+ * Return the entries from eid to the end of the node as two arrays.
+ * @param eid[IN] the first entry to return
+ * @param keys[OUT] the keys from entry eid on
+ * @param rids[OUT] the RecordIds from entry eid on
+ * @return the number of entries from eid on (0 if eid is past the end)
+ */
+template <class KeyType>
+int BTLeafNodeT<KeyType>::readLEntries(int eid, const KeyType*& keys, const RecordId*& rids)
+{
+	int count = getKeyCount();
+	if (eid < 0 || eid >= count)
+		return 0;
+
+	keys = this->keys() + eid;
+	rids = this->rids() + eid;
+
+	return count - eid;
+}
+
+/*
+ * Return the pid of the next slibling node.
+ * @return the PageId of the next sibling node
+ */
+template <class KeyType>
+PageId BTLeafNodeT<KeyType>::getNextNodePtr()
+{
+	return header()->nextPid;
+}
+
+/*
+ * Set the pid of the next slibling node.
+ * @param pid[IN] the PageId of the next sibling node
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+template <class KeyType>
+RC BTLeafNodeT<KeyType>::setNextNodePtr(PageId pid)
+{
+	// -1 marks the last leaf of the tree
+	if (pid < -1)
+		return RC_INVALID_PID;
+
+	header()->nextPid = pid;
+
+	return 0;
+}
+
+/*
+ * Return the pid of the previous slibling node.
+ * @return the PageId of the previous sibling node (-1 for the first leaf)
+ */
+template <class KeyType>
+PageId BTLeafNodeT<KeyType>::getPrevNodePtr()
+{
+	return header()->prevPid;
+}
+
+/*
+ * Set the pid of the previous slibling node.
+ * @param pid[IN] the PageId of the previous sibling node
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+template <class KeyType>
+RC BTLeafNodeT<KeyType>::setPrevNodePtr(PageId pid)
+{
+	// -1 marks the first leaf of the tree
+	if (pid < -1)
+		return RC_INVALID_PID;
+
+	header()->prevPid = pid;
+
+	return 0;
+}
+
+template <class KeyType>
+BTNonLeafNodeT<KeyType>::BTNonLeafNodeT() {
+	memset(buffer, 0, PageFile::PAGE_SIZE);
+	header()->level = 1;
+	header()->nextPid = -1;
+	header()->prevPid = -1;
+}
+
+template <class KeyType>
+BTNonLeafNodeT<KeyType>::~BTNonLeafNodeT() {
+}
+
+/*
+ * Read the content of the node from the page pid in the PageFile pf.
+ * @param pid[IN] the PageId to read
+ * @param pf[IN] PageFile to read from
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+template <class KeyType>
+RC BTNonLeafNodeT<KeyType>::read(PageId pid, const PageFile& pf)
+{
+	RC rc = pf.read(pid, buffer);
+	return rc;
+}
+
+/*
+ * Write the content of the node to the page pid in the PageFile pf.
+ * @param pid[IN] the PageId to write to
+ * @param pf[IN] PageFile to write to
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+template <class KeyType>
+RC BTNonLeafNodeT<KeyType>::write(PageId pid, PageFile& pf)
+{
+	RC rc = pf.write(pid, buffer);
+	return rc;
+}
+
+/*
+ * Return the node header stored at the beginning of the buffer.
+ */
+template <class KeyType>
+nodeHeader* BTNonLeafNodeT<KeyType>::header()
+{
+	return (nodeHeader*) buffer;
+}
+
+/*
+ * Return a pointer to the separator key array in the buffer.
+ */
+template <class KeyType>
+KeyType* BTNonLeafNodeT<KeyType>::keys()
+{
+	return (KeyType*) (buffer + sizeof(nodeHeader));
+}
+
+/*
+ * Return a pointer to the child PageId array in the buffer.
+ */
+template <class KeyType>
+PageId* BTNonLeafNodeT<KeyType>::pids()
+{
+	return (PageId*) (buffer + sizeof(nodeHeader) + maxKeys() * sizeof(KeyType));
+}
+
+/*
+ * Return a pointer to the child row count array of a counted node.
+ */
+template <class KeyType>
+int* BTNonLeafNodeT<KeyType>::counts()
+{
+	return (int*) (pids() + MAX_COUNTED_KEYS + 1);
+}
+
+/*
+ * Return the number of keys the node can hold in its format.
+ */
+template <class KeyType>
+int BTNonLeafNodeT<KeyType>::maxKeys()
+{
+	return (header()->flags & NODE_COUNTED) ? MAX_COUNTED_KEYS : MAX_KEYS;
+}
+
+/*
+ * Read the key from the node based on index.
+ * @param index[IN] the index to read the key from
+ * @param key[OUT] the key from the entry
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+template <class KeyType>
+RC BTNonLeafNodeT<KeyType>::readNLEntry(int index, KeyType& key)
+{
+	if (index < 0 || index >= getKeyCount())
+		return RC_INVALID_CURSOR;
+
+	key = keys()[index];
+
+	return 0;
+}
+
+/*
+ * Return the number of keys stored in the node.
+ * @return the number of keys in the node
+ */
+template <class KeyType>
+int BTNonLeafNodeT<KeyType>::getKeyCount()
+{
+	return header()->keyCount;
+}
+
+/*
+ * Set the number of keys stored in the node.
+ * @param count[IN] the new key count
+ */
+template <class KeyType>
+void BTNonLeafNodeT<KeyType>::setKeyCount(int count)
+{
+	header()->keyCount = count;
+}
+
+/*
+ * Return the level of the node in the tree (leaves are at level 0).
+ * @return the level of the node
+ */
+template <class KeyType>
+int BTNonLeafNodeT<KeyType>::getLevel()
+{
+	return header()->level;
+}
+
+/*
+ * Set the level of the node in the tree.
+ * @param level[IN] the level of the node (must be > 0 for non-leaf nodes)
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+template <class KeyType>
+RC BTNonLeafNodeT<KeyType>::setLevel(int level)
+{
+	if (level <= 0)
+		return RC_INVALID_ATTRIBUTE;
+
+	header()->level = level;
+	return 0;
+}
+
+/*
+ * Return the pid of the right sibling on the same level.
+ * @return the PageId of the right sibling (-1 if none)
+ */
+template <class KeyType>
+PageId BTNonLeafNodeT<KeyType>::getNextNodePtr()
+{
+	return header()->nextPid;
+}
+
+/*
+ * Set the pid of the right sibling on the same level.
+ * @param pid[IN] the PageId of the right sibling, -1 for none
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+template <class KeyType>
+RC BTNonLeafNodeT<KeyType>::setNextNodePtr(PageId pid)
+{
+	if (pid < -1)
+		return RC_INVALID_PID;
+
+	header()->nextPid = pid;
+
+	return 0;
+}
+
+/*
+ * Return whether pid is one of the children of the node.
+ * @param pid[IN] the child PageId to look for
+ * @return true if the node points to pid
+ */
+template <class KeyType>
+bool BTNonLeafNodeT<KeyType>::hasChildPtr(PageId pid)
+{
+	return getChildIndex(pid) >= 0;
+}
+
+/*
+ * Return the position of the child pid in the node.
+ * @param pid[IN] the child PageId to look for
+ * @return the index of pid (0 to getKeyCount()), -1 if not a child
+ */
+template <class KeyType>
+int BTNonLeafNodeT<KeyType>::getChildIndex(PageId pid)
+{
+	PageId* p = pids();
+	for (int i = 0; i <= getKeyCount(); i++)
+		if (p[i] == pid)
+			return i;
+
+	return -1;
+}
+
+/*
+ * Read the child PageId at the given position.
+ * @param index[IN] the position of the child (0 to getKeyCount())
+ * @param pid[OUT] the child PageId
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+template <class KeyType>
+RC BTNonLeafNodeT<KeyType>::readChildPtr(int index, PageId& pid)
+{
+	if (index < 0 || index > getKeyCount())
+		return RC_INVALID_CURSOR;
+
+	pid = pids()[index];
+
+	return 0;
+}
+
+/*
+ * Replace the separator key at the given position.
+ * @param index[IN] the position of the key
+ * @param key[IN] the new key
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+template <class KeyType>
+RC BTNonLeafNodeT<KeyType>::setKey(int index, const KeyType& key)
+{
+	if (index < 0 || index >= getKeyCount())
+		return RC_INVALID_CURSOR;
+
+	keys()[index] = key;
+
+	return 0;
+}
+
+/*
+ * Remove the key at index and the child PageId behind it.
+ * @param index[IN] the position of the key
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+template <class KeyType>
+RC BTNonLeafNodeT<KeyType>::remove(int index)
+{
+	int count = getKeyCount();
+	if (index < 0 || index >= count)
+		return RC_INVALID_CURSOR;
+
+	KeyType* k = keys();
+	PageId* p = pids();
+	memmove(k + index, k + index + 1, (count - index - 1) * sizeof(KeyType));
+	memmove(p + index + 1, p + index + 2, (count - index - 1) * sizeof(PageId));
+	if (isCounted())
+		memmove(counts() + index + 1, counts() + index + 2, (count - index - 1) * sizeof(int));
+	setKeyCount(count - 1);
+
+	return 0;
+}
+
+/*
+ * Move midKey and all entries of the right sibling to the end of this node.
+ * @param midKey[IN] the separator of the two nodes in the parent
+ * @param right[IN] the right sibling
+ * @return 0 if successful. RC_NODE_FULL if the entries do not fit;
+ *         the node is then left unchanged.
+ */
+template <class KeyType>
+RC BTNonLeafNodeT<KeyType>::merge(const KeyType& midKey, BTNonLeafNodeT& right)
+{
+	int count = getKeyCount();
+	int rcount = right.getKeyCount();
+	if (count + rcount + 1 > maxKeys())
+		return RC_NODE_FULL;
+
+	KeyType* k = keys();
+	PageId* p = pids();
+	k[count] = midKey;
+	memcpy(k + count + 1, right.keys(), rcount * sizeof(KeyType));
+	memcpy(p + count + 1, right.pids(), (rcount + 1) * sizeof(PageId));
+	if (isCounted())
+		memcpy(counts() + count + 1, right.counts(), (rcount + 1) * sizeof(int));
+	setKeyCount(count + rcount + 1);
+	setNextNodePtr(right.getNextNodePtr());
+
+	return 0;
+}
+
+/*
+ * Even out the entries of this node and its right sibling, rotating
+ * them through the separator in the parent.
+ * @param midKey[IN] the separator of the two nodes in the parent
+ * @param right[IN] the right sibling
+ * @param newMidKey[OUT] the separator to put into the parent instead
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+template <class KeyType>
+RC BTNonLeafNodeT<KeyType>::redistribute(const KeyType& midKey, BTNonLeafNodeT& right, KeyType& newMidKey)
+{
+	int count = getKeyCount();
+	int rcount = right.getKeyCount();
+	int total = count + rcount + 1;
+
+	// lay out the keys of both nodes with midKey between them
+	KeyType allKeys[2 * MAX_KEYS + 1];
+	PageId allPids[2 * MAX_KEYS + 2];
+	int allCounts[2 * MAX_KEYS + 2];
+	memcpy(allKeys, keys(), count * sizeof(KeyType));
+	allKeys[count] = midKey;
+	memcpy(allKeys + count + 1, right.keys(), rcount * sizeof(KeyType));
+	memcpy(allPids, pids(), (count + 1) * sizeof(PageId));
+	memcpy(allPids + count + 1, right.pids(), (rcount + 1) * sizeof(PageId));
+	if (isCounted()) {
+		memcpy(allCounts, counts(), (count + 1) * sizeof(int));
+		memcpy(allCounts + count + 1, right.counts(), (rcount + 1) * sizeof(int));
+	}
+
+	// the key in the middle goes up to the parent
+	int mid = total / 2;
+	if (mid > maxKeys() || total - mid - 1 > maxKeys())
+		return RC_NODE_FULL;
+
+	memcpy(keys(), allKeys, mid * sizeof(KeyType));
+	memcpy(pids(), allPids, (mid + 1) * sizeof(PageId));
+	setKeyCount(mid);
+
+	memcpy(right.keys(), allKeys + mid + 1, (total - mid - 1) * sizeof(KeyType));
+	memcpy(right.pids(), allPids + mid + 1, (total - mid) * sizeof(PageId));
+	right.setKeyCount(total - mid - 1);
+
+	if (isCounted()) {
+		memcpy(counts(), allCounts, (mid + 1) * sizeof(int));
+		memcpy(right.counts(), allCounts + mid + 1, (total - mid) * sizeof(int));
+	}
+
+	newMidKey = allKeys[mid];
+	return 0;
+}
+
+/*
+ * Return whether the node is less than half full.
+ * @return true if the node is underfull
+ */
+template <class KeyType>
+bool BTNonLeafNodeT<KeyType>::isUnderfull()
+{
+	return getKeyCount() < maxKeys() / 2;
+}
+
+/*
+ * Make the node keep the row count of every child.
+ * @param counted[IN] true for a counted node
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+template <class KeyType>
+RC BTNonLeafNodeT<KeyType>::setCounted(bool counted)
+{
+	if (getKeyCount() != 0)
+		return RC_INVALID_ATTRIBUTE;
+
+	if (counted)
+		header()->flags |= NODE_COUNTED;
+	else
+		header()->flags &= ~NODE_COUNTED;
+
+	return 0;
+}
+
+/*
+ * Return whether the node keeps the row counts of its children.
+ */
+template <class KeyType>
+bool BTNonLeafNodeT<KeyType>::isCounted()
+{
+	return (header()->flags & NODE_COUNTED) != 0;
+}
+
+/*
+ * Read the number of rows under the child at the given position.
+ * @param index[IN] the position of the child (0 to getKeyCount())
+ * @param count[OUT] the number of rows
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+template <class KeyType>
+RC BTNonLeafNodeT<KeyType>::readChildCount(int index, int& count)
+{
+	if (!isCounted())
+		return RC_INVALID_ATTRIBUTE;
+	if (index < 0 || index > getKeyCount())
+		return RC_INVALID_CURSOR;
+
+	count = counts()[index];
+
+	return 0;
+}
+
+/*
+ * Set the number of rows under the child at the given position.
+ * @param index[IN] the position of the child (0 to getKeyCount())
+ * @param count[IN] the number of rows
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+template <class KeyType>
+RC BTNonLeafNodeT<KeyType>::setChildCount(int index, int count)
+{
+	if (!isCounted())
+		return RC_INVALID_ATTRIBUTE;
+	if (index < 0 || index > getKeyCount())
+		return RC_INVALID_CURSOR;
+
+	counts()[index] = count;
+
+	return 0;
+}
+
+/*
+ * Return the number of rows under the node (0 if it is not counted).
+ */
+template <class KeyType>
+int BTNonLeafNodeT<KeyType>::getTotalCount()
+{
+	if (!isCounted())
+		return 0;
+
+	int total = 0;
+	int* c = counts();
+	for (int i = 0; i <= getKeyCount(); i++)
+		total += c[i];
+
+	return total;
+}
+
+/*
+ * Return the entry number a new key goes to: behind the keys <= key, or
+ * right behind the child left if that comes earlier among equal keys.
+ * @param key[IN] the key to insert
+ * @param left[IN] the child the new key goes behind
+ * @return the entry number of the new key
+ */
+template <class KeyType>
+int BTNonLeafNodeT<KeyType>::insertPosition(const KeyType& key, PageId left)
+{
+	KeyType* k = keys();
+	PageId* p = pids();
+	int eid = upperBound(k, getKeyCount(), key);
+
+	while (eid > 0 && k[eid - 1] == key && p[eid] != left)
+		eid--;
+	return eid;
+}
+
+/*
+ * Insert a (key, pid) pair to the node behind the child left.
+ * @param key[IN] the key to insert
+ * @param pid[IN] the PageId to insert
+ * @param left[IN] the child that pid was split from
+ * @return 0 if successful. Return an error code if the node is full.
+ */
+template <class KeyType>
+RC BTNonLeafNodeT<KeyType>::insert(const KeyType& key, PageId pid, PageId left)
+{
+	int currentCount = getKeyCount();
+	if (currentCount >= maxKeys())
+		return RC_NODE_FULL;
+
+	KeyType* k = keys();
+	PageId* p = pids();
+	int eid = insertPosition(key, left);
+
+	// key eid is followed by pid eid + 1
+	memmove(k + eid + 1, k + eid, (currentCount - eid) * sizeof(KeyType));
+	memmove(p + eid + 2, p + eid + 1, (currentCount - eid) * sizeof(PageId));
+	k[eid] = key;
+	p[eid + 1] = pid;
+	if (isCounted()) {
+		int* c = counts();
+		memmove(c + eid + 2, c + eid + 1, (currentCount - eid) * sizeof(int));
+		c[eid + 1] = 0;
+	}
+	setKeyCount(currentCount + 1);
+
+	return 0;
+}
+
+/*
+ * Insert the (key, pid) pair to the node
+ * and split the node half and half with sibling.
+ * The middle key after the split is returned in midKey.
+ * @param key[IN] the key to insert
+ * @param pid[IN] the PageId to insert
+ * @param left[IN] the child that pid was split from
+ * @param sibling[IN] the sibling node to split with. This node MUST be empty when this function is called.
+ * @param midKey[OUT] the key in the middle after the split. This key should be inserted to the parent node.
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+template <class KeyType>
+RC BTNonLeafNodeT<KeyType>::insertAndSplit(const KeyType& key, PageId pid, PageId left, BTNonLeafNodeT& sibling, KeyType& midKey)
+{
+	int currentCount = getKeyCount();
+
+	if (currentCount < maxKeys())
+		return RC_INVALID_FILE_FORMAT;
+	else if (sibling.getKeyCount() != 0)
+		return RC_INVALID_ATTRIBUTE;
+
+	// Lay out all maxKeys() + 1 keys and maxKeys() + 2 pids in order.
+	KeyType allKeys[MAX_KEYS + 1];
+	PageId allPids[MAX_KEYS + 2];
+	int allCounts[MAX_KEYS + 2];
+	KeyType* k = keys();
+	PageId* p = pids();
+	int eid = insertPosition(key, left);
+
+	memcpy(allKeys, k, eid * sizeof(KeyType));
+	allKeys[eid] = key;
+	memcpy(allKeys + eid + 1, k + eid, (currentCount - eid) * sizeof(KeyType));
+
+	memcpy(allPids, p, (eid + 1) * sizeof(PageId));
+	allPids[eid + 1] = pid;
+	memcpy(allPids + eid + 2, p + eid + 1, (currentCount - eid) * sizeof(PageId));
+
+	bool counted = isCounted();
+	if (counted) {
+		int* c = counts();
+		memcpy(allCounts, c, (eid + 1) * sizeof(int));
+		allCounts[eid + 1] = 0;
+		memcpy(allCounts + eid + 2, c + eid + 1, (currentCount - eid) * sizeof(int));
+	}
+
+	// The middle key moves up to the parent; the pid behind it becomes the
+	// leftmost child of the sibling.
+	int total = currentCount + 1;
+	int mid = total / 2;
+
+	midKey = allKeys[mid];
+
+	memcpy(k, allKeys, mid * sizeof(KeyType));
+	memcpy(p, allPids, (mid + 1) * sizeof(PageId));
+	setKeyCount(mid);
+
+	sibling.setLevel(getLevel());
+	sibling.setCounted(counted);
+	memcpy(sibling.keys(), allKeys + mid + 1, (total - mid - 1) * sizeof(KeyType));
+	memcpy(sibling.pids(), allPids + mid + 1, (total - mid) * sizeof(PageId));
+	sibling.setKeyCount(total - mid - 1);
+
+	if (counted) {
+		memcpy(counts(), allCounts, (mid + 1) * sizeof(int));
+		memcpy(sibling.counts(), allCounts + mid + 1, (total - mid) * sizeof(int));
+	}
+
+	// the sibling goes between this node and its old right sibling
+	sibling.setNextNodePtr(getNextNodePtr());
+
+	return 0;
+}
+
+/*
+ * Given the searchKey, find the child-node pointer to follow and
+ * output it in pid.
+ * @param searchKey[IN] the searchKey that is being looked up.
+ * @param pid[OUT] the pointer to the child node to follow.
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+template <class KeyType>
+RC BTNonLeafNodeT<KeyType>::locateChildPtr(const KeyType& searchKey, PageId& pid)
+{
+	// follow the pid behind the last key that is <= searchKey
+	pid = pids()[countLessEqual(keys(), getKeyCount(), searchKey)];
+
+	return 0;
+}
+
+/*
+ * Initialize the root node with (pid1, key, pid2).
+ * @param pid1[IN] the first PageId to insert
+ * @param key[IN] the key that should be inserted between the two PageIds
+ * @param pid2[IN] the PageId to insert behind the key
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+template <class KeyType>
+RC BTNonLeafNodeT<KeyType>::initializeRoot(PageId pid1, const KeyType& key, PageId pid2)
+{
+	// keep the level and format, the caller sets them before or after
+	// initializing
+	int level = getLevel();
+	short flags = header()->flags;
+	memset(buffer, 0, PageFile::PAGE_SIZE);
+	header()->level = level;
+	header()->flags = flags;
+	header()->nextPid = -1;
+	header()->prevPid = -1;
+
+	pids()[0] = pid1;
+	keys()[0] = key;
+	pids()[1] = pid2;
+	setKeyCount(1);
+
+	return 0;
+}
+
+BTPostingNode::BTPostingNode() {
 	memset(buffer, 0, PageFile::PAGE_SIZE);
+	header()->flags = NODE_POSTING;
+	header()->nextPid = -1;
+	header()->prevPid = -1;
 }
 
 /*
- * Read the content of the node from the page pid in the PageFile pf.
+ * Read the content of the page pid in the PageFile pf.
  * @param pid[IN] the PageId to read
  * @param pf[IN] PageFile to read from
  * @return 0 if successful. Return an error code if there is an error.
  */
-RC BTLeafNode::read(PageId pid, const PageFile& pf)
+RC BTPostingNode::read(PageId pid, const PageFile& pf)
 {
 	RC rc = pf.read(pid, buffer);
-	return rc; 
+	if (rc < 0)
+		return rc;
+
+	if (!(header()->flags & NODE_POSTING))
+		return RC_INVALID_FILE_FORMAT;
+
+	return 0;
 }
-    
+
 /*
  * Write the content of the node to the page pid in the PageFile pf.
  * @param pid[IN] the PageId to write to
  * @param pf[IN] PageFile to write to
  * @return 0 if successful. Return an error code if there is an error.
  */
-RC BTLeafNode::write(PageId pid, PageFile& pf)
+RC BTPostingNode::write(PageId pid, PageFile& pf)
 {
 	RC rc = pf.write(pid, buffer);
 	return rc;
 }
 
 /*
- * Return the number of keys stored in the node.
- * @return the number of keys in the node
+ * Return the node header stored at the beginning of the buffer.
  */
-int BTLeafNode::getKeyCount()
+nodeHeader* BTPostingNode::header()
 {
-	/*
-	 * Note: Leaf nodes just need to read the keys for each entry
-	 * in the node (until empty or until page_id pointer)
-	*/
-	int numKeys = 0;
-	int key;
-	RecordId rid;
-	RC rc;
-
-	for (int eid = 0; eid < MAX_KEYS; eid++) {
-		rc = readLEntry(eid, key, rid);
-		if (key < 0 || rc < 0)
-			break;
-		else numKeys++;
-	}
-
-	return numKeys;
+	return (nodeHeader*) buffer;
 }
 
 /*
- * Insert a (key, rid) pair to the node.
- * @param key[IN] the key to insert
- * @param rid[IN] the RecordId to insert
- * @return 0 if successful. Return an error code if the node is full.
+ * Return a pointer to the RecordId array in the buffer.
  */
-RC BTLeafNode::insert(int key, const RecordId& rid)
+RecordId* BTPostingNode::rids()
 {
-	int count = getKeyCount();
-	// ISSUE: If the node is full, do we need to split or just report error?
-	if (count >= MAX_KEYS)
-    	return RC_NODE_FULL;
-
-	int eid;
-	RC rc = locate(key, eid);
-	if (rc < 0) {
-		if (rc != RC_NO_SUCH_RECORD)
-    		return rc;
-    	else eid = count;
-    }
-
-    int* bufferPtr = (int*) buffer;
-
-    // Moves keys over by one index, and inserts new values into correct position.
-	for (int key_index = count * ENTRY_SIZE - 1; key_index >= eid * ENTRY_SIZE; key_index--) {
-    	buffer[key_index + ENTRY_SIZE] = buffer[key_index];
-    	if (key_index == eid * ENTRY_SIZE) {
-    		*(bufferPtr + key_index) = key;
-			*(bufferPtr + key_index + sizeof(int)) = rid.pid;
-			*(bufferPtr + key_index + sizeof(int) + sizeof(int)) = rid.sid;
-    	}
-	}
-
-	return 0;
+	return (RecordId*) (buffer + sizeof(nodeHeader));
 }
 
 /*
- * Insert the (key, rid) pair to the node
- * and split the node half and half with sibling.
- * The first key of the sibling node is returned in siblingKey.
- * @param key[IN] the key to insert.
- * @param rid[IN] the RecordId to insert.
- * @param sibling[IN] the sibling node to split with. This node MUST be EMPTY when this function is called.
- * @param siblingKey[OUT] the first key in the sibling node after split.
- * @return 0 if successful. Return an error code if there is an error.
+ * Append a RecordId to the page.
+ * @param rid[IN] the RecordId to append
+ * @return 0 if successful. RC_NODE_FULL if the page is full.
  */
-RC BTLeafNode::insertAndSplit(int key, const RecordId& rid, 
-                              BTLeafNode& sibling, int& siblingKey)
+RC BTPostingNode::append(const RecordId& rid)
 {
+	int count = getRidCount();
+	if (count >= MAX_RIDS)
+		return RC_NODE_FULL;
 
-	RC rc;
-	int numKeys = getKeyCount();
-
-	// Check to make sure the node is full. Otherwise, error.
-	// Check to make sure sibling node is empty. Otherwise, error.
-	// ISSUE: Can we make the assumption that we would only want to split if the node was full?
-	if (numKeys < MAX_KEYS)
-		return RC_INVALID_FILE_FORMAT;
-    else if (sibling.getKeyCount() != 0)
-		return RC_INVALID_ATTRIBUTE;
-	
-	// Get the index of the middle of the full node, to prepare to split node in half with sibling.
-	int sib_key;
-	RecordId sib_rid;
-	int mid = (numKeys + 1) / 2;
-	int* bufferPtr = (int*) buffer;
-
-	// Move second half of current node into sibling node; delete moved data from original node.
-	for (int key_index = mid * ENTRY_SIZE; key_index < numKeys * ENTRY_SIZE; key_index++) {
-		// read from original node, insert into sibling node
-		rc = readLEntry(key_index/ENTRY_SIZE, sib_key, sib_rid);
-		if (rc < 0) return rc;
-		rc = sibling.insert(sib_key, sib_rid);
-		if (rc < 0) return rc;
-
-		// delete from original node
-		*(bufferPtr + key_index) = -1;
-		*(bufferPtr + key_index + sizeof(int)) = -1;
-		*(bufferPtr + key_index + sizeof(int) + sizeof(int)) = -1;
-	}
-
-	// Set sibling's pointer to next sibling node.
-	sibling.setNextNodePtr(getNextNodePtr());
-	// Set current node's pointer to new sibling node.
-	// setNextNodePtr(endPid()-1);
-
-	// Insert new (key, rid) pair into correct position
-	// ISSUE: Do we need to push up values to parent node?
-	if (key < siblingKey) {
-		insert(key, rid);
-	} else sibling.insert(key, rid);
+	rids()[count] = rid;
+	header()->keyCount = count + 1;
 
 	return 0;
 }
 
-/**
- * If searchKey exists in the node, set eid to the index entry
- * with searchKey and return 0. If not, set eid to the index entry
- * immediately after the largest index key that is smaller than searchKey,
- * and return the error code RC_NO_SUCH_RECORD.
- * Remember that keys inside a B+tree node are always kept sorted.
- * @param searchKey[IN] the key to search for.
- * @param eid[OUT] the index entry number with searchKey or immediately
-                   behind the largest key smaller than searchKey.
- * @return 0 if searchKey is found. Otherwise return an error code.
+/*
+ * Remove the eid entry from the page.
+ * @param eid[IN] the entry number to remove
+ * @return 0 if successful. Return an error code if there is an error.
  */
-RC BTLeafNode::locate(int searchKey, int& eid)
-{
-	int key;
-	RecordId rid;
-	RC rc;
-
-	// Reads each entry in node until the key of that (key, rid) pair is >= desired key.
-	for(eid = 0; eid < getKeyCount(); eid++) {
-		rc = readLEntry(eid, key, rid);
-		if (rc < 0)
-			return rc;
-		else if (key == searchKey)
-			return 0;
-		else if (key > searchKey) {
-			eid--;
-			return RC_NO_SUCH_RECORD;
-		}
-	}
+RC BTPostingNode::remove(int eid)
+{
+	int count = getRidCount();
+	if (eid < 0 || eid >= count)
+		return RC_INVALID_CURSOR;
 
-	eid = -1;
-	return RC_NO_SUCH_RECORD;
+	RecordId* r = rids();
+	memmove(r + eid, r + eid + 1, (count - eid - 1) * sizeof(RecordId));
+	header()->keyCount = count - 1;
+
+	return 0;
 }
 
 /*
- * Read the (key, rid) pair from the eid entry.
- * @param eid[IN] the entry number to read the (key, rid) pair from
- * @param key[OUT] the key from the entry
+ * Read the RecordId from the eid entry.
+ * @param eid[IN] the entry number to read
  * @param rid[OUT] the RecordId from the entry
  * @return 0 if successful. Return an error code if there is an error.
  */
-RC BTLeafNode::readLEntry(int eid, int& key, RecordId& rid)
-{ 
-	// NOTE: eid is the index of the leaf node
+RC BTPostingNode::readEntry(int eid, RecordId& rid)
+{
+	if (eid < 0 || eid >= getRidCount())
+		return RC_INVALID_CURSOR;
 
-	// TODO: Not really sure if we should be using buffer or another
-	// structure?? HERE, buffer represents the leaf node.
+	rid = rids()[eid];
 
-	// TODO: Make a struct for (key, rid)?
-	// Right now, it assumes that we assume key, rid, sid are adjacent
-	// values in an array.
+	return 0;
+}
 
-	// Is it necessary to check if eid exceeds number of keys in page?
+/*
+ * Return all RecordIds of the page as an array.
+ * @param rids[OUT] the RecordIds of the page
+ * @return the number of RecordIds in the page
+ */
+int BTPostingNode::readEntries(const RecordId*& rids)
+{
+	rids = this->rids();
+	return getRidCount();
+}
 
-	if (eid < 0 || eid >= MAX_KEYS)
-		return RC_INVALID_CURSOR;
+/*
+ * Return the number of RecordIds stored in the page.
+ */
+int BTPostingNode::getRidCount()
+{
+	return header()->keyCount;
+}
 
-	int* bufferPtr = (int*) buffer;
-	int index = eid * ENTRY_SIZE;
+/*
+ * Return the pid of the next page of the list (-1 for the last page).
+ */
+PageId BTPostingNode::getNextNodePtr()
+{
+	return header()->nextPid;
+}
 
-	key = *(bufferPtr + index);
-	rid.pid = *(bufferPtr + index + sizeof(PageId));
-	if (rid.pid < 0)
+/*
+ * Set the pid of the next page of the list.
+ * @param pid[IN] the PageId of the next page, -1 for none
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTPostingNode::setNextNodePtr(PageId pid)
+{
+	if (pid < -1)
 		return RC_INVALID_PID;
-	rid.sid = *(bufferPtr + index + sizeof(PageId) + sizeof(int));
-	if (rid.sid < 0)
-		return RC_INVALID_RID;
 
-	return 0; 
+	header()->nextPid = pid;
+
+	return 0;
 }
 
 /*
- * Return the pid of the next slibling node.
- * @return the PageId of the next sibling node 
+ * Return the pid of the last page of the list (first page only).
  */
-PageId BTLeafNode::getNextNodePtr()
+PageId BTPostingNode::getLastNodePtr()
 {
-	int* p = (int*) buffer;
-	p = p + (MAX_KEYS * ENTRY_SIZE);
-	return *p;
+	return header()->prevPid;
 }
 
 /*
- * Set the pid of the next slibling node.
- * @param pid[IN] the PageId of the next sibling node 
+ * Set the pid of the last page of the list (first page only).
+ * @param pid[IN] the PageId of the last page
  * @return 0 if successful. Return an error code if there is an error.
  */
-RC BTLeafNode::setNextNodePtr(PageId pid)
+RC BTPostingNode::setLastNodePtr(PageId pid)
 {
-	// TODO: Check if pid is null? Not really sure what errors arise.
 	if (pid < 0)
 		return RC_INVALID_PID;
 
-	// Set pointer to end of buffer (node). Set node pointer to pid.
-	int* p = (int*) buffer;
-	p = p + (MAX_KEYS * ENTRY_SIZE);
-	*p = pid;
+	header()->prevPid = pid;
 
 	return 0;
 }
 
-BTNonLeafNode::BTNonLeafNode() {
+/*
+ * Return the number of RecordIds in the whole list (first page only).
+ * The length is kept in the int behind the RecordId array.
+ */
+int BTPostingNode::getTotalCount()
+{
+	return *(int*) (buffer + sizeof(nodeHeader) + MAX_RIDS * sizeof(RecordId));
+}
+
+/*
+ * Set the number of RecordIds in the whole list (first page only).
+ * @param count[IN] the length of the list
+ */
+void BTPostingNode::setTotalCount(int count)
+{
+	*(int*) (buffer + sizeof(nodeHeader) + MAX_RIDS * sizeof(RecordId)) = count;
+}
+
+template <class KeyType>
+BTTupleNodeT<KeyType>::BTTupleNodeT() {
 	memset(buffer, 0, PageFile::PAGE_SIZE);
+	header()->flags = NODE_LEAF | NODE_TUPLES;
+	header()->nextPid = -1;
+	header()->prevPid = -1;
+	tupleHeader()->dataStart = PageFile::PAGE_SIZE;
+}
+
+/*
+ * Return the bytes a tuple with the given value takes in a page.
+ * @param value[IN] the value of the tuple
+ * @return the size of the tuple, its slot included
+ */
+template <class KeyType>
+int BTTupleNodeT<KeyType>::tupleSize(const std::string& value)
+{
+	// the value ends at its first NUL byte, as in a RecordFile
+	int len = (int) strnlen(value.c_str(), MAX_VALUE_LENGTH);
+	return sizeof(unsigned short) + sizeof(KeyType) + 1 + len;
 }
 
 /*
  * Read the content of the node from the page pid in the PageFile pf.
  * @param pid[IN] the PageId to read
  * @param pf[IN] PageFile to read from
- * @return 0 if successful. Return an error code if there is an error.
+ * @return 0 if successful. RC_INVALID_FILE_FORMAT if the page is not
+ *         the leaf of a clustered index.
  */
-RC BTNonLeafNode::read(PageId pid, const PageFile& pf)
+template <class KeyType>
+RC BTTupleNodeT<KeyType>::read(PageId pid, const PageFile& pf)
 {
 	RC rc = pf.read(pid, buffer);
-	return rc; 
+	if (rc < 0)
+		return rc;
+
+	if (!(header()->flags & NODE_TUPLES))
+		return RC_INVALID_FILE_FORMAT;
+
+	return 0;
 }
-    
+
 /*
  * Write the content of the node to the page pid in the PageFile pf.
  * @param pid[IN] the PageId to write to
  * @param pf[IN] PageFile to write to
  * @return 0 if successful. Return an error code if there is an error.
  */
-RC BTNonLeafNode::write(PageId pid, PageFile& pf)
+template <class KeyType>
+RC BTTupleNodeT<KeyType>::write(PageId pid, PageFile& pf)
 {
-	RC rc = pf.write(pid, buffer);
-	return rc;
+	return pf.write(pid, buffer);
 }
 
 /*
- * Read the key from the node based on index.
- * @param index[IN] the index to read the key from
- * @param key[OUT] the key from the entry
- * @return 0 if successful. Return an error code if there is an error.
+ * Insert a tuple into the node, behind the tuples with the same key.
+ * @param key[IN] the key of the tuple
+ * @param value[IN] the value of the tuple
+ * @return 0 if successful. RC_NODE_FULL if the tuple does not fit.
  */
-RC BTNonLeafNode::readNLEntry(int index, int& key)
+template <class KeyType>
+RC BTTupleNodeT<KeyType>::insert(const KeyType& key, const std::string& value)
 {
-	// Is it necessary to check if eid exceeds number of keys in page?
-	if (index < 0 || index >= MAX_KEYS)
-		return RC_INVALID_CURSOR;
+	if (tupleSize(value) > getFreeSpace())
+		return RC_NODE_FULL;
+
+	// the first entry with a larger key
+	int lo = 0, hi = getKeyCount();
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		KeyType k;
+		readKey(mid, k);
+		if (key < k)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
 
-	// Sets ptr to index of key (indicated by index). Gets key value.
-	int* bufferPtr = (int*) buffer;
-	int total_index = index * ENTRY_SIZE + sizeof(PageId);
-	key = *(bufferPtr + total_index);
+	// the tuple goes behind the others, and its slot moves to lo
+	int count = getKeyCount();
+	int len = tupleSize(value) - sizeof(unsigned short) - sizeof(KeyType) - 1;
+	append(key, value.c_str(), len);
+	unsigned short* s = slots();
+	unsigned short off = s[count];
+	memmove(s + lo + 1, s + lo, (count - lo) * sizeof(unsigned short));
+	s[lo] = off;
 
-	return 0; 
+	return 0;
 }
 
 /*
- * Return the number of keys stored in the node.
- * @return the number of keys in the node
+ * Insert a tuple and move about half of the bytes of the node to sibling.
+ * @param key[IN] the key of the tuple
+ * @param value[IN] the value of the tuple
+ * @param sibling[IN] the sibling node to split with. This node MUST be EMPTY when this function is called.
+ * @param siblingKey[OUT] the first key in the sibling node after split.
+ * @return 0 if successful. Return an error code if there is an error.
  */
-int BTNonLeafNode::getKeyCount()
+template <class KeyType>
+RC BTTupleNodeT<KeyType>::insertAndSplit(const KeyType& key, const std::string& value, BTTupleNodeT& sibling, KeyType& siblingKey)
 {
-	/*Non-leaf nodes read every other key in the array for a key.*/
-	int numKeys = 0;
-	int key;
-	RC rc;
+	if (sibling.getKeyCount() != 0)
+		return RC_INVALID_ATTRIBUTE;
 
-	// Counts number of keys in node.
-	for (int pid = 0; pid < MAX_KEYS; pid++) {
-		rc = readNLEntry(pid, key);
-		if (key < 0) // TODO: THIS ASSUMES THAT KEYS CAN'T BE NEGATIVE
-			break; // NEED TO FIGURE OUT HOW TO MARK KEYS AS NON-EXISTENT
-		numKeys++;
+	// the tuples in key order with the new one behind its equal keys,
+	// read from a copy of the node
+	BTTupleNodeT<KeyType> old = *this;
+	char fresh[sizeof(KeyType) + 1 + MAX_VALUE_LENGTH];
+	const char* tuples[MAX_TUPLES + 1];
+	int left[MAX_TUPLES + 2];   // the bytes of the tuples in front of i
+	int count = getKeyCount();
+	int at;
+	KeyType k;
+
+	old.locate(key, at);
+	while (at < count && old.readKey(at, k) == 0 && !(key < k))
+		at++;
+
+	int len = tupleSize(value) - sizeof(unsigned short) - sizeof(KeyType) - 1;
+	memcpy(fresh, &key, sizeof(KeyType));
+	fresh[sizeof(KeyType)] = (char) len;
+	memcpy(fresh + sizeof(KeyType) + 1, value.data(), len);
+
+	int n = count + 1;
+	left[0] = 0;
+	for (int i = 0; i < n; i++) {
+		tuples[i] = (i < at) ? old.tuple(i) : (i == at) ? fresh : old.tuple(i - 1);
+		left[i + 1] = left[i] + sizeof(unsigned short) + sizeof(KeyType) + 1 + (unsigned char) tuples[i][sizeof(KeyType)];
+	}
+	int total = left[n];
+
+	// split where half of the bytes are on either side, or rather at the
+	// closest change of key that still leaves both halves in a page
+	int mid = 1;
+	while (mid < n - 1 && 2 * left[mid] < total)
+		mid++;
+	int split = -1;
+	for (int d = 0; d < n && split < 0; d++) {
+		for (int m = mid - d; m <= mid + d && split < 0; m += (d > 0) ? 2 * d : 1) {
+			if (m < 1 || m >= n || left[m] > CAPACITY || total - left[m] > CAPACITY)
+				continue;
+			KeyType a, b;
+			memcpy(&a, tuples[m - 1], sizeof(KeyType));
+			memcpy(&b, tuples[m], sizeof(KeyType));
+			if (a < b)
+				split = m;
+		}
+	}
+	if (split < 0)
+		split = mid;
+
+	clear();
+	for (int i = 0; i < n; i++) {
+		memcpy(&k, tuples[i], sizeof(KeyType));
+		BTTupleNodeT<KeyType>& to = (i < split) ? *this : sibling;
+		to.append(k, tuples[i] + sizeof(KeyType) + 1, (unsigned char) tuples[i][sizeof(KeyType)]);
 	}
 
-	return numKeys;
+	// The sibling takes over our old next pointer. The caller links the
+	// two nodes (and the leaf after the sibling) once the sibling has a
+	// PageId.
+	sibling.setNextNodePtr(getNextNodePtr());
+	sibling.readKey(0, siblingKey);
+	return 0;
 }
 
 /*
- * Insert a (key, pid) pair to the node.
- * @param key[IN] the key to insert
- * @param pid[IN] the PageId to insert
- * @return 0 if successful. Return an error code if the node is full.
+ * Find the first tuple with a key >= searchKey.
+ * @param searchKey[IN] the key to search for
+ * @param eid[OUT] the entry number of the tuple (getKeyCount() if every
+ *                 key is smaller)
+ * @return 0 if the tuple has searchKey. RC_NO_SUCH_RECORD otherwise.
  */
-RC BTNonLeafNode::insert(int key, PageId pid)
+template <class KeyType>
+RC BTTupleNodeT<KeyType>::locate(const KeyType& searchKey, int& eid)
 {
-	int currentCount = getKeyCount();
-	if (currentCount >= MAX_KEYS)
-    	return RC_NODE_FULL;
-
-    // CHECK THIS!! probs needs more error checking
-    int eid = 0;
-    non_leafNodeEntry * nl = (non_leafNodeEntry*)(buffer + sizeof(PageId));
-    for(int n = 0; n < currentCount; n++)
-    {
-    	if(nl->key > key)
-    		break;
-    	nl++;
-    	eid++;
-    }
+	int lo = 0, hi = getKeyCount();
+	KeyType k;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		readKey(mid, k);
+		if (k < searchKey)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
 
-    memmove(nl+1, nl, (currentCount - eid) * sizeof(non_leafNodeEntry));
+	eid = lo;
+	if (eid < getKeyCount() && readKey(eid, k) == 0 && k == searchKey)
+		return 0;
+	return RC_NO_SUCH_RECORD;
+}
 
-    nl->key = key;
-    nl->pid = pid;
+/*
+ * Read the tuple of entry eid.
+ * @param eid[IN] the entry number to read
+ * @param key[OUT] the key of the tuple
+ * @param value[OUT] the value of the tuple
+ * @return 0 if successful. RC_INVALID_CURSOR if there is no such entry.
+ */
+template <class KeyType>
+RC BTTupleNodeT<KeyType>::readTuple(int eid, KeyType& key, std::string& value)
+{
+	if (eid < 0 || eid >= getKeyCount())
+		return RC_INVALID_CURSOR;
 
+	const char* t = tuple(eid);
+	memcpy(&key, t, sizeof(KeyType));
+	value.assign(t + sizeof(KeyType) + 1, (unsigned char) t[sizeof(KeyType)]);
 	return 0;
 }
 
 /*
- * Insert the (key, pid) pair to the node
- * and split the node half and half with sibling.
- * The middle key after the split is returned in midKey.
- * @param key[IN] the key to insert
- * @param pid[IN] the PageId to insert
- * @param sibling[IN] the sibling node to split with. This node MUST be empty when this function is called.
- * @param midKey[OUT] the key in the middle after the split. This key should be inserted to the parent node.
- * @return 0 if successful. Return an error code if there is an error.
+ * Read the key of entry eid.
+ * @param eid[IN] the entry number to read
+ * @param key[OUT] the key of the tuple
+ * @return 0 if successful. RC_INVALID_CURSOR if there is no such entry.
  */
-RC BTNonLeafNode::insertAndSplit(int key, PageId pid, BTNonLeafNode& sibling, int& midKey)
-{ 
-
-	int currentCount = getKeyCount();
-	int midkey_eid = (currentCount - 1)/2;
-	int insert_key = 1;
-
+template <class KeyType>
+RC BTTupleNodeT<KeyType>::readKey(int eid, KeyType& key)
+{
+	if (eid < 0 || eid >= getKeyCount())
+		return RC_INVALID_CURSOR;
 
-	non_leafNodeEntry* first = (non_leafNodeEntry*) (buffer+sizeof(PageId));
-	non_leafNodeEntry* nl = first + midkey_eid;
-	non_leafNodeEntry* last = first + currentCount;
+	memcpy(&key, tuple(eid), sizeof(KeyType));
+	return 0;
+}
 
-    if(key> nl[1].key)
-    {
-    	midkey_eid++;
-    	nl++;
-    	insert_key = 0;
-    }
+/*
+ * Return the bytes left for more tuples in the node.
+ */
+template <class KeyType>
+int BTTupleNodeT<KeyType>::getFreeSpace()
+{
+	int slotEnd = sizeof(nodeHeader) + sizeof(tupleLeafHeader) + getKeyCount() * sizeof(unsigned short);
+	return tupleHeader()->dataStart - slotEnd;
+}
 
-    midKey = nl->key;
-    sibling.initializeRoot(nl->pid, nl[1].key, nl[1].pid);
-    for(int c = midkey_eid+2; c < currentCount; c++)
-    {
-    	sibling.insert(first[c].key, first[c].pid);
-    }
+/*
+ * Return the pid of the next sibling node.
+ */
+template <class KeyType>
+PageId BTTupleNodeT<KeyType>::getNextNodePtr()
+{
+	return header()->nextPid;
+}
 
-    memset(nl, 0, (currentCount - midkey_eid-1)* sizeof(non_leafNodeEntry));
+/*
+ * Set the pid of the next sibling node.
+ * @param pid[IN] the PageId of the next sibling node, -1 for none
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+template <class KeyType>
+RC BTTupleNodeT<KeyType>::setNextNodePtr(PageId pid)
+{
+	if (pid < -1)
+		return RC_INVALID_PID;
 
-	if(insert_key == 1)
-		insert(key, pid);
-	else
-		sibling.insert(key,pid);
+	header()->nextPid = pid;
+	return 0;
+}
 
-	return 0; 
+/*
+ * Return the pid of the previous sibling node.
+ */
+template <class KeyType>
+PageId BTTupleNodeT<KeyType>::getPrevNodePtr()
+{
+	return header()->prevPid;
 }
 
 /*
- * Given the searchKey, find the child-node pointer to follow and
- * output it in pid.
- * @param searchKey[IN] the searchKey that is being looked up.
- * @param pid[OUT] the pointer to the child node to follow.
+ * Set the pid of the previous sibling node.
+ * @param pid[IN] the PageId of the previous sibling node, -1 for none
  * @return 0 if successful. Return an error code if there is an error.
  */
-RC BTNonLeafNode::locateChildPtr(int searchKey, PageId& pid)
-{ 
-	//check for errors
-    PageId* page = (PageId*) buffer;
-   non_leafNodeEntry * nl = (non_leafNodeEntry*) (buffer + sizeof(PageId));
-    int key_count = getKeyCount();
-    for(int c = 0; c < key_count; c++)
-    {
-    	if(nl[c].key > searchKey){
-    		pid = (c==0) ? *page : nl[c-1].pid;
-    		return 0;
-    	}
-    }
-    pid = nl[key_count-1].pid;
-    return 0;
-
-
+template <class KeyType>
+RC BTTupleNodeT<KeyType>::setPrevNodePtr(PageId pid)
+{
+	if (pid < -1)
+		return RC_INVALID_PID;
 
- }
+	header()->prevPid = pid;
+	return 0;
+}
 
 /*
- * Initialize the root node with (pid1, key, pid2).
- * @param pid1[IN] the first PageId to insert
- * @param key[IN] the key that should be inserted between the two PageIds
- * @param pid2[IN] the PageId to insert behind the key
- * @return 0 if successful. Return an error code if there is an error.
+ * Return the number of tuples stored in the node.
  */
-RC BTNonLeafNode::initializeRoot(PageId pid1, int key, PageId pid2)
+template <class KeyType>
+int BTTupleNodeT<KeyType>::getKeyCount()
 {
-	//do we need to make sure buffer is empty?
-	memset(buffer, 0, PageFile::PAGE_SIZE);
+	return header()->keyCount;
+}
+
+template <class KeyType>
+nodeHeader* BTTupleNodeT<KeyType>::header()
+{
+	return (nodeHeader*) buffer;
+}
 
-	// TODO: Do we need to allocate memory for this?
-	int* ptr = (int*) buffer;
+template <class KeyType>
+tupleLeafHeader* BTTupleNodeT<KeyType>::tupleHeader()
+{
+	return (tupleLeafHeader*) (buffer + sizeof(nodeHeader));
+}
 
-	non_leafNodeEntry* nl = (non_leafNodeEntry*) (buffer+sizeof(PageId));
+template <class KeyType>
+unsigned short* BTTupleNodeT<KeyType>::slots()
+{
+	return (unsigned short*) (buffer + sizeof(nodeHeader) + sizeof(tupleLeafHeader));
+}
 
-	*ptr = pid1;
-	nl->pid = pid2;
-	nl->key = key;
+template <class KeyType>
+const char* BTTupleNodeT<KeyType>::tuple(int eid)
+{
+	return buffer + slots()[eid];
+}
 
-	/*(ptr + 1) = pid1;
-	*(ptr + 2) = key;
-	*(ptr + 3) = pid2; */
+/*
+ * Add a tuple behind the last one, with no check for space or order.
+ * @param key[IN] the key of the tuple
+ * @param value[IN] the value bytes
+ * @param len[IN] the number of value bytes
+ */
+template <class KeyType>
+void BTTupleNodeT<KeyType>::append(const KeyType& key, const char* value, int len)
+{
+	int off = tupleHeader()->dataStart - (sizeof(KeyType) + 1 + len);
+
+	memcpy(buffer + off, &key, sizeof(KeyType));
+	buffer[off + sizeof(KeyType)] = (char) len;
+	memcpy(buffer + off + sizeof(KeyType) + 1, value, len);
+	tupleHeader()->dataStart = off;
+	slots()[getKeyCount()] = off;
+	header()->keyCount++;
+}
 
-	return 0;
+/*
+ * Remove all tuples from the node; the sibling pointers stay.
+ */
+template <class KeyType>
+void BTTupleNodeT<KeyType>::clear()
+{
+	header()->keyCount = 0;
+	tupleHeader()->dataStart = PageFile::PAGE_SIZE;
 }
+
+// the key types the B+tree nodes are compiled for (see BTreeKey.h)
+template class BTLeafNodeT<int>;
+template class BTLeafNodeT<long long>;
+template class BTLeafNodeT<FixedString<16> >;
+template class BTLeafNodeT<FixedString<32> >;
+template class BTNonLeafNodeT<int>;
+template class BTNonLeafNodeT<long long>;
+template class BTNonLeafNodeT<FixedString<16> >;
+template class BTNonLeafNodeT<FixedString<32> >;
+template class BTTupleNodeT<int>;
+template class BTTupleNodeT<long long>;
+template class BTTupleNodeT<FixedString<16> >;
+template class BTTupleNodeT<FixedString<32> >;
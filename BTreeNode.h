@@ -13,35 +13,97 @@
 #include "RecordFile.h"
 #include "PageFile.h"
 #include "Bruinbase.h"
+#include "BTreeKey.h"
  #include <string.h>
  #include <cstdio>
 
  using namespace std;
 
+ /**
+  * The header stored at the beginning of every index node page.
+  * Keeping the key count here (instead of scanning for an "empty" key)
+  * makes sizing O(1) and leaves the whole int domain available for keys.
+  */
  typedef struct{
-    RecordId rid;
-    int key;
- } leafNodeEntry;
+    int    keyCount;  // number of keys stored in the node
+    short  level;     // 0 for a leaf, parent level = child level + 1
+    short  flags;     // NODE_* flags below
+    PageId nextPid;   // right sibling at the same level (-1 if none)
+    PageId prevPid;   // left sibling of a leaf (-1 if none)
+    int    lsn;       // log sequence number of the last change to the page
+ } nodeHeader;
 
+ // nodeHeader flags
+ const short NODE_LEAF       = 0x0001;
+ const short NODE_COMPRESSED = 0x0002;  // leaf uses the compressed format
+ const short NODE_POSTING    = 0x0004;  // page of a posting list
+ const short NODE_FREE       = 0x0008;  // page on the free list of the index
+ const short NODE_COUNTED    = 0x0010;  // non-leaf node keeps the row count of every child
+ const short NODE_TUPLES     = 0x0020;  // leaf of a clustered index (see BTTupleNodeT)
+
+ /**
+  * A key with many duplicates keeps its RecordIds in a posting list
+  * instead of one leaf entry per RecordId. The leaf then holds a single
+  * entry for the key whose RecordId is (first page of the list, POSTING_SID).
+  * No tuple has this sid, since slots run from 0 to RECORDS_PER_PAGE - 1.
+  */
+ const int POSTING_SID = RecordFile::RECORDS_PER_PAGE;
+
+ // a key with this many entries in a leaf moves them to a posting list
+ // on its next insert
+ const int POSTING_THRESHOLD = 8;
+
+ /**
+  * Return whether the RecordId of a leaf entry points to a posting list.
+  */
+ inline bool isPostingRid(const RecordId& rid) { return rid.sid == POSTING_SID; }
+
+ /**
+  * The header that follows nodeHeader in a compressed leaf page.
+  * Keys are stored as bit-packed offsets from keyBase, RecordId pids as
+  * bit-packed offsets from pidBase and sids as bit-packed values, each in
+  * its own array: [nodeHeader][compressedLeafHeader][keys][pids][sids]
+  */
+ typedef struct{
+    int           keyBase;  // smallest key in the node
+    PageId        pidBase;  // smallest RecordId pid in the node
+    unsigned char keyBits;  // bits per packed key offset
+    unsigned char pidBits;  // bits per packed pid offset
+    unsigned char sidBits;  // bits per packed sid
+    unsigned char unused;
+ } compressedLeafHeader;
+
+ /**
+  * The header that follows nodeHeader in a leaf of a clustered index.
+  * The slots (the offsets of the tuples, in key order) grow from the
+  * front of the page and the tuples from its end:
+  * [nodeHeader][tupleLeafHeader][slot 0 ... slot n-1] ... [tuples]
+  * A tuple is stored as [key][value length (1 byte)][value bytes].
+  */
  typedef struct{
-    int key;
-    PageId pid;
- } non_leafNodeEntry;
+    short dataStart;  // offset of the first tuple byte in the page
+    short unused;
+ } tupleLeafHeader;
 
 /**
- * BTLeafNode: The class representing a B+tree leaf node.
+ * BTLeafNodeT: The class representing a B+tree leaf node.
+ * The node is compiled separately for every key type (see BTreeKey.h),
+ * so key comparisons and the page layout are fixed at compile time.
  */
-class BTLeafNode {
+template <class KeyType>
+class BTLeafNodeT {
   public:
 
-    BTLeafNode();
-    ~BTLeafNode();
+    BTLeafNodeT();
+    ~BTLeafNodeT();
 
     // size of a leaf node entry
-    static const int ENTRY_SIZE = sizeof(RecordId) + sizeof(int);
+    static const int ENTRY_SIZE = sizeof(RecordId) + sizeof(KeyType);
     // number of record/key pairs per leaf node
-    //does it need to be a pointer to PageId?
-    static const int MAX_KEYS = (PageFile::PAGE_SIZE - sizeof(PageId)) / ENTRY_SIZE;
+    static const int MAX_KEYS = (PageFile::PAGE_SIZE - sizeof(nodeHeader)) / ENTRY_SIZE;
+    // upper bound on record/key pairs in a compressed leaf node
+    // (the actual number depends on how well the entries pack)
+    static const int MAX_COMPRESSED_KEYS = KeyTraits<KeyType>::packable ? 512 : MAX_KEYS;
 
     /**
     * Read the content of the node from the page pid in the PageFile pf.
@@ -66,7 +128,7 @@ class BTLeafNode {
     * @param rid[IN] the RecordId to insert
     * @return 0 if successful. Return an error code if the node is full.
     */
-    RC insert(int key, const RecordId& rid);
+    RC insert(const KeyType& key, const RecordId& rid);
 
    /**
     * Insert the (key, rid) pair to the node
@@ -79,7 +141,7 @@ class BTLeafNode {
     * @param siblingKey[OUT] the first key in the sibling node after split.
     * @return 0 if successful. Return an error code if there is an error.
     */
-    RC insertAndSplit(int key, const RecordId& rid, BTLeafNode& sibling, int& siblingKey);
+    RC insertAndSplit(const KeyType& key, const RecordId& rid, BTLeafNodeT& sibling, KeyType& siblingKey);
 
    /**
     * If searchKey exists in the node, set eid to the index entry
@@ -92,7 +154,7 @@ class BTLeafNode {
                       behind the largest key smaller than searchKey.
     * @return 0 if searchKey is found. If not, RC_NO_SEARCH_RECORD.
     */
-    RC locate(int searchKey, int& eid);
+    RC locate(const KeyType& searchKey, int& eid);
 
    /**
     * Read the (key, rid) pair from the eid entry.
@@ -101,7 +163,18 @@ class BTLeafNode {
     * @param rid[OUT] the RecordId from the slot
     * @return 0 if successful. Return an error code if there is an error.
     */
-    RC readLEntry(int eid, int& key, RecordId& rid);
+    RC readLEntry(int eid, KeyType& key, RecordId& rid);
+
+   /**
+    * Return the entries from eid to the end of the node as two arrays,
+    * so that a scan can go through a whole node without a call per entry.
+    * The pointers stay valid until the node is read or changed again.
+    * @param eid[IN] the first entry to return
+    * @param keys[OUT] the keys from entry eid on
+    * @param rids[OUT] the RecordIds from entry eid on
+    * @return the number of entries from eid on (0 if eid is past the end)
+    */
+    int readLEntries(int eid, const KeyType*& keys, const RecordId*& rids);
 
    /**
     * Return the pid of the next slibling node.
@@ -117,34 +190,155 @@ class BTLeafNode {
     */
     RC setNextNodePtr(PageId pid);
 
+   /**
+    * Return the pid of the previous sibling node.
+    * @return the PageId of the previous sibling node (-1 for the first leaf)
+    */
+    PageId getPrevNodePtr();
+
+   /**
+    * Set the previous sibling node PageId.
+    * @param pid[IN] the PageId of the previous sibling node
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC setPrevNodePtr(PageId pid);
+
    /**
     * Return the number of keys stored in the node.
     * @return the number of keys in the node
     */
     int getKeyCount();
 
+   /**
+    * Replace the n entries starting at eid, which all hold the same key,
+    * by a single entry with the same key and the given RecordId.
+    * Used to swap a run of duplicates for a pointer to their posting list.
+    * @param eid[IN] the first entry of the run
+    * @param n[IN] the number of entries in the run
+    * @param rid[IN] the RecordId of the remaining entry
+    * @return 0 if successful. RC_NODE_FULL if a compressed node cannot
+    *         pack the new RecordId; the node is then left unchanged.
+    */
+    RC collapseRun(int eid, int n, const RecordId& rid);
+
+   /**
+    * Remove the eid entry from the node.
+    * @param eid[IN] the entry number to remove
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC remove(int eid);
+
+   /**
+    * Move all entries of the right sibling to the end of this node.
+    * This node takes over the next pointer of the sibling; the caller
+    * points the leaf after the sibling back at this node.
+    * @param right[IN] the right sibling, with keys not smaller than ours
+    * @return 0 if successful. RC_NODE_FULL if the entries do not fit;
+    *         the node is then left unchanged.
+    */
+    RC merge(BTLeafNodeT& right);
+
+   /**
+    * Even out the entries of this node and its right sibling.
+    * Like insertAndSplit(), a run of equal keys stays in one node.
+    * @param right[IN] the right sibling, with keys not smaller than ours
+    * @param rightKey[OUT] the first key of the sibling afterwards
+    * @return 0 if successful. RC_NODE_FULL if no split point fits;
+    *         both nodes are then left unchanged.
+    */
+    RC redistribute(BTLeafNodeT& right, KeyType& rightKey);
+
+   /**
+    * Return whether the node is less than half full and should be
+    * merged with or refilled from a sibling.
+    * @return true if the node is underfull
+    */
+    bool isUnderfull();
+
+   /**
+    * Switch an empty node between the plain and the compressed page format.
+    * A compressed leaf stores its keys and RecordIds bit-packed against
+    * per-node bases, so dense keys give a much higher fanout.
+    * Only key types with KeyTraits<KeyType>::packable can be compressed.
+    * @param compressed[IN] true for the compressed format
+    * @return 0 if successful. Return an error code if the node is not empty
+    *         or the key type cannot be compressed.
+    */
+    RC setCompressed(bool compressed);
+
+   /**
+    * Return whether the node uses the compressed page format.
+    * @return true if the node is compressed
+    */
+    bool isCompressed();
+
   private:
+   /**
+    * Return the node header stored at the beginning of the buffer.
+    */
+    nodeHeader* header();
+
+   /**
+    * Set the number of keys stored in the node.
+    * @param count[IN] the new key count
+    */
+    void setKeyCount(int count);
+
+   /**
+    * Pack the decoded entries of a compressed node into the buffer.
+    */
+    void encode();
+
+   /**
+    * Unpack the entries of a compressed node from the buffer.
+    */
+    void decode();
+
+   /**
+    * Return a pointer to the key array.
+    * For a compressed node this is the decoded copy of the keys.
+    * Keys and RecordIds are stored as two separate arrays so that a
+    * search only pulls the cache lines holding keys.
+    * Page layout: [nodeHeader][key 0 ... key MAX_KEYS-1][rid 0 ... rid MAX_KEYS-1]
+    */
+    KeyType* keys();
+
+   /**
+    * Return a pointer to the RecordId array.
+    * For a compressed node this is the decoded copy of the RecordIds.
+    */
+    RecordId* rids();
+
    /**
     * The main memory buffer for loading the content of the disk page 
     * that contains the node.
     */
     char buffer[PageFile::PAGE_SIZE];
+
+    bool     compressed;                      // true if NODE_COMPRESSED is set
+    KeyType  ckeys[MAX_COMPRESSED_KEYS];      // decoded keys of a compressed node
+    RecordId crids[MAX_COMPRESSED_KEYS];      // decoded rids of a compressed node
 }; 
 
 
 /**
- * BTNonLeafNode: The class representing a B+tree nonleaf node.
+ * BTNonLeafNodeT: The class representing a B+tree nonleaf node.
  */
-class BTNonLeafNode {
+template <class KeyType>
+class BTNonLeafNodeT {
   public:
 
-    BTNonLeafNode();
-    ~BTNonLeafNode();
+    BTNonLeafNodeT();
+    ~BTNonLeafNodeT();
 
-    // size of a non-leaf node entry
-    static const int ENTRY_SIZE = 2 * sizeof(int);
+    // size of a non-leaf node entry (one separator key and one child PageId)
+    static const int ENTRY_SIZE = sizeof(KeyType) + sizeof(PageId);
     // number of pid/key pairs per non-leaf node
-    static const int MAX_KEYS = (PageFile::PAGE_SIZE - sizeof(PageId)) / ENTRY_SIZE;
+    // (the page also stores the leftmost child PageId)
+    static const int MAX_KEYS = (PageFile::PAGE_SIZE - sizeof(nodeHeader) - sizeof(PageId)) / ENTRY_SIZE;
+    // number of pid/key pairs per counted non-leaf node, which also stores
+    // the number of rows under every child
+    static const int MAX_COUNTED_KEYS = (PageFile::PAGE_SIZE - sizeof(nodeHeader) - sizeof(PageId) - sizeof(int)) / (ENTRY_SIZE + sizeof(int));
 
     /**
     * Read the content of the node from the page pid in the PageFile pf.
@@ -165,11 +359,16 @@ class BTNonLeafNode {
    /**
     * Insert a (key, pid) pair to the node.
     * Remember that all keys inside a B+tree node should be kept sorted.
+    * The pair goes behind the child left, which is behind the keys
+    * smaller than key; among equal keys (which a clustered index has
+    * when a run of keys goes on in the next leaf) the position of left
+    * decides.
     * @param key[IN] the key to insert
     * @param pid[IN] the PageId to insert
+    * @param left[IN] the child that pid was split from
     * @return 0 if successful. Return an error code if the node is full.
     */
-    RC insert(int key, PageId pid);
+    RC insert(const KeyType& key, PageId pid, PageId left);
 
    /**
     * Read the (pid, key) pair from the eid entry.
@@ -178,7 +377,7 @@ class BTNonLeafNode {
     * @param key[OUT] the key from the slot
     * @return 0 if successful. Return an error code if there is an error.
     */
-    RC readNLEntry(int pid, int& key);
+    RC readNLEntry(int pid, KeyType& key);
 
    /**
     * Insert the (key, pid) pair to the node
@@ -188,11 +387,14 @@ class BTNonLeafNode {
     * Remember that all keys inside a B+tree node should be kept sorted.
     * @param key[IN] the key to insert
     * @param pid[IN] the PageId to insert
+    * @param left[IN] the child that pid was split from (see insert())
     * @param sibling[IN] the sibling node to split with. This node MUST be empty when this function is called.
     * @param midKey[OUT] the key in the middle after the split. This key should be inserted to the parent node.
+    * The sibling takes over the right sibling pointer of this node; the
+    * caller points this node at the sibling once it has a PageId.
     * @return 0 if successful. Return an error code if there is an error.
     */
-    RC insertAndSplit(int key, PageId pid, BTNonLeafNode& sibling, int& midKey);
+    RC insertAndSplit(const KeyType& key, PageId pid, PageId left, BTNonLeafNodeT& sibling, KeyType& midKey);
 
    /**
     * Given the searchKey, find the child-node pointer to follow and
@@ -202,7 +404,7 @@ class BTNonLeafNode {
     * @param pid[OUT] the pointer to the child node to follow.
     * @return 0 if successful. Return an error code if there is an error.
     */
-    RC locateChildPtr(int searchKey, PageId& pid);
+    RC locateChildPtr(const KeyType& searchKey, PageId& pid);
 
    /**
     * Initialize the root node with (pid1, key, pid2).
@@ -211,7 +413,7 @@ class BTNonLeafNode {
     * @param pid2[IN] the PageId to insert behind the key
     * @return 0 if successful. Return an error code if there is an error.
     */
-    RC initializeRoot(PageId pid1, int key, PageId pid2);
+    RC initializeRoot(PageId pid1, const KeyType& key, PageId pid2);
 
    /**
     * Return the number of keys stored in the node.
@@ -219,7 +421,180 @@ class BTNonLeafNode {
     */
     int getKeyCount();
 
+   /**
+    * Return the level of the node in the tree (leaves are at level 0).
+    * @return the level of the node
+    */
+    int getLevel();
+
+   /**
+    * Set the level of the node in the tree.
+    * @param level[IN] the level of the node (must be > 0 for non-leaf nodes)
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC setLevel(int level);
+
+   /**
+    * Return the pid of the right sibling on the same level.
+    * @return the PageId of the right sibling (-1 if none)
+    */
+    PageId getNextNodePtr();
+
+   /**
+    * Set the pid of the right sibling on the same level.
+    * @param pid[IN] the PageId of the right sibling, -1 for none
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC setNextNodePtr(PageId pid);
+
+   /**
+    * Return whether pid is one of the children of the node.
+    * @param pid[IN] the child PageId to look for
+    * @return true if the node points to pid
+    */
+    bool hasChildPtr(PageId pid);
+
+   /**
+    * Return the position of the child pid in the node.
+    * @param pid[IN] the child PageId to look for
+    * @return the index of pid (0 to getKeyCount()), -1 if not a child
+    */
+    int getChildIndex(PageId pid);
+
+   /**
+    * Read the child PageId at the given position.
+    * @param index[IN] the position of the child (0 to getKeyCount())
+    * @param pid[OUT] the child PageId
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC readChildPtr(int index, PageId& pid);
+
+   /**
+    * Replace the separator key at the given position.
+    * @param index[IN] the position of the key
+    * @param key[IN] the new key
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC setKey(int index, const KeyType& key);
+
+   /**
+    * Remove the key at index and the child PageId behind it.
+    * @param index[IN] the position of the key
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC remove(int index);
+
+   /**
+    * Move midKey and all entries of the right sibling to the end of
+    * this node. This node takes over the next pointer of the sibling.
+    * @param midKey[IN] the separator of the two nodes in the parent
+    * @param right[IN] the right sibling
+    * @return 0 if successful. RC_NODE_FULL if the entries do not fit;
+    *         the node is then left unchanged.
+    */
+    RC merge(const KeyType& midKey, BTNonLeafNodeT& right);
+
+   /**
+    * Even out the entries of this node and its right sibling, rotating
+    * them through the separator in the parent.
+    * @param midKey[IN] the separator of the two nodes in the parent
+    * @param right[IN] the right sibling
+    * @param newMidKey[OUT] the separator to put into the parent instead
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC redistribute(const KeyType& midKey, BTNonLeafNodeT& right, KeyType& newMidKey);
+
+   /**
+    * Return whether the node is less than half full and should be
+    * merged with or refilled from a sibling.
+    * @return true if the node is underfull
+    */
+    bool isUnderfull();
+
+   /**
+    * Make the node keep the number of rows (leaf entries, counting every
+    * RecordId of a posting list) under each child. The row counts move
+    * with their children on insert, remove, merge and redistribute; a
+    * new child starts at 0 and the caller sets it.
+    * Can only be changed while the node is empty.
+    * @param counted[IN] true for a counted node
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC setCounted(bool counted);
+
+   /**
+    * Return whether the node keeps the row counts of its children.
+    */
+    bool isCounted();
+
+   /**
+    * Read the number of rows under the child at the given position.
+    * @param index[IN] the position of the child (0 to getKeyCount())
+    * @param count[OUT] the number of rows
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC readChildCount(int index, int& count);
+
+   /**
+    * Set the number of rows under the child at the given position.
+    * @param index[IN] the position of the child (0 to getKeyCount())
+    * @param count[IN] the number of rows
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC setChildCount(int index, int count);
+
+   /**
+    * Return the number of rows under the node (0 if it is not counted).
+    */
+    int getTotalCount();
+
   private:
+   /**
+    * Return the entry number a new key goes to (see insert()).
+    * @param key[IN] the key to insert
+    * @param left[IN] the child the new key goes behind
+    * @return the entry number of the new key
+    */
+    int insertPosition(const KeyType& key, PageId left);
+
+
+   /**
+    * Return the node header stored at the beginning of the buffer.
+    */
+    nodeHeader* header();
+
+   /**
+    * Return the number of keys the node can hold in its format.
+    */
+    int maxKeys();
+
+   /**
+    * Set the number of keys stored in the node.
+    * @param count[IN] the new key count
+    */
+    void setKeyCount(int count);
+
+   /**
+    * Return a pointer to the separator key array in the buffer.
+    * The keys are kept contiguous so that child search can compare
+    * several keys per instruction.
+    * Page layout: [nodeHeader][key 0 ... key MAX_KEYS-1][pid 0 ... pid MAX_KEYS]
+    * pid i is the child holding the keys in [key i-1, key i).
+    * A counted node holds MAX_COUNTED_KEYS keys and is followed by
+    * [count 0 ... count MAX_COUNTED_KEYS], the rows under pid i.
+    */
+    KeyType* keys();
+
+   /**
+    * Return a pointer to the child PageId array in the buffer.
+    */
+    PageId* pids();
+
+   /**
+    * Return a pointer to the child row count array of a counted node.
+    */
+    int* counts();
+
    /**
     * The main memory buffer for loading the content of the disk page 
     * that contains the node.
@@ -227,4 +602,294 @@ class BTNonLeafNode {
     char buffer[PageFile::PAGE_SIZE];
 }; 
 
+/**
+ * BTPostingNode: one page of the posting list of a duplicated key.
+ * The pages of a list are chained by nextPid, and the first page keeps the
+ * last page of the list in prevPid so that an append reads at most two
+ * pages. The list does not depend on the key type.
+ * In a counted index the first page also keeps the length of the list.
+ * Page layout: [nodeHeader][rid 0 ... rid MAX_RIDS-1][length]
+ */
+class BTPostingNode {
+  public:
+
+    BTPostingNode();
+
+    // number of RecordIds per posting page
+    static const int MAX_RIDS = (PageFile::PAGE_SIZE - sizeof(nodeHeader) - sizeof(int)) / sizeof(RecordId);
+
+    /**
+    * Read the content of the page pid in the PageFile pf.
+    * @param pid[IN] the PageId to read
+    * @param pf[IN] PageFile to read from
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC read(PageId pid, const PageFile& pf);
+
+   /**
+    * Write the content of the node to the page pid in the PageFile pf.
+    * @param pid[IN] the PageId to write to
+    * @param pf[IN] PageFile to write to
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC write(PageId pid, PageFile& pf);
+
+   /**
+    * Append a RecordId to the page.
+    * @param rid[IN] the RecordId to append
+    * @return 0 if successful. RC_NODE_FULL if the page is full.
+    */
+    RC append(const RecordId& rid);
+
+   /**
+    * Remove the eid entry from the page.
+    * @param eid[IN] the entry number to remove
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC remove(int eid);
+
+   /**
+    * Read the RecordId from the eid entry.
+    * @param eid[IN] the entry number to read
+    * @param rid[OUT] the RecordId from the entry
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC readEntry(int eid, RecordId& rid);
+
+   /**
+    * Return all RecordIds of the page as an array.
+    * The pointer stays valid until the page is read or changed again.
+    * @param rids[OUT] the RecordIds of the page
+    * @return the number of RecordIds in the page
+    */
+    int readEntries(const RecordId*& rids);
+
+   /**
+    * Return the number of RecordIds stored in the page.
+    */
+    int getRidCount();
+
+   /**
+    * Return the pid of the next page of the list (-1 for the last page).
+    */
+    PageId getNextNodePtr();
+
+   /**
+    * Set the pid of the next page of the list.
+    * @param pid[IN] the PageId of the next page, -1 for none
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC setNextNodePtr(PageId pid);
+
+   /**
+    * Return the pid of the last page of the list (first page only).
+    */
+    PageId getLastNodePtr();
+
+   /**
+    * Set the pid of the last page of the list (first page only).
+    * @param pid[IN] the PageId of the last page
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC setLastNodePtr(PageId pid);
+
+   /**
+    * Return the number of RecordIds in the whole list (first page of a
+    * list in a counted index only).
+    */
+    int getTotalCount();
+
+   /**
+    * Set the number of RecordIds in the whole list (first page only).
+    * @param count[IN] the length of the list
+    */
+    void setTotalCount(int count);
+
+  private:
+   /**
+    * Return the node header stored at the beginning of the buffer.
+    */
+    nodeHeader* header();
+
+   /**
+    * Return a pointer to the RecordId array in the buffer.
+    */
+    RecordId* rids();
+
+   /**
+    * The main memory buffer for loading the content of the disk page.
+    */
+    char buffer[PageFile::PAGE_SIZE];
+};
+
+/**
+ * BTTupleNodeT: a leaf node of a clustered index, which holds whole
+ * (key, value) tuples instead of (key, RecordId) pairs. Every value takes
+ * only its own length, so a page holds as many tuples as their values
+ * allow. Unlike in BTLeafNodeT, a run of equal keys may go on in the
+ * next leaf, and there are no posting lists.
+ */
+template <class KeyType>
+class BTTupleNodeT {
+  public:
+
+    BTTupleNodeT();
+
+    // the longest value stored; longer values are cut off like in a RecordFile
+    static const int MAX_VALUE_LENGTH = RecordFile::MAX_VALUE_LENGTH - 1;
+    // the bytes of a page available to the slots and tuples
+    static const int CAPACITY = PageFile::PAGE_SIZE - sizeof(nodeHeader) - sizeof(tupleLeafHeader);
+    // the most tuples a page can hold (all with empty values)
+    static const int MAX_TUPLES = CAPACITY / (sizeof(unsigned short) + sizeof(KeyType) + 1);
+
+   /**
+    * Return the bytes a tuple with the given value takes in a page,
+    * its slot included.
+    * @param value[IN] the value of the tuple
+    * @return the size of the tuple
+    */
+    static int tupleSize(const std::string& value);
+
+   /**
+    * Read the content of the node from the page pid in the PageFile pf.
+    * @param pid[IN] the PageId to read
+    * @param pf[IN] PageFile to read from
+    * @return 0 if successful. RC_INVALID_FILE_FORMAT if the page is not
+    *         the leaf of a clustered index.
+    */
+    RC read(PageId pid, const PageFile& pf);
+
+   /**
+    * Write the content of the node to the page pid in the PageFile pf.
+    * @param pid[IN] the PageId to write to
+    * @param pf[IN] PageFile to write to
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC write(PageId pid, PageFile& pf);
+
+   /**
+    * Insert a tuple into the node, behind the tuples with the same key.
+    * @param key[IN] the key of the tuple
+    * @param value[IN] the value of the tuple
+    * @return 0 if successful. RC_NODE_FULL if the tuple does not fit.
+    */
+    RC insert(const KeyType& key, const std::string& value);
+
+   /**
+    * Insert a tuple and move about half of the bytes of the node to
+    * sibling. The split is put between two different keys if one is
+    * close enough to the middle, otherwise a run of equal keys goes on
+    * in the sibling.
+    * @param key[IN] the key of the tuple
+    * @param value[IN] the value of the tuple
+    * @param sibling[IN] the sibling node to split with. This node MUST be EMPTY when this function is called.
+    * @param siblingKey[OUT] the first key in the sibling node after split.
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC insertAndSplit(const KeyType& key, const std::string& value, BTTupleNodeT& sibling, KeyType& siblingKey);
+
+   /**
+    * Find the first tuple with a key >= searchKey.
+    * @param searchKey[IN] the key to search for
+    * @param eid[OUT] the entry number of the tuple (getKeyCount() if
+    *                 every key is smaller)
+    * @return 0 if the tuple has searchKey. RC_NO_SUCH_RECORD otherwise.
+    */
+    RC locate(const KeyType& searchKey, int& eid);
+
+   /**
+    * Read the tuple of entry eid.
+    * @param eid[IN] the entry number to read
+    * @param key[OUT] the key of the tuple
+    * @param value[OUT] the value of the tuple
+    * @return 0 if successful. RC_INVALID_CURSOR if there is no such entry.
+    */
+    RC readTuple(int eid, KeyType& key, std::string& value);
+
+   /**
+    * Read the key of entry eid.
+    * @param eid[IN] the entry number to read
+    * @param key[OUT] the key of the tuple
+    * @return 0 if successful. RC_INVALID_CURSOR if there is no such entry.
+    */
+    RC readKey(int eid, KeyType& key);
+
+   /**
+    * Return the bytes left for more tuples in the node.
+    */
+    int getFreeSpace();
+
+   /**
+    * Return the pid of the next sibling node (-1 for the last leaf).
+    */
+    PageId getNextNodePtr();
+
+   /**
+    * Set the pid of the next sibling node.
+    * @param pid[IN] the PageId of the next sibling node, -1 for none
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC setNextNodePtr(PageId pid);
+
+   /**
+    * Return the pid of the previous sibling node (-1 for the first leaf).
+    */
+    PageId getPrevNodePtr();
+
+   /**
+    * Set the pid of the previous sibling node.
+    * @param pid[IN] the PageId of the previous sibling node, -1 for none
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC setPrevNodePtr(PageId pid);
+
+   /**
+    * Return the number of tuples stored in the node.
+    */
+    int getKeyCount();
+
+  private:
+   /**
+    * Return the node header stored at the beginning of the buffer.
+    */
+    nodeHeader* header();
+
+   /**
+    * Return the header behind the node header.
+    */
+    tupleLeafHeader* tupleHeader();
+
+   /**
+    * Return a pointer to the slot array in the buffer.
+    */
+    unsigned short* slots();
+
+   /**
+    * Return a pointer to the tuple of entry eid in the buffer.
+    */
+    const char* tuple(int eid);
+
+   /**
+    * Add a tuple behind the last one, with no check for space or order.
+    * @param key[IN] the key of the tuple
+    * @param value[IN] the value bytes
+    * @param len[IN] the number of value bytes
+    */
+    void append(const KeyType& key, const char* value, int len);
+
+   /**
+    * Remove all tuples from the node.
+    */
+    void clear();
+
+   /**
+    * The main memory buffer for loading the content of the disk page.
+    */
+    char buffer[PageFile::PAGE_SIZE];
+};
+
+// the nodes of the B+tree on the int key column
+typedef BTLeafNodeT<int>    BTLeafNode;
+typedef BTNonLeafNodeT<int> BTNonLeafNode;
+
 #endif /* BTREENODE_H */
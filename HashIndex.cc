@@ -0,0 +1,490 @@
+#include "HashIndex.h"
+#include <cstring>
+#include <algorithm>
+
+using namespace std;
+
+// page 0 holds [level, splitNext, entryCount, free list head,
+// bucket count, first page of the bucket table]; every table page holds
+// [next table page, count, primary pages...]
+static const int TABLE_ENTRIES = PageFile::PAGE_SIZE / sizeof(PageId) - 2;
+
+map<string, HashIndex::Directory> HashIndex::directories;
+pthread_mutex_t HashIndex::directoryLatch = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Spread the bits of key (the finalizer of MurmurHash3), so that the low
+ * bits that pick a bucket depend on the whole key.
+ */
+static unsigned hashKey(int key)
+{
+	unsigned h = (unsigned) key;
+
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+}
+
+HashBucket::HashBucket() {
+	memset(buffer, 0, PageFile::PAGE_SIZE);
+	setNextNodePtr(-1);
+}
+
+/*
+ * Read the content of the page pid in the PageFile pf.
+ * @param pid[IN] the PageId to read
+ * @param pf[IN] PageFile to read from
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC HashBucket::read(PageId pid, const PageFile& pf)
+{
+	RC rc = pf.read(pid, buffer);
+	if (rc < 0)
+		return rc;
+
+	if (getEntryCount() < 0 || getEntryCount() > MAX_ENTRIES)
+		return RC_INVALID_FILE_FORMAT;
+
+	return 0;
+}
+
+/*
+ * Write the content of the page to the page pid in the PageFile pf.
+ * @param pid[IN] the PageId to write to
+ * @param pf[IN] PageFile to write to
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC HashBucket::write(PageId pid, PageFile& pf)
+{
+	return pf.write(pid, buffer);
+}
+
+/*
+ * Add a (key, RecordId) pair to the page.
+ * @param key[IN] the key
+ * @param rid[IN] the RecordId
+ * @return 0 if successful. RC_NODE_FULL if the page is full.
+ */
+RC HashBucket::insert(int key, const RecordId& rid)
+{
+	int count = getEntryCount();
+	if (count >= MAX_ENTRIES)
+		return RC_NODE_FULL;
+
+	entries()[count].key = key;
+	entries()[count].rid = rid;
+	((int*) buffer)[0] = count + 1;
+	return 0;
+}
+
+/*
+ * Read the (key, RecordId) pair of entry eid.
+ * @param eid[IN] the entry number to read
+ * @param key[OUT] the key
+ * @param rid[OUT] the RecordId
+ * @return 0 if successful. RC_INVALID_CURSOR if there is no such entry.
+ */
+RC HashBucket::readEntry(int eid, int& key, RecordId& rid)
+{
+	if (eid < 0 || eid >= getEntryCount())
+		return RC_INVALID_CURSOR;
+
+	key = entries()[eid].key;
+	rid = entries()[eid].rid;
+	return 0;
+}
+
+/*
+ * Return the number of pairs stored in the page.
+ */
+int HashBucket::getEntryCount()
+{
+	return ((int*) buffer)[0];
+}
+
+/*
+ * Return the pid of the next page of the bucket.
+ */
+PageId HashBucket::getNextNodePtr()
+{
+	return ((PageId*) buffer)[1];
+}
+
+/*
+ * Set the pid of the next page of the bucket.
+ * @param pid[IN] the PageId of the next page, -1 for none
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC HashBucket::setNextNodePtr(PageId pid)
+{
+	if (pid < -1)
+		return RC_INVALID_PID;
+
+	((PageId*) buffer)[1] = pid;
+	return 0;
+}
+
+/*
+ * Return a pointer to the entry array in the buffer.
+ */
+HashBucket::Entry* HashBucket::entries()
+{
+	return (Entry*) (buffer + 2 * sizeof(int));
+}
+
+/*
+ * HashIndex constructor
+ */
+HashIndex::HashIndex()
+{
+	writable = false;
+	freePid = 0;
+}
+
+/*
+ * Open the index file in read or write mode.
+ * @param indexname[IN] the name of the index file
+ * @param mode[IN] 'r' for read, 'w' for write
+ * @return error code. 0 if no error
+ */
+RC HashIndex::open(const string& indexname, char mode)
+{
+	RC rc;
+	char buf[PageFile::PAGE_SIZE];
+	int* bufPtr = (int*) buf;
+
+	if ((rc = pf.open(indexname, mode)) < 0)
+		return rc;
+	writable = (mode == 'w' || mode == 'W');
+	name = indexname;
+
+	// the saved state of the file is only good if nobody else wrote it,
+	// and only for a snapshot that sees the latest pages
+	pthread_mutex_lock(&directoryLatch);
+	bool current = pf.isCurrent();
+	if (current && pf.endPid() > 0 && directories[indexname].endPid == pf.endPid()) {
+		dir = directories[indexname];
+		pthread_mutex_unlock(&directoryLatch);
+		freePid = pf.endPid();
+		return 0;
+	}
+	pthread_mutex_unlock(&directoryLatch);
+
+	dir = Directory();
+	memset(buf, 0, PageFile::PAGE_SIZE);
+
+	// a new index starts with a single empty bucket
+	if (pf.endPid() == 0) {
+		bufPtr[3] = -1;
+		bufPtr[5] = -1;
+		if ((rc = pf.write(0, buf)) < 0) {
+			pf.close();
+			return rc;
+		}
+		freePid = 1;
+
+		HashBucket bucket;
+		PageId pid = allocatePage();
+		if ((rc = bucket.write(pid, pf)) < 0) {
+			pf.close();
+			return rc;
+		}
+		dir.buckets.push_back(pid);
+		return 0;
+	}
+
+	if ((rc = pf.read(0, buf)) < 0) {
+		pf.close();
+		return rc;
+	}
+	dir.level = bufPtr[0];
+	dir.splitNext = bufPtr[1];
+	dir.entryCount = bufPtr[2];
+	dir.freeHead = bufPtr[3];
+	int count = bufPtr[4];
+	PageId tablePid = bufPtr[5];
+
+	while (tablePid >= 0 && (int) dir.buckets.size() < count) {
+		if ((rc = pf.read(tablePid, buf)) < 0) {
+			pf.close();
+			return rc;
+		}
+		dir.tablePages.push_back(tablePid);
+		dir.buckets.insert(dir.buckets.end(), bufPtr + 2, bufPtr + 2 + bufPtr[1]);
+		tablePid = bufPtr[0];
+	}
+	if ((int) dir.buckets.size() != count) {
+		pf.close();
+		return RC_INVALID_FILE_FORMAT;
+	}
+	freePid = pf.endPid();
+
+	pthread_mutex_lock(&directoryLatch);
+	if (current && pf.isCurrent()) {
+		dir.endPid = pf.endPid();
+		directories[indexname] = dir;
+	}
+	pthread_mutex_unlock(&directoryLatch);
+
+	return 0;
+}
+
+/*
+ * Close the index file.
+ * @return error code. 0 if no error
+ */
+RC HashIndex::close()
+{
+	RC rc;
+
+	if (writable) {
+		char buf[PageFile::PAGE_SIZE];
+		int* bufPtr = (int*) buf;
+
+		// the bucket table only grows, so it keeps its pages and takes
+		// more where it needs them
+		size_t pages = (dir.buckets.size() + TABLE_ENTRIES - 1) / TABLE_ENTRIES;
+		while (dir.tablePages.size() < pages)
+			dir.tablePages.push_back(allocatePage());
+
+		for (size_t p = 0; p < pages; p++) {
+			size_t from = p * TABLE_ENTRIES;
+			size_t n = min((size_t) TABLE_ENTRIES, dir.buckets.size() - from);
+			memset(buf, 0, PageFile::PAGE_SIZE);
+			bufPtr[0] = (p + 1 < pages) ? dir.tablePages[p + 1] : -1;
+			bufPtr[1] = (int) n;
+			memcpy(bufPtr + 2, &dir.buckets[from], n * sizeof(PageId));
+			if ((rc = pf.write(dir.tablePages[p], buf)) < 0) {
+				pf.close();
+				return rc;
+			}
+		}
+
+		memset(buf, 0, PageFile::PAGE_SIZE);
+		bufPtr[0] = dir.level;
+		bufPtr[1] = dir.splitNext;
+		bufPtr[2] = dir.entryCount;
+		bufPtr[3] = dir.freeHead;
+		bufPtr[4] = (int) dir.buckets.size();
+		bufPtr[5] = dir.tablePages.empty() ? -1 : dir.tablePages[0];
+		rc = pf.write(0, buf);
+
+		pthread_mutex_lock(&directoryLatch);
+		dir.endPid = (rc < 0) ? -1 : pf.endPid();
+		directories[name] = dir;
+		pthread_mutex_unlock(&directoryLatch);
+
+		if (rc < 0) {
+			pf.close();
+			return rc;
+		}
+	}
+
+	return pf.close();
+}
+
+/*
+ * Insert a (key, RecordId) pair into the index.
+ * @param key[IN] the key
+ * @param rid[IN] the RecordId of the tuple
+ * @return error code. 0 if no error
+ */
+RC HashIndex::insert(int key, const RecordId& rid)
+{
+	RC rc;
+	HashBucket primary;
+	HashBucket overflow;
+
+	if (dir.buckets.empty())
+		return RC_INVALID_FILE_FORMAT;
+
+	PageId pid = dir.buckets[bucketOf(key)];
+	if ((rc = primary.read(pid, pf)) < 0)
+		return rc;
+
+	// a full primary page hands the pair to its first overflow page, or
+	// to a new overflow page in front of the others
+	if (primary.insert(key, rid) == 0)
+		rc = primary.write(pid, pf);
+	else {
+		PageId next = primary.getNextNodePtr();
+		if (next >= 0 && (rc = overflow.read(next, pf)) < 0)
+			return rc;
+
+		if (next >= 0 && overflow.insert(key, rid) == 0)
+			rc = overflow.write(next, pf);
+		else {
+			HashBucket page;
+			PageId newPid = allocatePage();
+			page.insert(key, rid);
+			page.setNextNodePtr(next);
+			if ((rc = page.write(newPid, pf)) < 0)
+				return rc;
+			primary.setNextNodePtr(newPid);
+			rc = primary.write(pid, pf);
+		}
+	}
+	if (rc < 0)
+		return rc;
+
+	dir.entryCount++;
+	if ((long long) dir.entryCount * 100 > (long long) dir.buckets.size() * HashBucket::MAX_ENTRIES * SPLIT_LOAD)
+		return split();
+	return 0;
+}
+
+/*
+ * Return the RecordIds of all pairs with the given key.
+ * @param key[IN] the key to look up
+ * @param rids[OUT] the RecordIds
+ * @return error code. 0 if no error
+ */
+RC HashIndex::lookup(int key, vector<RecordId>& rids)
+{
+	RC rc;
+	HashBucket page;
+
+	rids.clear();
+	if (dir.buckets.empty())
+		return RC_INVALID_FILE_FORMAT;
+
+	for (PageId pid = dir.buckets[bucketOf(key)]; pid >= 0; pid = page.getNextNodePtr()) {
+		if ((rc = page.read(pid, pf)) < 0)
+			return rc;
+
+		int k;
+		RecordId rid;
+		for (int i = 0; page.readEntry(i, k, rid) == 0; i++)
+			if (k == key)
+				rids.push_back(rid);
+	}
+
+	return 0;
+}
+
+/*
+ * Return the bucket number of key: the low level bits of its hash, or
+ * one bit more if that bucket was split in this round already.
+ */
+int HashIndex::bucketOf(int key)
+{
+	unsigned h = hashKey(key);
+	unsigned b = h & ((1u << dir.level) - 1);
+
+	if ((int) b < dir.splitNext)
+		b = h & ((2u << dir.level) - 1);
+	return (int) b;
+}
+
+/*
+ * Split the bucket at the split pointer.
+ * @return error code. 0 if no error
+ */
+RC HashIndex::split()
+{
+	RC rc;
+	HashBucket page;
+	vector<pair<int, RecordId> > stay;
+	vector<pair<int, RecordId> > move;
+	vector<PageId> pages;
+
+	// the pairs with the next bit of the hash set go to the new bucket
+	for (PageId pid = dir.buckets[dir.splitNext]; pid >= 0; pid = page.getNextNodePtr()) {
+		if ((rc = page.read(pid, pf)) < 0)
+			return rc;
+		pages.push_back(pid);
+
+		int key;
+		RecordId rid;
+		for (int i = 0; page.readEntry(i, key, rid) == 0; i++) {
+			if (hashKey(key) & (1u << dir.level))
+				move.push_back(make_pair(key, rid));
+			else
+				stay.push_back(make_pair(key, rid));
+		}
+	}
+
+	PageId primary;
+	if ((rc = writeBucket(stay, pages, primary)) < 0)
+		return rc;
+	if ((rc = writeBucket(move, vector<PageId>(), primary)) < 0)
+		return rc;
+	dir.buckets.push_back(primary);
+
+	// a round ends once every bucket it began with is split
+	if (++dir.splitNext == (1 << dir.level)) {
+		dir.level++;
+		dir.splitNext = 0;
+	}
+	return 0;
+}
+
+/*
+ * Write pairs into the pages of a bucket.
+ * @param pairs[IN] the pairs of the bucket
+ * @param pages[IN] the pages the bucket had
+ * @param primary[OUT] the primary page of the bucket
+ * @return error code. 0 if no error
+ */
+RC HashIndex::writeBucket(const vector<pair<int, RecordId> >& pairs, const vector<PageId>& pages, PageId& primary)
+{
+	RC rc;
+
+	// an empty bucket keeps its primary page
+	size_t n = max((size_t) 1, (pairs.size() + HashBucket::MAX_ENTRIES - 1) / HashBucket::MAX_ENTRIES);
+	vector<PageId> pids(pages.begin(), pages.begin() + min(n, pages.size()));
+	while (pids.size() < n)
+		pids.push_back(allocatePage());
+	for (size_t p = n; p < pages.size(); p++)
+		if ((rc = freePage(pages[p])) < 0)
+			return rc;
+
+	for (size_t p = 0; p < n; p++) {
+		HashBucket page;
+		size_t end = min(pairs.size(), (p + 1) * HashBucket::MAX_ENTRIES);
+		for (size_t i = p * HashBucket::MAX_ENTRIES; i < end; i++)
+			page.insert(pairs[i].first, pairs[i].second);
+		page.setNextNodePtr(p + 1 < n ? pids[p + 1] : -1);
+		if ((rc = page.write(pids[p], pf)) < 0)
+			return rc;
+	}
+
+	primary = pids[0];
+	return 0;
+}
+
+/*
+ * Take a page from the free list, or from the end of the file.
+ * @return the PageId of the page
+ */
+PageId HashIndex::allocatePage()
+{
+	HashBucket page;
+
+	if (dir.freeHead >= 0 && page.read(dir.freeHead, pf) == 0) {
+		PageId pid = dir.freeHead;
+		dir.freeHead = page.getNextNodePtr();
+		return pid;
+	}
+	return freePid++;
+}
+
+/*
+ * Put the page pid on the free list.
+ * @param pid[IN] the PageId of the page nothing points to any more
+ * @return error code. 0 if no error
+ */
+RC HashIndex::freePage(PageId pid)
+{
+	RC rc;
+	HashBucket page;
+
+	page.setNextNodePtr(dir.freeHead);
+	if ((rc = page.write(pid, pf)) < 0)
+		return rc;
+	dir.freeHead = pid;
+	return 0;
+}
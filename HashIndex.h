@@ -0,0 +1,210 @@
+#ifndef HASHINDEX_H
+#define HASHINDEX_H
+
+#include "Bruinbase.h"
+#include "PageFile.h"
+#include "RecordFile.h"
+#include <map>
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+/**
+ * A page of a HashIndex bucket: (key, RecordId) pairs in insertion order,
+ * and the overflow page that holds more pairs of the same bucket.
+ * Free pages of the index are chained through the same pointer.
+ */
+class HashBucket {
+ public:
+  HashBucket();
+
+  // number of pairs per bucket page
+  static const int MAX_ENTRIES = (PageFile::PAGE_SIZE - 2 * sizeof(int)) / (sizeof(int) + sizeof(RecordId));
+
+  /**
+   * Read the content of the page pid in the PageFile pf.
+   * @param pid[IN] the PageId to read
+   * @param pf[IN] PageFile to read from
+   * @return 0 if successful. Return an error code if there is an error.
+   */
+  RC read(PageId pid, const PageFile& pf);
+
+  /**
+   * Write the content of the page to the page pid in the PageFile pf.
+   * @param pid[IN] the PageId to write to
+   * @param pf[IN] PageFile to write to
+   * @return 0 if successful. Return an error code if there is an error.
+   */
+  RC write(PageId pid, PageFile& pf);
+
+  /**
+   * Add a (key, RecordId) pair to the page.
+   * @param key[IN] the key
+   * @param rid[IN] the RecordId
+   * @return 0 if successful. RC_NODE_FULL if the page is full.
+   */
+  RC insert(int key, const RecordId& rid);
+
+  /**
+   * Read the (key, RecordId) pair of entry eid.
+   * @param eid[IN] the entry number to read
+   * @param key[OUT] the key
+   * @param rid[OUT] the RecordId
+   * @return 0 if successful. RC_INVALID_CURSOR if there is no such entry.
+   */
+  RC readEntry(int eid, int& key, RecordId& rid);
+
+  /**
+   * Return the number of pairs stored in the page.
+   */
+  int getEntryCount();
+
+  /**
+   * Return the pid of the next page of the bucket (-1 for the last page).
+   */
+  PageId getNextNodePtr();
+
+  /**
+   * Set the pid of the next page of the bucket.
+   * @param pid[IN] the PageId of the next page, -1 for none
+   * @return 0 if successful. Return an error code if there is an error.
+   */
+  RC setNextNodePtr(PageId pid);
+
+ private:
+  struct Entry {
+    int      key;
+    RecordId rid;
+  };
+
+  /**
+   * Return a pointer to the entry array in the buffer.
+   */
+  Entry* entries();
+
+  /**
+   * The main memory buffer for loading the content of the disk page:
+   * [entry count][next pid][entries].
+   */
+  char buffer[PageFile::PAGE_SIZE];
+};
+
+/**
+ * A persistent linear hashing index from the int key column to the
+ * RecordIds of the tuples, for equality lookups. A lookup reads the
+ * primary page of the bucket of its key, and overflow pages only where
+ * a bucket outgrew a page (the duplicates of a single key, say). The
+ * bucket table, which holds the primary page of every bucket, is read
+ * into memory on open() and, like the pinned pages of a B+tree index,
+ * kept for the file after close(); a lookup on a reopened index then
+ * reads no other page.
+ *
+ * The index grows one bucket at a time: whenever the pairs fill more
+ * than SPLIT_LOAD percent of the primary pages, the bucket at the split
+ * pointer is split in two by one more bit of the key hash. There are no
+ * range lookups; those go to the B+tree.
+ *
+ * A HashIndex must not be used by several threads at once.
+ */
+class HashIndex {
+ public:
+  HashIndex();
+
+  /**
+   * Open the index file in read or write mode.
+   * Under 'w' mode, the index file is created if it does not exist.
+   * @param indexname[IN] the name of the index file
+   * @param mode[IN] 'r' for read, 'w' for write
+   * @return error code. 0 if no error
+   */
+  RC open(const std::string& indexname, char mode);
+
+  /**
+   * Close the index file, saving the bucket table under 'w' mode.
+   * @return error code. 0 if no error
+   */
+  RC close();
+
+  /**
+   * Insert a (key, RecordId) pair into the index.
+   * @param key[IN] the key
+   * @param rid[IN] the RecordId of the tuple
+   * @return error code. 0 if no error
+   */
+  RC insert(int key, const RecordId& rid);
+
+  /**
+   * Return the RecordIds of all pairs with the given key.
+   * @param key[IN] the key to look up
+   * @param rids[OUT] the RecordIds, in no particular order
+   * @return error code. 0 if no error
+   */
+  RC lookup(int key, std::vector<RecordId>& rids);
+
+ private:
+  // split a bucket when the pairs fill this percentage of the primary pages
+  static const int SPLIT_LOAD = 75;
+
+  /**
+   * Return the bucket number of key.
+   */
+  int bucketOf(int key);
+
+  /**
+   * Split the bucket at the split pointer into itself and a new bucket
+   * at the end of the table, and move the split pointer on.
+   * @return error code. 0 if no error
+   */
+  RC split();
+
+  /**
+   * Write pairs into the pages of a bucket, reusing the pages in pages
+   * (the first one is the primary page) and taking more as needed.
+   * Pages that are left over go to the free list.
+   * @param pairs[IN] the pairs of the bucket
+   * @param pages[IN] the pages the bucket had
+   * @param primary[OUT] the primary page of the bucket
+   * @return error code. 0 if no error
+   */
+  RC writeBucket(const std::vector<std::pair<int, RecordId> >& pairs, const std::vector<PageId>& pages, PageId& primary);
+
+  /**
+   * Take a page from the free list, or from the end of the file.
+   * @return the PageId of the page
+   */
+  PageId allocatePage();
+
+  /**
+   * Put the page pid on the free list.
+   * @param pid[IN] the PageId of the page nothing points to any more
+   * @return error code. 0 if no error
+   */
+  RC freePage(PageId pid);
+
+  /**
+   * The state of an index file that open() reads from page 0 and the
+   * bucket table pages. It stays valid while the file has endPid pages.
+   */
+  struct Directory {
+    Directory() : endPid(-1), level(0), splitNext(0), entryCount(0), freeHead(-1) {}
+
+    PageId endPid;      // the size of the file the state is valid for
+    int    level;       // 2^level buckets were there when the round began
+    int    splitNext;   // the next bucket to split in this round
+    int    entryCount;  // the pairs in the index
+    PageId freeHead;    // the first page of the free list (-1 if none)
+    std::vector<PageId> buckets;    // the primary page of every bucket
+    std::vector<PageId> tablePages; // the pages the bucket table is saved in
+  };
+
+  PageFile  pf;        /// the PageFile the index is stored in
+  std::string name;    /// the name of the index file
+  bool      writable;  /// true if the index was opened in 'w' mode
+  PageId    freePid;   /// the first page not handed out yet
+  Directory dir;       /// the state of the index
+
+  static std::map<std::string, Directory> directories; /// by file name
+  static pthread_mutex_t directoryLatch; /// guards directories
+};
+
+#endif /* HASHINDEX_H */
@@ -0,0 +1,495 @@
+#include "LearnedIndex.h"
+#include <cstring>
+#include <climits>
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+
+// page 0 holds [entry count, segment count, first model page]; the data
+// pages follow from page 1 on, and the model pages follow the data pages
+
+map<string, LearnedIndex::Model> LearnedIndex::models;
+pthread_mutex_t LearnedIndex::modelLatch = PTHREAD_MUTEX_INITIALIZER;
+
+LearnedPage::LearnedPage() {
+	memset(buffer, 0, PageFile::PAGE_SIZE);
+}
+
+/*
+ * Read the content of the page pid in the PageFile pf.
+ * @param pid[IN] the PageId to read
+ * @param pf[IN] PageFile to read from
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC LearnedPage::read(PageId pid, const PageFile& pf)
+{
+	RC rc = pf.read(pid, buffer);
+	if (rc < 0)
+		return rc;
+
+	if (getEntryCount() < 0 || getEntryCount() > MAX_ENTRIES)
+		return RC_INVALID_FILE_FORMAT;
+
+	return 0;
+}
+
+/*
+ * Write the content of the page to the page pid in the PageFile pf.
+ * @param pid[IN] the PageId to write to
+ * @param pf[IN] PageFile to write to
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC LearnedPage::write(PageId pid, PageFile& pf)
+{
+	return pf.write(pid, buffer);
+}
+
+/*
+ * Add a (key, RecordId) pair at the end of the page.
+ * @param key[IN] the key
+ * @param rid[IN] the RecordId
+ * @return 0 if successful. RC_NODE_FULL if the page is full.
+ */
+RC LearnedPage::append(int key, const RecordId& rid)
+{
+	int count = getEntryCount();
+	if (count >= MAX_ENTRIES)
+		return RC_NODE_FULL;
+
+	entries()[count].key = key;
+	entries()[count].rid = rid;
+	((int*) buffer)[0] = count + 1;
+	return 0;
+}
+
+/*
+ * Read the (key, RecordId) pair of entry eid.
+ * @param eid[IN] the entry number to read
+ * @param key[OUT] the key
+ * @param rid[OUT] the RecordId
+ * @return 0 if successful. RC_INVALID_CURSOR if there is no such entry.
+ */
+RC LearnedPage::readEntry(int eid, int& key, RecordId& rid)
+{
+	if (eid < 0 || eid >= getEntryCount())
+		return RC_INVALID_CURSOR;
+
+	key = entries()[eid].key;
+	rid = entries()[eid].rid;
+	return 0;
+}
+
+/*
+ * Return the entry number of the first pair with a key >= searchKey.
+ * @param searchKey[IN] the key to look for
+ */
+int LearnedPage::lowerBound(int searchKey)
+{
+	int lo = 0;
+	int hi = getEntryCount();
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (entries()[mid].key < searchKey)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/*
+ * Return the number of pairs stored in the page.
+ */
+int LearnedPage::getEntryCount()
+{
+	return ((int*) buffer)[0];
+}
+
+/*
+ * Return a pointer to the entry array in the buffer.
+ */
+LearnedPage::Entry* LearnedPage::entries()
+{
+	return (Entry*) (buffer + sizeof(int));
+}
+
+/*
+ * LearnedIndex constructor
+ */
+LearnedIndex::LearnedIndex()
+{
+}
+
+/*
+ * Open the index file in read or write mode.
+ * @param indexname[IN] the name of the index file
+ * @param mode[IN] 'r' for read, 'w' for write
+ * @return error code. 0 if no error
+ */
+RC LearnedIndex::open(const string& indexname, char mode)
+{
+	RC rc;
+	char buf[PageFile::PAGE_SIZE];
+	int* bufPtr = (int*) buf;
+
+	if ((rc = pf.open(indexname, mode)) < 0)
+		return rc;
+	name = indexname;
+
+	// the saved model of the file is only good if nobody else wrote it,
+	// and only for a snapshot that sees the latest pages
+	pthread_mutex_lock(&modelLatch);
+	bool current = pf.isCurrent();
+	if (current && pf.endPid() > 0 && models[indexname].endPid == pf.endPid()) {
+		model = models[indexname];
+		pthread_mutex_unlock(&modelLatch);
+		return 0;
+	}
+	pthread_mutex_unlock(&modelLatch);
+
+	model = Model();
+	memset(buf, 0, PageFile::PAGE_SIZE);
+
+	// a new index holds no pairs
+	if (pf.endPid() == 0) {
+		bufPtr[2] = -1;
+		if ((rc = pf.write(0, buf)) < 0) {
+			pf.close();
+			return rc;
+		}
+		return 0;
+	}
+
+	if ((rc = pf.read(0, buf)) < 0) {
+		pf.close();
+		return rc;
+	}
+	model.entryCount = bufPtr[0];
+	int count = bufPtr[1];
+	PageId modelPid = bufPtr[2];
+
+	if (model.entryCount < 0 || count < 0 || (model.entryCount > 0 && count == 0)) {
+		pf.close();
+		return RC_INVALID_FILE_FORMAT;
+	}
+
+	model.segments.resize(count);
+	for (int i = 0; i < count; i += MODEL_ENTRIES, modelPid++) {
+		if ((rc = pf.read(modelPid, buf)) < 0) {
+			pf.close();
+			return rc;
+		}
+		memcpy(&model.segments[i], buf, min((int) MODEL_ENTRIES, count - i) * sizeof(Segment));
+	}
+
+	pthread_mutex_lock(&modelLatch);
+	if (current && pf.isCurrent()) {
+		model.endPid = pf.endPid();
+		models[indexname] = model;
+	}
+	pthread_mutex_unlock(&modelLatch);
+
+	return 0;
+}
+
+/*
+ * Close the index file.
+ * @return error code. 0 if no error
+ */
+RC LearnedIndex::close()
+{
+	return pf.close();
+}
+
+/*
+ * Add (key, RecordId) pairs to the index.
+ * @param entries[IN] the pairs to add, in any order
+ * @return error code. 0 if no error
+ */
+RC LearnedIndex::build(const vector<pair<int, RecordId> >& entries)
+{
+	RC rc;
+	char buf[PageFile::PAGE_SIZE];
+	int* bufPtr = (int*) buf;
+	LearnedPage page;
+	vector<pair<int, RecordId> > all;
+	vector<Segment> segments;
+
+	// the pairs already in the index are merged with the new ones
+	int key;
+	RecordId rid;
+	all.reserve(model.entryCount + entries.size());
+	for (PageId pid = 1; (int) all.size() < model.entryCount; pid++) {
+		if ((rc = page.read(pid, pf)) < 0)
+			return rc;
+		for (int i = 0; page.readEntry(i, key, rid) == 0; i++)
+			all.push_back(make_pair(key, rid));
+	}
+	all.insert(all.end(), entries.begin(), entries.end());
+	sort(all.begin(), all.end());
+
+	// the data pages, full except for the last one
+	PageId pid = 1;
+	for (size_t i = 0; i < all.size(); pid++) {
+		LearnedPage data;
+		for (; i < all.size() && data.append(all[i].first, all[i].second) == 0; i++)
+			;
+		if ((rc = data.write(pid, pf)) < 0)
+			return rc;
+	}
+
+	fit(all, segments);
+	PageId modelPid = pid;
+	for (size_t i = 0; i < segments.size(); i += MODEL_ENTRIES, pid++) {
+		memset(buf, 0, PageFile::PAGE_SIZE);
+		memcpy(buf, &segments[i], min((size_t) MODEL_ENTRIES, segments.size() - i) * sizeof(Segment));
+		if ((rc = pf.write(pid, buf)) < 0)
+			return rc;
+	}
+
+	memset(buf, 0, PageFile::PAGE_SIZE);
+	bufPtr[0] = (int) all.size();
+	bufPtr[1] = (int) segments.size();
+	bufPtr[2] = segments.empty() ? -1 : modelPid;
+	if ((rc = pf.write(0, buf)) < 0)
+		return rc;
+
+	model.entryCount = (int) all.size();
+	model.segments.swap(segments);
+
+	pthread_mutex_lock(&modelLatch);
+	model.endPid = pf.endPid();
+	models[name] = model;
+	pthread_mutex_unlock(&modelLatch);
+
+	return 0;
+}
+
+/*
+ * Find the first pair with a key >= searchKey.
+ * @param searchKey[IN] the key to find
+ * @param cursor[OUT] the cursor pointing to the pair
+ * @return 0 if searchKey is found. Othewise, an error code
+ */
+RC LearnedIndex::locate(int searchKey, IndexCursor& cursor)
+{
+	RC rc;
+	int pos;
+	bool found;
+
+	cursor.pid = -1;
+	cursor.eid = 0;
+	cursor.ppid = -1;
+	cursor.peid = 0;
+
+	if ((rc = lowerBound(searchKey, pos, found)) < 0)
+		return rc;
+
+	if (pos < model.entryCount) {
+		cursor.pid = 1 + pos / LearnedPage::MAX_ENTRIES;
+		cursor.eid = pos % LearnedPage::MAX_ENTRIES;
+	}
+	return found ? 0 : RC_NO_SUCH_RECORD;
+}
+
+/*
+ * Read the (key, rid) pair at the location specified by the index cursor,
+ * and move foward the cursor to the next pair.
+ * @param cursor[IN/OUT] the cursor pointing to a pair in a data page
+ * @param key[OUT] the key stored at the index cursor location.
+ * @param rid[OUT] the RecordId stored at the index cursor location.
+ * @return error code. 0 if no error
+ */
+RC LearnedIndex::readForward(IndexCursor& cursor, int& key, RecordId& rid)
+{
+	RC rc;
+	LearnedPage page;
+	int pages = (model.entryCount + LearnedPage::MAX_ENTRIES - 1) / LearnedPage::MAX_ENTRIES;
+
+	if (cursor.pid < 0)
+		return RC_END_OF_TREE;
+	if (cursor.pid == 0 || cursor.pid > pages)
+		return RC_INVALID_CURSOR;
+
+	if ((rc = page.read(cursor.pid, pf)) < 0)
+		return rc;
+	if ((rc = page.readEntry(cursor.eid, key, rid)) < 0)
+		return rc;
+
+	// the data pages are consecutive, so the next page is the next pid
+	if (++cursor.eid == page.getEntryCount()) {
+		cursor.pid = (cursor.pid < pages) ? cursor.pid + 1 : -1;
+		cursor.eid = 0;
+	}
+	return 0;
+}
+
+/*
+ * Count the pairs with keys in [low, high].
+ * @param low[IN] the smallest key to count
+ * @param high[IN] the largest key to count
+ * @param count[OUT] the number of pairs in the range
+ * @return error code. 0 if no error
+ */
+RC LearnedIndex::countRange(int low, int high, int& count)
+{
+	RC rc;
+	int from, to;
+	bool found;
+
+	count = 0;
+	if (low > high)
+		return 0;
+
+	if ((rc = lowerBound(low, from, found)) < 0)
+		return rc;
+	if (high == INT_MAX)
+		to = model.entryCount;
+	else if ((rc = lowerBound(high + 1, to, found)) < 0)
+		return rc;
+
+	count = to - from;
+	return 0;
+}
+
+/*
+ * Find the position of the first pair with a key >= searchKey.
+ * @param searchKey[IN] the key to look for
+ * @param pos[OUT] the position (the entry count if every key is smaller)
+ * @param found[OUT] true if the pair at pos has searchKey
+ * @return error code. 0 if no error
+ */
+RC LearnedIndex::lowerBound(int searchKey, int& pos, bool& found)
+{
+	RC rc;
+	LearnedPage page;
+	const int perPage = LearnedPage::MAX_ENTRIES;
+	int pages = (model.entryCount + perPage - 1) / perPage;
+
+	pos = 0;
+	found = false;
+	if (model.entryCount == 0)
+		return 0;
+
+	// the segment of searchKey, and the positions its keys can have
+	vector<Segment>& segs = model.segments;
+	int next = 0;
+	for (int right = (int) segs.size(); next < right; ) {
+		int mid = (next + right) / 2;
+		if (segs[mid].key <= searchKey)
+			next = mid + 1;
+		else
+			right = mid;
+	}
+	double p = 0;
+	int lo = 0, hi = 0;
+	if (next > 0) {
+		Segment& s = segs[next - 1];
+		lo = s.pos;
+		hi = (next < (int) segs.size()) ? segs[next].pos : model.entryCount;
+		p = s.pos + s.slope * ((double) searchKey - s.key);
+		p = max((double) lo, min((double) hi, p));
+	}
+	int from = max(lo, (int) floor(p) - EPSILON);
+
+	// start at the predicted page; step back while the window reaches into
+	// an earlier page and the page starts with a key that is not smaller
+	int pg = min((int) p, model.entryCount - 1) / perPage;
+	if ((rc = page.read(pg + 1, pf)) < 0)
+		return rc;
+
+	int key;
+	RecordId rid;
+	bool stepped = false;
+	int nextKey = 0;
+	while (pg * perPage > from && page.readEntry(0, key, rid) == 0 && key >= searchKey) {
+		stepped = true;
+		nextKey = key;
+		pg--;
+		if ((rc = page.read(pg + 1, pf)) < 0)
+			return rc;
+	}
+
+	int eid = page.lowerBound(searchKey);
+	if (eid == page.getEntryCount() && stepped) {
+		pos = (pg + 1) * perPage;
+		found = (nextKey == searchKey);
+		return 0;
+	}
+
+	// past the window (which the model rules out) the pages are scanned on
+	while (eid == page.getEntryCount() && pg + 1 < pages) {
+		pg++;
+		if ((rc = page.read(pg + 1, pf)) < 0)
+			return rc;
+		eid = page.lowerBound(searchKey);
+	}
+
+	pos = pg * perPage + eid;
+	found = (page.readEntry(eid, key, rid) == 0 && key == searchKey);
+	return 0;
+}
+
+/*
+ * Fit the segments of the model to sorted pairs.
+ *
+ * Every key k in the index is a point (k, first position of k), and
+ * unless k + 1 is a key as well, (k + 1, first position after the pairs
+ * of k) is a point too; a search key between two points then has its
+ * first pair at the position of the point after it. The points are cut
+ * into segments greedily: a segment starts at a point and takes the
+ * following points while some slope through its first point passes every
+ * point within EPSILON - 1 positions (the -1 is for rounding), which a
+ * shrinking range of slopes keeps track of.
+ * @param entries[IN] the pairs in key order
+ * @param segments[OUT] the segments
+ */
+void LearnedIndex::fit(const vector<pair<int, RecordId> >& entries, vector<Segment>& segments)
+{
+	vector<pair<int, int> > points;
+	size_t n = entries.size();
+
+	segments.clear();
+	for (size_t i = 0; i < n; ) {
+		int k = entries[i].first;
+		size_t e = i;
+		while (e < n && entries[e].first == k)
+			e++;
+		points.push_back(make_pair(k, (int) i));
+		if (k != INT_MAX && (e == n || entries[e].first != k + 1))
+			points.push_back(make_pair(k + 1, (int) e));
+		i = e;
+	}
+
+	const double eps = EPSILON - 1;
+	Segment cur;
+	double low = 0, high = HUGE_VAL;
+	for (size_t i = 0; i < points.size(); i++) {
+		double x = (double) points[i].first;
+		double y = points[i].second;
+
+		if (i > 0) {
+			double dx = x - cur.key;
+			double l = (y - eps - cur.pos) / dx;
+			double h = (y + eps - cur.pos) / dx;
+			if (max(low, l) <= min(high, h)) {
+				low = max(low, l);
+				high = min(high, h);
+				continue;
+			}
+			cur.slope = (high == HUGE_VAL) ? low : (low + high) / 2;
+			segments.push_back(cur);
+		}
+
+		cur.key = points[i].first;
+		cur.pos = points[i].second;
+		low = 0;
+		high = HUGE_VAL;
+	}
+	if (!points.empty()) {
+		cur.slope = (high == HUGE_VAL) ? low : (low + high) / 2;
+		segments.push_back(cur);
+	}
+}
@@ -0,0 +1,221 @@
+#ifndef LEARNEDINDEX_H
+#define LEARNEDINDEX_H
+
+#include "Bruinbase.h"
+#include "PageFile.h"
+#include "RecordFile.h"
+#include "BTreeIndex.h"
+#include <map>
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+/**
+ * A data page of a LearnedIndex: (key, RecordId) pairs in key order.
+ * Every data page but the last one is full, so the position of a pair
+ * among all pairs of the index gives its page and slot.
+ */
+class LearnedPage {
+ public:
+  LearnedPage();
+
+  // number of pairs per data page
+  static const int MAX_ENTRIES = (PageFile::PAGE_SIZE - sizeof(int)) / (sizeof(int) + sizeof(RecordId));
+
+  /**
+   * Read the content of the page pid in the PageFile pf.
+   * @param pid[IN] the PageId to read
+   * @param pf[IN] PageFile to read from
+   * @return 0 if successful. Return an error code if there is an error.
+   */
+  RC read(PageId pid, const PageFile& pf);
+
+  /**
+   * Write the content of the page to the page pid in the PageFile pf.
+   * @param pid[IN] the PageId to write to
+   * @param pf[IN] PageFile to write to
+   * @return 0 if successful. Return an error code if there is an error.
+   */
+  RC write(PageId pid, PageFile& pf);
+
+  /**
+   * Add a (key, RecordId) pair at the end of the page.
+   * @param key[IN] the key, no smaller than the keys in the page
+   * @param rid[IN] the RecordId
+   * @return 0 if successful. RC_NODE_FULL if the page is full.
+   */
+  RC append(int key, const RecordId& rid);
+
+  /**
+   * Read the (key, RecordId) pair of entry eid.
+   * @param eid[IN] the entry number to read
+   * @param key[OUT] the key
+   * @param rid[OUT] the RecordId
+   * @return 0 if successful. RC_INVALID_CURSOR if there is no such entry.
+   */
+  RC readEntry(int eid, int& key, RecordId& rid);
+
+  /**
+   * Return the entry number of the first pair with a key >= searchKey
+   * (the entry count if every key is smaller).
+   * @param searchKey[IN] the key to look for
+   */
+  int lowerBound(int searchKey);
+
+  /**
+   * Return the number of pairs stored in the page.
+   */
+  int getEntryCount();
+
+ private:
+  struct Entry {
+    int      key;
+    RecordId rid;
+  };
+
+  /**
+   * Return a pointer to the entry array in the buffer.
+   */
+  Entry* entries();
+
+  /**
+   * The main memory buffer for loading the content of the disk page:
+   * [entry count][entries].
+   */
+  char buffer[PageFile::PAGE_SIZE];
+};
+
+/**
+ * A read-only index on the int key column for tables whose keys are
+ * spread evenly, built in one go after a load. The (key, RecordId) pairs
+ * are stored in key order in full data pages, and a piecewise linear
+ * model of the keys maps a key to the position of its first pair, off by
+ * at most EPSILON positions. A lookup reads the data page of the
+ * predicted position, and a neighboring page only where the error window
+ * crosses into it; there are no non-leaf nodes to read. The model takes
+ * a few segments for evenly spread keys (a few KB for millions of
+ * skewed ones); it is read on open() and, like the bucket table of a
+ * HashIndex, kept for the file after close().
+ *
+ * The index has the locate()/readForward() interface of a B+tree index,
+ * so it answers key ranges as well. New pairs cannot be inserted one by
+ * one: build() merges them with the pairs already in the index and
+ * writes the whole file again.
+ *
+ * A LearnedIndex must not be used by several threads at once.
+ */
+class LearnedIndex {
+ public:
+  LearnedIndex();
+
+  /**
+   * Open the index file in read or write mode.
+   * Under 'w' mode, the index file is created if it does not exist.
+   * @param indexname[IN] the name of the index file
+   * @param mode[IN] 'r' for read, 'w' for write
+   * @return error code. 0 if no error
+   */
+  RC open(const std::string& indexname, char mode);
+
+  /**
+   * Close the index file.
+   * @return error code. 0 if no error
+   */
+  RC close();
+
+  /**
+   * Add (key, RecordId) pairs to the index: the pairs already in the
+   * index and the new ones are sorted, written to the data pages and
+   * fitted with a new model.
+   * @param entries[IN] the pairs to add, in any order
+   * @return error code. 0 if no error
+   */
+  RC build(const std::vector<std::pair<int, RecordId> >& entries);
+
+  /**
+   * Find the first pair with a key >= searchKey, like
+   * BTreeIndexT::locate(): if its key is searchKey, set the cursor to it
+   * and return 0. If not, set the cursor to the first pair with a larger
+   * key (pid -1 if there is none) and return RC_NO_SUCH_RECORD.
+   * @param searchKey[IN] the key to find
+   * @param cursor[OUT] the cursor pointing to the pair
+   * @return 0 if searchKey is found. Othewise, an error code
+   */
+  RC locate(int searchKey, IndexCursor& cursor);
+
+  /**
+   * Read the (key, rid) pair at the location specified by the index
+   * cursor, and move foward the cursor to the next pair.
+   * @param cursor[IN/OUT] the cursor pointing to a pair in a data page
+   * @param key[OUT] the key stored at the index cursor location.
+   * @param rid[OUT] the RecordId stored at the index cursor location.
+   * @return error code. 0 if no error, RC_END_OF_TREE past the last pair
+   */
+  RC readForward(IndexCursor& cursor, int& key, RecordId& rid);
+
+  /**
+   * Count the pairs with keys in [low, high] from the positions of the
+   * two ends of the range, without reading the pairs in between.
+   * @param low[IN] the smallest key to count
+   * @param high[IN] the largest key to count
+   * @param count[OUT] the number of pairs in the range
+   * @return error code. 0 if no error
+   */
+  RC countRange(int low, int high, int& count);
+
+ private:
+  // the largest distance between the predicted and the real position of
+  // the first pair of a key; less than a page, so that the pairs a lookup
+  // may have to look at lie in at most two pages
+  static const int EPSILON = LearnedPage::MAX_ENTRIES / 2;
+
+  /**
+   * One piece of the model: the keys from key up to the key of the next
+   * segment have their first pair around pos + slope * (key' - key).
+   */
+  struct Segment {
+    int    key;    // the first key of the segment
+    int    pos;    // the position of the first pair of key
+    double slope;  // positions per key
+  };
+
+  // number of segments per model page
+  static const int MODEL_ENTRIES = PageFile::PAGE_SIZE / sizeof(Segment);
+
+  /**
+   * The state of an index file that open() reads from page 0 and the
+   * model pages. It stays valid while the file has endPid pages.
+   */
+  struct Model {
+    Model() : endPid(-1), entryCount(0) {}
+
+    PageId endPid;      // the size of the file the state is valid for
+    int    entryCount;  // the pairs in the index
+    std::vector<Segment> segments;
+  };
+
+  /**
+   * Find the position of the first pair with a key >= searchKey.
+   * @param searchKey[IN] the key to look for
+   * @param pos[OUT] the position (the entry count if every key is smaller)
+   * @param found[OUT] true if the pair at pos has searchKey
+   * @return error code. 0 if no error
+   */
+  RC lowerBound(int searchKey, int& pos, bool& found);
+
+  /**
+   * Fit the segments of the model to sorted pairs.
+   * @param entries[IN] the pairs in key order
+   * @param segments[OUT] the segments
+   */
+  static void fit(const std::vector<std::pair<int, RecordId> >& entries, std::vector<Segment>& segments);
+
+  PageFile    pf;        /// the PageFile the index is stored in
+  std::string name;      /// the name of the index file
+  Model       model;     /// the state of the index
+
+  static std::map<std::string, Model> models; /// by file name
+  static pthread_mutex_t modelLatch; /// guards models
+};
+
+#endif /* LEARNEDINDEX_H */
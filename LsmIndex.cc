@@ -0,0 +1,542 @@
+#include "LsmIndex.h"
+#include <cstring>
+#include <climits>
+#include <cstdio>
+
+using namespace std;
+
+// page 0 of the .lsm file holds [next run number, run count, run numbers]
+
+map<string, LsmIndex::Manifest> LsmIndex::manifests;
+vector<pthread_t> LsmIndex::mergers;
+pthread_mutex_t LsmIndex::manifestLatch = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * LsmIndex constructor
+ */
+LsmIndex::LsmIndex()
+{
+	writable = false;
+	hasBase = false;
+}
+
+/*
+ * LsmIndex destructor
+ */
+LsmIndex::~LsmIndex()
+{
+	closeSources();
+}
+
+/*
+ * Open the tier of the B+tree index <name>.idx in read or write mode.
+ * @param indexname[IN] the name of the index without the extension
+ * @param mode[IN] 'r' for read, 'w' for write
+ * @return error code. 0 if no error
+ */
+RC LsmIndex::open(const string& indexname, char mode)
+{
+	RC rc = 0;
+	PageFile pf;
+	char buf[PageFile::PAGE_SIZE];
+	int* bufPtr = (int*) buf;
+
+	if ((rc = pf.open(indexname + ".lsm", mode)) < 0)
+		return rc;
+	name = indexname;
+	writable = (mode == 'w');
+
+	// a merge rewrites the list of runs on its own; it must not do so
+	// over the list of a write transaction, nor merge its runs
+	if (writable && PageFile::isWriting())
+		waitForMerges();
+
+	// the list of runs is read once and then kept up to date in memory;
+	// a snapshot that misses a later change reads the list it sees (which
+	// only changes under manifestLatch)
+	pthread_mutex_lock(&manifestLatch);
+	bool current = pf.isCurrent();
+	Manifest& m = manifests[name];
+	if (!current) {
+		if ((rc = pf.read(0, buf)) == 0) {
+			int count = bufPtr[1];
+			if (count < 0 || count > PageFile::PAGE_SIZE / (int) sizeof(int) - 2)
+				rc = RC_INVALID_FILE_FORMAT;
+			else
+				runIds.assign(bufPtr + 2, bufPtr + 2 + count);
+		}
+	}
+	else if (!m.loaded) {
+		if (pf.endPid() == 0) {
+			if (writable)
+				rc = saveManifest(name, m);
+		}
+		else if ((rc = pf.read(0, buf)) == 0) {
+			int count = bufPtr[1];
+			if (bufPtr[0] < 0 || count < 0 || count > PageFile::PAGE_SIZE / (int) sizeof(int) - 2)
+				rc = RC_INVALID_FILE_FORMAT;
+			else {
+				m.nextRun = bufPtr[0];
+				m.runs.assign(bufPtr + 2, bufPtr + 2 + count);
+			}
+		}
+		m.loaded = (rc == 0 && (writable || pf.endPid() > 0));
+	}
+	if (current)
+		runIds = m.runs;
+	if (rc == 0)
+		rc = openSources();
+	pthread_mutex_unlock(&manifestLatch);
+	pf.close();
+
+	return rc;
+}
+
+/*
+ * Write the memtable out as a run, and close the index.
+ * @return error code. 0 if no error
+ */
+RC LsmIndex::close()
+{
+	RC rc = 0;
+	RC r_close;
+
+	if (writable)
+		rc = flush();
+	if ((r_close = closeSources()) < 0)
+		rc = r_close;
+	memtable.clear();
+	return rc;
+}
+
+/*
+ * Insert a (key, RecordId) pair into the memtable.
+ * @param key[IN] the key
+ * @param rid[IN] the RecordId of the tuple
+ * @return error code. 0 if no error
+ */
+RC LsmIndex::insert(int key, const RecordId& rid)
+{
+	if (!writable)
+		return RC_INVALID_FILE_MODE;
+
+	// pairs of equal keys stay in insertion order
+	memtable.insert(make_pair(key, rid));
+	if ((int) memtable.size() >= MEMTABLE_ENTRIES)
+		return flush();
+	return 0;
+}
+
+/*
+ * Write the memtable out as a new run.
+ * @return error code. 0 if no error
+ */
+RC LsmIndex::flush()
+{
+	RC rc;
+	int n;
+
+	if (!writable)
+		return RC_INVALID_FILE_MODE;
+	if (memtable.empty())
+		return 0;
+
+	// new runs wait while the background merges are far behind
+	pthread_mutex_lock(&manifestLatch);
+	bool behind = ((int) manifests[name].runs.size() >= 2 * MAX_RUNS);
+	pthread_mutex_unlock(&manifestLatch);
+	if (behind)
+		waitForMerges();
+
+	// the run number is saved before the run is written, so that no later
+	// run reuses the file if the run never makes it into the list
+	pthread_mutex_lock(&manifestLatch);
+	Manifest& m = manifests[name];
+	n = m.nextRun++;
+	rc = saveManifest(name, m);
+	pthread_mutex_unlock(&manifestLatch);
+	if (rc < 0)
+		return rc;
+
+	vector<pair<int, RecordId> > entries(memtable.begin(), memtable.end());
+	LearnedIndex* run = new LearnedIndex;
+	if ((rc = run->open(runName(name, n), 'w')) < 0) {
+		delete run;
+		return rc;
+	}
+	if ((rc = run->build(entries)) < 0) {
+		run->close();
+		delete run;
+		PageFile::remove(runName(name, n));
+		return rc;
+	}
+
+	// the new run stays open for the lookups of this index
+	runs.push_back(run);
+	runIds.push_back(n);
+	memtable.clear();
+
+	pthread_mutex_lock(&manifestLatch);
+	m.runs.push_back(n);
+	rc = saveManifest(name, m);
+	if (rc == 0 && !PageFile::isWriting())
+		startMerge(name, m);
+	pthread_mutex_unlock(&manifestLatch);
+
+	return rc;
+}
+
+/*
+ * Move the memtable and all runs into the B+tree, and remove the runs.
+ * @return error code. 0 if no error
+ */
+RC LsmIndex::merge()
+{
+	RC rc = 0;
+	vector<pair<int, RecordId> > entries;
+	vector<int> ids;
+
+	if (!writable || !hasBase)
+		return RC_INVALID_FILE_MODE;
+
+	// a background merge would replace runs under our feet
+	waitForMerges();
+
+	pthread_mutex_lock(&manifestLatch);
+	ids = manifests[name].runs;
+	pthread_mutex_unlock(&manifestLatch);
+
+	for (size_t i = 0; i < ids.size(); i++)
+		if ((rc = readRun(runName(name, ids[i]), entries)) < 0)
+			return rc;
+	entries.insert(entries.end(), memtable.begin(), memtable.end());
+
+	// the sorted pairs go into the leaves one leaf at a time
+	if ((rc = base.bulkLoad(entries, 100)) < 0)
+		return rc;
+	memtable.clear();
+
+	pthread_mutex_lock(&manifestLatch);
+	Manifest& m = manifests[name];
+	m.runs.erase(m.runs.begin(), m.runs.begin() + ids.size());
+	rc = saveManifest(name, m);
+	pthread_mutex_unlock(&manifestLatch);
+	if (rc < 0)
+		return rc;
+
+	for (size_t i = 0; i < runs.size(); i++) {
+		runs[i]->close();
+		delete runs[i];
+	}
+	runs.clear();
+	runIds.clear();
+	for (size_t i = 0; i < ids.size(); i++)
+		PageFile::remove(runName(name, ids[i]));
+
+	return 0;
+}
+
+/*
+ * Return true if there are pairs outside of the B+tree.
+ */
+bool LsmIndex::hasRuns()
+{
+	return !runs.empty() || !memtable.empty();
+}
+
+/*
+ * Set the cursor to the first pair with a key >= searchKey.
+ * @param searchKey[IN] the key to find
+ * @param cursor[OUT] the cursor
+ * @return 0 if searchKey is found. Otherwise an error code
+ */
+RC LsmIndex::locate(int searchKey, LsmCursor& cursor)
+{
+	RC rc;
+	bool found = false;
+
+	cursor.runs.resize(runs.size());
+	cursor.heads.resize(runs.size() + 2);
+
+	cursor.base.pid = -1;
+	if (hasBase && (rc = base.locate(searchKey, cursor.base)) < 0 && rc != RC_NO_SUCH_RECORD)
+		return rc;
+	for (size_t i = 0; i < runs.size(); i++)
+		if ((rc = runs[i]->locate(searchKey, cursor.runs[i])) < 0 && rc != RC_NO_SUCH_RECORD)
+			return rc;
+	cursor.mem = memtable.lower_bound(searchKey);
+
+	for (size_t i = 0; i < cursor.heads.size(); i++) {
+		if ((rc = advance(cursor, i)) < 0)
+			return rc;
+		if (cursor.heads[i].valid && cursor.heads[i].key == searchKey)
+			found = true;
+	}
+	return found ? 0 : RC_NO_SUCH_RECORD;
+}
+
+/*
+ * Read the smallest pair at the cursor and move the cursor past it.
+ * @param cursor[IN/OUT] the cursor
+ * @param key[OUT] the key of the pair
+ * @param rid[OUT] the RecordId of the pair
+ * @return error code. 0 if no error, RC_END_OF_TREE past the last pair
+ */
+RC LsmIndex::readForward(LsmCursor& cursor, int& key, RecordId& rid)
+{
+	int next = -1;
+
+	// on equal keys the earlier source wins
+	for (size_t i = 0; i < cursor.heads.size(); i++)
+		if (cursor.heads[i].valid && (next < 0 || cursor.heads[i].key < cursor.heads[next].key))
+			next = (int) i;
+	if (next < 0)
+		return RC_END_OF_TREE;
+
+	key = cursor.heads[next].key;
+	rid = cursor.heads[next].rid;
+	return advance(cursor, next);
+}
+
+/*
+ * Start a background merge for every index with MAX_RUNS runs or more.
+ */
+void LsmIndex::startMerges()
+{
+	pthread_mutex_lock(&manifestLatch);
+	map<string, Manifest>::iterator it;
+	for (it = manifests.begin(); it != manifests.end(); it++)
+		startMerge(it->first, it->second);
+	pthread_mutex_unlock(&manifestLatch);
+}
+
+/*
+ * Wait for the background merges of all indexes to finish.
+ */
+void LsmIndex::waitForMerges()
+{
+	vector<pthread_t> threads;
+
+	pthread_mutex_lock(&manifestLatch);
+	threads.swap(mergers);
+	pthread_mutex_unlock(&manifestLatch);
+
+	for (size_t i = 0; i < threads.size(); i++)
+		pthread_join(threads[i], NULL);
+}
+
+/*
+ * Read the next pair of source i into its head.
+ * @param cursor[IN/OUT] the cursor
+ * @param i[IN] the source
+ * @return error code. 0 if no error
+ */
+RC LsmIndex::advance(LsmCursor& cursor, size_t i)
+{
+	RC rc = 0;
+	LsmCursor::Head& head = cursor.heads[i];
+
+	if (i == 0)
+		rc = hasBase ? base.readForward(cursor.base, head.key, head.rid) : RC_END_OF_TREE;
+	else if (i <= runs.size())
+		rc = runs[i - 1]->readForward(cursor.runs[i - 1], head.key, head.rid);
+	else if (cursor.mem == memtable.end())
+		rc = RC_END_OF_TREE;
+	else {
+		head.key = cursor.mem->first;
+		head.rid = cursor.mem->second;
+		++cursor.mem;
+	}
+
+	head.valid = (rc == 0);
+	return (rc == RC_END_OF_TREE) ? 0 : rc;
+}
+
+/*
+ * Open the runs in runIds, and the B+tree if it exists.
+ * @return error code. 0 if no error
+ */
+RC LsmIndex::openSources()
+{
+	RC rc = 0;
+
+	for (size_t i = 0; i < runIds.size(); i++) {
+		LearnedIndex* run = new LearnedIndex;
+		if ((rc = run->open(runName(name, runIds[i]), 'r')) < 0) {
+			delete run;
+			break;
+		}
+		runs.push_back(run);
+	}
+
+	if (rc == 0) {
+		rc = base.open(name + ".idx", writable ? 'w' : 'r');
+		hasBase = (rc == 0);
+		// a read-only tier needs no B+tree
+		if (!writable)
+			rc = 0;
+	}
+	if (rc < 0)
+		closeSources();
+	return rc;
+}
+
+/*
+ * Close the runs and the B+tree.
+ * @return error code. 0 if no error
+ */
+RC LsmIndex::closeSources()
+{
+	RC rc = 0;
+
+	for (size_t i = 0; i < runs.size(); i++) {
+		runs[i]->close();
+		delete runs[i];
+	}
+	runs.clear();
+	runIds.clear();
+
+	if (hasBase)
+		rc = base.close();
+	hasBase = false;
+	return rc;
+}
+
+/*
+ * Start a background merge of the runs of an index, unless one is running.
+ * @param name[IN] the name of the index
+ * @param m[IN/OUT] its runs
+ */
+void LsmIndex::startMerge(const string& name, Manifest& m)
+{
+	if ((int) m.runs.size() < MAX_RUNS || m.merging)
+		return;
+
+	pthread_t thread;
+	string* arg = new string(name);
+	if (pthread_create(&thread, NULL, mergeRuns, arg) == 0) {
+		m.merging = true;
+		mergers.push_back(thread);
+	}
+	else
+		delete arg;
+}
+
+/*
+ * Write the list of runs of name to its .lsm file.
+ * @param name[IN] the name of the index
+ * @param m[IN] its runs
+ * @return error code. 0 if no error
+ */
+RC LsmIndex::saveManifest(const string& name, const Manifest& m)
+{
+	RC rc;
+	PageFile pf;
+	char buf[PageFile::PAGE_SIZE];
+	int* bufPtr = (int*) buf;
+
+	if ((int) m.runs.size() > PageFile::PAGE_SIZE / (int) sizeof(int) - 2)
+		return RC_NODE_FULL;
+
+	memset(buf, 0, PageFile::PAGE_SIZE);
+	bufPtr[0] = m.nextRun;
+	bufPtr[1] = (int) m.runs.size();
+	for (size_t i = 0; i < m.runs.size(); i++)
+		bufPtr[2 + i] = m.runs[i];
+
+	if ((rc = pf.open(name + ".lsm", 'w')) < 0)
+		return rc;
+	rc = pf.write(0, buf);
+	pf.close();
+	return rc;
+}
+
+/*
+ * Return the file name of run n of the index name.
+ */
+string LsmIndex::runName(const string& name, int n)
+{
+	char suffix[16];
+	sprintf(suffix, ".run%d", n);
+	return name + suffix;
+}
+
+/*
+ * Read all pairs of a run, in key order.
+ * @param file[IN] the file name of the run
+ * @param entries[OUT] the pairs are added at the end
+ * @return error code. 0 if no error
+ */
+RC LsmIndex::readRun(const string& file, vector<pair<int, RecordId> >& entries)
+{
+	RC rc;
+	LearnedIndex run;
+	IndexCursor cursor;
+	int key;
+	RecordId rid;
+
+	if ((rc = run.open(file, 'r')) < 0)
+		return rc;
+	rc = run.locate(INT_MIN, cursor);
+	if (rc == 0 || rc == RC_NO_SUCH_RECORD)
+		while ((rc = run.readForward(cursor, key, rid)) == 0)
+			entries.push_back(make_pair(key, rid));
+	run.close();
+
+	return (rc == RC_END_OF_TREE) ? 0 : rc;
+}
+
+/*
+ * Merge the runs of an index into a single run.
+ *
+ * The oldest MAX_RUNS runs are read and written out as one new run
+ * without holding manifestLatch; the list then swaps them for the new
+ * run, and their files are removed once no snapshot reads them (see
+ * PageFile::remove()). Lookups that still have them open keep reading
+ * the removed files. New runs may come in meanwhile, so
+ * this goes on until there are fewer than MAX_RUNS runs.
+ * @param arg[IN] the name of the index, a new std::string
+ */
+void* LsmIndex::mergeRuns(void* arg)
+{
+	string name = *(string*) arg;
+	delete (string*) arg;
+
+	pthread_mutex_lock(&manifestLatch);
+	Manifest& m = manifests[name];
+	while ((int) m.runs.size() >= MAX_RUNS) {
+		RC rc = 0;
+		vector<int> ids(m.runs.begin(), m.runs.begin() + MAX_RUNS);
+		int n = m.nextRun++;
+		if (saveManifest(name, m) < 0)
+			break;
+		pthread_mutex_unlock(&manifestLatch);
+
+		vector<pair<int, RecordId> > entries;
+		for (size_t i = 0; i < ids.size() && rc == 0; i++)
+			rc = readRun(runName(name, ids[i]), entries);
+		if (rc == 0) {
+			LearnedIndex run;
+			if ((rc = run.open(runName(name, n), 'w')) == 0) {
+				rc = run.build(entries);
+				run.close();
+			}
+		}
+
+		pthread_mutex_lock(&manifestLatch);
+		if (rc < 0) {
+			PageFile::remove(runName(name, n));
+			break;
+		}
+		m.runs.erase(m.runs.begin(), m.runs.begin() + ids.size());
+		m.runs.insert(m.runs.begin(), n);
+		if (saveManifest(name, m) < 0)
+			break;
+		for (size_t i = 0; i < ids.size(); i++)
+			PageFile::remove(runName(name, ids[i]));
+	}
+	m.merging = false;
+	pthread_mutex_unlock(&manifestLatch);
+
+	return NULL;
+}
@@ -0,0 +1,232 @@
+#ifndef LSMINDEX_H
+#define LSMINDEX_H
+
+#include "Bruinbase.h"
+#include "RecordFile.h"
+#include "BTreeIndex.h"
+#include "LearnedIndex.h"
+#include <map>
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+/**
+ * A cursor over an LsmIndex: one position in each of the B+tree, the
+ * runs and the memtable, and the next pair of each of them.
+ */
+struct LsmCursor {
+  /**
+   * The next pair of one source. The sources are the B+tree, the runs
+   * from the oldest to the newest, and the memtable, in this order.
+   */
+  struct Head {
+    bool     valid;  // false once the source has no more pairs
+    int      key;
+    RecordId rid;
+  };
+
+  IndexCursor              base;   // the position in the B+tree
+  std::vector<IndexCursor> runs;   // the position in every run
+  std::multimap<int, RecordId>::const_iterator mem; // in the memtable
+  std::vector<Head>        heads;  // the next pair of every source
+};
+
+/**
+ * An ingest tier in front of the B+tree index on the key column, like
+ * the upper levels of a log-structured merge tree. New (key, RecordId)
+ * pairs go into a sorted memtable in memory; a full memtable (and the
+ * memtable at close()) is written out as an immutable sorted run, a
+ * LearnedIndex file of its own, with sequential writes only. Once there
+ * are MAX_RUNS runs, a background thread merges them into a single run.
+ * merge() finally moves all runs into the B+tree, one leaf at a time
+ * (see BTreeIndexT::bulkLoad()).
+ *
+ * A lookup merges the B+tree, the runs and the memtable: locate() and
+ * readForward() return the pairs of all of them in key order, those of
+ * equal keys from the B+tree first, then from the older runs. A cursor
+ * does not survive insert() or flush() on its index.
+ *
+ * The list of runs of an index <name> is kept in <name>.lsm, and a run
+ * in <name>.run<N>. The B+tree is <name>.idx, which need not exist.
+ *
+ * The runs a merge replaces are removed through PageFile::remove(), so
+ * a snapshot that began before the merge still reads them. A merge only
+ * starts outside of a write transaction, as a snapshot must not see its
+ * new run list before the runs it lists are committed; startMerges()
+ * starts the merges that were held back. For the same reason, open()
+ * in 'w' mode within a write transaction first waits for the running
+ * merges, and there is one write transaction at a time.
+ *
+ * An LsmIndex must not be used by several threads at once; the
+ * background merges run beside it.
+ */
+class LsmIndex {
+ public:
+  LsmIndex();
+  ~LsmIndex();
+
+  /**
+   * Open the tier of the B+tree index <name>.idx in read or write mode.
+   * Under 'w' mode, the list of runs is created if it does not exist.
+   * @param name[IN] the name of the index without the extension
+   * @param mode[IN] 'r' for read, 'w' for write
+   * @return error code. 0 if no error
+   */
+  RC open(const std::string& name, char mode);
+
+  /**
+   * Write the memtable out as a run, and close the index.
+   * @return error code. 0 if no error
+   */
+  RC close();
+
+  /**
+   * Insert a (key, RecordId) pair into the memtable, writing it out as
+   * a run once it holds MEMTABLE_ENTRIES pairs.
+   * @param key[IN] the key
+   * @param rid[IN] the RecordId of the tuple
+   * @return error code. 0 if no error
+   */
+  RC insert(int key, const RecordId& rid);
+
+  /**
+   * Write the memtable out as a new run, and start a background merge
+   * of the runs if there are MAX_RUNS of them.
+   * @return error code. 0 if no error
+   */
+  RC flush();
+
+  /**
+   * Move the memtable and all runs into the B+tree, and remove the runs.
+   * Under 'w' mode only.
+   * @return error code. 0 if no error
+   */
+  RC merge();
+
+  /**
+   * Return true if there are pairs outside of the B+tree.
+   */
+  bool hasRuns();
+
+  /**
+   * Set the cursor to the first pair with a key >= searchKey in the
+   * B+tree, the runs or the memtable.
+   * @param searchKey[IN] the key to find
+   * @param cursor[OUT] the cursor
+   * @return 0 if searchKey is found. RC_NO_SUCH_RECORD if the cursor
+   *         points to a larger key (or to nothing). Otherwise an error code
+   */
+  RC locate(int searchKey, LsmCursor& cursor);
+
+  /**
+   * Read the smallest pair at the cursor and move the cursor past it.
+   * @param cursor[IN/OUT] the cursor
+   * @param key[OUT] the key of the pair
+   * @param rid[OUT] the RecordId of the pair
+   * @return error code. 0 if no error, RC_END_OF_TREE past the last pair
+   */
+  RC readForward(LsmCursor& cursor, int& key, RecordId& rid);
+
+  /**
+   * Start a background merge for every index with MAX_RUNS runs or more
+   * that has none running.
+   */
+  static void startMerges();
+
+  /**
+   * Wait for the background merges of all indexes to finish.
+   */
+  static void waitForMerges();
+
+ private:
+  // the pairs the memtable holds before it becomes a run
+  static const int MEMTABLE_ENTRIES = 65536;
+
+  // the runs that are merged into one in the background
+  static const int MAX_RUNS = 4;
+
+  /**
+   * The runs of an index: the numbers of their files from the oldest to
+   * the newest, and the number of the next run.
+   */
+  struct Manifest {
+    Manifest() : loaded(false), nextRun(0), merging(false) {}
+
+    bool             loaded;   // read from the .lsm file yet
+    int              nextRun;
+    std::vector<int> runs;
+    bool             merging;  // a background merge is running
+  };
+
+  /**
+   * Read the next pair of source i into its head.
+   * @param cursor[IN/OUT] the cursor
+   * @param i[IN] the source
+   * @return error code. 0 if no error
+   */
+  RC advance(LsmCursor& cursor, size_t i);
+
+  /**
+   * Open the runs in runIds, and the B+tree if it exists. The caller
+   * holds manifestLatch, so that no merge removes a run meanwhile.
+   * @return error code. 0 if no error
+   */
+  RC openSources();
+
+  /**
+   * Start a background merge of the runs of an index, unless one is
+   * running. The caller holds manifestLatch.
+   * @param name[IN] the name of the index
+   * @param m[IN/OUT] its runs
+   */
+  static void startMerge(const std::string& name, Manifest& m);
+
+  /**
+   * Close the runs and the B+tree.
+   * @return error code. 0 if no error
+   */
+  RC closeSources();
+
+  /**
+   * Read all pairs of a run, in key order.
+   * @param file[IN] the file name of the run
+   * @param entries[OUT] the pairs are added at the end
+   * @return error code. 0 if no error
+   */
+  static RC readRun(const std::string& file, std::vector<std::pair<int, RecordId> >& entries);
+
+  /**
+   * Write the list of runs of name to its .lsm file. The caller holds
+   * manifestLatch.
+   * @param name[IN] the name of the index
+   * @param m[IN] its runs
+   * @return error code. 0 if no error
+   */
+  static RC saveManifest(const std::string& name, const Manifest& m);
+
+  /**
+   * Return the file name of run n of the index name.
+   */
+  static std::string runName(const std::string& name, int n);
+
+  /**
+   * Merge the runs of an index into a single run (the thread body of a
+   * background merge).
+   * @param arg[IN] the name of the index, a new std::string
+   */
+  static void* mergeRuns(void* arg);
+
+  std::string  name;      /// the name of the index without the extension
+  bool         writable;  /// true if the index was opened in 'w' mode
+  bool         hasBase;   /// true if the B+tree exists
+  BTreeIndex   base;      /// the B+tree
+  std::vector<int> runIds; /// the runs open in runs
+  std::vector<LearnedIndex*> runs; /// the open runs, oldest first
+  std::multimap<int, RecordId> memtable; /// the pairs not written out yet
+
+  static std::map<std::string, Manifest> manifests; /// by index name
+  static std::vector<pthread_t> mergers; /// the background merges started
+  static pthread_mutex_t manifestLatch; /// guards manifests and mergers
+};
+
+#endif /* LSMINDEX_H */
@@ -15,11 +15,23 @@
 #include <unistd.h>
 
 using std::string;
+using std::map;
+using std::multiset;
+using std::vector;
+using std::pair;
+using std::make_pair;
 
 int PageFile::readCount = 0;
 int PageFile::writeCount = 0;
-int PageFile::cacheClock = 1;
-struct PageFile::cacheStruct PageFile::readCache[PageFile::CACHE_COUNT];
+struct PageFile::cacheShard PageFile::readCache[PageFile::CACHE_SHARDS];
+pthread_rwlock_t PageFile::versionLatch = PTHREAD_RWLOCK_INITIALIZER;
+pthread_rwlock_t PageFile::pageLatches[PageFile::PAGE_LATCHES];
+int PageFile::commitClock = 0;
+multiset<int> PageFile::snapshots;
+map<PageFile::FileId, PageFile::FileVersions> PageFile::versions;
+vector<pair<int, string> > PageFile::removals;
+pthread_key_t PageFile::threadKey;
+pthread_once_t PageFile::threadOnce = PTHREAD_ONCE_INIT;
 
 PageFile::PageFile() 
 { 
@@ -64,7 +76,25 @@ RC PageFile::open(const string& filename, char mode)
   rc = ::fstat(fd, &statbuf);
   if (rc < 0) { ::close(fd); fd = -1; return RC_FILE_OPEN_FAILED; }
   epid = statbuf.st_size / PAGE_SIZE;
+  id = FileId(statbuf.st_dev, statbuf.st_ino);
 
+  ThreadState* ts = threadState();
+  bool missing;
+
+  pthread_rwlock_wrlock(&versionLatch);
+  FileVersions& fv = versions[id];
+  if (fv.ends.empty()) fv.ends.push_back(make_pair(0, epid));
+  fv.opens++;
+
+  // a snapshot does not see a file that had no page when it began
+  missing = (ts->snapshot >= 0 && oflag == O_RDONLY && endAt(fv, ts->snapshot) == 0);
+  if (missing) {
+    fv.opens--;
+    collect(id);
+  }
+  pthread_rwlock_unlock(&versionLatch);
+
+  if (missing) { ::close(fd); fd = -1; epid = 0; return RC_FILE_OPEN_FAILED; }
   return 0;
 }
 
@@ -72,17 +102,29 @@ RC PageFile::close()
 {
   if (fd <= 0) return RC_FILE_CLOSE_FAILED;
 
+  // evict all cached pages for this file. this comes first, as another
+  // thread may get the same fd as soon as it is closed
+  for (int s = 0; s < CACHE_SHARDS; s++) {
+    cacheShard& shard = readCache[s];
+    pthread_mutex_lock(&shard.latch);
+    for (int i = 0; i < CACHE_COUNT; i++) {
+      if (shard.slots[i].fd == fd && shard.slots[i].lastAccessed != 0) {
+         shard.slots[i].fd = 0;
+         shard.slots[i].pid = 0;
+         shard.slots[i].lastAccessed = 0;
+      }
+    }
+    pthread_mutex_unlock(&shard.latch);
+  }
+
   // close the file
   if (::close(fd) < 0) return RC_FILE_CLOSE_FAILED;
 
-  // evict all cached pages for this file
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].fd == fd && readCache[i].lastAccessed != 0) {
-       readCache[i].fd = 0;
-       readCache[i].pid = 0;
-       readCache[i].lastAccessed = 0;
-    }
-  }
+  // the versions of the file go once nobody needs them
+  pthread_rwlock_wrlock(&versionLatch);
+  versions[id].opens--;
+  collect(id);
+  pthread_rwlock_unlock(&versionLatch);
 
   // set the fd and epid to the initial state
   fd = -1; 
@@ -90,9 +132,154 @@ RC PageFile::close()
   return 0;
 }
 
+void PageFile::prefetch(PageId pid, int n) const
+{
+#ifdef POSIX_FADV_WILLNEED
+  PageId end = __atomic_load_n(&epid, __ATOMIC_ACQUIRE);
+
+  if (fd < 0 || pid < 0 || pid >= end || n <= 0) return;
+  if (n > end - pid) n = end - pid;
+
+  posix_fadvise(fd, (off_t) pid * PAGE_SIZE, (off_t) n * PAGE_SIZE, POSIX_FADV_WILLNEED);
+#endif
+}
+
 PageId PageFile::endPid() const 
 {
-  return epid;
+  ThreadState* ts = threadState();
+  PageId end = __atomic_load_n(&epid, __ATOMIC_ACQUIRE);
+
+  // a snapshot sees the size the file had when it began
+  if (ts->snapshot >= 0) {
+    pthread_rwlock_rdlock(&versionLatch);
+    map<FileId, FileVersions>::const_iterator it = versions.find(id);
+    if (it != versions.end() && endAt(it->second, ts->snapshot) < end)
+      end = endAt(it->second, ts->snapshot);
+    pthread_rwlock_unlock(&versionLatch);
+  }
+  return end;
+}
+
+bool PageFile::isCurrent() const
+{
+  ThreadState* ts = threadState();
+  bool current = true;
+
+  if (ts->snapshot < 0) return true;
+
+  pthread_rwlock_rdlock(&versionLatch);
+  map<FileId, FileVersions>::const_iterator it = versions.find(id);
+  if (it != versions.end()) {
+    const FileVersions& fv = it->second;
+    current = (fv.pending == 0 && fv.growing == 0 && fv.changed <= ts->snapshot);
+  }
+  pthread_rwlock_unlock(&versionLatch);
+  return current;
+}
+
+void PageFile::beginSnapshot()
+{
+  ThreadState* ts = threadState();
+
+  pthread_rwlock_wrlock(&versionLatch);
+  ts->snapshot = commitClock;
+  snapshots.insert(commitClock);
+  pthread_rwlock_unlock(&versionLatch);
+}
+
+void PageFile::endSnapshot()
+{
+  ThreadState* ts = threadState();
+
+  if (ts->snapshot < 0) return;
+
+  pthread_rwlock_wrlock(&versionLatch);
+  snapshots.erase(snapshots.find(ts->snapshot));
+  ts->snapshot = -1;
+
+  // the old contents only this snapshot needed go
+  map<FileId, FileVersions>::iterator it = versions.begin();
+  while (it != versions.end()) {
+    FileId next = (it++)->first;
+    collect(next);
+  }
+  collectRemoved();
+  pthread_rwlock_unlock(&versionLatch);
+}
+
+void PageFile::beginWrite()
+{
+  threadState()->writing = true;
+}
+
+void PageFile::commitWrite()
+{
+  ThreadState* ts = threadState();
+  map<FileId, FileVersions>::iterator f;
+
+  if (!ts->writing) return;
+
+  pthread_rwlock_wrlock(&versionLatch);
+  int commit = ++commitClock;
+
+  // the pages overwritten by the transaction
+  for (size_t i = 0; i < ts->pages.size(); i++) {
+    if ((f = versions.find(ts->pages[i].first)) == versions.end()) continue;
+    map<PageId, PageState>::iterator st = f->second.pages.find(ts->pages[i].second);
+    if (st != f->second.pages.end() && st->second.commit == UNCOMMITTED) {
+      st->second.commit = commit;
+      f->second.pending--;
+    }
+    f->second.changed = commit;
+  }
+
+  // the files it added pages to
+  for (map<FileId, PageId>::iterator e = ts->ends.begin(); e != ts->ends.end(); e++) {
+    if ((f = versions.find(e->first)) == versions.end()) continue;
+    FileVersions& fv = f->second;
+    fv.growing--;
+    fv.changed = commit;
+    if (e->second > fv.ends.back().second) {
+      if (!snapshots.empty() && fv.ends.back().first <= *snapshots.rbegin())
+        fv.ends.push_back(make_pair(commit, e->second));
+      else
+        fv.ends.back() = make_pair(commit, e->second);
+    }
+  }
+
+  for (size_t i = 0; i < ts->removed.size(); i++)
+    removals.push_back(make_pair(commit, ts->removed[i]));
+
+  for (size_t i = 0; i < ts->pages.size(); i++)
+    collect(ts->pages[i].first);
+  for (map<FileId, PageId>::iterator e = ts->ends.begin(); e != ts->ends.end(); e++)
+    collect(e->first);
+  collectRemoved();
+  pthread_rwlock_unlock(&versionLatch);
+
+  ts->writing = false;
+  ts->pages.clear();
+  ts->ends.clear();
+  ts->removed.clear();
+}
+
+bool PageFile::isWriting()
+{
+  return threadState()->writing;
+}
+
+void PageFile::remove(const string& filename)
+{
+  ThreadState* ts = threadState();
+
+  pthread_rwlock_wrlock(&versionLatch);
+  if (ts->writing)
+    ts->removed.push_back(filename);
+  else {
+    removals.push_back(make_pair(commitClock, filename));
+    collectRemoved();
+  }
+  pthread_rwlock_unlock(&versionLatch);
 }
 
 RC PageFile::seek(PageId pid) const
@@ -102,79 +289,347 @@ RC PageFile::seek(PageId pid) const
 
 RC PageFile::write(PageId pid, const void* buffer)
 {
-  RC rc;
+  RC rc = 0;
+  ThreadState* ts = threadState();
+  FileVersions* fv;
+  PageState* st;
+  PageVersion old;
+  int seen;
+  bool keep;
+  bool kept = false;
+
   if (pid < 0) return RC_INVALID_PID; 
 
-  // seek to the location of the page
-  if ((rc = seek(pid)) < 0) return rc;
+  cacheShard& shard = shardOf(fd, pid);
+  pthread_rwlock_t& latch = pageLatch(id, pid);
+
+  // no other write of the page and no read of it from disk runs until
+  // the page and its versions are updated
+  pthread_rwlock_wrlock(&latch);
+
+  for (;;) {
+    pthread_rwlock_wrlock(&versionLatch);
+    fv = &versions[id];
+
+    // the content on disk is kept if a snapshot may still read it: any
+    // snapshot while the write is not committed, or else the running
+    // snapshots that see it. pages past the end need nothing kept
+    st = NULL;
+    seen = 0;
+    keep = false;
+    if (pid < fv->ends.back().second) {
+      map<PageId, PageState>::iterator it = fv->pages.find(pid);
+      if (it != fv->pages.end()) {
+        st = &it->second;
+        seen = st->commit;
+      }
+      if (seen != UNCOMMITTED)
+        keep = ts->writing || (!snapshots.empty() && *snapshots.rbegin() >= seen);
+    }
+    if (!keep || kept) break;
+
+    // read the content without versionLatch, and check again, as a
+    // snapshot may begin meanwhile
+    pthread_rwlock_unlock(&versionLatch);
+    if (::pread(fd, old.buffer, PAGE_SIZE, (off_t) pid * PAGE_SIZE) < 0) {
+      pthread_rwlock_unlock(&latch);
+      return RC_FILE_READ_FAILED;
+    }
+    __sync_fetch_and_add(&readCount, 1);
+    kept = true;
+  }
+  old.commit = seen;
+
+  // the new content is seen when the write transaction commits, or
+  // right away. the snapshots that read the page wait for the latch of
+  // the page, so they find it on disk
+  if (pid >= fv->ends.back().second) {
+    if (ts->writing) {
+      map<FileId, PageId>::iterator e = ts->ends.find(id);
+      if (e == ts->ends.end()) {
+        fv->growing++;
+        ts->ends[id] = pid + 1;
+      }
+      else if (pid >= e->second)
+        e->second = pid + 1;
+    }
+    else {
+      fv->changed = ++commitClock;
+      if (!snapshots.empty() && fv->ends.back().first <= *snapshots.rbegin())
+        fv->ends.push_back(make_pair(commitClock, pid + 1));
+      else
+        fv->ends.back() = make_pair(commitClock, pid + 1);
+    }
+  }
+  else if (seen != UNCOMMITTED) {
+    if (st == NULL && keep) st = &fv->pages[pid];
+    if (keep) st->older.push_back(old);
+    if (ts->writing) {
+      st = &fv->pages[pid];
+      st->commit = UNCOMMITTED;
+      fv->pending++;
+      ts->pages.push_back(make_pair(id, pid));
+    }
+    else {
+      fv->changed = ++commitClock;
+      if (st != NULL) st->commit = commitClock;
+      // without snapshots, no state is needed
+      if (st != NULL && snapshots.empty()) fv->pages.erase(pid);
+    }
+  }
+  else if (!ts->writing)
+    fv->changed = ++commitClock;
+  pthread_rwlock_unlock(&versionLatch);
 
   // write the buffer to the disk page
-  if (::write(fd, buffer, PAGE_SIZE) < 0) return RC_FILE_WRITE_FAILED;
+  if (::pwrite(fd, buffer, PAGE_SIZE, (off_t) pid * PAGE_SIZE) < 0) {
+    rc = RC_FILE_WRITE_FAILED;
+    goto done;
+  }
 
   // if the page is in read cache, invalidate it
+  pthread_mutex_lock(&shard.latch);
   for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].fd == fd && readCache[i].pid == pid &&
-        readCache[i].lastAccessed != 0) {
-       readCache[i].fd = 0;
-       readCache[i].pid = 0;
-       readCache[i].lastAccessed = 0;
+    if (shard.slots[i].fd == fd && shard.slots[i].pid == pid &&
+        shard.slots[i].lastAccessed != 0) {
+       shard.slots[i].fd = 0;
+       shard.slots[i].pid = 0;
+       shard.slots[i].lastAccessed = 0;
        break;
     }
   }
+  shard.writes++;
+  pthread_mutex_unlock(&shard.latch);
 
-  // if the written pid >= end pid, update the end pid
-  if (pid >= epid) epid = pid + 1;
+  // if the written pid >= end pid, update the end pid. the page is on
+  // disk before a reader sees the new end, and a write of another page
+  // may grow the file at the same time
+  {
+    PageId end = __atomic_load_n(&epid, __ATOMIC_RELAXED);
+    while (pid >= end &&
+           !__atomic_compare_exchange_n(&epid, &end, pid + 1, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+  }
 
   // increase page write count
-  writeCount++;
+  __sync_fetch_and_add(&writeCount, 1);
 
-  return 0;
+  done:
+  pthread_rwlock_unlock(&latch);
+  return rc;
 }
 
 RC PageFile::read(PageId pid, void* buffer) const
 {
   RC rc;
+  int toEvict;
+  int writes;
+  ThreadState* ts = threadState();
+  bool snapshot = (ts->snapshot >= 0);
+
+  if (pid < 0) return RC_INVALID_PID; 
 
-  if (pid < 0 || pid >= epid) return RC_INVALID_PID; 
+  cacheShard& shard = shardOf(fd, pid);
+  pthread_rwlock_t& latch = pageLatch(id, pid);
+
+  // a snapshot keeps the page from being written until it is read, so
+  // that the content on disk is the one the check below found
+  if (snapshot) pthread_rwlock_rdlock(&latch);
+
+  if (pid >= __atomic_load_n(&epid, __ATOMIC_ACQUIRE)) { rc = RC_INVALID_PID; goto done; }
+
+  //
+  // a snapshot reads the content the page had when it began
+  //
+  if (snapshot) {
+    pthread_rwlock_rdlock(&versionLatch);
+    rc = readOlder(pid, ts->snapshot, buffer);
+    pthread_rwlock_unlock(&versionLatch);
+    if (rc <= 0) goto done;
+  }
 
   //
   // if the page is in cache, read it from there
   //
+  pthread_mutex_lock(&shard.latch);
   for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].fd == fd && readCache[i].pid == pid && 
-        readCache[i].lastAccessed != 0) {
-       memcpy(buffer, readCache[i].buffer, PAGE_SIZE);
-       readCache[i].lastAccessed = ++cacheClock;
-       return 0;
+    if (shard.slots[i].fd == fd && shard.slots[i].pid == pid && 
+        shard.slots[i].lastAccessed != 0) {
+       memcpy(buffer, shard.slots[i].buffer, PAGE_SIZE);
+       shard.slots[i].lastAccessed = ++shard.clock;
+       pthread_mutex_unlock(&shard.latch);
+       rc = 0;
+       goto done;
     }
   }
+  writes = shard.writes;
+  pthread_mutex_unlock(&shard.latch);
 
-  // seek to the page
-  if ((rc = seek(pid)) < 0) return rc;
-  
-  // find the cache slot to evict
-  int toEvict = 0; 
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].lastAccessed == 0) {
-      toEvict = i;
-      break;
+  // read the page without the cache latch, so that the other threads
+  // keep using the shard meanwhile. the page latch keeps the page from
+  // being written while it is read
+  if (!snapshot) pthread_rwlock_rdlock(&latch);
+  rc = (::pread(fd, buffer, PAGE_SIZE, (off_t) pid * PAGE_SIZE) < 0) ? RC_FILE_READ_FAILED : 0;
+  if (!snapshot) pthread_rwlock_unlock(&latch);
+  if (rc < 0) goto done;
+
+  // increase the page read count
+  __sync_fetch_and_add(&readCount, 1);
+
+  // cache the page, unless it was written while it was read
+  pthread_mutex_lock(&shard.latch);
+  if (shard.writes == writes) {
+    // find the cache slot to evict, or the one another thread put the
+    // page in meanwhile
+    toEvict = -1;
+    for (int i = 0; i < CACHE_COUNT; i++) {
+      if (shard.slots[i].fd == fd && shard.slots[i].pid == pid &&
+          shard.slots[i].lastAccessed != 0) {
+        toEvict = i;
+        break;
+      }
     }
-    if (readCache[i].lastAccessed < readCache[toEvict].lastAccessed) {
-      toEvict = i;
+    if (toEvict < 0) {
+      toEvict = 0; 
+      for (int i = 0; i < CACHE_COUNT; i++) {
+        if (shard.slots[i].lastAccessed == 0) {
+          toEvict = i;
+          break;
+        }
+        if (shard.slots[i].lastAccessed < shard.slots[toEvict].lastAccessed) {
+          toEvict = i;
+        }
+      }
     }
+    shard.slots[toEvict].fd = fd;
+    shard.slots[toEvict].pid = pid;
+    shard.slots[toEvict].lastAccessed = ++shard.clock;
+    memcpy(shard.slots[toEvict].buffer, buffer, PAGE_SIZE);
   }
-  readCache[toEvict].fd = fd;
-  readCache[toEvict].pid = pid;
-  readCache[toEvict].lastAccessed = ++cacheClock;
- 
-  // read the page to cache first and copy it to the buffer
-  if (::read(fd, readCache[toEvict].buffer, PAGE_SIZE) < 0) {
-    return RC_FILE_READ_FAILED;
-  }
-  memcpy(buffer, readCache[toEvict].buffer, PAGE_SIZE);
+  pthread_mutex_unlock(&shard.latch);
 
-  // increase the page read count
-  readCount++;
+  done:
+  if (snapshot) pthread_rwlock_unlock(&latch);
+  return rc;
+}
 
+RC PageFile::readOlder(PageId pid, int snapshot, void* buffer) const
+{
+  map<FileId, FileVersions>::const_iterator f = versions.find(id);
+  if (f == versions.end()) return 1;
+  const FileVersions& fv = f->second;
+
+  if (pid >= endAt(fv, snapshot)) return RC_INVALID_PID;
+
+  map<PageId, PageState>::const_iterator it = fv.pages.find(pid);
+  if (it == fv.pages.end() || it->second.commit <= snapshot) return 1;
+
+  const vector<PageVersion>& older = it->second.older;
+  int i = (int) older.size() - 1;
+  while (i >= 0 && older[i].commit > snapshot) i--;
+  if (i < 0) return RC_INVALID_PID;
+  memcpy(buffer, older[i].buffer, PAGE_SIZE);
   return 0;
 }
+
+PageId PageFile::endAt(const FileVersions& fv, int commit)
+{
+  PageId end = 0;
+
+  for (size_t i = 0; i < fv.ends.size() && fv.ends[i].first <= commit; i++)
+    end = fv.ends[i].second;
+  return end;
+}
+
+void PageFile::collect(const FileId& id)
+{
+  map<FileId, FileVersions>::iterator f = versions.find(id);
+  if (f == versions.end()) return;
+  FileVersions& fv = f->second;
+
+  // an old content is needed by the snapshots from its commit until the
+  // commit of the next content, and by the snapshots to come while the
+  // content on disk is not committed
+  map<PageId, PageState>::iterator it = fv.pages.begin();
+  while (it != fv.pages.end()) {
+    PageState& st = it->second;
+    int next = st.commit;
+    for (int i = (int) st.older.size() - 1; i >= 0; i--) {
+      multiset<int>::iterator s = snapshots.lower_bound(st.older[i].commit);
+      bool needed = (s != snapshots.end() && *s < next) ||
+                    (i == (int) st.older.size() - 1 && st.commit == UNCOMMITTED);
+      next = st.older[i].commit;
+      if (!needed) st.older.erase(st.older.begin() + i);
+    }
+
+    // a content all snapshots see needs no state
+    if (st.older.empty() && st.commit != UNCOMMITTED &&
+        (snapshots.empty() || st.commit <= *snapshots.begin()))
+      fv.pages.erase(it++);
+    else
+      it++;
+  }
+
+  // the oldest snapshot needs no older size than the one it sees
+  while (fv.ends.size() > 1 && (snapshots.empty() || fv.ends[1].first <= *snapshots.begin()))
+    fv.ends.erase(fv.ends.begin());
+
+  if (fv.opens == 0 && fv.pending == 0 && fv.growing == 0 && fv.pages.empty() &&
+      fv.ends.size() == 1 && (snapshots.empty() || fv.changed <= *snapshots.begin()))
+    versions.erase(f);
+}
+
+void PageFile::collectRemoved()
+{
+  for (size_t i = 0; i < removals.size(); ) {
+    if (snapshots.empty() || *snapshots.begin() >= removals[i].first) {
+      ::unlink(removals[i].second.c_str());
+      removals.erase(removals.begin() + i);
+    }
+    else
+      i++;
+  }
+}
+
+PageFile::ThreadState* PageFile::threadState()
+{
+  pthread_once(&threadOnce, initialize);
+
+  ThreadState* ts = (ThreadState*) pthread_getspecific(threadKey);
+  if (ts == NULL) {
+    ts = new ThreadState;
+    pthread_setspecific(threadKey, ts);
+  }
+  return ts;
+}
+
+void PageFile::initialize()
+{
+  pthread_key_create(&threadKey, deleteThreadState);
+
+  for (int s = 0; s < CACHE_SHARDS; s++) {
+    pthread_mutex_init(&readCache[s].latch, NULL);
+    readCache[s].clock = 1;
+    readCache[s].writes = 0;
+  }
+  for (int l = 0; l < PAGE_LATCHES; l++)
+    pthread_rwlock_init(&pageLatches[l], NULL);
+}
+
+PageFile::cacheShard& PageFile::shardOf(int fd, PageId pid)
+{
+  // consecutive pages go to different shards
+  return readCache[((unsigned) fd * 31 + (unsigned) pid) % CACHE_SHARDS];
+}
+
+pthread_rwlock_t& PageFile::pageLatch(const FileId& id, PageId pid)
+{
+  // the latch is by file, not by fd, as every PageFile open on a file
+  // reads and writes the same pages
+  unsigned long h = ((unsigned long) id.first * 31 + (unsigned long) id.second) * 31 + (unsigned) pid;
+  return pageLatches[h % PAGE_LATCHES];
+}
+
+void PageFile::deleteThreadState(void* state)
+{
+  delete (ThreadState*) state;
+}
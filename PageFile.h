@@ -11,12 +11,31 @@
 #define PAGEFILE_H
 
 #include <string>
+#include <map>
+#include <set>
+#include <vector>
+#include <pthread.h>
+#include <sys/types.h>
 #include "Bruinbase.h"
 
 typedef int PageId;
 
 /**
- * read/write a file in the unit of a page
+ * read/write a file in the unit of a page.
+ *
+ * a thread may read the files as of one moment: between beginSnapshot()
+ * and endSnapshot(), every read() and endPid() shows the page contents
+ * and the file sizes as they were when the snapshot began, whatever other
+ * threads write meanwhile. a thread that writes within beginWrite() and
+ * commitWrite() has all its writes show up in the snapshots that begin
+ * after commitWrite(), and in no snapshot before; every other write shows
+ * up right away, in the snapshots that begin after it.
+ *
+ * the files are still written in place. when a page is overwritten, its
+ * old content is kept in memory as long as a snapshot may read it, and
+ * dropped when the last such snapshot ends; pages added at the end of a
+ * file need no old content, as the snapshots before them stop at the old
+ * end of the file.
  */
 class PageFile {
  public:
@@ -58,6 +77,16 @@ class PageFile {
    * @return error code. 0 if no error
    */
   RC write(PageId pid, const void *buffer);
+
+  /**
+   * ask the operating system to start reading n pages from pid in the
+   * background, so that a later read() of them does not wait for the
+   * disk. this is only a hint: nothing is read into the cache and the
+   * page read count does not change.
+   * @param pid[IN] the first page to read ahead
+   * @param n[IN] the number of pages
+   */
+  void prefetch(PageId pid, int n = 1) const;
     
   /**
    * note the +1 part. The last page id in the file is actually endPid()-1.
@@ -66,6 +95,53 @@ class PageFile {
    */
   PageId endPid() const;
 
+  /**
+   * @return true if no page of the file changed since the snapshot of
+   * the calling thread began (always true outside of a snapshot).
+   * the state of a file kept in memory past close(), like the pinned
+   * pages of an index, can stand for the snapshot only then.
+   */
+  bool isCurrent() const;
+
+  /**
+   * start a snapshot of all files for the calling thread (see above).
+   * every beginSnapshot() must be matched by an endSnapshot().
+   */
+  static void beginSnapshot();
+
+  /**
+   * end the snapshot of the calling thread, and drop the old page
+   * contents no other snapshot needs.
+   */
+  static void endSnapshot();
+
+  /**
+   * start a write transaction for the calling thread: its writes are not
+   * seen by any snapshot until commitWrite(). the writes are not undone
+   * by anything, and the thread itself reads them right away.
+   */
+  static void beginWrite();
+
+  /**
+   * make the writes of the write transaction of the calling thread seen
+   * by the snapshots that begin from now on.
+   */
+  static void commitWrite();
+
+  /**
+   * @return true if the calling thread is in a write transaction
+   */
+  static bool isWriting();
+
+  /**
+   * remove a file once no snapshot may read it any more: right away if no
+   * snapshot began before the removal (before commitWrite() in a write
+   * transaction), otherwise when the last such snapshot ends. the name
+   * must not be used for a new file meanwhile.
+   * @param filename[IN] the name of the file to remove
+   */
+  static void remove(const std::string& filename);
+
   /**
    * @return the total # of disk reads
    */
@@ -86,27 +162,156 @@ class PageFile {
   RC seek(PageId pid) const;
 
  private:
+  // the commit of a page content that is not committed yet
+  static const int UNCOMMITTED = 0x7fffffff;
+
+  typedef std::pair<dev_t, ino_t> FileId;
+
+  // an old content of a page, seen by the snapshots from its commit on
+  // until the commit of the next content
+  struct PageVersion {
+    int  commit;
+    char buffer[PAGE_SIZE];
+  };
+
+  // the commit of the content a page has on disk (if it is not seen by
+  // every snapshot), and the old contents snapshots may still need
+  struct PageState {
+    PageState() : commit(0) {}
+
+    int commit;
+    std::vector<PageVersion> older;  // the oldest first
+  };
+
+  // the versions of a file, kept while it is open or any of them counts
+  struct FileVersions {
+    FileVersions() : opens(0), changed(0), pending(0), growing(0) {}
+
+    int opens;     // PageFiles open on the file
+    int changed;   // the commit of the last committed write
+    int pending;   // pages with a content that is not committed
+    int growing;   // write transactions that added pages
+    std::vector<std::pair<int, PageId> > ends; // the file size from a commit on
+    std::map<PageId, PageState> pages;
+  };
+
+  // what a thread is doing: reading a snapshot or writing a transaction
+  struct ThreadState {
+    ThreadState() : snapshot(-1), writing(false) {}
+
+    int  snapshot;  // the last commit the snapshot sees, -1 if none
+    bool writing;   // true in a write transaction
+    std::vector<std::pair<FileId, PageId> > pages; // the pages it wrote
+    std::map<FileId, PageId> ends;     // the files it added pages to
+    std::vector<std::string> removed;  // the files it removed
+  };
+
+  /**
+   * return the state of the calling thread, created on the first call.
+   */
+  static ThreadState* threadState();
+
+  /**
+   * create threadKey, the cache latches and the page latches (through
+   * threadOnce).
+   */
+  static void initialize();
+
+  /**
+   * delete the state of a thread that exits.
+   */
+  static void deleteThreadState(void* state);
+
+  /**
+   * read the content a page had as of a snapshot, if it is not the one
+   * on disk. the caller holds versionLatch.
+   * @param pid[IN] the page to read
+   * @param snapshot[IN] the last commit the snapshot sees
+   * @param buffer[OUT] the content of the page
+   * @return 0 if the page was read, 1 if the snapshot sees the content on
+   * disk, an error code if the snapshot does not see the page
+   */
+  RC readOlder(PageId pid, int snapshot, void* buffer) const;
+
+  /**
+   * the size the file had as of a commit. the caller holds versionLatch.
+   */
+  static PageId endAt(const FileVersions& fv, int commit);
+
+  /**
+   * drop the old contents of a file that no snapshot needs, and forget
+   * the file when nothing of it is needed any more. the caller holds
+   * versionLatch for writing.
+   */
+  static void collect(const FileId& id);
+
+  /**
+   * unlink the removed files no snapshot may read. the caller holds
+   * versionLatch for writing.
+   */
+  static void collectRemoved();
+
   int     fd;     // file descriptor of the associated unix file
-  PageId  epid;   // (last page id + 1) of the file
+  PageId  epid;   // (last page id + 1) of the file; written by write()
+                  //   with release, read with acquire, as readers do not
+                  //   take the latch of the page written
+  FileId  id;     // the device and inode of the file
 
   //
-  // the following set of members implement LRU caching 
+  // the following set of members implement LRU caching. the cache is
+  // split into shards by page, each with its own latch, so that threads
+  // reading pages of different shards do not wait for each other, and no
+  // latch is held while a page is read from disk
   //
-  static const int CACHE_COUNT = 10;
-
-  static int cacheClock; // clock tick counter for LRU policy
+  static const int CACHE_SHARDS = 16;
+  static const int CACHE_COUNT = 10;    // pages cached per shard
 
   // the actual cache data structure
-  static struct cacheStruct {
-    int    fd;              // file id of the cached page
-    PageId pid;             // page id of the cached page
-    int    lastAccessed;    // the last time the cached page was accessed
-                            //   (lastAccessed == 0) means that the buffer is empty
-    char buffer[PAGE_SIZE]; // the buffer used for caching
-  } readCache[CACHE_COUNT];
+  static struct cacheShard {
+    pthread_mutex_t latch;  // guards the slots, clock and writes
+    int clock;              // clock tick counter for LRU policy
+    int writes;             // # of writes to the pages of the shard: a page
+                            //   read before a write is not cached after it
+    struct cacheStruct {
+      int    fd;              // file id of the cached page
+      PageId pid;             // page id of the cached page
+      int    lastAccessed;    // the last time the cached page was accessed
+                              //   (lastAccessed == 0) means that the buffer is empty
+      char buffer[PAGE_SIZE]; // the buffer used for caching
+    } slots[CACHE_COUNT];
+  } readCache[CACHE_SHARDS];
+
+  /**
+   * @return the cache shard of a page
+   */
+  static cacheShard& shardOf(int fd, PageId pid);
 
   static int readCount;  // total # of page reads 
   static int writeCount; // total # of page writes 
+
+  // latches on the pages of all files, by file and page: held shared to
+  // read a page from disk (by a snapshot from the check of its versions
+  // on), and exclusive to write it and update its versions, so that a
+  // page is read and written whole and the writes of different pages
+  // run at the same time
+  static const int PAGE_LATCHES = 64;
+  static pthread_rwlock_t pageLatches[PAGE_LATCHES];
+
+  /**
+   * @return the latch of a page
+   */
+  static pthread_rwlock_t& pageLatch(const FileId& id, PageId pid);
+
+  // guards the versions below; held only while they are read or changed,
+  // never across a read or write of a page
+  static pthread_rwlock_t versionLatch;
+
+  static int commitClock;  // the last commit
+  static std::multiset<int> snapshots;  // the commits the snapshots see
+  static std::map<FileId, FileVersions> versions;  // by file
+  static std::vector<std::pair<int, std::string> > removals; // by commit
+  static pthread_key_t threadKey;    // the ThreadState of every thread
+  static pthread_once_t threadOnce;  // calls initialize()
 };
   
 #endif // PAGEFILE_H
@@ -184,6 +184,11 @@ RC RecordFile::read(const RecordId& rid, int& key, string& value) const
   return 0;
 }
 
+void RecordFile::prefetch(const RecordId& rid) const
+{
+  if (rid.pid >= 0 && rid.pid <= erid.pid) pf.prefetch(rid.pid);
+}
+
 RC RecordFile::append(int key, const std::string& value, RecordId& rid)
 {
   RC   rc;
@@ -79,6 +79,13 @@ class RecordFile {
    */
   RC read(const RecordId& rid, int& key, std::string& value) const;
 
+  /**
+   * start reading the page of a record in the background, ahead of
+   * read() (see PageFile::prefetch()).
+   * @param rid[IN] the id of the record that will be read
+   */
+  void prefetch(const RecordId& rid) const;
+
   /**
    * append a new record at the end of the file.
    * note that RecordFile does not have write() function.
@@ -10,8 +10,10 @@
 #include <cstdio>
 #include <cstring>
 #include <cstdlib>
+#include <climits>
 #include <iostream>
 #include <fstream>
+#include <algorithm>
 #include "Bruinbase.h"
 #include "SqlEngine.h"
 #include "BTreeIndex.h"
@@ -22,6 +24,232 @@ using namespace std;
 extern FILE* sqlin;
 int sqlparse(void);
 
+// how many leaves an index range scan reads ahead of the leaf it is on
+static const int PREFETCH_LEAVES = 8;
+
+/*
+ * check whether the tuple (key, value) satisfies all conditions in cond.
+ * @param key[IN] the key of the tuple
+ * @param value[IN] the value of the tuple
+ * @param cond[IN] list of conditions in the WHERE clause
+ * @return true if every condition is met
+ */
+static bool checkConds(int key, const string& value, const vector<SelCond>& cond)
+{
+  int diff;
+
+  for (unsigned i = 0; i < cond.size(); i++) {
+    // compute the difference between the tuple value and the condition value
+    switch (cond[i].attr) {
+    case 1:
+      {
+        // compare instead of subtracting so that the full int range works
+        int v = atoi(cond[i].value);
+        diff = (key > v) - (key < v);
+      }
+      break;
+    case 2:
+      diff = strcmp(value.c_str(), cond[i].value);
+      break;
+    }
+
+    // fail the tuple if any condition is not met
+    switch (cond[i].comp) {
+    case SelCond::EQ:
+      if (diff != 0) return false;
+      break;
+    case SelCond::NE:
+      if (diff == 0) return false;
+      break;
+    case SelCond::GT:
+      if (diff <= 0) return false;
+      break;
+    case SelCond::LT:
+      if (diff >= 0) return false;
+      break;
+    case SelCond::GE:
+      if (diff < 0) return false;
+      break;
+    case SelCond::LE:
+      if (diff > 0) return false;
+      break;
+    }
+  }
+
+  return true;
+}
+
+/*
+ * narrow the range [low_k, high_k] of keys with every condition on the
+ * key column.
+ * @param cond[IN] list of conditions in the WHERE clause
+ * @param low_k[OUT] the smallest key the conditions allow
+ * @param high_k[OUT] the largest key the conditions allow
+ * @param bounded[OUT] true if a condition bounds the range on either side
+ * @return false if no key satisfies the conditions
+ */
+static bool keyRange(const vector<SelCond>& cond, int& low_k, int& high_k, bool& bounded)
+{
+  bool has_low  = false;
+  bool has_high = false;
+  int  keyComp;
+
+  low_k  = INT_MIN;
+  high_k = INT_MAX;
+  for (unsigned i = 0; i < cond.size(); i++) {
+    if (cond[i].attr != 1) continue;
+
+    keyComp = atoi(cond[i].value);
+    switch (cond[i].comp) {
+    case SelCond::EQ:
+      if (!has_low || keyComp > low_k) low_k = keyComp;
+      if (!has_high || keyComp < high_k) high_k = keyComp;
+      has_low = has_high = true;
+      break;
+    case SelCond::NE:
+      break;
+    case SelCond::GT:
+      if (keyComp == INT_MAX) return false;
+      if (!has_low || keyComp + 1 > low_k) low_k = keyComp + 1;
+      has_low = true;
+      break;
+    case SelCond::GE:
+      if (!has_low || keyComp > low_k) low_k = keyComp;
+      has_low = true;
+      break;
+    case SelCond::LT:
+      if (keyComp == INT_MIN) return false;
+      if (!has_high || keyComp - 1 < high_k) high_k = keyComp - 1;
+      has_high = true;
+      break;
+    case SelCond::LE:
+      if (!has_high || keyComp < high_k) high_k = keyComp;
+      has_high = true;
+      break;
+    }
+  }
+
+  bounded = has_low || has_high;
+  return low_k <= high_k;
+}
+
+
+/*
+ * what the conditions of a SELECT allow an index on the key column to do.
+ */
+struct KeyPlan {
+  bool empty;      // no key satisfies the conditions
+  bool bounded;    // a condition bounds the key range on either side
+  int  low_k;      // the smallest key the conditions allow
+  int  high_k;     // the largest key the conditions allow
+  bool indexOnly;  // the key of an index entry is all the query needs
+  bool rangeOnly;  // a COUNT(*) whose conditions all fit into the range
+  bool tableScan;  // a table scan is at least as cheap as the index
+};
+
+/*
+ * work out the key range of a SELECT and what its index can answer.
+ * @param attr[IN] attribute in the SELECT clause
+ * @param cond[IN] list of conditions in the WHERE clause
+ * @param plan[OUT] the plan
+ */
+static void planKeys(int attr, const vector<SelCond>& cond, KeyPlan& plan)
+{
+  bool keyCond = false;
+
+  plan.bounded = false;
+  plan.empty = !keyRange(cond, plan.low_k, plan.high_k, plan.bounded);
+
+  // SELECT key and COUNT(*) are answered from the index alone (without
+  // reading the table) unless a condition needs the value, and a COUNT(*)
+  // over a key range may be read off the index without its entries,
+  // unless a condition cannot be put into the range
+  plan.indexOnly = (attr == 1 || attr == 4);
+  plan.rangeOnly = (attr == 4);
+  for (unsigned i = 0; i < cond.size(); i++) {
+    if (cond[i].attr == 1) keyCond = true;
+    if (cond[i].attr == 2) plan.indexOnly = plan.rangeOnly = false;
+    // key <> N cannot be answered with a single range
+    if (cond[i].attr == 1 && cond[i].comp == SelCond::NE) plan.rangeOnly = false;
+  }
+
+  // no range on the key: a table scan is at least as cheap, unless the
+  // index alone answers a condition on the key; its entries take far
+  // fewer pages. a query with no condition always reads the table, which
+  // has the tuples of a plain LOAD that left the indexes behind
+  plan.tableScan = !plan.bounded && !plan.empty && !(plan.indexOnly && keyCond);
+}
+
+/*
+ * print the tuple (key, value) as the SELECT clause asks, if it
+ * satisfies all conditions.
+ * @param attr[IN] attribute in the SELECT clause
+ * @param key[IN] the key of the tuple
+ * @param value[IN] the value of the tuple
+ * @param cond[IN] list of conditions in the WHERE clause
+ * @param count[IN/OUT] the number of matching tuples, counting this one
+ */
+static void printTuple(int attr, int key, const string& value, const vector<SelCond>& cond, int& count)
+{
+  if (!checkConds(key, value, cond)) return;
+
+  // the condition is met for the tuple.
+  // increase matching tuple counter
+  count++;
+
+  // print the tuple
+  switch (attr) {
+  case 1:  // SELECT key
+    fprintf(stdout, "%d\n", key);
+    break;
+  case 2:  // SELECT value
+    fprintf(stdout, "%s\n", value.c_str());
+    break;
+  case 3:  // SELECT *
+    fprintf(stdout, "%d '%s'\n", key, value.c_str());
+    break;
+  }
+}
+
+/*
+ * print the tuple of an index entry, if it satisfies all conditions.
+ * the tuple is read from the table unless the key is all the query needs.
+ * @param rf[IN] the table; not read if indexOnly
+ * @param table[IN] the table name in the FROM clause
+ * @param indexOnly[IN] true if the key of the entry answers the query
+ * @param key[IN] the key of the entry
+ * @param rid[IN] the RecordId of the entry
+ * @param attr[IN] attribute in the SELECT clause
+ * @param cond[IN] list of conditions in the WHERE clause
+ * @param count[IN/OUT] the number of matching tuples, counting this one
+ * @return error code. 0 if no error
+ */
+static RC printEntry(const RecordFile& rf, const string& table, bool indexOnly, int key, const RecordId& rid,
+                     int attr, const vector<SelCond>& cond, int& count)
+{
+  RC     rc;
+  string value;
+
+  if (!indexOnly && (rc = rf.read(rid, key, value)) < 0) {
+    fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
+    return rc;
+  }
+
+  printTuple(attr, key, value, cond, count);
+  return 0;
+}
+
+/*
+ * print the number of matching tuples if the SELECT clause is COUNT(*).
+ * @param attr[IN] attribute in the SELECT clause
+ * @param count[IN] the number of matching tuples
+ */
+static void printCount(int attr, int count)
+{
+  if (attr == 4) {
+    fprintf(stdout, "%d\n", count);
+  }
+}
 
 RC SqlEngine::run(FILE* commandline)
 {
@@ -32,6 +260,9 @@ RC SqlEngine::run(FILE* commandline)
   sqlparse();  // sqlparse() is defined in SqlParser.tab.c generated from
                // SqlParser.y by bison (bison is GNU equivalent of yacc)
 
+  // the runs of the ingest tiers are merged in the background
+  LsmIndex::waitForMerges();
+
   return 0;
 }
 
@@ -52,204 +283,384 @@ The conditions listed in the WHERE clause are passed as the input parameter cond
 
 RC SqlEngine::selectHelper(BTreeIndex& btree, int attr, const string& table, const vector<SelCond>& cond)
 {
+  RecordFile rf;   // RecordFile containing the table
+  BTreeCursor cursor;
 
+  RC        rc;
+  int       count    =  0;
+  const int*      keys;   // a batch of index entries
+  const RecordId* rids;
+  int       n;
+  bool      done     = false;
+  KeyPlan   plan;
+
+  planKeys(attr, cond, plan);
+
+  // a clustered index holds the table itself
+  if (plan.tableScan && !btree.isClustered())
+    return -1;
+
+  if (plan.empty) {
+    printCount(attr, count);
+    return 0;
+  }
+
+  // a COUNT(*) over a key range is read off the row counts of a counted
+  // index
+  if (plan.rangeOnly && btree.countRange(plan.low_k, plan.high_k, count) == 0) {
+    fprintf(stdout, "%d\n", count);
+    return 0;
+  }
+  count = 0;
+
+  if (btree.isClustered())
+    return selectClustered(btree, attr, cond, plan.low_k, plan.high_k);
+
+  // open the table file
+  if (!plan.indexOnly && (rc = rf.open(table + ".tbl", 'r')) < 0) {
+    fprintf(stderr, "Error: table %s does not exist\n", table.c_str());
+    return rc;
+  }
+
+  // cursor should be placed at lowest possible value, given conditions
+  rc = btree.openCursor(plan.low_k, cursor);
+  if (rc < 0 && rc != RC_NO_SUCH_RECORD) {
+    fprintf(stderr, "Error: cannot locate lowest key\n");
+    goto exit_select;
+  }
+  // a range (not a single key) is read ahead leaf by leaf
+  cursor.setPrefetch(plan.low_k < plan.high_k ? PREFETCH_LEAVES : 0, plan.indexOnly ? NULL : &rf);
+
+  // Read the tuples a batch of index entries at a time until out of the range
+  while (!done && (rc = cursor.next(keys, rids, n)) == 0) {
+    for (int i = 0; i < n; i++) {
+      if (keys[i] > plan.high_k) {
+        done = true;
+        break;
+      }
+      if ((rc = printEntry(rf, table, plan.indexOnly, keys[i], rids[i], attr, cond, count)) < 0)
+        goto exit_select;
+    }
+  }
+  if (rc < 0 && rc != RC_END_OF_TREE) {
+    fprintf(stderr, "Error: while reading a tuple from tree\n");
+    goto exit_select;
+  }
+
+  // if we only need to return count
+  printCount(attr, count);
+  rc = 0;
+
+  exit_select:
+  rf.close();
+  return rc;
+}
+
+RC SqlEngine::selectHashHelper(HashIndex& hash, int attr, const string& table, const vector<SelCond>& cond)
+{
+  RecordFile rf;   // RecordFile containing the table
+  vector<RecordId> rids;
+
+  RC        rc;
+  int       count    =  0;
+  bool      has_eq   = false;
+  int       eq_k     = 0;
+  KeyPlan   plan;
+
+  // every RecordId of the lookup has key eq_k, so SELECT key and COUNT(*)
+  // need no tuple as in selectHelper()
+  planKeys(attr, cond, plan);
+
+  for (unsigned i = 0; i < cond.size(); i++) {
+    if (cond[i].attr == 1 && cond[i].comp == SelCond::EQ && !has_eq) {
+      eq_k = atoi(cond[i].value);
+      has_eq = true;
+    }
+  }
+
+  // only key = N is answered by the hash index
+  if (!has_eq)
+    return -1;
+
+  if ((rc = hash.lookup(eq_k, rids)) < 0) {
+    fprintf(stderr, "Error: while reading the hash index\n");
+    return rc;
+  }
+  // read the tuples in table order
+  sort(rids.begin(), rids.end());
+
+  // open the table file
+  if (!plan.indexOnly && (rc = rf.open(table + ".tbl", 'r')) < 0) {
+    fprintf(stderr, "Error: table %s does not exist\n", table.c_str());
+    return rc;
+  }
+
+  for (size_t i = 0; i < rids.size(); i++)
+    if ((rc = printEntry(rf, table, plan.indexOnly, eq_k, rids[i], attr, cond, count)) < 0)
+      goto exit_select;
+
+  // if we only need to return count
+  printCount(attr, count);
+  rc = 0;
+
+  exit_select:
+  rf.close();
+  return rc;
+}
+
+RC SqlEngine::selectLearnedHelper(LearnedIndex& lidx, int attr, const string& table, const vector<SelCond>& cond)
+{
   RecordFile rf;   // RecordFile containing the table
-  RecordId   rid;  // record cursor for table scanning
   IndexCursor cursor;
+  RecordId   rid;
+
+  RC        rc;
+  int       key;
+  int       count    =  0;
+  KeyPlan   plan;
+
+  planKeys(attr, cond, plan);
+
+  if (plan.tableScan)
+    return -1;
+
+  if (plan.empty) {
+    printCount(attr, count);
+    return 0;
+  }
+
+  // the count is the distance between the positions of the two ends
+  if (plan.rangeOnly && lidx.countRange(plan.low_k, plan.high_k, count) == 0) {
+    fprintf(stdout, "%d\n", count);
+    return 0;
+  }
+  count = 0;
+
+  // open the table file
+  if (!plan.indexOnly && (rc = rf.open(table + ".tbl", 'r')) < 0) {
+    fprintf(stderr, "Error: table %s does not exist\n", table.c_str());
+    return rc;
+  }
+
+  rc = lidx.locate(plan.low_k, cursor);
+  if (rc < 0 && rc != RC_NO_SUCH_RECORD) {
+    fprintf(stderr, "Error: cannot locate lowest key\n");
+    goto exit_select;
+  }
+
+  while ((rc = lidx.readForward(cursor, key, rid)) == 0 && key <= plan.high_k)
+    if ((rc = printEntry(rf, table, plan.indexOnly, key, rid, attr, cond, count)) < 0)
+      goto exit_select;
+  if (rc < 0 && rc != RC_END_OF_TREE) {
+    fprintf(stderr, "Error: while reading the learned index\n");
+    goto exit_select;
+  }
+
+  // if we only need to return count
+  printCount(attr, count);
+  rc = 0;
+
+  exit_select:
+  rf.close();
+  return rc;
+}
+
+RC SqlEngine::selectLsmHelper(LsmIndex& lsm, int attr, const string& table, const vector<SelCond>& cond)
+{
+  RecordFile rf;   // RecordFile containing the table
+  LsmCursor  cursor;
+  RecordId   rid;
+
+  RC        rc;
+  int       key;
+  int       count    =  0;
+  KeyPlan   plan;
+
+  // the runs keep no row counts, so a COUNT(*) reads the pairs
+  planKeys(attr, cond, plan);
+
+  if (plan.tableScan)
+    return -1;
+
+  if (plan.empty) {
+    printCount(attr, count);
+    return 0;
+  }
+
+  // open the table file
+  if (!plan.indexOnly && (rc = rf.open(table + ".tbl", 'r')) < 0) {
+    fprintf(stderr, "Error: table %s does not exist\n", table.c_str());
+    return rc;
+  }
+
+  rc = lsm.locate(plan.low_k, cursor);
+  if (rc < 0 && rc != RC_NO_SUCH_RECORD) {
+    fprintf(stderr, "Error: cannot locate lowest key\n");
+    goto exit_select;
+  }
+
+  while ((rc = lsm.readForward(cursor, key, rid)) == 0 && key <= plan.high_k)
+    if ((rc = printEntry(rf, table, plan.indexOnly, key, rid, attr, cond, count)) < 0)
+      goto exit_select;
+  if (rc < 0 && rc != RC_END_OF_TREE) {
+    fprintf(stderr, "Error: while reading the ingest tier\n");
+    goto exit_select;
+  }
+
+  // if we only need to return count
+  printCount(attr, count);
+  rc = 0;
+
+  exit_select:
+  rf.close();
+  return rc;
+}
+
+RC SqlEngine::selectClustered(BTreeIndex& btree, int attr, const vector<SelCond>& cond, int low_k, int high_k)
+{
+  BTreeCursor cursor;
 
   RC        rc;
-  int       key;     
+  int       key;
   string    value;
   int       count    =  0;
-  int       diff;
 
-  // variables for conditions involving keys
-  int       keyComp  = -1;
-  int       low_k    = -1;
-  int       high_k   = -1;
-  vector<int> eq_cond_k;
-  bool has_eq_k = false; // checks for  multiple equlity statements
+  // cursor should be placed at lowest possible value, given conditions
+  rc = btree.openCursor(low_k, cursor);
+  if (rc < 0 && rc != RC_NO_SUCH_RECORD) {
+    fprintf(stderr, "Error: cannot locate lowest key\n");
+    return rc;
+  }
+  // the tuples are in the leaves, so only the leaves are read ahead
+  cursor.setPrefetch(low_k < high_k ? PREFETCH_LEAVES : 0, NULL);
+
+  // Read the tuples in key order until out of the range
+  while ((rc = cursor.nextTuple(key, value)) == 0 && key <= high_k)
+    printTuple(attr, key, value, cond, count);
+  if (rc < 0 && rc != RC_END_OF_TREE) {
+    fprintf(stderr, "Error: while reading a tuple from tree\n");
+    return rc;
+  }
 
-  // variables for conditions involving values
-  string    valComp  = "";
-  string    low_v    = "";
-  string    high_v   = "";
-  vector<string> eq_cond_v;
-  bool has_eq_v = false; // checks for  multiple equlity statements
+  // if we only need to return count
+  printCount(attr, count);
+  return 0;
+}
 
+RC SqlEngine::selectValueHelper(ValueIndex& vtree, int attr, const string& table, const vector<SelCond>& cond)
+{
+  RecordFile rf;   // RecordFile containing the table
+  ValueCursor cursor;
 
-  // check the conditions on the tuple
+  RC        rc;
+  int       count    =  0;
+  const ValueKey* vkeys;  // a batch of index entries
+  const RecordId* rids;
+  int       n;
+  bool      done     = false;
+
+  // the range of values allowed by the conditions on the value column
+  bool      has_low  = false;
+  bool      has_high = false;
+  string    low_v;
+  string    high_v;
+
+  // narrow the value range with every condition on the value column.
+  // GT and LT are treated as GE and LE here; checkConds() drops the
+  // boundary values later.
   for (unsigned i = 0; i < cond.size(); i++) {
-    // compute the difference between the tuple value and the condition value
-    switch (cond[i].attr) {
-    case 1:
-      switch (cond[i].comp) {
-      case SelCond::EQ:
-        keyComp = atoi(cond[i].value);
-        // if there are no equality statements yet
-        if (!has_eq_k) {
-          eq_cond_k.push_back(keyComp);
-          has_eq_k = true;
-          low_k = keyComp;
-          high_k = keyComp;
-        }
-        // if there are existing equality statements
-        else if (has_eq_k) {
-          if (eq_cond_k[0] != keyComp) {
-            return 0;
-          }
-        }
-        // if (diff != 0) goto next_tuple;
-        break;
-      case SelCond::NE:
-        // we should use indexing
-        goto use_index;
-        // if (diff == 0) goto next_tuple;
-        break;
-      case SelCond::GT:
-        keyComp = atoi(cond[i].value);
-        if (keyComp >= low_k || low_k == -1) {
-          low_k = keyComp;
-        }
-        break;
-      case SelCond::LT:
-        keyComp = atoi(cond[i].value);
-        if (keyComp <= high_k || high_k == -1) {
-          high_k = keyComp;
-        }
-        break;
-      case SelCond::GE:
-        keyComp = atoi(cond[i].value);
-        if (keyComp > low_k || low_k == -1) {
-          low_k = keyComp;
-        }
-        break;
-      case SelCond::LE:
-        keyComp = atoi(cond[i].value);
-        if (keyComp < high_k || high_k == -1) {
-          high_k = keyComp;
-        }
-        break;
-      }
+    if (cond[i].attr != 2) continue;
+
+    switch (cond[i].comp) {
+    case SelCond::EQ:
+      if (!has_low || low_v < cond[i].value) low_v = cond[i].value;
+      if (!has_high || high_v > cond[i].value) high_v = cond[i].value;
+      has_low = has_high = true;
       break;
-    case 2:
-      //diff = strcmp(value.c_str(), cond[i].value);
-      switch (cond[i].comp) {
-      case SelCond::EQ:
-        valComp = cond[i].value;
-        // if there are no equality statements yet
-        if (!has_eq_v) {
-          eq_cond_v.push_back(valComp);
-          has_eq_v = true;
-          low_v = valComp;
-          high_v = valComp;
-        }
-        // if there are existing equality statements
-        // check to see if they have equal values
-        else if (has_eq_v) {
-          if (eq_cond_v[0] != valComp) {
-            return 0;
-          }
-        }
-        // if (diff != 0) goto next_tuple;
-        break;
-      case SelCond::NE:
-        // we should use indexing
-        goto use_index;
-        //if (diff == 0) goto next_tuple;
-        break;
-      case SelCond::GT:
-        valComp = cond[i].value;
-        if (valComp >= low_v || low_v == "") {
-          low_v = valComp;
-        }
-        break;
-      case SelCond::LT:
-        valComp = cond[i].value;
-        if (valComp <= high_v || high_v == "") {
-          high_v = valComp;
-        }
-        break;
-      case SelCond::GE:
-        valComp = cond[i].value;
-        if (valComp > low_v || low_v == "") {
-          low_v = valComp;
-        }
-        break;
-      case SelCond::LE:
-        valComp = cond[i].value;
-        if (valComp < high_v || high_v == "") {
-          high_v = valComp;
-        }
-        break;
-      }
+    case SelCond::NE:
+      // cannot be answered with a single range
+      break;
+    case SelCond::GT:
+    case SelCond::GE:
+      if (!has_low || low_v < cond[i].value) low_v = cond[i].value;
+      has_low = true;
+      break;
+    case SelCond::LT:
+    case SelCond::LE:
+      if (!has_high || high_v > cond[i].value) high_v = cond[i].value;
+      has_high = true;
       break;
     }
   }
 
-  // ISSUE: is the lowest key value 0????????
-  if (low_k == -1)
-    low_k = 0;
+  // no range on the value: a table scan is at least as cheap
+  if (!has_low && !has_high)
+    return -1;
 
-  // cursor should be placed at lowest possible value, given conditions
-  if ((rc = btree.locate(low_k, cursor)) < 0) {
-    fprintf(stderr, "Error: cannot locate lowest key\n");
-    return rc;
+  if (has_low && has_high && low_v > high_v) {
+    printCount(attr, count);
+    return 0;
   }
 
-    // open the table file
+  // the index holds the first bytes of every value, and cutting off two
+  // values keeps their order, so the cut-off bounds enclose every match
+  ValueKey low_k  = ValueKey::fromString(low_v);
+  ValueKey high_k = ValueKey::fromString(high_v);
+
+  // open the table file
   if ((rc = rf.open(table + ".tbl", 'r')) < 0) {
     fprintf(stderr, "Error: table %s does not exist\n", table.c_str());
     return rc;
   }
 
-  // Read the tuples until out of the range
-  while (rc == 0 && (high_k == -1 || key <= high_k)) {
-    // if attr == 4, then we only need to get count
-    if(attr != 4) {
-      if ((rc = btree.readForward(cursor, key, rid)) < 0) {
-        fprintf(stderr, "Error: while reading a tuple from tree\n");
-        return rc;
-      }
-      else {
-        if ((rc = rf.read(rid, key, value)) < 0) {
-          fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
-          return rc;
-        }
-        // if value meets conditions
-        if (value >= low_v && value <= high_v) {
-          // print the tuple 
-          switch (attr) {
-          case 1:  // SELECT key
-            fprintf(stdout, "%d\n", key);
-            break;
-          case 2:  // SELECT value
-            fprintf(stdout, "%s\n", value.c_str());
-            break;
-          case 3:  // SELECT *
-            fprintf(stdout, "%d '%s'\n", key, value.c_str());
-            break;
-          }
-        }
+  // cursor should be placed at lowest possible value, given conditions
+  rc = vtree.openCursor(low_k, cursor);
+  if (rc < 0 && rc != RC_NO_SUCH_RECORD) {
+    fprintf(stderr, "Error: cannot locate lowest value\n");
+    goto exit_select;
+  }
+  cursor.setPrefetch(!has_high || low_v < high_v ? PREFETCH_LEAVES : 0, &rf);
+
+  // Read the tuples a batch of index entries at a time until out of the range
+  while (!done && (rc = cursor.next(vkeys, rids, n)) == 0) {
+    for (int i = 0; i < n; i++) {
+      if (has_high && vkeys[i] > high_k) {
+        done = true;
+        break;
       }
+
+      // the key is only known once the tuple is read
+      if ((rc = printEntry(rf, table, false, 0, rids[i], attr, cond, count)) < 0)
+        goto exit_select;
     }
-    // the condition is met for the tuple. 
-    // increase matching tuple counter
-    count++;
   }
-
-  // if we only need to return count
-  if (attr == 4) {
-    fprintf(stdout, "%d\n", count);
+  if (rc < 0 && rc != RC_END_OF_TREE) {
+    fprintf(stderr, "Error: while reading a tuple from value index\n");
+    goto exit_select;
   }
 
-  use_index:
-    return -1;
+  // if we only need to return count
+  printCount(attr, count);
+  rc = 0;
 
-  return 0;
+  exit_select:
+  rf.close();
+  return rc;
 }
 
 RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
+{
+  RC rc;
+
+  // the query sees the files as of now, whatever a LOAD writes meanwhile
+  PageFile::beginSnapshot();
+  rc = selectTable(attr, table, cond);
+  PageFile::endSnapshot();
+
+  return rc;
+}
+
+RC SqlEngine::selectTable(int attr, const string& table, const vector<SelCond>& cond)
 {
   RecordFile rf;   // RecordFile containing the table
   RecordId   rid;  // record cursor for table scanning
@@ -258,14 +669,52 @@ RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
   int    key;     
   string value;
   int    count;
-  int    diff;
 
   BTreeIndex btree;
+  ValueIndex vtree;
+  HashIndex  hash;
+  LearnedIndex lidx;
+  LsmIndex   lsm;
+
+  // key = N goes to the hash index, if the table has one
+  if ((rc = hash.open(table + ".hidx", 'r')) == 0) {
+    rc = selectHashHelper(hash, attr, table, cond);
+    hash.close();
+    // returns -1 if there is no equality condition on the key
+    if (rc != -1)
+      return rc;
+  }
+
+  // key ranges go to the learned index, if the table has one; it reads
+  // no non-leaf pages
+  if ((rc = lidx.open(table + ".lidx", 'r')) == 0) {
+    rc = selectLearnedHelper(lidx, attr, table, cond);
+    lidx.close();
+    if (rc != -1)
+      return rc;
+  }
+
+  // the B+tree misses the keys still in the runs of the ingest tier
+  if ((rc = lsm.open(table, 'r')) == 0) {
+    rc = lsm.hasRuns() ? selectLsmHelper(lsm, attr, table, cond) : -1;
+    lsm.close();
+    if (rc != -1)
+      return rc;
+  }
 
     // open the index file
   if ((rc = btree.open(table + ".idx", 'r')) == 0) {
     rc = selectHelper(btree, attr, table, cond);
-    // returns -1 if condition contains <>, so we should use indexing
+    btree.close();
+    // returns -1 if the key conditions give no range, so we scan the table
+    if (rc != -1)
+      return rc;
+  }
+
+  // no key range: try the index on the value column, if there is one
+  if ((rc = vtree.open(table + ".vidx", 'r')) == 0) {
+    rc = selectValueHelper(vtree, attr, table, cond);
+    vtree.close();
     if (rc != -1)
       return rc;
   }
@@ -286,67 +735,15 @@ RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
       goto exit_select;
     }
 
-    // check the conditions on the tuple
-    for (unsigned i = 0; i < cond.size(); i++) {
-      // compute the difference between the tuple value and the condition value
-      switch (cond[i].attr) {
-      case 1:
-        diff = key - atoi(cond[i].value);
-        break;
-      case 2:
-        diff = strcmp(value.c_str(), cond[i].value);
-        break;
-      }
-
-      // skip the tuple if any condition is not met
-      switch (cond[i].comp) {
-      case SelCond::EQ:
-        if (diff != 0) goto next_tuple;
-        break;
-      case SelCond::NE:
-        if (diff == 0) goto next_tuple;
-        break;
-      case SelCond::GT:
-        if (diff <= 0) goto next_tuple;
-        break;
-      case SelCond::LT:
-        if (diff >= 0) goto next_tuple;
-        break;
-      case SelCond::GE:
-        if (diff < 0) goto next_tuple;
-        break;
-      case SelCond::LE:
-        if (diff > 0) goto next_tuple;
-        break;
-      }
-    }
-
-    // the condition is met for the tuple. 
-    // increase matching tuple counter
-    count++;
-
-    // print the tuple 
-    switch (attr) {
-    case 1:  // SELECT key
-      fprintf(stdout, "%d\n", key);
-      break;
-    case 2:  // SELECT value
-      fprintf(stdout, "%s\n", value.c_str());
-      break;
-    case 3:  // SELECT *
-      fprintf(stdout, "%d '%s'\n", key, value.c_str());
-      break;
-    }
+    // print the tuple if every condition is met
+    printTuple(attr, key, value, cond, count);
 
     // move to the next tuple
-    next_tuple:
     ++rid;
   }
 
   // print matching tuple count if "select count(*)"
-  if (attr == 4) {
-    fprintf(stdout, "%d\n", count);
-  }
+  printCount(attr, count);
   rc = 0;
 
   // close the table file and return
@@ -355,7 +752,22 @@ RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
   return rc;
 }
 
-RC SqlEngine::load(const string& table, const string& loadfile, bool index)
+RC SqlEngine::load(const string& table, const string& loadfile, bool index, const vector<IndexOpt>& opts)
+{
+  RC rc;
+
+  // the queries see all of the load or nothing of it
+  PageFile::beginWrite();
+  rc = loadTable(table, loadfile, index, opts);
+  PageFile::commitWrite();
+
+  // the runs of an lsm load are merged once they are committed
+  LsmIndex::startMerges();
+
+  return rc;
+}
+
+RC SqlEngine::loadTable(const string& table, const string& loadfile, bool index, const vector<IndexOpt>& opts)
 {
   /* our implementation */
 
@@ -377,12 +789,122 @@ RC SqlEngine::load(const string& table, const string& loadfile, bool index)
  //RecordFile status variables
  RC rc=0;
  RC r_close;
+ RC r_build;
 
 
  string line_buffer; //buffer for reading from loadfile
 
  int line_num = 0; //keep track which line we're on
 
+ //index options
+ bool compressed = false;
+ bool counted = false;
+ bool value_index = false;
+ bool clustered = false;
+ bool hash_index = false;
+ bool learned = false;
+ bool lsm = false;
+ int fill_factor = 100;
+
+  for (unsigned i = 0; i < opts.size(); i++) {
+    if (strcmp(opts[i].name, "compressed") == 0) {
+      compressed = true;
+    }
+    else if (strcmp(opts[i].name, "counted") == 0) {
+      counted = true;
+    }
+    else if (strcmp(opts[i].name, "value") == 0) {
+      value_index = true;
+    }
+    else if (strcmp(opts[i].name, "clustered") == 0) {
+      clustered = true;
+    }
+    else if (strcmp(opts[i].name, "hash") == 0) {
+      hash_index = true;
+    }
+    else if (strcmp(opts[i].name, "learned") == 0) {
+      learned = true;
+    }
+    else if (strcmp(opts[i].name, "lsm") == 0) {
+      lsm = true;
+    }
+    else if (strcmp(opts[i].name, "fillfactor") == 0) {
+      fill_factor = (opts[i].value == NULL) ? 0 : atoi(opts[i].value);
+      if (fill_factor < 1 || fill_factor > 100) {
+        fprintf(stderr, "Error: fillfactor must be a percentage between 1 and 100\n");
+        return RC_INVALID_ATTRIBUTE;
+      }
+    }
+    else {
+      fprintf(stderr, "Error: unknown index option %s\n", opts[i].name);
+      return RC_INVALID_ATTRIBUTE;
+    }
+  }
+
+  // a clustered table keeps its tuples in its index, so every later
+  // load of the table goes there as well
+  if (!clustered) {
+    BTreeIndex probe;
+    if (probe.open(table + ".idx", 'r') == 0) {
+      clustered = probe.isClustered();
+      probe.close();
+    }
+  }
+  if (clustered) {
+    if (compressed || counted || value_index || hash_index || learned || lsm) {
+      fprintf(stderr, "Error: a clustered index cannot be compressed, counted, have a value, hash or learned index or take lsm loads\n");
+      return RC_INVALID_ATTRIBUTE;
+    }
+    if (rec_file.open(table + ".tbl", 'r') == 0) {
+      bool has_rows = (rec_file.endRid().pid > 0 || rec_file.endRid().sid > 0);
+      rec_file.close();
+      if (has_rows) {
+        fprintf(stderr, "Error: table %s already has tuples, cannot cluster it\n", table.c_str());
+        return RC_INVALID_ATTRIBUTE;
+      }
+    }
+    index = true;
+  }
+
+  // a value index would miss the tuples of a load that does not update it
+  if (index && !clustered && !value_index) {
+    ValueIndex probe;
+    if (probe.open(table + ".vidx", 'r') == 0) {
+      value_index = true;
+      probe.close();
+    }
+  }
+  // and so would a hash index
+  if (index && !clustered && !hash_index) {
+    HashIndex probe;
+    if (probe.open(table + ".hidx", 'r') == 0) {
+      hash_index = true;
+      probe.close();
+    }
+  }
+  // and so would a learned index, which is rebuilt with the new tuples
+  if (index && !clustered && !learned) {
+    LearnedIndex probe;
+    if (probe.open(table + ".lidx", 'r') == 0) {
+      learned = true;
+      probe.close();
+    }
+  }
+  // the runs of earlier lsm loads go into the index before this load
+  if (index && !clustered && !lsm) {
+    LsmIndex probe;
+    if (probe.open(table, 'r') == 0) {
+      bool has_runs = probe.hasRuns();
+      probe.close();
+      if (has_runs && ((rc = probe.open(table, 'w')) < 0 ||
+                       (rc = probe.merge()) < 0 || (rc = probe.close()) < 0)) {
+        fprintf(stderr, "Error moving the runs of table %s into its index\n", table.c_str());
+        probe.close();
+        return rc;
+      }
+    }
+  }
+
   //attempt to open the file
   curr_file.open(loadfile.c_str(), std::ifstream::in);
 
@@ -391,7 +913,7 @@ RC SqlEngine::load(const string& table, const string& loadfile, bool index)
 	return RC_FILE_OPEN_FAILED;
 
   } 
- if((rc = rec_file.open((table + ".tbl").c_str(), 'w')) != 0)
+ if(!clustered && (rc = rec_file.open((table + ".tbl").c_str(), 'w')) != 0)
  {	fprintf(stderr, "Error opening record file for table %s\n", table.c_str());
         return rc;
  }
@@ -401,6 +923,99 @@ RC SqlEngine::load(const string& table, const string& loadfile, bool index)
     rc = tree_index.open(table + ".idx", 'w');
     if (rc < 0) {
       tree_index.close();
+      if (!clustered)
+        rec_file.close();
+      return rc;
+    }
+    if (compressed && (rc = tree_index.setCompressedLeaves(true)) < 0) {
+      fprintf(stderr, "Error: index for table %s already exists, cannot compress it\n", table.c_str());
+      tree_index.close();
+      if (!clustered)
+        rec_file.close();
+      return rc;
+    }
+    if (counted && (rc = tree_index.setCountedNodes(true)) < 0) {
+      fprintf(stderr, "Error: index for table %s already exists, cannot count it\n", table.c_str());
+      tree_index.close();
+      if (!clustered)
+        rec_file.close();
+      return rc;
+    }
+    if (clustered && (rc = tree_index.setClustered(true)) < 0) {
+      fprintf(stderr, "Error: index for table %s already exists, cannot cluster it\n", table.c_str());
+      tree_index.close();
+      if (!clustered)
+        rec_file.close();
+      return rc;
+    }
+  }
+
+  ValueIndex value_tree;
+  vector<pair<int, RecordId> > key_entries;
+  vector<pair<ValueKey, RecordId> > value_entries;
+  vector<pair<int, string> > tuples;
+  HashIndex hash_tree;
+  bool hash_new = false;
+  if (hash_index == true) {
+    HashIndex probe;
+    if (probe.open(table + ".hidx", 'r') == 0)
+      probe.close();
+    else
+      hash_new = true;
+    if ((rc = hash_tree.open(table + ".hidx", 'w')) < 0) {
+      fprintf(stderr, "Error opening hash index for table %s\n", table.c_str());
+      tree_index.close();
+      rec_file.close();
+      return rc;
+    }
+  }
+  bool value_new = false;
+  if (value_index == true) {
+    ValueIndex probe;
+    if (probe.open(table + ".vidx", 'r') == 0)
+      probe.close();
+    else
+      value_new = true;
+    if ((rc = value_tree.open(table + ".vidx", 'w')) < 0) {
+      fprintf(stderr, "Error opening value index for table %s\n", table.c_str());
+      tree_index.close();
+      if (hash_index == true)
+        hash_tree.close();
+      rec_file.close();
+      return rc;
+    }
+  }
+
+  bool learned_new = false;
+  vector<pair<int, RecordId> > learned_entries;
+  if (learned == true) {
+    LearnedIndex probe;
+    if (probe.open(table + ".lidx", 'r') == 0)
+      probe.close();
+    else
+      learned_new = true;
+  }
+
+  // an index created on a table that already has tuples starts with them
+  if (hash_new == true || value_new == true || learned_new == true) {
+    for (rid.pid = rid.sid = 0; rid < rec_file.endRid(); ++rid) {
+      if ((rc = rec_file.read(rid, key, value)) < 0)
+        break;
+      if (value_new == true)
+        value_entries.push_back(make_pair(ValueKey::fromString(value), rid));
+      if (learned_new == true)
+        learned_entries.push_back(make_pair(key, rid));
+      if (hash_new == true && (rc = hash_tree.insert(key, rid)) != 0)
+        break;
+    }
+    if (rc != 0) {
+      fprintf(stderr, "Error indexing the tuples already in table %s\n", table.c_str());
+      tree_index.close();
+      if (hash_index == true)
+        hash_tree.close();
+      if (value_index == true)
+        value_tree.close();
+      rec_file.close();
       return rc;
     }
   }
@@ -417,19 +1032,26 @@ RC SqlEngine::load(const string& table, const string& loadfile, bool index)
     fprintf(stderr, "Error parsing from loadfile %s at line %i\n", 
           loadfile.c_str(), line_num);
   }
+  else if (clustered) {
+    // the tuples go straight into the index
+    tuples.push_back(make_pair(key, value));
+  }
   else {
   //append the line 
     if((rc = rec_file.append(key, value, rid)) != 0) {
       fprintf(stderr, "Error appending to table %s\n", table.c_str());
       break;
     }
-    if (index == true) {
-      rc = tree_index.insert(key, rid);
-      if (rc < 0) {
-        fprintf(stderr, "Error inserting data into index for table %s\n", table.c_str());
-        tree_index.close();
-        return rc;
-      }
+    // the indexes are built in one go once all tuples are in the table
+    if (index == true)
+      key_entries.push_back(make_pair(key, rid));
+    if (value_index == true)
+      value_entries.push_back(make_pair(ValueKey::fromString(value), rid));
+    // the hash index grows a bucket at a time, so it takes every pair
+    // right away
+    if (hash_index == true && (rc = hash_tree.insert(key, rid)) != 0) {
+      fprintf(stderr, "Error inserting data into hash index for table %s\n", table.c_str());
+      break;
     }
   }
 	line_num++; //increment line_num
@@ -438,8 +1060,68 @@ RC SqlEngine::load(const string& table, const string& loadfile, bool index)
 //attempt to close the file now
 curr_file.close();
 
+//build the indexes bottom-up from the collected (key, rid) pairs
+if (clustered) {
+  if ((r_build = tree_index.bulkLoadTuples(tuples, fill_factor)) < 0) {
+    fprintf(stderr, "Error inserting data into index for table %s\n", table.c_str());
+    rc = r_build;
+  }
+}
+else if (index == true && lsm == false) {
+  if ((r_build = tree_index.bulkLoad(key_entries, fill_factor)) < 0) {
+    fprintf(stderr, "Error inserting data into index for table %s\n", table.c_str());
+    rc = r_build;
+  }
+}
+if (value_index == true) {
+  if ((r_build = value_tree.bulkLoad(value_entries, fill_factor)) < 0) {
+    fprintf(stderr, "Error inserting data into value index for table %s\n", table.c_str());
+    rc = r_build;
+  }
+}
+if (learned == true) {
+  LearnedIndex learned_index;
+  learned_entries.insert(learned_entries.end(), key_entries.begin(), key_entries.end());
+  if ((r_build = learned_index.open(table + ".lidx", 'w')) < 0 ||
+      (r_build = learned_index.build(learned_entries)) < 0) {
+    fprintf(stderr, "Error building learned index for table %s\n", table.c_str());
+    rc = r_build;
+  }
+  if ((r_close = learned_index.close()) != 0)
+    rc = r_close;
+}
+
+//close the index so that its root and height are saved
+if (index == true) {
+  if ((r_close = tree_index.close()) != 0)
+    rc = r_close;
+}
+if (value_index == true) {
+  if ((r_close = value_tree.close()) != 0)
+    rc = r_close;
+}
+if (hash_index == true) {
+  if ((r_close = hash_tree.close()) != 0)
+    rc = r_close;
+}
+
+//the new keys of an lsm load become a run once the index is closed
+if (lsm == true) {
+  LsmIndex lsm_index;
+  if ((r_build = lsm_index.open(table, 'w')) == 0) {
+    for (size_t i = 0; i < key_entries.size() && r_build == 0; i++)
+      r_build = lsm_index.insert(key_entries[i].first, key_entries[i].second);
+  }
+  if (r_build < 0) {
+    fprintf(stderr, "Error inserting data into the runs of table %s\n", table.c_str());
+    rc = r_build;
+  }
+  if ((r_close = lsm_index.close()) != 0)
+    rc = r_close;
+}
+
 //close the RecordFile as well
-if((r_close = rec_file.close()) != 0)
+if(!clustered && (r_close = rec_file.close()) != 0)
 {
 	return r_close;
 }
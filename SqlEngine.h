@@ -14,6 +14,9 @@
 #include "Bruinbase.h"
 #include "RecordFile.h"
 #include "BTreeIndex.h"
+#include "HashIndex.h"
+#include "LearnedIndex.h"
+#include "LsmIndex.h"
 
 /**
  * data structure to represent a condition in the WHERE clause
@@ -24,6 +27,15 @@ struct SelCond {
   char* value;  // the value to compare
 };
 
+/**
+ * data structure to represent an option given after LOAD ... WITH INDEX,
+ * e.g. "LOAD movie FROM 'movie.del' WITH INDEX compressed"
+ */
+struct IndexOpt {
+  char* name;   // option name (lower case)
+  char* value;  // option value of "name = value", NULL if none was given
+};
+
 /**
  * the class that takes, parses, and executes the user commands.
  */
@@ -43,6 +55,9 @@ class SqlEngine {
    * executes a SELECT statement.
    * all conditions in conds must be ANDed together.
    * the result of the SELECT is printed on screen.
+   * the table and its indexes are read from a snapshot taken when the
+   * SELECT starts (see PageFile::beginSnapshot()), so a LOAD running in
+   * another thread meanwhile is seen either in full or not at all.
    * @param attr[IN] attribute in the SELECT clause
    * (1: key, 2: value, 3: *, 4: count(*))
    * @param table[IN] the table name in the FROM clause
@@ -51,16 +66,124 @@ class SqlEngine {
    */
   static RC select(int attr, const std::string& table, const std::vector<SelCond>& cond);
 
+  /**
+   * executes a SELECT statement in the snapshot select() took.
+   * @param attr[IN] attribute in the SELECT clause
+   * @param table[IN] the table name in the FROM clause
+   * @param conds[IN] list of conditions in the WHERE clause
+   * @return error code. 0 if no error
+   */
+  static RC selectTable(int attr, const std::string& table, const std::vector<SelCond>& cond);
+
   static RC selectHelper(BTreeIndex& btree, int attr, const std::string& table, const std::vector<SelCond>& cond);
 
+  /**
+   * answers a SELECT with the secondary index on the value column.
+   * the conditions on value give the range of value keys to read;
+   * every candidate tuple is checked against all conditions.
+   * @param vtree[IN] the index on the value column
+   * @param attr[IN] attribute in the SELECT clause
+   * @param table[IN] the table name in the FROM clause
+   * @param conds[IN] list of conditions in the WHERE clause
+   * @return error code. 0 if no error, -1 if value gives no range
+   */
+  static RC selectValueHelper(ValueIndex& vtree, int attr, const std::string& table, const std::vector<SelCond>& cond);
+
+  /**
+   * answers a SELECT with an equality condition on the key column
+   * through the hash index of the table. every tuple of the key is
+   * checked against all conditions.
+   * @param hash[IN] the hash index on the key column
+   * @param attr[IN] attribute in the SELECT clause
+   * @param table[IN] the table name in the FROM clause
+   * @param conds[IN] list of conditions in the WHERE clause
+   * @return error code. 0 if no error, -1 if there is no key = N condition
+   */
+  static RC selectHashHelper(HashIndex& hash, int attr, const std::string& table, const std::vector<SelCond>& cond);
+
+  /**
+   * answers a SELECT with a key range through the learned index of the
+   * table. the pairs of the range are read in key order from the data
+   * pages of the index; every candidate tuple is checked against all
+   * conditions.
+   * @param lidx[IN] the learned index on the key column
+   * @param attr[IN] attribute in the SELECT clause
+   * @param table[IN] the table name in the FROM clause
+   * @param conds[IN] list of conditions in the WHERE clause
+   * @return error code. 0 if no error, -1 if the key gives no range
+   */
+  static RC selectLearnedHelper(LearnedIndex& lidx, int attr, const std::string& table, const std::vector<SelCond>& cond);
+
+  /**
+   * answers a SELECT with a key range on a table whose newest keys are
+   * still in the runs of its ingest tier. the pairs of the range are
+   * read in key order from the B+tree and the runs together; every
+   * candidate tuple is checked against all conditions.
+   * @param lsm[IN] the ingest tier of the index on the key column
+   * @param attr[IN] attribute in the SELECT clause
+   * @param table[IN] the table name in the FROM clause
+   * @param conds[IN] list of conditions in the WHERE clause
+   * @return error code. 0 if no error, -1 if the key gives no range
+   */
+  static RC selectLsmHelper(LsmIndex& lsm, int attr, const std::string& table, const std::vector<SelCond>& cond);
+
+  /**
+   * answers a SELECT on a clustered table, whose tuples are stored in
+   * the leaves of its index (see BTreeIndexT::setClustered()).
+   * the tuples of the key range are read in key order from the leaves
+   * and checked against all conditions.
+   * @param btree[IN] the clustered index of the table
+   * @param attr[IN] attribute in the SELECT clause
+   * @param cond[IN] list of conditions in the WHERE clause
+   * @param low_k[IN] the smallest key the conditions allow
+   * @param high_k[IN] the largest key the conditions allow
+   * @return error code. 0 if no error
+   */
+  static RC selectClustered(BTreeIndex& btree, int attr, const std::vector<SelCond>& cond, int low_k, int high_k);
+
   /**
    * load a table from a load file.
+   * the load is one write transaction (see PageFile::beginWrite()): a
+   * SELECT that starts before it ends sees none of its tuples.
+   * the index options currently understood are:
+   *   compressed - store the index leaf nodes in the compressed format
+   *   counted    - keep row counts in the index, so COUNT(*) over a key
+   *                range reads one path of the tree instead of the range
+   *   value      - also build a secondary index on the value column
+   *   hash       - also build a hash index on the key column, which
+   *                answers key = N in about one page read; once there,
+   *                it is kept up to date by every load WITH INDEX
+   *   learned    - also build a learned index on the key column, which
+   *                predicts where a key is in its sorted pairs, so key
+   *                lookups read about one page and no non-leaf nodes.
+   *                once there, it is rebuilt by every load WITH INDEX
+   *   lsm        - write the new keys as a sorted run next to the index
+   *                instead of into it (see LsmIndex), so a large load
+   *                into a large table writes pages sequentially. the
+   *                next load WITH INDEX without the option moves all
+   *                runs into the index
+   *   clustered  - store the tuples in the index leaves instead of a
+   *                table file, so key range scans read no record pages;
+   *                every later load of the table goes into the index.
+   *                cannot be combined with the other options above
+   *   fillfactor = N - fill the index nodes to N percent (default 100)
+   * @param table[IN] the table name in the LOAD command
+   * @param loadfile[IN] the file name of the load file
+   * @param index[IN] true if "WITH INDEX" option was specified
+   * @param opts[IN] list of options given after WITH INDEX
+   * @return error code. 0 if no error
+   */
+  static RC load(const std::string& table, const std::string& loadfile, bool index, const std::vector<IndexOpt>& opts);
+
+  /**
+   * load a table in the write transaction load() started.
    * @param table[IN] the table name in the LOAD command
    * @param loadfile[IN] the file name of the load file
    * @param index[IN] true if "WITH INDEX" option was specified
+   * @param opts[IN] list of options given after WITH INDEX
    * @return error code. 0 if no error
    */
-  static RC load(const std::string& table, const std::string& loadfile, bool index);
+  static RC loadTable(const std::string& table, const std::string& loadfile, bool index, const std::vector<IndexOpt>& opts);
 
   /**
    * parse a line from the load file into the (key, value) pair.
@@ -35,6 +35,8 @@ static void runSelect(int attr, const char* table, const std::vector<SelCond>& c
   char* string;
   SelCond* cond;
   std::vector<SelCond>* conds;
+  IndexOpt* opt;
+  std::vector<IndexOpt>* opts;
 }
 
 %token SELECT FROM WHERE LOAD WITH INDEX QUIT COUNT AND OR 
@@ -46,6 +48,8 @@ static void runSelect(int attr, const char* table, const std::vector<SelCond>& c
 %type <string> table value
 %type <cond> condition
 %type <conds> conditions
+%type <opt> index_option
+%type <opts> index_options
 %%
 
 commands:
@@ -67,14 +71,46 @@ quit_command:
 
 load_command:
 	LOAD table FROM STRING LF { 
-	  SqlEngine::load(std::string($2), std::string($4), false); 
+	  std::vector<IndexOpt> opts;
+	  SqlEngine::load(std::string($2), std::string($4), false, opts); 
 	  free($2);
 	  free($4);
 	}
-	| LOAD table FROM STRING WITH INDEX LF { 
-	  SqlEngine::load(std::string($2), std::string($4), true); 
+	| LOAD table FROM STRING WITH INDEX index_options LF { 
+	  SqlEngine::load(std::string($2), std::string($4), true, *$7); 
 	  free($2);
 	  free($4);
+	  for (unsigned i = 0; i < $7->size(); i++) {
+	    free((*$7)[i].name);
+	    free((*$7)[i].value);
+	  }
+	  delete $7;
+	}
+	;
+
+index_options:
+	/* empty */ {
+	  $$ = new std::vector<IndexOpt>;
+	}
+	| index_options index_option {
+	  $1->push_back(*$2);
+	  $$ = $1;
+	  delete $2;
+	}
+	;
+
+index_option:
+	ID {
+	  IndexOpt* o = new IndexOpt;
+	  o->name = $1;
+	  o->value = NULL;
+	  $$ = o;
+	}
+	| ID EQUAL value {
+	  IndexOpt* o = new IndexOpt;
+	  o->name = $1;
+	  o->value = $3;
+	  $$ = o;
 	}
 	;
 
@@ -0,0 +1,115 @@
+/**
+ * Counts the heap allocations of B+tree lookups and checks the index for
+ * leaks.
+ *
+ * Every operator new and delete of the program is counted. After an
+ * index of n keys (with duplicates) is built, it reports the allocations
+ * of n locate() calls, of a readForward() scan and of a cursor scan over
+ * all entries, which should all be 0. It then builds, reads and closes
+ * the index a few more times and checks that the allocations still live
+ * afterwards do not grow from one round to the next. The first round is
+ * left out, as it creates the state that lives on by design: the pinned
+ * pages of the index and the PageFile state of the thread.
+ *
+ * usage: bench/alloc [n] [index file]
+ * exits with 1 if a lookup allocates or an allocation leaks
+ */
+
+#include "BTreeIndex.h"
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <unistd.h>
+
+static long allocs = 0;
+static long frees = 0;
+
+void* operator new(size_t size)
+{
+  void* p = malloc(size ? size : 1);
+  if (p == NULL) throw std::bad_alloc();
+  allocs++;
+  return p;
+}
+
+void operator delete(void* p) noexcept
+{
+  if (p != NULL) frees++;
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+  if (p != NULL) frees++;
+  free(p);
+}
+
+// build the index, and return the allocations of the lookups
+static long round(const char* filename, int n, bool report)
+{
+  BTreeIndex idx;
+  IndexCursor cursor;
+  BTreeCursor scan;
+  const int* keys;
+  const RecordId* rids;
+  RecordId rid;
+  int key, count;
+  long entries, a, total = 0;
+
+  ::unlink(filename);
+  idx.open(filename, 'w');
+  srand(1);
+  a = allocs;
+  for (int i = 0; i < n; i++) {
+    rid.pid = i / 9;
+    rid.sid = i % 9;
+    idx.insert(rand() % (n / 2), rid);
+  }
+  if (report) printf("insert:      %8ld new for %d inserts\n", allocs - a, n);
+  idx.close();
+
+  idx.open(filename, 'r');
+  a = allocs;
+  for (int i = 0; i < n; i++) idx.locate(rand() % (n / 2), cursor);
+  total += allocs - a;
+  if (report) printf("locate:      %8ld new for %d lookups\n", allocs - a, n);
+
+  a = allocs;
+  entries = 0;
+  idx.locate(0, cursor);
+  while (idx.readForward(cursor, key, rid) == 0) entries++;
+  total += allocs - a;
+  if (report) printf("readForward: %8ld new for %ld entries\n", allocs - a, entries);
+
+  a = allocs;
+  entries = 0;
+  idx.openCursor(0, scan);
+  while (scan.next(keys, rids, count) == 0) entries += count;
+  total += allocs - a;
+  if (report) printf("cursor:      %8ld new for %ld entries\n", allocs - a, entries);
+
+  idx.close();
+  ::unlink(filename);
+  return total;
+}
+
+int main(int argc, char** argv)
+{
+  int n = (argc > 1) ? atoi(argv[1]) : 200000;
+  const char* filename = (argc > 2) ? argv[2] : "alloc.idx";
+  long lookups, live, grown = 0;
+  const int ROUNDS = 3;
+
+  if (n < 2) n = 2;
+  lookups = round(filename, n, true);
+
+  live = allocs - frees;
+  for (int r = 0; r < ROUNDS; r++) {
+    lookups += round(filename, n, false);
+    grown += (allocs - frees) - live;
+    live = allocs - frees;
+  }
+  printf("live allocations grown over %d more rounds: %ld\n", ROUNDS, grown);
+
+  return (lookups != 0 || grown != 0) ? 1 : 0;
+}
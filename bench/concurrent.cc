@@ -0,0 +1,163 @@
+/**
+ * Measures how B+tree inserts and lookups scale with the number of
+ * threads sharing one open index.
+ *
+ * For 1, 2, 4, ... threads up to the maximum, it builds an index of n
+ * keys in random order with that many insert threads, and checks that
+ * every key was inserted once and in order. It then times random
+ * locate() calls on that index split across that many threads, with the
+ * pages of the index dropped from the operating system cache first, so
+ * that the lookups wait for the disk as they do on a large index, and
+ * again with all pages cached. The lookups are few enough next to the
+ * leaves that most of the first ones read a leaf no lookup read before.
+ *
+ * usage: bench/concurrent [n] [max threads] [lookups] [index file]
+ */
+
+#include "BTreeIndex.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <vector>
+
+using std::vector;
+
+static BTreeIndex idx;
+static vector<int> keys;
+static int threads;
+static int lookups;
+
+static double now()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void* insertKeys(void* arg)
+{
+  long id = (long) arg;
+  RecordId rid;
+
+  for (size_t i = id; i < keys.size(); i += threads) {
+    rid.pid = keys[i];
+    rid.sid = 0;
+    if (idx.insert(keys[i], rid) < 0) {
+      fprintf(stderr, "insert of %d failed\n", keys[i]);
+      exit(1);
+    }
+  }
+  return NULL;
+}
+
+static void* locateKeys(void* arg)
+{
+  unsigned seed = (unsigned) (long) arg + 1;
+  IndexCursor cursor;
+
+  for (int i = 0; i < lookups / threads; i++) {
+    int key = rand_r(&seed) % keys.size();
+    if (idx.locate(key, cursor) < 0) {
+      fprintf(stderr, "key %d not found\n", key);
+      exit(1);
+    }
+  }
+  return NULL;
+}
+
+// run f on the given number of threads and return the seconds it took
+static double run(void* (*f)(void*), int n)
+{
+  vector<pthread_t> th(n);
+  double start = now();
+
+  threads = n;
+  for (long i = 0; i < n; i++) pthread_create(&th[i], NULL, f, (void*) i);
+  for (int i = 0; i < n; i++) pthread_join(th[i], NULL);
+  return now() - start;
+}
+
+// check that the index holds every key once, in order
+static void verify()
+{
+  BTreeCursor cursor;
+  const int* ks;
+  const RecordId* rids;
+  int n;
+  long count = 0;
+
+  idx.openCursor(0, cursor);
+  while (cursor.next(ks, rids, n) == 0) {
+    for (int i = 0; i < n; i++, count++) {
+      if (ks[i] != count || rids[i].pid != ks[i]) {
+        fprintf(stderr, "entry %ld is wrong: key %d\n", count, ks[i]);
+        exit(1);
+      }
+    }
+  }
+  if (count != (long) keys.size()) {
+    fprintf(stderr, "%ld keys found, %d inserted\n", count, (int) keys.size());
+    exit(1);
+  }
+}
+
+// drop the pages of a file from the operating system cache, or read
+// them all into it
+static void setCache(const char* filename, bool cached)
+{
+  char buffer[65536];
+  int fd = open(filename, O_RDONLY);
+
+  if (fd < 0) return;
+  if (cached)
+    while (read(fd, buffer, sizeof(buffer)) > 0);
+#ifdef POSIX_FADV_DONTNEED
+  else {
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  }
+#endif
+  close(fd);
+}
+
+int main(int argc, char** argv)
+{
+  int n = (argc > 1) ? atoi(argv[1]) : 1000000;
+  int maxThreads = (argc > 2) ? atoi(argv[2]) : 8;
+  const char* filename = (argc > 4) ? argv[4] : "concurrent.idx";
+  double t;
+
+  for (int i = 0; i < n; i++) keys.push_back(i);
+  srand(1);
+  std::random_shuffle(keys.begin(), keys.end());
+  lookups = (argc > 3) ? atoi(argv[3]) : 2000;
+
+  printf("threads  inserts/s  lookups/s (cold)  lookups/s (cached)\n");
+  for (int nt = 1; nt <= maxThreads; nt *= 2) {
+    ::remove(filename);
+    if (idx.open(filename, 'w') < 0) {
+      fprintf(stderr, "cannot open %s\n", filename);
+      return 1;
+    }
+    t = run(insertKeys, nt);
+    printf("%7d  %9.0f", nt, n / t);
+    verify();
+    idx.close();
+
+    idx.open(filename, 'r');
+    setCache(filename, false);
+    t = run(locateKeys, nt);
+    printf("  %16.0f", lookups / t);
+    setCache(filename, true);
+    t = run(locateKeys, nt);
+    printf("  %18.0f\n", lookups / t);
+    idx.close();
+  }
+
+  ::remove(filename);
+  return 0;
+}
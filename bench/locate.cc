@@ -0,0 +1,84 @@
+/**
+ * Measures the throughput of B+tree lookups that descend a tall tree from
+ * memory.
+ *
+ * It builds an index of n keys inserted in random order, reopens it and
+ * times random locate() calls after one pass over the same keys. Every
+ * nonleaf page stays pinned, so a lookup searches the nodes on the way
+ * down in memory and only reads its leaf through the PageFile, from the
+ * cache of the operating system after the first pass.
+ *
+ * The child search of the nonleaf nodes is picked at compile time: "make
+ * bench" builds it with SSE2, "make bench-avx2" builds bench/locate-avx2
+ * with AVX2, for a processor that has it.
+ *
+ * usage: bench/locate [n] [lookups] [index file]
+ */
+
+#include "BTreeIndex.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <sys/time.h>
+#include <vector>
+
+using std::vector;
+
+static double now()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+int main(int argc, char** argv)
+{
+  int n = (argc > 1) ? atoi(argv[1]) : 1000000;
+  int lookups = (argc > 2) ? atoi(argv[2]) : 1000000;
+  const char* filename = (argc > 3) ? argv[3] : "locate.idx";
+  BTreeIndex idx;
+  IndexCursor cursor;
+  RecordId rid;
+  vector<int> keys;
+  double t;
+
+  if (n < 1) n = 1;
+  if (lookups < 1) lookups = 1;
+  BTreeIndex::setPinBudget(n);
+  for (int i = 0; i < n; i++) keys.push_back(i);
+  srand(1);
+  std::random_shuffle(keys.begin(), keys.end());
+
+  ::remove(filename);
+  if (idx.open(filename, 'w') < 0) {
+    fprintf(stderr, "cannot open %s\n", filename);
+    return 1;
+  }
+  for (int i = 0; i < n; i++) {
+    rid.pid = keys[i];
+    rid.sid = 0;
+    idx.insert(keys[i], rid);
+  }
+  idx.close();
+
+  // the search keys, drawn before the timing starts
+  keys.clear();
+  for (int i = 0; i < lookups; i++) keys.push_back(rand() % n);
+
+  idx.open(filename, 'r');
+  for (int pass = 0; pass < 2; pass++) {
+    t = now();
+    for (int i = 0; i < lookups; i++) {
+      if (idx.locate(keys[i], cursor) < 0) {
+        fprintf(stderr, "key %d not found\n", keys[i]);
+        return 1;
+      }
+    }
+    t = now() - t;
+  }
+  printf("%d keys: %.0f lookups/s, %.0f ns/lookup\n", n, lookups / t, t * 1e9 / lookups);
+  idx.close();
+
+  ::remove(filename);
+  return 0;
+}
@@ -0,0 +1,69 @@
+/**
+ * Measures the latency of a search within one B+tree node.
+ *
+ * It fills a leaf node and a nonleaf node to MAX_KEYS keys, every third
+ * int, and times BTLeafNode::locate() and BTNonLeafNode::locateChildPtr()
+ * for random search keys over the whole key range of the node, so that
+ * about a third of the searches find their key and the rest fall between
+ * two keys. The search keys are drawn before the timing starts.
+ * "make bench-avx2" builds bench/nodesearch-avx2, which has the AVX2 child
+ * search of the nonleaf nodes instead of the SSE2 one.
+ *
+ * usage: bench/nodesearch [searches]
+ */
+
+#include "BTreeNode.h"
+#include <cstdio>
+#include <cstdlib>
+#include <sys/time.h>
+#include <vector>
+
+using std::vector;
+
+static double now()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+int main(int argc, char** argv)
+{
+  int n = (argc > 1) ? atoi(argv[1]) : 10000000;
+  BTLeafNode leaf;
+  BTNonLeafNode nonleaf;
+  RecordId rid;
+  vector<int> keys;
+  PageId pid;
+  long sink = 0;
+  int eid;
+  double t;
+
+  if (n < 1) n = 1;
+  rid.pid = 1;
+  rid.sid = 0;
+  for (int i = 0; i < BTLeafNode::MAX_KEYS; i++) leaf.insert(i * 3, rid);
+  nonleaf.initializeRoot(0, 0, 1);
+  for (int i = 1; i < BTNonLeafNode::MAX_KEYS; i++) nonleaf.insert(i * 3, i + 1, i);
+
+  srand(1);
+  for (int i = 0; i < n; i++) keys.push_back(rand() % (BTNonLeafNode::MAX_KEYS * 3));
+
+  printf("node     keys  ns/search\n");
+  t = now();
+  for (int i = 0; i < n; i++) {
+    leaf.locate(keys[i] % (BTLeafNode::MAX_KEYS * 3), eid);
+    sink += eid;
+  }
+  printf("leaf     %4d  %9.1f\n", leaf.getKeyCount(), (now() - t) * 1e9 / n);
+
+  t = now();
+  for (int i = 0; i < n; i++) {
+    nonleaf.locateChildPtr(keys[i], pid);
+    sink += pid;
+  }
+  printf("nonleaf  %4d  %9.1f\n", nonleaf.getKeyCount(), (now() - t) * 1e9 / n);
+
+  // keep the searches from being optimized away
+  return (sink == -1) ? 1 : 0;
+}